@@ -0,0 +1,208 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+// Micro-benchmark of the MR-MPI key hash functions in C++
+// Syntax: hashbench N Nrepeat seed
+//   N = # of keys in each key set
+//   Nrepeat = # of times each key set is hashed for timing
+//   seed = RNG seed (positive int)
+// compares hashlittle() to hashkey() on integer key sets like those
+//   aggregate() and convert() see, reporting throughput and the
+//   max/average load of keys assigned to P processors and to hash buckets
+// runs on proc 0, other procs are idle
+
+#include "mpi.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+#include "stdint.h"
+#include "hash.h"
+
+#define NBUCKET_LOG 16       // # of hash buckets = 2^NBUCKET_LOG
+
+struct KEYSET {          // N keys stored contiguously
+  const char *name;
+  char *keys;
+  int *offset;           // offset of each key in keys
+  int *length;           // length of each key
+  int n;
+};
+
+typedef uint32_t (*HASH)(const void *, size_t, uint32_t);
+
+void build(KEYSET *, const char *, int, int);
+void benchmark(KEYSET *, const char *, HASH, int);
+double balance(KEYSET *, HASH, uint32_t, int, int);
+
+static const int nprocs_list[] = {7,64,1000};
+volatile uint32_t sink;        // keeps hash loops from being optimized away
+
+/* ---------------------------------------------------------------------- */
+
+int main(int narg, char **args)
+{
+  MPI_Init(&narg,&args);
+
+  int me;
+  MPI_Comm_rank(MPI_COMM_WORLD,&me);
+
+  if (narg != 4) {
+    if (me == 0) printf("Syntax: hashbench N Nrepeat seed\n");
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  int n = atoi(args[1]);
+  int nrepeat = atoi(args[2]);
+  int seed = atoi(args[3]);
+  if (n <= 0 || nrepeat <= 0) {
+    if (me == 0) printf("ERROR: N and Nrepeat must be > 0\n");
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  if (me == 0) {
+    srand48(seed);
+
+    printf("%-8s %-10s %9s %9s",
+	   "keys","hash","Mkeys/s","Mbyte/s");
+    for (int i = 0; i < 3; i++) printf("   P=%-4d",nprocs_list[i]);
+    printf(" buckets\n");
+
+    const char *names[] = {"seq32","stride32","seq64","edge","rmat64","text"};
+    for (int iset = 0; iset < 6; iset++) {
+      KEYSET set;
+      build(&set,names[iset],n,seed);
+      benchmark(&set,"lookup3",hashlittle,nrepeat);
+      benchmark(&set,"hashkey",hashkey,nrepeat);
+      delete [] set.keys;
+      delete [] set.offset;
+      delete [] set.length;
+    }
+
+    printf("P=N and buckets columns are max/average keys per "
+	   "processor or bucket\n");
+  }
+
+  MPI_Finalize();
+}
+
+/* ----------------------------------------------------------------------
+   build a key set of N keys
+   seq32 = 4-byte IDs 0 to N-1
+   stride32 = 4-byte IDs that are multiples of 1024
+   seq64 = 8-byte IDs 0 to N-1
+   edge = 2 4-byte IDs, 16 edges per source vertex, random targets
+   rmat64 = 8-byte IDs with RMAT-like skew toward low-numbered vertices
+   text = IDs 0 to N-1 as decimal strings, variable length
+------------------------------------------------------------------------- */
+
+void build(KEYSET *set, const char *name, int n, int seed)
+{
+  set->name = name;
+  set->n = n;
+  set->offset = new int[n];
+  set->length = new int[n];
+
+  int size = 8;
+  if (strcmp(name,"seq32") == 0 || strcmp(name,"stride32") == 0) size = 4;
+  else if (strcmp(name,"text") == 0) size = 16;
+  set->keys = new char[(uint64_t) n*size];
+
+  int offset = 0;
+  for (int i = 0; i < n; i++) {
+    char *key = &set->keys[offset];
+    int len = size;
+
+    if (strcmp(name,"seq32") == 0) {
+      uint32_t id = i;
+      memcpy(key,&id,4);
+    } else if (strcmp(name,"stride32") == 0) {
+      uint32_t id = (uint32_t) i << 10;
+      memcpy(key,&id,4);
+    } else if (strcmp(name,"seq64") == 0) {
+      uint64_t id = i;
+      memcpy(key,&id,8);
+    } else if (strcmp(name,"edge") == 0) {
+      uint32_t edge[2];
+      edge[0] = i/16;
+      edge[1] = lrand48() % n;
+      memcpy(key,edge,8);
+    } else if (strcmp(name,"rmat64") == 0) {
+      uint64_t id = 0;
+      for (int ilevel = 0; ilevel < 32; ilevel++)
+	if (drand48() > 0.75) id |= 1ULL << ilevel;
+      memcpy(key,&id,8);
+    } else {
+      len = sprintf(key,"%d",i);
+    }
+
+    set->offset[i] = offset;
+    set->length[i] = len;
+    offset += len;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   time Nrepeat passes of hash over key set, print one line of results
+------------------------------------------------------------------------- */
+
+void benchmark(KEYSET *set, const char *hashname, HASH hash, int nrepeat)
+{
+  uint32_t sum = 0;
+  uint64_t nbytes = 0;
+  for (int i = 0; i < set->n; i++) nbytes += set->length[i];
+
+  double start = MPI_Wtime();
+  for (int irepeat = 0; irepeat < nrepeat; irepeat++)
+    for (int i = 0; i < set->n; i++)
+      sum += hash(&set->keys[set->offset[i]],set->length[i],irepeat);
+  double time = MPI_Wtime() - start;
+  if (time == 0.0) time = 1.0e-9;
+
+  printf("%-8s %-10s %9.1f %9.1f",set->name,hashname,
+	 (double) set->n*nrepeat/time/1.0e6,
+	 (double) nbytes*nrepeat/time/1024.0/1024.0);
+
+  // processor assignment as in MapReduce::aggregate()
+  // bucket assignment as in KeyMultiValue::kv2unique()
+
+  for (int i = 0; i < 3; i++)
+    printf(" %8.3f",balance(set,hash,nprocs_list[i],nprocs_list[i],0));
+  printf(" %7.3f",balance(set,hash,0,1 << NBUCKET_LOG,1));
+  printf("\n");
+  sink = sum;
+}
+
+/* ----------------------------------------------------------------------
+   max/average count of keys in Nbin bins, seeding hash with seed
+   bin = hash % Nbin, or low bits of hash if mask is set
+------------------------------------------------------------------------- */
+
+double balance(KEYSET *set, HASH hash, uint32_t seed, int nbin, int mask)
+{
+  int *count = new int[nbin];
+  for (int i = 0; i < nbin; i++) count[i] = 0;
+
+  uint32_t h;
+  for (int i = 0; i < set->n; i++) {
+    h = hash(&set->keys[set->offset[i]],set->length[i],seed);
+    if (mask) count[h & (nbin-1)]++;
+    else count[h % nbin]++;
+  }
+
+  int max = 0;
+  for (int i = 0; i < nbin; i++)
+    if (count[i] > max) max = count[i];
+  delete [] count;
+
+  return max / ((double) set->n/nbin);
+}
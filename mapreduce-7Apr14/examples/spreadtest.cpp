@@ -0,0 +1,200 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+// Test that duplicated keys are spread across processors in C++
+// Syntax: spreadtest N
+//   N = # of KV pairs generated by each proc
+// most pairs are identical, same key and same value, as in a word count
+// sample_sort_keys() must spread them across the procs between the
+//   splitters they equal, in global order, for each all2all setting
+// collate() with skewsplit = SKEWSPLIT must put the values of the
+//   duplicated key on SKEWSPLIT procs, or all procs if there are fewer
+// prints PASS or FAIL for each check, aborts if any check fails
+
+#include "mpi.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "limits.h"
+#include "mapreduce.h"
+#include "keyvalue.h"
+
+using namespace MAPREDUCE_NS;
+
+#define HOTKEY 5          // key of the duplicated pairs
+#define HOTFRAC 7         // # of pairs out of 10 that are duplicates
+#define SKEWSPLIT 4       // skewsplit setting for collate()
+
+void generate(int, KeyValue *, void *);
+void order(char *, int, char *, int, void *);
+void hot(char *, int, char *, int, int *, void *);
+int check(int, const char *, int);
+
+struct Order {            // range and order of one proc's sorted keys
+  int lo,hi;
+  int sorted;
+  int n;
+};
+
+int me,nprocs;
+int nkv;
+
+/* ---------------------------------------------------------------------- */
+
+int main(int narg, char **args)
+{
+  MPI_Init(&narg,&args);
+  MPI_Comm_rank(MPI_COMM_WORLD,&me);
+  MPI_Comm_size(MPI_COMM_WORLD,&nprocs);
+
+  if (narg != 2) {
+    if (me == 0) printf("Syntax: spreadtest N\n");
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  nkv = atoi(args[1]);
+  if (nkv <= 0) {
+    if (me == 0) printf("ERROR: N must be > 0\n");
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  int nfail = 0;
+
+  for (int all2all = 0; all2all <= 2; all2all++) {
+
+    // sample sort of duplicated pairs
+    // keys must be in global order and procs within 2x of the average
+
+    MapReduce *mr = new MapReduce(MPI_COMM_WORLD);
+    mr->verbosity = 0;
+    mr->all2all = all2all;
+    mr->map(nprocs,generate,NULL);
+    mr->sample_sort_keys(1);
+
+    Order mine;
+    mine.lo = INT_MAX;
+    mine.hi = INT_MIN;
+    mine.sorted = 1;
+    mine.n = 0;
+    mr->scan(order,&mine);
+    delete mr;
+
+    Order *all = new Order[nprocs];
+    MPI_Allgather(&mine,4,MPI_INT,all,4,MPI_INT,MPI_COMM_WORLD);
+
+    int sorted = 1;
+    int nmax = 0;
+    int last = INT_MIN;
+    for (int iproc = 0; iproc < nprocs; iproc++) {
+      if (!all[iproc].sorted) sorted = 0;
+      if (all[iproc].n) {
+	if (all[iproc].lo < last) sorted = 0;
+	last = all[iproc].hi;
+      }
+      if (all[iproc].n > nmax) nmax = all[iproc].n;
+    }
+    delete [] all;
+
+    nfail += check(all2all,"sample sort order",sorted);
+    nfail += check(all2all,"sample sort balance",nmax <= 2*nkv);
+
+    // collate of duplicated pairs with hot key splitting
+    // every value must arrive, on min(SKEWSPLIT,P) procs
+
+    mr = new MapReduce(MPI_COMM_WORLD);
+    mr->verbosity = 0;
+    mr->all2all = all2all;
+    mr->skewsplit = SKEWSPLIT;
+    mr->map(nprocs,generate,NULL);
+    mr->collate(NULL);
+
+    int nhot = 0;
+    mr->scan(hot,&nhot);
+    delete mr;
+
+    int nhotall,nhotprocs;
+    int hashot = (nhot > 0);
+    MPI_Allreduce(&nhot,&nhotall,1,MPI_INT,MPI_SUM,MPI_COMM_WORLD);
+    MPI_Allreduce(&hashot,&nhotprocs,1,MPI_INT,MPI_SUM,MPI_COMM_WORLD);
+
+    int nexpect = 0;
+    for (int i = 0; i < nkv; i++)
+      if (i % 10 < HOTFRAC) nexpect++;
+    int nsplit = SKEWSPLIT < nprocs ? SKEWSPLIT : nprocs;
+
+    nfail += check(all2all,"hot key values",nhotall == nexpect*nprocs);
+    nfail += check(all2all,"hot key split",nhotprocs == nsplit);
+  }
+
+  if (nfail) {
+    if (me == 0) printf("%d checks failed\n",nfail);
+    MPI_Abort(MPI_COMM_WORLD,1);
+  }
+
+  MPI_Finalize();
+}
+
+/* ----------------------------------------------------------------------
+   add N pairs, most of them the identical pair (HOTKEY,1)
+------------------------------------------------------------------------- */
+
+void generate(int itask, KeyValue *kv, void *ptr)
+{
+  int key,value;
+
+  srand(me+1);
+  for (int i = 0; i < nkv; i++) {
+    if (i % 10 < HOTFRAC) {
+      key = HOTKEY;
+      value = 1;
+    } else {
+      key = HOTKEY+1 + rand() % 1000;
+      value = i;
+    }
+    kv->add((char *) &key,sizeof(int),(char *) &value,sizeof(int));
+  }
+}
+
+/* ----------------------------------------------------------------------
+   track range of sorted keys and whether they are in order
+------------------------------------------------------------------------- */
+
+void order(char *key, int keybytes, char *value, int valuebytes, void *ptr)
+{
+  Order *mine = (Order *) ptr;
+  int k = *(int *) key;
+  if (mine->n && k < mine->hi) mine->sorted = 0;
+  if (k < mine->lo) mine->lo = k;
+  if (k > mine->hi) mine->hi = k;
+  mine->n++;
+}
+
+/* ----------------------------------------------------------------------
+   count values of HOTKEY in a collated KMV pair
+------------------------------------------------------------------------- */
+
+void hot(char *key, int keybytes, char *multivalue, int nvalues,
+	 int *valuebytes, void *ptr)
+{
+  if (*(int *) key == HOTKEY) *(int *) ptr += nvalues;
+}
+
+/* ----------------------------------------------------------------------
+   print result of one check, return 1 if it failed
+------------------------------------------------------------------------- */
+
+int check(int all2all, const char *name, int pass)
+{
+  if (me == 0)
+    printf("all2all %d: %-24s %s\n",all2all,name,pass ? "PASS" : "FAIL");
+  return !pass;
+}
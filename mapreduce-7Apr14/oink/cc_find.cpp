@@ -58,7 +58,8 @@ void CCFind::run()
 
   MapReduce *mre = obj->input(1,read_edge,NULL);
   MapReduce *mrv = obj->create_mr();
-  MapReduce *mrz = obj->create_mr();
+  MapReduce *mrev = obj->create_mr();
+  MapReduce *mrz = NULL;
 
   // assign each vertex initially to its own zone
 
@@ -66,6 +67,12 @@ void CCFind::run()
   mrv->collate(NULL);
   mrv->reduce(reduce_self_zone,NULL);
 
+  // MRev = Vi : Eij for both vertices of each edge
+  // aggregated once, so each iteration only communicates zones of MRv
+
+  mrev->map(mre,map_edge_vert,NULL);
+  mrev->aggregate(NULL);
+
   // loop until zones do not change
 
   int niterate = 0;
@@ -73,7 +80,8 @@ void CCFind::run()
   while (1) {
     niterate++;
 
-    mrz->map(mre,map_edge_vert,NULL);
+    delete mrz;
+    mrz = mrev->copy();
     mrz->add(mrv);
     mrz->collate(NULL);
     mrz->reduce(reduce_edge_zone,NULL);
@@ -100,6 +108,7 @@ void CCFind::run()
 
   mrz->map(mrv,invert,NULL);
   uint64_t ncc = mrz->collate(NULL);
+  delete mrz;
 
   char msg[128];
   sprintf(msg,"CC_find: %lu components in %d iterations",ncc,niterate);
@@ -341,6 +341,10 @@ void MRMPI::run(int index, int narg, char **arg)
     else if (strcmp(arg[1],"zeropage") == 0) mr->zeropage = atoi(arg[2]);
     else if (strcmp(arg[1],"keyalign") == 0) mr->keyalign = atoi(arg[2]);
     else if (strcmp(arg[1],"valuealign") == 0) mr->valuealign = atoi(arg[2]);
+    else if (strcmp(arg[1],"nthreads") == 0) mr->nthreads = atoi(arg[2]);
+    else if (strcmp(arg[1],"asyncio") == 0) mr->asyncio = atoi(arg[2]);
+    else if (strcmp(arg[1],"mmapio") == 0) mr->mmapio = atoi(arg[2]);
+    else if (strcmp(arg[1],"codec") == 0) mr->codec = atoi(arg[2]);
     else if (strcmp(arg[1],"fpath") == 0) mr->set_fpath(arg[2]);
     else error->all("Illegal MR object set command");
 
@@ -62,6 +62,10 @@ Object::Object(OINK *oink) : Pointers(oink)
   global.maxpage = 0;
   global.freepage = 1;
   global.zeropage = 0;
+  global.nthreads = 1;
+  global.asyncio = 1;
+  global.mmapio = 0;
+  global.codec = 0;
   global.scratch = NULL;
   global.prepend = NULL;
   global.substitute = 0;
@@ -732,6 +736,14 @@ void Object::set(int narg, char **arg)
       global.freepage = atoi(arg[iarg+1]);
     } else if (strcmp(arg[iarg],"zeropage") == 0) {
       global.zeropage = atoi(arg[iarg+1]);
+    } else if (strcmp(arg[iarg],"nthreads") == 0) {
+      global.nthreads = atoi(arg[iarg+1]);
+    } else if (strcmp(arg[iarg],"asyncio") == 0) {
+      global.asyncio = atoi(arg[iarg+1]);
+    } else if (strcmp(arg[iarg],"mmapio") == 0) {
+      global.mmapio = atoi(arg[iarg+1]);
+    } else if (strcmp(arg[iarg],"codec") == 0) {
+      global.codec = atoi(arg[iarg+1]);
     } else if (strcmp(arg[iarg],"scratch") == 0) {
       delete [] global.scratch;
       int n = strlen(arg[iarg+1]) + 1;
@@ -808,6 +820,10 @@ MapReduce *Object::allocate_mr(int verbosity, int timer,
   mr->maxpage = global.maxpage;
   mr->freepage = global.freepage;
   mr->zeropage = global.zeropage;
+  mr->nthreads = global.nthreads;
+  mr->asyncio = global.asyncio;
+  mr->mmapio = global.mmapio;
+  mr->codec = global.codec;
 
   if (global.scratch) {
     char sdir[MAXLINE];
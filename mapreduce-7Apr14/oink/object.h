@@ -106,6 +106,10 @@ class Object : protected Pointers {
     int maxpage;       // ditto
     int freepage;      // ditto
     int zeropage;      // ditto
+    int nthreads;      // ditto
+    int asyncio;       // ditto
+    int mmapio;        // ditto
+    int codec;         // ditto
     char *scratch;     // ditto
     char *prepend;     // str to prepend to dir/file paths for scratch/in/out
     int substitute;    // substitution rule on % for scratch/in/out paths
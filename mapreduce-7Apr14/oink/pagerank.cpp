@@ -7,6 +7,7 @@
 ------------------------------------------------------------------------- */
 
 #include "typedefs.h"
+#include "math.h"
 #include "string.h"
 #include "stdlib.h"
 #include "pagerank.h"
@@ -22,6 +23,19 @@
 using namespace OINK_NS;
 using namespace MAPREDUCE_NS;
 
+// value types are told apart by size when they share a KMV:
+//   MRg holds LINKs and one rank per vertex
+//   MRv holds one RANK per vertex and rank contributions
+
+typedef struct {
+  VERTEX vj;               // vertex Vi links to
+  WEIGHT wt;               // fraction of Vi's rank that flows to Vj
+} LINK;
+typedef struct {
+  double rank;
+  uint64_t nlink;          // # of out-links of vertex, 0 if dangling
+} RANK;
+
 /* ---------------------------------------------------------------------- */
 
 PageRank::PageRank(OINK *oink) : Command(oink)
@@ -40,25 +54,89 @@ void PageRank::run()
   // MRe = Eij : weight
 
   MapReduce *mre = obj->input(1,read_edge_weight,NULL);
-  MapReduce *mrv = obj->create_mr();
-  MapReduce *mrr = obj->create_mr();
+  mrg = obj->create_mr();
+  mrv = obj->create_mr();
+  mrc = obj->create_mr();
+
+  // MRg = Vi : LINK for each out-link of Vi
+  // weights normalized to sum to 1 over out-links of each vertex
+  // MRg is aggregated by Vi once, its links never move again
+
+  mrg->map(mre,map_edge_link,NULL);
+  mrg->collate(NULL);
+  mrg->reduce(reduce_normalize,NULL);
+
+  // MRv = Vi : RANK for every vertex, initial rank = 1/N
+  // aggregated by Vi the same as MRg
+
+  mrv->map(mre,map_edge_vertices,NULL);
+  nvert = mrv->collate(NULL);
+  mrv->reduce(reduce_vertex_init,this);
+
+  // iterate until summed change in rank < tolerance
+  // only rank contributions to other vertices are communicated
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tstart = MPI_Wtime();
+
+  int niterate = 0;
+  double changeall = 0.0;
+  char msg[128];
+
+  while (niterate < maxiter) {
+    niterate++;
+    double titer = MPI_Wtime();
+
+    // add Vi : rank of each non-dangling vertex to its links in MRg
+    // sum rank of dangling vertices, it is spread evenly to all vertices
 
-  // MRv = list of vertices in the directed graph
-  
-  mrv->map(mre,edge_to_vertices,NULL);
-  mrv->collate(NULL);
-  mrv->reduce(cull,NULL);
+    dangling = 0.0;
+    mrg->open(1);
+    mrv->scan(scan_rank,this);
+    mrg->close();
 
-  // iterate over PageRank calculations
+    double danglingall;
+    MPI_Allreduce(&dangling,&danglingall,1,MPI_DOUBLE,MPI_SUM,
+		  MPI_COMM_WORLD);
+    dangling = danglingall;
 
-  for (int iterate = 0; iterate < maxiter; iterate++) {
+    // MRc = Vj : rank * weight for each link Vi -> Vj
+    // compress of MRg is local and leaves it with just its links again
 
+    mrc->open();
+    mrg->compress(reduce_scatter,this);
+    mrc->close();
+
+    // send contributions to owners of Vj, add them to MRv
+    // MRv = Vi : new RANK
+
+    mrc->aggregate(NULL);
+    mrv->open(1);
+    mrc->scan(scan_contribution,this);
+    mrv->close();
+
+    change = 0.0;
+    mrv->compress(reduce_update,this);
+    MPI_Allreduce(&change,&changeall,1,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+
+    sprintf(msg,"PageRank iteration %d: change %g, dangling %g, %g secs",
+	    niterate,changeall,dangling,MPI_Wtime()-titer);
+    if (me == 0) error->message(msg);
+
+    if (changeall < tolerance) break;
   }
 
-  // MRr = Vi : rank
+  MPI_Barrier(MPI_COMM_WORLD);
+  double tstop = MPI_Wtime();
+
+  // MRv = Vi : rank
 
-  //obj->output(1,mrr,print,NULL);
-  obj->output(1,mre,print,NULL);
+  mrv->map(mrv,map_rank,NULL);
+  obj->output(1,mrv,print,NULL);
+
+  sprintf(msg,"PageRank: %lu vertices, %d iterations, change %g, %g secs",
+	  nvert,niterate,changeall,tstop-tstart);
+  if (me == 0) error->message(msg);
 
   obj->cleanup();
 }
@@ -72,12 +150,15 @@ void PageRank::params(int narg, char **arg)
   tolerance = atof(arg[0]);
   maxiter = atoi(arg[1]);
   alpha = atof(arg[2]);
+
+  if (tolerance < 0.0 || maxiter < 1 || alpha < 0.0 || alpha > 1.0)
+    error->all("Illegal pagerank command");
 }
 
 /* ---------------------------------------------------------------------- */
 
-void PageRank::print(char *key, int keybytes, 
-		 char *value, int valuebytes, void *ptr) 
+void PageRank::print(char *key, int keybytes,
+		 char *value, int valuebytes, void *ptr)
 {
   FILE *fp = (FILE *) ptr;
   VERTEX v = *(VERTEX *) key;
@@ -88,20 +169,232 @@ void PageRank::print(char *key, int keybytes,
 /* ---------------------------------------------------------------------- */
 /* ---------------------------------------------------------------------- */
 
-// here are sample map/reduce funcs
+/* ----------------------------------------------------------------------
+   map_edge_link
+   input: key = Vi Vj, value = weight
+   output: key = Vi, value = LINK with Vj and weight
+------------------------------------------------------------------------- */
+
+void PageRank::map_edge_link(uint64_t itask, char *key, int keybytes,
+			     char *value, int valuebytes,
+			     KeyValue *kv, void *ptr)
+{
+  EDGE *edge = (EDGE *) key;
+  LINK link;
+  link.vj = edge->vj;
+  link.wt = *(WEIGHT *) value;
+  kv->add((char *) &edge->vi,sizeof(VERTEX),(char *) &link,sizeof(LINK));
+}
 
-/*
+/* ----------------------------------------------------------------------
+   map_edge_vertices
+   input: key = Vi Vj, value = weight
+   output:
+     key = Vi, value = Vj
+     key = Vj, value = NULL
+------------------------------------------------------------------------- */
 
-void PageRank::map_edge_vert(uint64_t itask, char *key, int keybytes, 
-			    char *value, int valuebytes, 
-			    KeyValue *kv, void *ptr)
+void PageRank::map_edge_vertices(uint64_t itask, char *key, int keybytes,
+				 char *value, int valuebytes,
+				 KeyValue *kv, void *ptr)
 {
+  EDGE *edge = (EDGE *) key;
+  kv->add((char *) &edge->vi,sizeof(VERTEX),
+	  (char *) &edge->vj,sizeof(VERTEX));
+  kv->add((char *) &edge->vj,sizeof(VERTEX),NULL,0);
 }
 
-void PageRank::reduce_second_degree(char *key, int keybytes,
-				char *multivalue, int nvalues, 
+/* ----------------------------------------------------------------------
+   reduce_normalize
+   input: key = Vi, multivalue = LINKs
+   output: key = Vi, value = LINK with weight / sum of weights
+   if weights sum to 0, each out-link gets an equal share
+------------------------------------------------------------------------- */
+
+void PageRank::reduce_normalize(char *key, int keybytes,
+				char *multivalue, int nvalues,
 				int *valuebytes, KeyValue *kv, void *ptr)
 {
+  int i;
+  LINK *link;
+
+  uint64_t nvalues_total;
+  CHECK_FOR_BLOCKS(multivalue,valuebytes,nvalues,nvalues_total)
+
+  double sum = 0.0;
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  link = (LINK *) multivalue;
+  for (i = 0; i < nvalues; i++) sum += link[i].wt;
+  END_BLOCK_LOOP
+
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  link = (LINK *) multivalue;
+  for (i = 0; i < nvalues; i++) {
+    if (sum > 0.0) link[i].wt /= sum;
+    else link[i].wt = 1.0/nvalues_total;
+    kv->add(key,keybytes,(char *) &link[i],sizeof(LINK));
+  }
+  END_BLOCK_LOOP
+}
+
+/* ----------------------------------------------------------------------
+   reduce_vertex_init
+   input: key = Vi, multivalue = Vj for out-links, NULL for in-links
+   output: key = Vi, value = RANK with rank = 1/N
+------------------------------------------------------------------------- */
+
+void PageRank::reduce_vertex_init(char *key, int keybytes,
+				  char *multivalue, int nvalues,
+				  int *valuebytes, KeyValue *kv, void *ptr)
+{
+  PageRank *data = (PageRank *) ptr;
+
+  uint64_t nvalues_total;
+  CHECK_FOR_BLOCKS(multivalue,valuebytes,nvalues,nvalues_total)
+
+  RANK r;
+  r.rank = 1.0/data->nvert;
+  r.nlink = 0;
+
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  for (int i = 0; i < nvalues; i++)
+    if (valuebytes[i]) r.nlink++;
+  END_BLOCK_LOOP
+
+  kv->add(key,keybytes,(char *) &r,sizeof(RANK));
 }
 
-*/
+/* ----------------------------------------------------------------------
+   scan_rank
+   input: key = Vi, value = RANK
+   output: key = Vi, value = rank added to MRg if Vi has out-links
+   else rank summed as dangling
+------------------------------------------------------------------------- */
+
+void PageRank::scan_rank(char *key, int keybytes,
+			 char *value, int valuebytes, void *ptr)
+{
+  PageRank *data = (PageRank *) ptr;
+  RANK *r = (RANK *) value;
+  if (r->nlink)
+    data->mrg->kv->add(key,keybytes,(char *) &r->rank,sizeof(double));
+  else data->dangling += r->rank;
+}
+
+/* ----------------------------------------------------------------------
+   reduce_scatter
+   input: key = Vi, multivalue = LINKs and one rank
+   output:
+     key = Vi, value = LINK for each link, back into MRg
+     key = Vj, value = alpha * rank * weight into MRc for each link
+------------------------------------------------------------------------- */
+
+void PageRank::reduce_scatter(char *key, int keybytes,
+			      char *multivalue, int nvalues,
+			      int *valuebytes, KeyValue *kv, void *ptr)
+{
+  PageRank *data = (PageRank *) ptr;
+  KeyValue *kvc = data->mrc->kv;
+  char *value;
+  int i;
+
+  uint64_t nvalues_total;
+  CHECK_FOR_BLOCKS(multivalue,valuebytes,nvalues,nvalues_total)
+
+  // find rank of Vi, re-emit links
+
+  double rank = 0.0;
+
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  value = multivalue;
+  for (i = 0; i < nvalues; i++) {
+    if (valuebytes[i] == sizeof(double)) rank = *(double *) value;
+    else kv->add(key,keybytes,value,valuebytes[i]);
+    value += valuebytes[i];
+  }
+  END_BLOCK_LOOP
+
+  // emit contribution to each linked vertex
+
+  double scaled = data->alpha * rank;
+  double contrib;
+  LINK *link;
+
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  value = multivalue;
+  for (i = 0; i < nvalues; i++) {
+    if (valuebytes[i] == sizeof(LINK)) {
+      link = (LINK *) value;
+      contrib = scaled * link->wt;
+      kvc->add((char *) &link->vj,sizeof(VERTEX),
+	       (char *) &contrib,sizeof(double));
+    }
+    value += valuebytes[i];
+  }
+  END_BLOCK_LOOP
+}
+
+/* ----------------------------------------------------------------------
+   scan_contribution
+   input: key = Vj, value = contribution
+   output: same KV added to MRv
+------------------------------------------------------------------------- */
+
+void PageRank::scan_contribution(char *key, int keybytes,
+				 char *value, int valuebytes, void *ptr)
+{
+  PageRank *data = (PageRank *) ptr;
+  data->mrv->kv->add(key,keybytes,value,valuebytes);
+}
+
+/* ----------------------------------------------------------------------
+   reduce_update
+   input: key = Vi, multivalue = one RANK and contributions
+   output: key = Vi, value = RANK with new rank =
+     (1-alpha)/N + alpha * dangling/N + sum of contributions
+   change in rank is tallied
+------------------------------------------------------------------------- */
+
+void PageRank::reduce_update(char *key, int keybytes,
+			     char *multivalue, int nvalues,
+			     int *valuebytes, KeyValue *kv, void *ptr)
+{
+  PageRank *data = (PageRank *) ptr;
+  char *value;
+  RANK r;
+
+  uint64_t nvalues_total;
+  CHECK_FOR_BLOCKS(multivalue,valuebytes,nvalues,nvalues_total)
+
+  double sum = 0.0;
+
+  BEGIN_BLOCK_LOOP(multivalue,valuebytes,nvalues)
+  value = multivalue;
+  for (int i = 0; i < nvalues; i++) {
+    if (valuebytes[i] == sizeof(RANK)) memcpy(&r,value,sizeof(RANK));
+    else sum += *(double *) value;
+    value += valuebytes[i];
+  }
+  END_BLOCK_LOOP
+
+  double rank = ((1.0-data->alpha) + data->alpha*data->dangling) /
+    data->nvert + sum;
+  data->change += fabs(rank - r.rank);
+  r.rank = rank;
+
+  kv->add(key,keybytes,(char *) &r,sizeof(RANK));
+}
+
+/* ----------------------------------------------------------------------
+   map_rank
+   input: key = Vi, value = RANK
+   output: key = Vi, value = rank
+------------------------------------------------------------------------- */
+
+void PageRank::map_rank(uint64_t itask, char *key, int keybytes,
+			char *value, int valuebytes,
+			KeyValue *kv, void *ptr)
+{
+  RANK *r = (RANK *) value;
+  kv->add(key,keybytes,(char *) &r->rank,sizeof(double));
+}
@@ -16,7 +16,9 @@ CommandStyle(pagerank,PageRank)
 #define OINK_PAGERANK_H
 
 #include "command.h"
+#include "mapreduce.h"
 #include "keyvalue.h"
+using MAPREDUCE_NS::MapReduce;
 using MAPREDUCE_NS::KeyValue;
 
 namespace OINK_NS {
@@ -31,22 +33,29 @@ class PageRank : public Command {
   double tolerance,alpha;
   int maxiter;
 
+  uint64_t nvert;                 // # of vertices in graph
+  double dangling;                // rank summed over dangling vertices
+  double change;                  // rank change summed over vertices
+  MapReduce *mrg,*mrv,*mrc;
+
   static void print(char *, int, char *, int, void *);
 
-  /*
-  static void map_edge_vert(uint64_t, char *, int, char *, int,
+  static void map_edge_link(uint64_t, char *, int, char *, int,
 			    KeyValue *, void *);
-  static void reduce_first_degree(char *, int, char *, int, int *, 
-				  KeyValue *, void *);
-  static void reduce_second_degree(char *, int, char *, int, int *, 
-				   KeyValue *, void *);
-  static void map_low_degree(uint64_t, char *, int, char *, int,
-			     KeyValue *, void *);
-  static void reduce_nsq_angles(char *, int, char *, int, int *, 
+  static void map_edge_vertices(uint64_t, char *, int, char *, int,
 				KeyValue *, void *);
-  static void reduce_emit_triangles(char *, int, char *, int, int *, 
-				    KeyValue *, void *);
-  */
+  static void reduce_normalize(char *, int, char *, int, int *, 
+			       KeyValue *, void *);
+  static void reduce_vertex_init(char *, int, char *, int, int *, 
+				 KeyValue *, void *);
+  static void scan_rank(char *, int, char *, int, void *);
+  static void reduce_scatter(char *, int, char *, int, int *, 
+			     KeyValue *, void *);
+  static void scan_contribution(char *, int, char *, int, void *);
+  static void reduce_update(char *, int, char *, int, int *, 
+			    KeyValue *, void *);
+  static void map_rank(uint64_t, char *, int, char *, int,
+		       KeyValue *, void *);
 };
 
 }
@@ -371,6 +371,42 @@ class mrmpi:
     n = self.lib.MR_sort_multivalues_flag(self.mr,flag)
     return n
 
+  def sample_sort_keys(self,compare):
+    self.compare_caller = compare
+    n = self.lib.MR_sample_sort_keys(self.mr,self.compare_def)
+    return n
+
+  def sample_sort_keys_flag(self,flag):
+    n = self.lib.MR_sample_sort_keys_flag(self.mr,flag)
+    return n
+
+  def sample_sort_values(self,compare):
+    self.compare_caller = compare
+    n = self.lib.MR_sample_sort_values(self.mr,self.compare_def)
+    return n
+
+  def sample_sort_values_flag(self,flag):
+    n = self.lib.MR_sample_sort_values_flag(self.mr,flag)
+    return n
+
+  def topk_keys(self,k,compare):
+    self.compare_caller = compare
+    n = self.lib.MR_topk_keys(self.mr,k,self.compare_def)
+    return n
+
+  def topk_keys_flag(self,k,flag):
+    n = self.lib.MR_topk_keys_flag(self.mr,k,flag)
+    return n
+
+  def topk_values(self,k,compare):
+    self.compare_caller = compare
+    n = self.lib.MR_topk_values(self.mr,k,self.compare_def)
+    return n
+
+  def topk_values_flag(self,k,flag):
+    n = self.lib.MR_topk_values_flag(self.mr,k,flag)
+    return n
+
   def compare_callback(self,cobj1,len1,cobj2,len2):
     obj1 = loads(cobj1[:len1])
     obj2 = loads(cobj2[:len2])
@@ -0,0 +1,189 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#include "pthread.h"
+#include "stdio.h"
+#include "string.h"
+#include "stdint.h"
+#include "asyncio.h"
+#include "mapreduce.h"
+#include "error.h"
+
+using namespace MAPREDUCE_NS;
+
+enum{READ,WRITE};
+
+/* ----------------------------------------------------------------------
+   background reads and writes of whole pages for a KV, KMV, or Spool
+   one operation is in flight at a time, performed by its own thread
+   data moves through a staging page taken from the MR page pool,
+     so the owner's in-memory page is free as soon as an operation starts:
+     write() copies the page into the staging page, then writes it
+     read() prefetches a page, fetch() copies it to the in-memory page
+------------------------------------------------------------------------- */
+
+AsyncIO::AsyncIO(MapReduce *mr_caller, Error *error_caller)
+{
+  mr = mr_caller;
+  error = error_caller;
+
+  buf = NULL;
+  memtag = -1;
+  busy = 0;
+  ipage = -1;
+}
+
+/* ---------------------------------------------------------------------- */
+
+AsyncIO::~AsyncIO()
+{
+  release();
+}
+
+/* ----------------------------------------------------------------------
+   request a staging page if do not have one
+   return 1 if have one, 0 if MR page pool is capped by maxpage,
+     since the page could be one that an MR operation will need
+------------------------------------------------------------------------- */
+
+int AsyncIO::acquire()
+{
+  if (buf) return 1;
+  if (mr->maxpage) return 0;
+
+  uint64_t dummy;
+  buf = mr->mem_request(1,dummy,memtag);
+  return 1;
+}
+
+/* ----------------------------------------------------------------------
+   finish any operation, give staging page back to MR
+------------------------------------------------------------------------- */
+
+void AsyncIO::release()
+{
+  wait();
+  ipage = -1;
+  if (buf) {
+    mr->mem_unmark(memtag);
+    buf = NULL;
+    memtag = -1;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   start writing N bytes of page to fp at offset
+   page is copied to staging page first, caller can reuse it on return
+------------------------------------------------------------------------- */
+
+void AsyncIO::write(FILE *fp_caller, uint64_t offset_caller, char *page,
+		    uint64_t n)
+{
+  wait();
+  ipage = -1;
+  memcpy(buf,page,n);
+
+  fp = fp_caller;
+  offset = offset_caller;
+  nbytes = n;
+  start(WRITE);
+}
+
+/* ----------------------------------------------------------------------
+   start reading N bytes of page ipage from fp at offset into staging page
+------------------------------------------------------------------------- */
+
+void AsyncIO::read(FILE *fp_caller, int ipage_caller, uint64_t offset_caller,
+		   uint64_t n)
+{
+  wait();
+
+  fp = fp_caller;
+  ipage = ipage_caller;
+  offset = offset_caller;
+  nbytes = n;
+  start(READ);
+}
+
+/* ----------------------------------------------------------------------
+   copy page ipage into caller's page if it was read successfully
+   return 1 if copied, 0 if caller must read it itself
+------------------------------------------------------------------------- */
+
+int AsyncIO::fetch(int ipage_caller, char *page)
+{
+  wait();
+  if (ipage != ipage_caller) {
+    ipage = -1;
+    return 0;
+  }
+
+  ipage = -1;
+  if (!status) return 0;
+  memcpy(page,buf,nbytes);
+  mr->rsize += nbytes;
+  return 1;
+}
+
+/* ----------------------------------------------------------------------
+   wait for operation in flight to finish
+   a failed write is reported as a warning like synchronous writes
+------------------------------------------------------------------------- */
+
+void AsyncIO::wait()
+{
+  if (!busy) return;
+
+  pthread_join(thread,NULL);
+  busy = 0;
+
+  if (which == WRITE) {
+    mr->wsize += nbytes;
+    if (!status) {
+      char str[128];
+      sprintf(str,"Bad asynchronous fwrite/fseek: %lu %lu",
+	      (unsigned long) offset,(unsigned long) nbytes);
+      error->warning(str);
+    }
+  }
+}
+
+/* ----------------------------------------------------------------------
+   launch thread to perform an operation
+------------------------------------------------------------------------- */
+
+void AsyncIO::start(int which_caller)
+{
+  which = which_caller;
+  if (pthread_create(&thread,NULL,thread_standalone,this))
+    error->one("Could not create asynchronous I/O thread");
+  busy = 1;
+}
+
+void *AsyncIO::thread_standalone(void *ptr)
+{
+  AsyncIO *aio = (AsyncIO *) ptr;
+  FILE *fp = aio->fp;
+
+  int seekflag = fseek(fp,aio->offset,SEEK_SET);
+  int n;
+  if (aio->which == WRITE) n = fwrite(aio->buf,aio->nbytes,1,fp);
+  else n = fread(aio->buf,aio->nbytes,1,fp);
+
+  aio->status = (seekflag == 0 && (n == 1 || aio->nbytes == 0));
+  if (aio->which == READ && ferror(fp)) {
+    aio->status = 0;
+    clearerr(fp);
+  }
+  return NULL;
+}
@@ -0,0 +1,59 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include "pthread.h"
+#include "stdio.h"
+#include "stdint.h"
+
+namespace MAPREDUCE_NS {
+
+class AsyncIO {
+ public:
+  AsyncIO(class MapReduce *, class Error *);
+  ~AsyncIO();
+
+  int acquire();
+  void release();
+  void write(FILE *, uint64_t, char *, uint64_t);
+  void read(FILE *, int, uint64_t, uint64_t);
+  int fetch(int, char *);
+  void wait();
+
+ private:
+  class MapReduce *mr;
+  class Error *error;
+
+  char *buf;                    // staging page, NULL if none
+  int memtag;                   // MR page ID of buf
+
+  // operation in flight or last completed
+
+  int busy;                     // 1 if a thread is performing it
+  int which;                    // READ or WRITE
+  FILE *fp;                     // file it is performed on
+  uint64_t offset;              // file offset
+  uint64_t nbytes;              // # of bytes
+  int ipage;                    // page read into buf, -1 if none
+  int status;                   // 1 if seek and read/write succeeded
+  pthread_t thread;
+
+  void start(int);
+  static void *thread_standalone(void *);
+};
+
+}
+
+#endif
@@ -76,6 +76,18 @@ uint64_t MR_aggregate(void *MRptr, int (*myhash)(char *, int))
   return mr->aggregate(myhash);
 }
 
+uint64_t MR_aggregate_combine(void *MRptr, int (*myhash)(char *, int),
+			      void (*mycombine)(char *, int, char *,
+						int, int *, void *, void *),
+			      void *APPptr)
+{
+  typedef void (CombineFunc)(char *, int, char *,
+			     int, int *, KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  CombineFunc *appcombine = (CombineFunc *) mycombine;
+  return mr->aggregate(myhash,appcombine,APPptr);
+}
+
 uint64_t MR_broadcast(void *MRptr, int root)
 {
   MapReduce *mr = (MapReduce *) MRptr;
@@ -106,6 +118,18 @@ uint64_t MR_collate(void *MRptr, int (*myhash)(char *, int))
   return mr->collate(myhash);
 }
 
+uint64_t MR_collate_combine(void *MRptr, int (*myhash)(char *, int),
+			    void (*mycombine)(char *, int, char *,
+					      int, int *, void *, void *),
+			    void *APPptr)
+{
+  typedef void (CombineFunc)(char *, int, char *,
+			     int, int *, KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  CombineFunc *appcombine = (CombineFunc *) mycombine;
+  return mr->collate(myhash,appcombine,APPptr);
+}
+
 uint64_t MR_compress(void *MRptr,
 		     void (*mycompress)(char *, int, char *,
 					int, int *, void *, void *),
@@ -250,6 +274,58 @@ uint64_t MR_map_mr_add(void *MRptr, void *MRptr2,
   return mr->map(mr2,appmap,APPptr,addflag);
 }
 
+uint64_t MR_map_fixed(void *MRptr, void *MRptr2,
+		      void (*mymap)(uint64_t, int, char *, char *, int,
+				    void *, void *),
+		      void *APPptr)
+{
+  typedef void (MapFunc)(uint64_t, int, char *, char *, int,
+			 KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  MapReduce *mr2 = (MapReduce *) MRptr2;
+  MapFunc *appmap = (MapFunc *) mymap;
+  return mr->map_fixed(mr2,appmap,APPptr);
+}
+
+uint64_t MR_map_fixed_add(void *MRptr, void *MRptr2,
+			  void (*mymap)(uint64_t, int, char *, char *, int,
+					void *, void *),
+			  void *APPptr, int addflag)
+{
+  typedef void (MapFunc)(uint64_t, int, char *, char *, int,
+			 KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  MapReduce *mr2 = (MapReduce *) MRptr2;
+  MapFunc *appmap = (MapFunc *) mymap;
+  return mr->map_fixed(mr2,appmap,APPptr,addflag);
+}
+
+uint64_t MR_map_batch(void *MRptr, void *MRptr2,
+		      void (*mymap)(uint64_t, int, char **, int *,
+				    char **, int *, void *, void *),
+		      void *APPptr)
+{
+  typedef void (MapFunc)(uint64_t, int, char **, int *, char **, int *,
+			 KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  MapReduce *mr2 = (MapReduce *) MRptr2;
+  MapFunc *appmap = (MapFunc *) mymap;
+  return mr->map_batch(mr2,appmap,APPptr);
+}
+
+uint64_t MR_map_batch_add(void *MRptr, void *MRptr2,
+			  void (*mymap)(uint64_t, int, char **, int *,
+					char **, int *, void *, void *),
+			  void *APPptr, int addflag)
+{
+  typedef void (MapFunc)(uint64_t, int, char **, int *, char **, int *,
+			 KeyValue *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  MapReduce *mr2 = (MapReduce *) MRptr2;
+  MapFunc *appmap = (MapFunc *) mymap;
+  return mr->map_batch(mr2,appmap,APPptr,addflag);
+}
+
 void MR_open(void *MRptr)
 {
   MapReduce *mr = (MapReduce *) MRptr;
@@ -329,6 +405,27 @@ uint64_t MR_scan_kmv(void *MRptr,
   return mr->scan(appscan,APPptr);
 }
 
+uint64_t MR_scan_fixed(void *MRptr,
+		       void (*myscan)(int, char *, char *, int, void *),
+		       void *APPptr)
+{
+  typedef void (ScanFunc)(int, char *, char *, int, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  ScanFunc *appscan = (ScanFunc *) myscan;
+  return mr->scan_fixed(appscan,APPptr);
+}
+
+uint64_t MR_scan_batch(void *MRptr,
+		       void (*myscan)(int, char **, int *, char **, int *,
+				      void *),
+		       void *APPptr)
+{
+  typedef void (ScanFunc)(int, char **, int *, char **, int *, void *);
+  MapReduce *mr = (MapReduce *) MRptr;
+  ScanFunc *appscan = (ScanFunc *) myscan;
+  return mr->scan_batch(appscan,APPptr);
+}
+
 uint64_t MR_scrunch(void *MRptr, int numprocs, char *key, int keybytes)
 {
   MapReduce *mr = (MapReduce *) MRptr;
@@ -372,6 +469,76 @@ uint64_t MR_sort_multivalues_flag(void *MRptr, int flag)
   return mr->sort_multivalues(flag);
 }
 
+uint64_t MR_sample_sort_keys(void *MRptr, 
+			     int (*mycompare)(char *, int, char *, int))
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->sample_sort_keys(mycompare);
+}
+
+uint64_t MR_sample_sort_keys_flag(void *MRptr, int flag)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->sample_sort_keys(flag);
+}
+
+uint64_t MR_sample_sort_values(void *MRptr, 
+			       int (*mycompare)(char *, int, char *, int))
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->sample_sort_values(mycompare);
+}
+
+uint64_t MR_sample_sort_values_flag(void *MRptr, int flag)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->sample_sort_values(flag);
+}
+
+uint64_t MR_topk_keys(void *MRptr, int k,
+		      int (*mycompare)(char *, int, char *, int))
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->topk_keys(k,mycompare);
+}
+
+uint64_t MR_topk_keys_flag(void *MRptr, int k, int flag)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->topk_keys(k,flag);
+}
+
+uint64_t MR_topk_values(void *MRptr, int k,
+			int (*mycompare)(char *, int, char *, int))
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->topk_values(k,mycompare);
+}
+
+uint64_t MR_topk_values_flag(void *MRptr, int k, int flag)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->topk_values(k,flag);
+}
+
+uint64_t MR_sum_values(void *MRptr, int flag, void *result)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->sum_values(flag,result);
+}
+
+uint64_t MR_min_values(void *MRptr, int flag, void *result)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->min_values(flag,result);
+}
+
+uint64_t MR_max_values(void *MRptr, int flag, void *result)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  return mr->max_values(flag,result);
+}
+
 uint64_t MR_kv_stats(void *MRptr, int level)
 {
   MapReduce *mr = (MapReduce *) MRptr;
@@ -444,6 +611,54 @@ void MR_set_valuealign(void *MRptr, int value)
   mr->valuealign = value;
 }
 
+void MR_set_fixedkey(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->fixedkey = value;
+}
+
+void MR_set_fixedvalue(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->fixedvalue = value;
+}
+
+void MR_set_nthreads(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->nthreads = value;
+}
+
+void MR_set_mapthreads(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->mapthreads = value;
+}
+
+void MR_set_skewsplit(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->skewsplit = value;
+}
+
+void MR_set_asyncio(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->asyncio = value;
+}
+
+void MR_set_mmapio(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->mmapio = value;
+}
+
+void MR_set_codec(void *MRptr, int value)
+{
+  MapReduce *mr = (MapReduce *) MRptr;
+  mr->codec = value;
+}
+
 void MR_set_fpath(void *MRptr, char *str)
 {
   MapReduce *mr = (MapReduce *) MRptr;
@@ -472,3 +687,15 @@ void MR_kv_add_multi_dynamic(void *KVptr, int n,
   KeyValue *kv = (KeyValue *) KVptr;
   kv->add(n,key,keybytes,value,valuebytes);
 }
+
+void MR_kv_add_n(void *KVptr, int n, char *key, char *value)
+{
+  KeyValue *kv = (KeyValue *) KVptr;
+  kv->add_n(n,key,value);
+}
+
+void MR_kv_add_n_pairs(void *KVptr, int n, char *pairs)
+{
+  KeyValue *kv = (KeyValue *) KVptr;
+  kv->add_n(n,pairs);
+}
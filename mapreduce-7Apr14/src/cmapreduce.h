@@ -33,11 +33,21 @@ void *MR_copy(void *MRptr);
 
 uint64_t MR_add(void *MRptr, void *MRptr2);
 uint64_t MR_aggregate(void *MRptr, int (*myhash)(char *, int));
+uint64_t MR_aggregate_combine(void *MRptr, int (*myhash)(char *, int),
+			      void (*mycombine)(char *, int, char *, int,
+						int *, void *KVptr,
+						void *APPptr),
+			      void *APPptr);
 uint64_t MR_broadcast(void *MRptr, int);
 uint64_t MR_clone(void *MRptr);
 uint64_t MR_close(void *MRptr);
 uint64_t MR_collapse(void *MRptr, char *key, int keybytes);
 uint64_t MR_collate(void *MRptr, int (*myhash)(char *, int));
+uint64_t MR_collate_combine(void *MRptr, int (*myhash)(char *, int),
+			    void (*mycombine)(char *, int, char *, int,
+					      int *, void *KVptr,
+					      void *APPptr),
+			    void *APPptr);
 uint64_t MR_compress(void *MRptr, 
 		     void (*mycompress)(char *, int, char *, int, int *, 
 					void *KVptr, void *APPptr),
@@ -93,6 +103,24 @@ uint64_t MR_map_mr_add(void *MRptr, void *MRptr2,
 		       void (*mymap)(uint64_t, char *, int, char *, int, 
 				     void *KVptr, void *APPptr),
 		       void *APPptr, int addflag);
+uint64_t MR_map_fixed(void *MRptr, void *MRptr2,
+		      void (*mymap)(uint64_t, int, char *, char *, int,
+				    void *KVptr, void *APPptr),
+		      void *APPptr);
+uint64_t MR_map_fixed_add(void *MRptr, void *MRptr2,
+			  void (*mymap)(uint64_t, int, char *, char *, int,
+					void *KVptr, void *APPptr),
+			  void *APPptr, int addflag);
+uint64_t MR_map_batch(void *MRptr, void *MRptr2,
+		      void (*mymap)(uint64_t, int, char **, int *,
+				    char **, int *,
+				    void *KVptr, void *APPptr),
+		      void *APPptr);
+uint64_t MR_map_batch_add(void *MRptr, void *MRptr2,
+			  void (*mymap)(uint64_t, int, char **, int *,
+					char **, int *,
+					void *KVptr, void *APPptr),
+			  void *APPptr, int addflag);
 
 void MR_open(void *MRptr);
 void MR_open_add(void *MRptr, int addflag);
@@ -114,6 +142,13 @@ uint64_t MR_scan_kv(void *MRptr,
 uint64_t MR_scan_kmv(void *MRptr,
 		     void (*myscan)(char *, int, char *, int, int *, void *),
 		     void *APPptr);
+uint64_t MR_scan_fixed(void *MRptr,
+		       void (*myscan)(int, char *, char *, int, void *),
+		       void *APPptr);
+uint64_t MR_scan_batch(void *MRptr,
+		       void (*myscan)(int, char **, int *, char **, int *,
+				      void *),
+		       void *APPptr);
 
 uint64_t MR_scrunch(void *MRptr, int numprocs, char *key, int keybytes);
 uint64_t MR_sort_keys(void *MRptr, 
@@ -125,6 +160,22 @@ uint64_t MR_sort_values_flag(void *MRptr, int);
 uint64_t MR_sort_multivalues(void *MRptr,
 			     int (*mycompare)(char *, int, char *, int));
 uint64_t MR_sort_multivalues_flag(void *MRptr, int);
+uint64_t MR_sample_sort_keys(void *MRptr, 
+			     int (*mycompare)(char *, int, char *, int));
+uint64_t MR_sample_sort_keys_flag(void *MRptr, int);
+uint64_t MR_sample_sort_values(void *MRptr,
+			       int (*mycompare)(char *, int, char *, int));
+uint64_t MR_sample_sort_values_flag(void *MRptr, int);
+uint64_t MR_topk_keys(void *MRptr, int k,
+		      int (*mycompare)(char *, int, char *, int));
+uint64_t MR_topk_keys_flag(void *MRptr, int k, int);
+uint64_t MR_topk_values(void *MRptr, int k,
+			int (*mycompare)(char *, int, char *, int));
+uint64_t MR_topk_values_flag(void *MRptr, int k, int);
+
+uint64_t MR_sum_values(void *MRptr, int, void *result);
+uint64_t MR_min_values(void *MRptr, int, void *result);
+uint64_t MR_max_values(void *MRptr, int, void *result);
 
 uint64_t MR_kv_stats(void *MRptr, int level);
 uint64_t MR_kmv_stats(void *MRptr, int level);
@@ -139,6 +190,14 @@ void MR_set_minpage(void *MRptr, int value);
 void MR_set_maxpage(void *MRptr, int value);
 void MR_set_keyalign(void *MRptr, int value);
 void MR_set_valuealign(void *MRptr, int value);
+void MR_set_fixedkey(void *MRptr, int value);
+void MR_set_fixedvalue(void *MRptr, int value);
+void MR_set_nthreads(void *MRptr, int value);
+void MR_set_mapthreads(void *MRptr, int value);
+void MR_set_skewsplit(void *MRptr, int value);
+void MR_set_asyncio(void *MRptr, int value);
+void MR_set_mmapio(void *MRptr, int value);
+void MR_set_codec(void *MRptr, int value);
 void MR_set_fpath(void *MRptr, char *str);
 
 void MR_kv_add(void *KVptr, char *key, int keybytes, 
@@ -149,6 +208,8 @@ void MR_kv_add_multi_static(void *KVptr, int n,
 void MR_kv_add_multi_dynamic(void *KVptr, int n,
 			     char *key, int *keybytes,
 			     char *value, int *valuebytes);
+void MR_kv_add_n(void *KVptr, int n, char *key, char *value);
+void MR_kv_add_n_pairs(void *KVptr, int n, char *pairs);
 
 #ifdef __cplusplus
 }
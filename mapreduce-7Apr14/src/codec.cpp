@@ -0,0 +1,324 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#include "mpi.h"
+#include "string.h"
+#include "stdint.h"
+#include "codec.h"
+#include "mapreduce.h"
+#include "memory.h"
+#include "error.h"
+
+using namespace MAPREDUCE_NS;
+
+#define HASHLOG 14            // LZ hash table has 2^HASHLOG entries
+#define MINMATCH 4            // shortest LZ match
+#define MAXOFFSET 65535       // farthest LZ match, fits in 2 bytes
+#define SKIPTRIGGER 6         // LZ search step grows after 2^6 misses
+#define HEADER (sizeof(uint64_t)+sizeof(int))
+
+/* ----------------------------------------------------------------------
+   compression of KV pages in 2 stages:
+     delta stage: page is viewed as 4-byte words, each word is replaced
+       by its difference from the word one stride earlier, stride =
+       size of a KV pair, so fixed-size pairs of sorted or dense integer
+       keys/values leave small differences, which are zigzag-encoded
+       as varints of 1 byte each when below 64
+     LZ stage: varint stream is compressed by an LZ77 coder in the
+       style of LZ4, sequences of a token, literals, 2-byte offset,
+       match length, which removes the runs of repeated bytes left
+       by identical lengths and padding
+   encoded data = header with # of decoded bytes and delta stride,
+     then LZ stream
+------------------------------------------------------------------------- */
+
+Codec::Codec(MapReduce *mr_caller, uint64_t maxbytes_caller,
+	     Memory *memory_caller, Error *error_caller)
+{
+  mr = mr_caller;
+  memory = memory_caller;
+  error = error_caller;
+
+  maxbytes = maxbytes_caller;
+  maxmid = maxbytes + maxbytes/4 + 16;
+
+  buf = (char *) memory->smalloc(maxbytes,"codec:buf");
+  mid = (unsigned char *) memory->smalloc(maxmid,"codec:mid");
+  table = (uint32_t *)
+    memory->smalloc((1 << HASHLOG)*sizeof(uint32_t),"codec:table");
+}
+
+/* ---------------------------------------------------------------------- */
+
+Codec::~Codec()
+{
+  memory->sfree(buf);
+  memory->sfree(mid);
+  memory->sfree(table);
+}
+
+/* ----------------------------------------------------------------------
+   encode N bytes of src into dest, stride = size of a KV pair
+   return # of encoded bytes, 0 if they would exceed limit,
+     in which case caller should store src as-is
+------------------------------------------------------------------------- */
+
+uint64_t Codec::encode(char *src, uint64_t n, int stride, char *dest,
+		       uint64_t limit)
+{
+  if (n > maxbytes) error->one("Codec encode exceeds page size");
+  if (limit <= HEADER) return 0;
+
+  double timestart = MPI_Wtime();
+
+  uint64_t nmid = delta((unsigned char *) src,n,stride,mid);
+  memcpy(dest,&n,sizeof(uint64_t));
+  memcpy(&dest[sizeof(uint64_t)],&stride,sizeof(int));
+  uint64_t ncode = lz(mid,nmid,(unsigned char *) &dest[HEADER],limit-HEADER);
+
+  mr->ztime += MPI_Wtime() - timestart;
+  if (ncode == 0) return 0;
+
+  ncode += HEADER;
+  mr->zsize += n;
+  mr->zcsize += ncode;
+  return ncode;
+}
+
+/* ----------------------------------------------------------------------
+   decode NSRC bytes of src into dest, which holds up to limit bytes
+   return # of decoded bytes
+------------------------------------------------------------------------- */
+
+uint64_t Codec::decode(char *src, uint64_t nsrc, char *dest, uint64_t limit)
+{
+  double timestart = MPI_Wtime();
+
+  uint64_t n;
+  int stride;
+  memcpy(&n,src,sizeof(uint64_t));
+  memcpy(&stride,&src[sizeof(uint64_t)],sizeof(int));
+  if (n > limit || nsrc < HEADER) error->one("Corrupt encoded page in Codec");
+
+  uint64_t nmid = unlz((unsigned char *) &src[HEADER],nsrc-HEADER,mid,maxmid);
+  undelta(mid,nmid,stride,(unsigned char *) dest,n);
+
+  mr->ztime += MPI_Wtime() - timestart;
+  return n;
+}
+
+/* ----------------------------------------------------------------------
+   delta stage, words of src minus words one stride back as varints
+   trailing bytes that are not a whole word are copied
+   return # of bytes in dest
+------------------------------------------------------------------------- */
+
+uint64_t Codec::delta(unsigned char *src, uint64_t n, int stride,
+		      unsigned char *dest)
+{
+  uint64_t lag = stride/sizeof(uint32_t);
+  if (stride % sizeof(uint32_t) || lag == 0) lag = 1;
+
+  uint64_t nword = n/sizeof(uint32_t);
+  unsigned char *ptr = dest;
+  uint32_t word,prev,diff,zigzag;
+
+  for (uint64_t i = 0; i < nword; i++) {
+    memcpy(&word,&src[i*sizeof(uint32_t)],sizeof(uint32_t));
+    if (i >= lag) memcpy(&prev,&src[(i-lag)*sizeof(uint32_t)],
+			 sizeof(uint32_t));
+    else prev = 0;
+    diff = word - prev;
+    zigzag = (diff << 1) ^ (uint32_t) (((int32_t) diff) >> 31);
+    while (zigzag >= 0x80) {
+      *(ptr++) = (zigzag & 0x7F) | 0x80;
+      zigzag >>= 7;
+    }
+    *(ptr++) = zigzag;
+  }
+
+  uint64_t ntail = n - nword*sizeof(uint32_t);
+  memcpy(ptr,&src[nword*sizeof(uint32_t)],ntail);
+  return ptr+ntail - dest;
+}
+
+/* ----------------------------------------------------------------------
+   inverse of delta stage, NSRC bytes of src become N bytes of dest
+------------------------------------------------------------------------- */
+
+void Codec::undelta(unsigned char *src, uint64_t nsrc, int stride,
+		    unsigned char *dest, uint64_t n)
+{
+  uint64_t lag = stride/sizeof(uint32_t);
+  if (stride % sizeof(uint32_t) || lag == 0) lag = 1;
+
+  uint64_t nword = n/sizeof(uint32_t);
+  unsigned char *ptr = src;
+  unsigned char *stop = src + nsrc;
+  uint32_t word,prev,zigzag;
+  int shift;
+
+  for (uint64_t i = 0; i < nword; i++) {
+    zigzag = 0;
+    shift = 0;
+    do {
+      if (ptr == stop) error->one("Corrupt encoded page in Codec");
+      zigzag |= ((uint32_t) (*ptr & 0x7F)) << shift;
+      shift += 7;
+    } while (*(ptr++) & 0x80);
+
+    if (i >= lag) memcpy(&prev,&dest[(i-lag)*sizeof(uint32_t)],
+			 sizeof(uint32_t));
+    else prev = 0;
+    word = prev + ((zigzag >> 1) ^ (0U - (zigzag & 1)));
+    memcpy(&dest[i*sizeof(uint32_t)],&word,sizeof(uint32_t));
+  }
+
+  uint64_t ntail = n - nword*sizeof(uint32_t);
+  if (stop-ptr != (int64_t) ntail) error->one("Corrupt encoded page in Codec");
+  memcpy(&dest[nword*sizeof(uint32_t)],ptr,ntail);
+}
+
+/* ----------------------------------------------------------------------
+   LZ stage, compress N bytes of src into dest
+   each sequence = token with literal and match lengths in 4 bits each,
+     extra length bytes if 15, literals, 2-byte offset, extra match bytes
+   last sequence has only literals
+   return # of bytes in dest, 0 if they would exceed limit
+------------------------------------------------------------------------- */
+
+uint64_t Codec::lz(unsigned char *src, uint64_t n, unsigned char *dest,
+		   uint64_t limit)
+{
+  memset(table,0,(1 << HASHLOG)*sizeof(uint32_t));
+
+  unsigned char *op = dest;
+  unsigned char *ostop = dest + limit;
+  uint64_t i = 0;
+  uint64_t anchor = 0;
+  uint64_t nlit,nmatch,len;
+  uint32_t word,cand,hash;
+  int misses = 0;
+
+  while (1) {
+
+    // search for a match at i, table stores position+1 of a hashed word
+    // step over incompressible data faster the longer it goes on
+
+    nmatch = 0;
+    if (i + MINMATCH <= n) {
+      memcpy(&word,&src[i],sizeof(uint32_t));
+      hash = (word * 2654435761U) >> (32-HASHLOG);
+      cand = table[hash];
+      table[hash] = i+1;
+      if (cand && i - (cand-1) <= MAXOFFSET &&
+	  memcmp(&src[cand-1],&src[i],MINMATCH) == 0) {
+	cand--;
+	nmatch = MINMATCH;
+	while (i+nmatch < n && src[cand+nmatch] == src[i+nmatch]) nmatch++;
+      } else {
+	i += 1 + (misses++ >> SKIPTRIGGER);
+	continue;
+      }
+    }
+
+    // emit sequence of literals since anchor and the match, if any
+
+    nlit = (nmatch ? i : n) - anchor;
+    if (op + 1 + nlit/255+1 + nlit + 2 + nmatch/255+1 > ostop) return 0;
+
+    unsigned char *token = op++;
+    *token = (nlit >= 15 ? 15 : nlit) << 4;
+    if (nlit >= 15) {
+      for (len = nlit-15; len >= 255; len -= 255) *(op++) = 255;
+      *(op++) = len;
+    }
+    memcpy(op,&src[anchor],nlit);
+    op += nlit;
+
+    if (nmatch == 0) break;
+
+    uint64_t offset = i - cand;
+    *(op++) = offset & 0xFF;
+    *(op++) = offset >> 8;
+    len = nmatch - MINMATCH;
+    *token |= (len >= 15 ? 15 : len);
+    if (len >= 15) {
+      for (len -= 15; len >= 255; len -= 255) *(op++) = 255;
+      *(op++) = len;
+    }
+
+    i += nmatch;
+    anchor = i;
+    misses = 0;
+  }
+
+  return op - dest;
+}
+
+/* ----------------------------------------------------------------------
+   inverse of LZ stage, NSRC bytes of src into dest of size limit
+   return # of bytes in dest
+------------------------------------------------------------------------- */
+
+uint64_t Codec::unlz(unsigned char *src, uint64_t nsrc, unsigned char *dest,
+		     uint64_t limit)
+{
+  unsigned char *ip = src;
+  unsigned char *istop = src + nsrc;
+  unsigned char *op = dest;
+  unsigned char *ostop = dest + limit;
+  uint64_t nlit,nmatch,offset;
+  unsigned char token,byte;
+
+  while (ip < istop) {
+    token = *(ip++);
+    nlit = token >> 4;
+    if (nlit == 15)
+      do {
+	if (ip == istop) error->one("Corrupt encoded page in Codec");
+	byte = *(ip++);
+	nlit += byte;
+      } while (byte == 255);
+
+    if (nlit > (uint64_t) (istop-ip) || nlit > (uint64_t) (ostop-op))
+      error->one("Corrupt encoded page in Codec");
+    memcpy(op,ip,nlit);
+    ip += nlit;
+    op += nlit;
+    if (ip == istop) break;
+
+    if (istop-ip < 2) error->one("Corrupt encoded page in Codec");
+    offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    nmatch = token & 15;
+    if (nmatch == 15)
+      do {
+	if (ip == istop) error->one("Corrupt encoded page in Codec");
+	byte = *(ip++);
+	nmatch += byte;
+      } while (byte == 255);
+    nmatch += MINMATCH;
+
+    if (offset == 0 || offset > (uint64_t) (op-dest) ||
+	nmatch > (uint64_t) (ostop-op))
+      error->one("Corrupt encoded page in Codec");
+
+    // byte-wise copy since match may overlap what it produces
+
+    unsigned char *match = op - offset;
+    for (uint64_t k = 0; k < nmatch; k++) *(op++) = *(match++);
+  }
+
+  return op - dest;
+}
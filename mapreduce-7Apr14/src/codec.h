@@ -0,0 +1,49 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#ifndef CODEC_H
+#define CODEC_H
+
+#include "stdint.h"
+
+namespace MAPREDUCE_NS {
+
+class Codec {
+ public:
+  char *buf;                    // encoded bytes of one page for callers
+
+  Codec(class MapReduce *, uint64_t, class Memory *, class Error *);
+  ~Codec();
+
+  uint64_t encode(char *, uint64_t, int, char *, uint64_t);
+  uint64_t decode(char *, uint64_t, char *, uint64_t);
+
+ private:
+  class MapReduce *mr;
+  class Memory *memory;
+  class Error *error;
+
+  uint64_t maxbytes;            // max # of bytes encoded at once
+  uint64_t maxmid;              // allocated size of mid
+  unsigned char *mid;           // varint stream between the 2 stages
+  uint32_t *table;              // LZ hash table of recent positions
+
+  uint64_t delta(unsigned char *, uint64_t, int, unsigned char *);
+  void undelta(unsigned char *, uint64_t, int, unsigned char *, uint64_t);
+  uint64_t lz(unsigned char *, uint64_t, unsigned char *, uint64_t);
+  uint64_t unlz(unsigned char *, uint64_t, unsigned char *, uint64_t);
+};
+
+}
+
+#endif
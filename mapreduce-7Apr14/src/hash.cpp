@@ -4,6 +4,7 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "string.h"
 
 #define HASH_LITTLE_ENDIAN 1       // Intel and AMD are little endian
 
@@ -331,3 +332,141 @@ uint32_t hashlittle( const void *key, size_t length, uint32_t initval)
   return h;
 #endif /* PURIFY_HATES_HASHLITTLE */
 }
+
+/*
+-------------------------------------------------------------------------------
+hashkey() -- hash a key for assignment to a processor or hash bucket
+
+Most keys MR-MPI shuffles are 4-byte or 8-byte integers (vertex IDs,
+edges as pairs of 4-byte IDs), for which a byte-oriented hash like
+hashlittle() does far more work than needed.  hashkey() picks by length:
+
+  4 bytes: hashkey32(), 32-bit multiply-xorshift finalizer
+  8 bytes: hashkey64(), 64-bit multiply-xorshift finalizer (splitmix64)
+  other:   hashkeywide(), 16 bytes per step folded by a 64x64->128-bit
+           multiply, in the style of wyhash
+
+All mix every key bit into every bit of the result, so both the low
+bits used as a bucket index and the value modulo a processor count are
+well spread for sequential or strided integers.  Different initval
+seeds give unrelated results, so the processor and bucket assignment
+of a key are independent.
+
+Building with -DMRMPI_HASH_LOOKUP3 makes hashkey() call hashlittle()
+for all keys, as MR-MPI did previously.  Results of all these functions
+depend on the byte order of the machine.
+-------------------------------------------------------------------------------
+*/
+
+#define PHI32 0x9e3779b9U
+#define PHI64 0x9e3779b97f4a7c15ULL
+#define WIDE0 0xa0761d6478bd642fULL
+#define WIDE1 0xe7037ed1a0b428dbULL
+#define WIDE2 0x8ebc6af09c88c6e3ULL
+
+uint32_t hashkey32(const void *key, uint32_t initval)
+{
+  uint32_t x;
+  memcpy(&x,key,4);
+  x += initval*PHI32;
+  x ^= x >> 16;
+  x *= 0x7feb352dU;
+  x ^= x >> 15;
+  x *= 0x846ca68bU;
+  x ^= x >> 16;
+  return x;
+}
+
+uint32_t hashkey64(const void *key, uint32_t initval)
+{
+  uint64_t x;
+  memcpy(&x,key,8);
+  x += (initval+1)*PHI64;
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return (uint32_t) x;
+}
+
+/* fold 128-bit product of a and b to 64 bits */
+
+static inline uint64_t mulfold(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t) a * b;
+  return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+  uint64_t ahi = a >> 32, alo = (uint32_t) a;
+  uint64_t bhi = b >> 32, blo = (uint32_t) b;
+  uint64_t lo = alo*blo, mid1 = ahi*blo, mid2 = alo*bhi, hi = ahi*bhi;
+  uint64_t mid = (lo >> 32) + (uint32_t) mid1 + (uint32_t) mid2;
+  hi += (mid1 >> 32) + (mid2 >> 32) + (mid >> 32);
+  lo = (mid << 32) | (uint32_t) lo;
+  return lo ^ hi;
+#endif
+}
+
+/* unaligned reads of 4 and 8 bytes, fixed size so memcpy() is inlined */
+
+static inline uint64_t read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v,p,4);
+  return v;
+}
+
+static inline uint64_t read64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v,p,8);
+  return v;
+}
+
+uint32_t hashkeywide(const void *key, size_t length, uint32_t initval)
+{
+  const unsigned char *p = (const unsigned char *) key;
+  uint64_t h = (initval ^ WIDE0) + length*WIDE1;
+  uint64_t a,b;
+
+  // keys of up to 16 bytes are read as 2 words, possibly overlapping,
+  //   longer keys 16 bytes at a time with the last 16 bytes read at the end
+  // overlapping bytes cause no collisions since length is already in h
+
+  if (length <= 16) {
+    if (length >= 4) {
+      size_t k = (length >> 3) << 2;
+      a = (read32(p) << 32) | read32(p+k);
+      b = (read32(p+length-4) << 32) | read32(p+length-4-k);
+    } else if (length > 0) {
+      a = ((uint64_t) p[0] << 16) | ((uint64_t) p[length >> 1] << 8) |
+	p[length-1];
+      b = 0;
+    } else a = b = 0;
+  } else {
+    size_t n = length;
+    while (n > 16) {
+      h = mulfold(read64(p) ^ WIDE1,read64(p+8) ^ h);
+      p += 16;
+      n -= 16;
+    }
+    a = read64(p+n-16);
+    b = read64(p+n-8);
+  }
+
+  h = mulfold(a ^ WIDE1,b ^ h);
+  h = mulfold(h ^ WIDE2,length ^ WIDE0);
+  return (uint32_t) (h ^ (h >> 32));
+}
+
+uint32_t hashkey(const void *key, size_t length, uint32_t initval)
+{
+#ifdef MRMPI_HASH_LOOKUP3
+  return hashlittle(key,length,initval);
+#else
+  if (length == 4) return hashkey32(key,initval);
+  if (length == 8) return hashkey64(key,initval);
+  return hashkeywide(key,length,initval);
+#endif
+}
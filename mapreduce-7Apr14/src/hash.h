@@ -3,3 +3,12 @@
 // bob_jenkins@burtleburtle.net
 
 uint32_t hashlittle(const void *key, size_t length, uint32_t);
+
+// Hash function hashkey() used by MR-MPI for keys
+// 4-byte and 8-byte keys are hashed by an integer mix,
+// longer keys by a wide multiply hash, see hash.cpp
+
+uint32_t hashkey(const void *key, size_t length, uint32_t);
+uint32_t hashkey32(const void *key, uint32_t);
+uint32_t hashkey64(const void *key, uint32_t);
+uint32_t hashkeywide(const void *key, size_t length, uint32_t);
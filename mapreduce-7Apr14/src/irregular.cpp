@@ -25,6 +25,8 @@ using namespace MAPREDUCE_NS;
 #define MAX(A,B) ((A) > (B)) ? (A) : (B)
 
 #define INTMAX 0x7FFFFFFF
+#define SPARSE 4              // sparse if procs send to <= 1/SPARSE of procs
+#define NBXTAG 1              // tag of discovery messages
 
 /* ---------------------------------------------------------------------- */
 
@@ -52,6 +54,17 @@ Irregular::Irregular(int all2all_caller, Memory *memory_caller,
   recvprocs = new int[nprocs];
   request = new MPI_Request[nprocs];
   status = new MPI_Status[nprocs];
+
+  sparse = 0;
+  graph = MPI_COMM_NULL;
+  gnsend = gnrecv = 0;
+  gsendprocs = new int[nprocs];
+  grecvprocs = new int[nprocs];
+  sendinfo = new int[2*nprocs];
+  gsendbytes = new int[nprocs];
+  gsdispls = new int[nprocs];
+  grecvbytes = new int[nprocs];
+  grdispls = new int[nprocs];
 }
 
 /* ---------------------------------------------------------------------- */
@@ -70,10 +83,19 @@ Irregular::~Irregular()
   delete [] recvprocs;
   delete [] request;
   delete [] status;
+
+  if (graph != MPI_COMM_NULL) MPI_Comm_free(&graph);
+  delete [] gsendprocs;
+  delete [] grecvprocs;
+  delete [] sendinfo;
+  delete [] gsendbytes;
+  delete [] gsdispls;
+  delete [] grecvbytes;
+  delete [] grdispls;
 }
 
 /* ----------------------------------------------------------------------
-   setup irregular communication for all2all or custom
+   setup irregular communication for all2all, custom, or sparse
    n = # of datums contributed by this proc
    proclist = which proc each datum is to be sent to
    sizes = byte count of each datum
@@ -84,28 +106,53 @@ Irregular::~Irregular()
    limit #1 = total volume of send data exceeds INTMAX
    limit #2 = total volume of recv data exceeds min(recvlimit,INTMAX)
    2nd limit also insures # of received datums cannot exceed INTMAX
-   extra data is setup for custom communication:
+   if not all2all and no proc sends to more than 1/SPARSE of the procs,
+     sparse is set and recvbytes is found by discover(),
+     else via MPI_Alltoall() of all counts
+   extra data is setup for custom and sparse communication:
      sendprocs = list of nsend procs to send to
      recvprocs = list of nrecv procs to recv from
      reorder = contiguous send indices for each send, self copy is last
+     graph = neighbor topology for sparse exchange,
+       kept from the previous setup if no proc's neighbors have changed
 ------------------------------------------------------------------------- */
 
 int Irregular::setup(int n, int *proclist, int *sizes, int *reorder,
 		     uint64_t recvlimit, double &fraction)
 {
-  // compute sendbytes and sdispls
+  // compute sendbytes and senddatums
 
   for (int i = 0; i < nprocs; i++) bigsendbytes[i] = 0;
-  for (int i = 0; i < n; i++) bigsendbytes[proclist[i]] += sizes[i];
+  for (int i = 0; i < nprocs; i++) senddatums[i] = 0;
+  for (int i = 0; i < n; i++) {
+    bigsendbytes[proclist[i]] += sizes[i];
+    senddatums[proclist[i]]++;
+  }
+
+  // max over procs of: bytes sent to a single proc, send total,
+  //   # of procs sent to besides self
+
+  uint64_t maxsend[3],maxsendall[3];
+  maxsend[0] = maxsend[1] = maxsend[2] = 0;
+  for (int i = 0; i < nprocs; i++) {
+    maxsend[0] = MAX(maxsend[0],bigsendbytes[i]);
+    maxsend[1] += bigsendbytes[i];
+    if (bigsendbytes[i] && i != me) maxsend[2]++;
+  }
+  MPI_Allreduce(maxsend,maxsendall,3,MRMPI_BIGINT,MPI_MAX,comm);
 
   // error return if any proc sending > INTMAX to a single proc
 
-  uint64_t maxsend = 0;
-  for (int i = 0; i < nprocs; i++) maxsend = MAX(maxsend,bigsendbytes[i]);
-  uint64_t maxsendall;
-  MPI_Allreduce(&maxsend,&maxsendall,1,MRMPI_BIGINT,MPI_MAX,comm);
-  if (maxsendall > INTMAX) {
-    fraction = ((double) INTMAX) / maxsendall;
+  if (maxsendall[0] > INTMAX) {
+    fraction = ((double) INTMAX) / maxsendall[0];
+    return 0;
+  }
+
+  // error return if any proc's send total > INTMAX
+
+  uint64_t sendtotal = maxsend[1];
+  if (maxsendall[1] > INTMAX) {
+    fraction = ((double) INTMAX) / sendtotal;
     return 0;
   }
 
@@ -114,24 +161,15 @@ int Irregular::setup(int n, int *proclist, int *sizes, int *reorder,
   // compute sdispls
 
   sdispls[0] = 0;
-  uint64_t sendtotal = sendbytes[0];
-  for (int i = 1; i < nprocs; i++) {
+  for (int i = 1; i < nprocs; i++)
     sdispls[i] = sdispls[i-1] + sendbytes[i-1];
-    sendtotal += sendbytes[i];
-  }
 
-  // error return if any proc's send total > INTMAX
-
-  uint64_t sendtotalmax;
-  MPI_Allreduce(&sendtotal,&sendtotalmax,1,MRMPI_BIGINT,MPI_MAX,comm);
-  if (sendtotalmax > INTMAX) {
-    fraction = ((double) INTMAX) / sendtotal;
-    return 0;
-  }
+  sparse = (!all2all && SPARSE*maxsendall[2] <= nprocs);
 
   // compute recvbytes and rdispls
 
-  MPI_Alltoall(sendbytes,1,MPI_INT,recvbytes,1,MPI_INT,comm);
+  if (sparse) ndatum = discover();
+  else MPI_Alltoall(sendbytes,1,MPI_INT,recvbytes,1,MPI_INT,comm);
 
   rdispls[0] = 0;
   uint64_t recvtotal = recvbytes[0];
@@ -152,15 +190,14 @@ int Irregular::setup(int n, int *proclist, int *sizes, int *reorder,
   }
 
   // successful setup
-  // compute senddatums
-  // nrecv = total # of datums I receive, guaranteed to be < INTMAX
+  // ndatum = total # of datums I receive, guaranteed to be < INTMAX
+  // already known if sparse
 
   cssize = sendtotal - sendbytes[me];
   crsize = recvtotal - recvbytes[me];
 
-  for (int i = 0; i < nprocs; i++) senddatums[i] = 0;
-  for (int i = 0; i < n; i++) senddatums[proclist[i]]++;
-  MPI_Reduce_scatter(senddatums,&ndatum,one,MPI_INT,MPI_SUM,comm);
+  if (!sparse)
+    MPI_Reduce_scatter(senddatums,&ndatum,one,MPI_INT,MPI_SUM,comm);
 
   // if all2all, done
 
@@ -169,7 +206,7 @@ int Irregular::setup(int n, int *proclist, int *sizes, int *reorder,
     return ndatum;
   }
 
-  // if custom, setup additional data strucs
+  // if custom or sparse, setup additional data strucs
   // sendprocs,recvprocs = lists of procs to send to and recv from
   // begin lists with iproc > me and wrap around
   // reorder = contiguous send indices for each proc I send to
@@ -212,16 +249,94 @@ int Irregular::setup(int n, int *proclist, int *sizes, int *reorder,
   delete [] proc2send;
   delete [] offset;
 
+  // if sparse, neighbor topology with recvprocs as sources
+  //   and sendprocs as destinations
+  // creating it is collective, so recreate only if any proc's lists
+  //   differ from the ones the current graph was created with
+
+  if (sparse) {
+    int change = (graph == MPI_COMM_NULL ||
+		  nsend != gnsend || nrecv != gnrecv ||
+		  memcmp(sendprocs,gsendprocs,nsend*sizeof(int)) ||
+		  memcmp(recvprocs,grecvprocs,nrecv*sizeof(int)));
+    int changeall;
+    MPI_Allreduce(&change,&changeall,1,MPI_INT,MPI_MAX,comm);
+
+    if (changeall) {
+      if (graph != MPI_COMM_NULL) MPI_Comm_free(&graph);
+      MPI_Dist_graph_create_adjacent(comm,nrecv,recvprocs,MPI_UNWEIGHTED,
+				     nsend,sendprocs,MPI_UNWEIGHTED,
+				     MPI_INFO_NULL,0,&graph);
+      gnsend = nsend;
+      gnrecv = nrecv;
+      memcpy(gsendprocs,sendprocs,nsend*sizeof(int));
+      memcpy(grecvprocs,recvprocs,nrecv*sizeof(int));
+    }
+  }
+
   fraction = 1.0;
   return ndatum;
 }
 
 /* ----------------------------------------------------------------------
-   perform irregular communication via all2all or custom
+   find recvbytes from only the procs that send to me
+   NBX algorithm: synchronous send of bytes and # of datums to each proc
+     I send to, receive such messages from any proc until all my sends
+     are matched, then join a nonblocking barrier and keep receiving
+     until every proc has joined it
+   return total # of datums I recv, including self
+------------------------------------------------------------------------- */
+
+int Irregular::discover()
+{
+  int iproc,flag;
+  int recvinfo[2];
+  MPI_Status mpistatus;
+  MPI_Request barrier;
+
+  int nreq = 0;
+  for (iproc = 0; iproc < nprocs; iproc++) {
+    recvbytes[iproc] = 0;
+    if (iproc == me || sendbytes[iproc] == 0) continue;
+    sendinfo[2*nreq] = sendbytes[iproc];
+    sendinfo[2*nreq+1] = senddatums[iproc];
+    MPI_Issend(&sendinfo[2*nreq],2,MPI_INT,iproc,NBXTAG,comm,&request[nreq]);
+    nreq++;
+  }
+
+  recvbytes[me] = sendbytes[me];
+  int count = senddatums[me];
+
+  int barrier_active = 0;
+  int done = 0;
+  while (!done) {
+    MPI_Iprobe(MPI_ANY_SOURCE,NBXTAG,comm,&flag,&mpistatus);
+    if (flag) {
+      iproc = mpistatus.MPI_SOURCE;
+      MPI_Recv(recvinfo,2,MPI_INT,iproc,NBXTAG,comm,MPI_STATUS_IGNORE);
+      recvbytes[iproc] = recvinfo[0];
+      count += recvinfo[1];
+    }
+
+    if (barrier_active) MPI_Test(&barrier,&done,MPI_STATUS_IGNORE);
+    else {
+      MPI_Testall(nreq,request,&flag,MPI_STATUSES_IGNORE);
+      if (flag) {
+	MPI_Ibarrier(comm,&barrier);
+	barrier_active = 1;
+      }
+    }
+  }
+
+  return count;
+}
+
+/* ----------------------------------------------------------------------
+   perform irregular communication via all2all, custom, or sparse
    n = # of datums contributed by this proc
    proclist (for all2all) = which proc each datum is to be sent to
    sizes = byte count of each datum
-   reorder (for custom) = contiguous send indices for each send
+   reorder (for custom/sparse) = contiguous send indices for each send
    copy = buffer to pack send datums into
    recv = buffer to recv all datums into
 ------------------------------------------------------------------------- */
@@ -230,6 +345,7 @@ void Irregular::exchange(int n, int *proclist, char **ptrs, int *sizes,
 			 int *reorder, char *copy, char *recv)
 {
   if (all2all) exchange_all2all(n,proclist,ptrs,sizes,copy,recv);
+  else if (sparse) exchange_sparse(n,reorder,ptrs,sizes,copy,recv);
   else exchange_custom(n,reorder,ptrs,sizes,copy,recv);
 }
 
@@ -315,3 +431,58 @@ void Irregular::exchange_custom(int n, int *indices, char **ptrs, int *sizes,
 
   if (nrecv) MPI_Waitall(nrecv,request,status);
 }
+
+/* ----------------------------------------------------------------------
+   sparse communication via MPI_Ineighbor_alltoallv() on graph
+   copy datums for all sends into copy buf, contiguous for each send
+   copy self data while messages are in flight
+   indices are 0 to N-1, contiguous for each proc to send to, self copy is last
+   datums are received in same place as for custom
+------------------------------------------------------------------------- */
+
+void Irregular::exchange_sparse(int n, int *indices, char **ptrs, int *sizes,
+				char *copy, char *recv)
+{
+  int i,j,iproc;
+  char *ptr;
+  MPI_Request req;
+
+  // pack all messages
+
+  int index = 0;
+  ptr = copy;
+  for (int isend = 0; isend < nsend; isend++) {
+    iproc = sendprocs[isend];
+    gsendbytes[isend] = sendbytes[iproc];
+    gsdispls[isend] = ptr - copy;
+    n = senddatums[iproc];
+    for (i = 0; i < n; i++) {
+      j = indices[index++];
+      memcpy(ptr,ptrs[j],sizes[j]);
+      ptr += sizes[j];
+    }
+  }
+
+  for (int irecv = 0; irecv < nrecv; irecv++) {
+    iproc = recvprocs[irecv];
+    grecvbytes[irecv] = recvbytes[iproc];
+    grdispls[irecv] = rdispls[iproc];
+  }
+
+  MPI_Ineighbor_alltoallv(copy,gsendbytes,gsdispls,MPI_BYTE,
+			  recv,grecvbytes,grdispls,MPI_BYTE,graph,&req);
+
+  // copy self data directly to recv buf
+
+  if (self) {
+    ptr = &recv[rdispls[me]];
+    n = senddatums[me];
+    for (i = 0; i < n; i++) {
+      j = indices[index++];
+      memcpy(ptr,ptrs[j],sizes[j]);
+      ptr += sizes[j];
+    }
+  }
+
+  MPI_Wait(&req,MPI_STATUS_IGNORE);
+}
@@ -26,6 +26,8 @@ class Irregular {
 
   uint64_t cssize,crsize;    // total send/recv bytes for one exchange
 
+  int sparse;                // 1 if last setup chose sparse exchange
+
   int setup(int, int *, int *, int *, uint64_t, double &);
   void exchange(int, int *, char **, int *, int *, char *, char *);
 
@@ -57,8 +59,22 @@ class Irregular {
   MPI_Request *request;      // MPI requests for posted recvs
   MPI_Status *status;        // MPI statuses for Waitall
 
+  // sparse settings
+
+  MPI_Comm graph;            // neighbor topology of sendprocs/recvprocs
+  int gnsend,gnrecv;         // # of neighbors graph was created with
+  int *gsendprocs;           // sendprocs graph was created with
+  int *grecvprocs;           // recvprocs graph was created with
+  int *sendinfo;             // bytes and # of datums sent to each proc
+  int *gsendbytes;           // bytes to send to each neighbor
+  int *gsdispls;             // neighbor offset into clumped send buffer
+  int *grecvbytes;           // bytes to recv from each neighbor
+  int *grdispls;             // neighbor offset into recv buffer
+
   void exchange_all2all(int, int *, char **, int *, char *, char *);
   void exchange_custom(int, int *, char **, int *, char *, char *);
+  void exchange_sparse(int, int *, char **, int *, char *, char *);
+  int discover();
 
 };
 
@@ -22,6 +22,8 @@
 #include "spool.h"
 #include "hash.h"
 #include "memory.h"
+#include "asyncio.h"
+#include "mmapio.h"
 #include "error.h"
 
 using namespace MAPREDUCE_NS;
@@ -37,6 +39,8 @@ using namespace MAPREDUCE_NS;
 #define PAGECHUNK 16
 #define MINSPOOLBYTES 16384
 #define INTMAX 0x7FFFFFFF
+#define MAXLOAD 0.75               // max fraction of hash table slots in use
+#define SHORTKEY 8                 // keys stored in hash slot if this short
 
 enum{KVFILE,KMVFILE,SORTFILE,PARTFILE,SETFILE};   // same as in mapreduce.cpp
 
@@ -62,6 +66,9 @@ KeyMultiValue::KeyMultiValue(MapReduce *mr_caller,
   filename = mr->file_create(KMVFILE);
   fileflag = 0;
   fp = NULL;
+  aio = NULL;
+  mio = NULL;
+  if (mr->mmapio) mio = new MMapIO(mr,error);
 
   pages = NULL;
   npage = maxpage = 0;
@@ -82,6 +89,11 @@ KeyMultiValue::KeyMultiValue(MapReduce *mr_caller,
   twolenbytes = 2*sizeof(int);
   threelenbytes = 3*sizeof(int);
 
+  // KV pairs being converted have no lengths if they are fixed-size
+
+  kfixed = mr->kfixed;
+  vfixed = mr->vfixed;
+
   if (ONEMAX < MINSPOOLBYTES || ONEMAX < ALIGNFILE)
     error->all("KeyMultiValue settings are inconsistent");
 
@@ -101,10 +113,9 @@ KeyMultiValue::~KeyMultiValue()
   // users may use request_page() via multivalue_block() multiple times,
   // so cannot close file on last page in request_page()
 
-  if (fp) {
-    fclose(fp);
-    fp = NULL;
-  }
+  close_fp();
+  delete aio;
+  delete mio;
 
   deallocate(1);
   memory->sfree(pages);
@@ -189,8 +200,7 @@ void KeyMultiValue::complete()
 
   if (fileflag || mr->outofcore > 0) {
     write_page();
-    fclose(fp);
-    fp = NULL;
+    close_fp();
   }
 
   npage++;
@@ -238,9 +248,15 @@ int KeyMultiValue::request_page(int ipage, int writeflag,
 				uint64_t &valuesize_page,
 				uint64_t &alignsize_page)
 {
-  // load page from file if necessary
+  // load page from file if necessary, unless it was prefetched
+  // prefetch next page while caller works on this one
 
-  if (fileflag) read_page(ipage,writeflag);
+  if (fileflag) {
+    if (!aio || !aio->fetch(ipage,page)) read_page(ipage,writeflag);
+    if (ipage < npage-1 && async())
+      aio->read(fp,ipage+1,pages[ipage+1].fileoffset,
+		pages[ipage+1].filesize);
+  }
 
   keysize_page = pages[ipage].keysize;
   valuesize_page = pages[ipage].valuesize;
@@ -282,10 +298,7 @@ void KeyMultiValue::overwrite_page(int ipage)
 
 void KeyMultiValue::close_file()
 {
-  if (fp) {
-    fclose(fp);
-    fp = NULL;
-  }
+  close_fp();
 }
 
 /* ----------------------------------------------------------------------
@@ -357,10 +370,15 @@ void KeyMultiValue::clone(KeyValue *kv)
     ptr = page_kv;
 
     for (int i = 0; i < nkey_kv; i++) {
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-      ptr += twolenbytes;
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
@@ -438,10 +456,15 @@ void KeyMultiValue::collapse_one(char *key, int keybytes, KeyValue *kv,
     ptr = page_kv;
 
     for (int i = 0; i < nkey_kv; i++) {
-      keybytes_kv = *((int *) ptr);
-      valuebytes_kv = *((int *) (ptr+sizeof(int)));;
+      if (kfixed) {
+	keybytes_kv = kfixed;
+	valuebytes_kv = vfixed;
+      } else {
+	keybytes_kv = *((int *) ptr);
+	valuebytes_kv = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-      ptr += twolenbytes;
       ptr = ROUNDUP(ptr,kalignm1);
       key_kv = ptr;
       ptr += keybytes_kv;
@@ -496,12 +519,12 @@ void KeyMultiValue::convert(KeyValue *kv)
 
   // estimate = # of unique keys that can be stored in 2 pages of memunique
   // each unique key requires roughly:
-  //   1 Unique, 1 hash bucket, keyave bytes for the key itself
-  // set nbuckets to power of 2 just smaller than estimate
-  // also limit nbuckets to INTMAX+1 = 2^31
-  //   since are using 32-bit hash and want hashmask & ibucket to be ints
-  // set aside first portion of memunique for nbuckets
+  //   1 Unique, 1/MAXLOAD hash slots, keyave bytes for the key itself
+  // nslots = enough slots for estimate keys at MAXLOAD
+  //   limit nslots to INTMAX, table is never more than MAXLOAD full
+  // set aside first portion of memunique for hash table
   // remainder for Unique data structs + keys
+  // empty the table once, kv2unique() empties only slots it used
 
   uint64_t uniquesize;
   int uniquetag;
@@ -509,26 +532,26 @@ void KeyMultiValue::convert(KeyValue *kv)
 
   uint64_t n = MAX(kv->nkv,1);
   double keyave = 1.0*kv->ksize/n;
-  double oneave = keyave + sizeof(Unique) + sizeof(Unique *);
+  double oneave = keyave + sizeof(Unique) + sizeof(Slot)/MAXLOAD;
   uint64_t estimate = static_cast<uint64_t> (uniquesize/oneave);
   if (estimate == 0) error->one("Cannot hold any unique keys in memory");
 
-  uint64_t nbuckets = 1;
-  while (nbuckets <= estimate) nbuckets *= 2;
-  nbuckets /= 2;
-  nbuckets = MIN(nbuckets,INTMAX);
-  if (nbuckets == INTMAX) nbuckets++;
-  hashmask = nbuckets-1;
+  nslots = static_cast<uint64_t> (estimate/MAXLOAD) + 1;
+  nslots = MIN(nslots,INTMAX);
+  maxunique = static_cast<uint64_t> (nslots*MAXLOAD);
+  maxunique = MAX(maxunique,1);
 
-  buckets = (Unique **) memunique;
-  bucketbytes = nbuckets*sizeof(Unique *);
-  ustart = memunique + bucketbytes;
+  slots = (Slot *) memunique;
+  ustart = memunique + nslots*sizeof(Slot);
   ustop = memunique + uniquesize;
   ukeyoffset = sizeof(Unique);
 
   if (ustop-ustart < ukeyoffset)
     error->one("Cannot hold any unique keys in memory");
 
+  memset(slots,0,nslots*sizeof(Slot));
+  nunique = 0;
+
   // use KV's memory page for all file reading, release it at end
   // spool_memory() requests MR pages, sets up memory allocs for Spool pages
 
@@ -610,7 +633,9 @@ void KeyMultiValue::convert(KeyValue *kv)
 
     // free Spools for all sets and one partition
     // if nset = 1, then set 0 has Spools from ipartition, so don't re-delete
-    // partition may have original KV, delete it to recover disk/memory space
+    // partition may have original KV, delete it to recover disk space
+    // its memory page is still readpage, so detach it before deleting,
+    //   else it returns to the MR page pool while in use
 
     for (int iset = 0; iset < nset; iset++) {
       if (sets[iset].sp) delete sets[iset].sp;
@@ -621,7 +646,10 @@ void KeyMultiValue::convert(KeyValue *kv)
       delete partitions[ipartition].sp;
     if (nset > 1 && partitions[ipartition].sp2) 
       delete partitions[ipartition].sp2;
-    if (partitions[ipartition].kv) delete kv;
+    if (partitions[ipartition].kv) {
+      kv->page = NULL;
+      delete kv;
+    }
 
     ipartition++;
   }
@@ -644,21 +672,35 @@ void KeyMultiValue::convert(KeyValue *kv)
 
 void KeyMultiValue::kv2unique(int ipartition)
 {
-  int i,ispool,nkey_kv,keybytes,valuebytes,ibucket,pagecut,ncut;
+  int i,ispool,nkey_kv,keybytes,valuebytes,pagecut,ncut;
   int nnew,nbits,mask,shift;
   uint64_t kdummy,vdummy,adummy,sizecut;
-  uint32_t ubucket;
   char *ptr,*ptr_start,*key,*keyunique,*unext;
-  Unique *uptr,*uprev;
+  Unique *uptr;
+  Slot *slot;
   Spool *spextra;
   Spool **spools;
 
   int full = 0;
   uint64_t count = 0;
 
+  // empty hash slots used by unique keys of previous partition
+  // cheaper than clearing entire table when partitions are small
+
+  uptr = (Unique *) ustart;
+  for (i = 0; i < nunique; i++) {
+    slots[uptr->islot].uptr = NULL;
+    unext = (char *) uptr;
+    unext += ukeyoffset + uptr->keybytes;
+    unext = ROUNDUP(unext,ualignm1);
+    uptr = (Unique *) unext;
+  }
+
+  // all keys in this partition share the sortbit hi-end bits of their hash
+
   nunique = 0;
   unext = ustart;
-  memset(buckets,0,bucketbytes);
+  hashshift = partitions[ipartition].sortbit;
 
   // loop over KV pairs in this partition
   // source of KV pairs is either full KV or a Spool, not both
@@ -680,11 +722,16 @@ void KeyMultiValue::kv2unique(int ipartition)
     ptr = page_kv;
 
     for (i = 0; i < nkey_kv; i++) {
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
-      
       ptr_start = ptr;
-      ptr += twolenbytes;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
@@ -692,8 +739,7 @@ void KeyMultiValue::kv2unique(int ipartition)
       ptr += valuebytes;
       ptr = ROUNDUP(ptr,talignm1);
 
-      ibucket = hash(key,keybytes);
-      uptr = find(ibucket,key,keybytes,uprev);
+      uptr = find(key,keybytes,slot);
       count++;
 
       // if key is already in unique list, increment counters
@@ -706,18 +752,17 @@ void KeyMultiValue::kv2unique(int ipartition)
 	continue;
       }
 
-      // if space available, add key to unique list
+      // if space available, add key to unique list and claim its slot
 
       uptr = (Unique *) unext;
       unext += ukeyoffset + keybytes;
       unext = ROUNDUP(unext,ualignm1);
 
-      if (unext <= ustop) {
-	if (uprev) uprev->next = uptr;
-	else buckets[ibucket] = uptr;
+      if (unext <= ustop && nunique < maxunique) {
+	slot->uptr = uptr;
 	uptr->nvalue = 1;
 	uptr->mvbytes = valuebytes;
-	uptr->next = NULL;
+	uptr->islot = slot - slots;
 	uptr->keybytes = keybytes;
 	keyunique = ((char *) uptr) + ukeyoffset;
 	memcpy(keyunique,key,keybytes);
@@ -725,7 +770,7 @@ void KeyMultiValue::kv2unique(int ipartition)
 	continue;
       }
 
-      // space is not available, so overflow into new Spool files
+      // space or slots not available, so overflow into new Spool files
       // if this is first overflow KV pair, create partitions
       // pagecut,ncut,sizecut = info on last KV pair before cut
       // nnew = estimate of # of new parts based on KV fraction seen so far
@@ -769,9 +814,9 @@ void KeyMultiValue::kv2unique(int ipartition)
       }
 
       // add KV pair to appropriate partition
+      // find() stored hashed key in the empty slot
 
-      ubucket = hashlittle(key,keybytes,0);
-      ispool = (ubucket >> shift) & mask;
+      ispool = (slot->hash >> shift) & mask;
       spools[ispool]->add(ptr-ptr_start,ptr_start);
     }
   }
@@ -1055,10 +1100,11 @@ void KeyMultiValue::unique2kmv_set(int iset)
 
 void KeyMultiValue::partition2sets(int ipartition)
 {
-  int i,nkey_kv,keybytes,valuebytes,ibucket,ispool;
+  int i,nkey_kv,keybytes,valuebytes,ispool;
   uint64_t kdummy,vdummy,adummy;
   char *ptr,*ptr_start,*key;
-  Unique *uptr,*udummy;
+  Unique *uptr;
+  Slot *sdummy;
 
   // destination Spools for all KV pairs in partition
 
@@ -1091,10 +1137,15 @@ void KeyMultiValue::partition2sets(int ipartition)
 
     for (i = 0; i < nkey_kv; i++) {
       ptr_start = ptr;
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-      ptr += twolenbytes;
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
@@ -1102,8 +1153,7 @@ void KeyMultiValue::partition2sets(int ipartition)
       ptr += valuebytes;
       ptr = ROUNDUP(ptr,talignm1);
 
-      ibucket = hash(key,keybytes);
-      uptr = find(ibucket,key,keybytes,udummy);
+      uptr = find(key,keybytes,sdummy);
       if (!uptr) error->one("Internal find error in partition2sets");
 
       ispool = uptr->set;
@@ -1138,11 +1188,12 @@ void KeyMultiValue::partition2sets(int ipartition)
 
 void KeyMultiValue::kv2kmv(int iset)
 {
-  int i,nkey_kv,keybytes,valuebytes,ibucket;
+  int i,nkey_kv,keybytes,valuebytes;
   uint64_t kdummy,vdummy,adummy;
   char *ptr,*key,*value,*multivalue;
   int *valuesizes;
-  Unique *uptr,*udummy;
+  Unique *uptr;
+  Slot *sdummy;
 
   // loop over KV pairs in this set
   // source of KV pairs can be KV, KV + Spool, Spool, or Spool + Spool2
@@ -1168,10 +1219,15 @@ void KeyMultiValue::kv2kmv(int iset)
     ptr = page_kv;
 	
     for (i = 0; i < nkey_kv; i++) {
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
-	  
-      ptr += twolenbytes;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
@@ -1180,8 +1236,7 @@ void KeyMultiValue::kv2kmv(int iset)
       ptr += valuebytes;
       ptr = ROUNDUP(ptr,talignm1);
 	  
-      ibucket = hash(key,keybytes);
-      uptr = find(ibucket,key,keybytes,udummy);
+      uptr = find(key,keybytes,sdummy);
       if (!uptr) error->one("Internal find error in kv2kmv");
       if (uptr->set != iset) error->one("Internal set error in kv2kmv");
 
@@ -1274,10 +1329,15 @@ void KeyMultiValue::kv2kmv_extended(int iset)
     ptr = page_kv;
 
     for (i = 0; i < nkey_kv; i++) {
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
-	  
-      ptr += twolenbytes;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
@@ -1393,45 +1453,53 @@ Spool *KeyMultiValue::create_partition(int ispool)
 }
 
 /* ----------------------------------------------------------------------
-   find a Unique in ibucket that matches key
-   return index of Unique
-   if cannot find key, return NULL
-   if bucket was empty, set prev = NULL
-   else set prev = ptr to last Unique in the bucket
+   find the Unique that matches key via the hash table
+   probe slots linearly from the one the hashed key maps to
+   slots store hash and 1st bytes of key, so keys of SHORTKEY bytes or
+     less are matched without touching their Unique
+   return ptr to Unique
+   if cannot find key, return NULL and set slot = empty slot where key
+     belongs, caller claims it by setting its uptr
 ------------------------------------------------------------------------- */
 
-KeyMultiValue::Unique *KeyMultiValue::find(int ibucket, char *key, 
-					   int keybytes, Unique *&uprev)
+KeyMultiValue::Unique *KeyMultiValue::find(char *key, int keybytes,
+					   Slot *&slot)
 {
-  Unique *uptr = buckets[ibucket];
-  if (!uptr) {
-    uprev = NULL;
-    return NULL;
-  }
+  uint32_t hash = hashkey(key,keybytes,0);
+
+  uint64_t shortkey = 0;
+  if (keybytes >= SHORTKEY) memcpy(&shortkey,key,SHORTKEY);
+  else memcpy(&shortkey,key,keybytes);
 
+  // map hash to a slot by its bits below hashshift, which differ
+  //   between keys in a partition, without a divide
+
+  uint32_t bits = ((uint64_t) hash) << hashshift;
+  uint64_t islot = (((uint64_t) bits) * nslots) >> 32;
+
+  Slot *sptr;
   char *keyunique;
-  while (uptr) {
-    keyunique = ((char *) uptr) + ukeyoffset;
-    if (keybytes == uptr->keybytes && memcmp(key,keyunique,keybytes) == 0)
-      return uptr;
-    uprev = uptr;
-    uptr = uptr->next;
+
+  while (1) {
+    sptr = &slots[islot];
+    if (!sptr->uptr) break;
+    if (sptr->hash == hash && sptr->keybytes == keybytes &&
+	sptr->shortkey == shortkey) {
+      if (keybytes <= SHORTKEY) return sptr->uptr;
+      keyunique = ((char *) sptr->uptr) + ukeyoffset;
+      if (memcmp(&key[SHORTKEY],&keyunique[SHORTKEY],
+		 keybytes-SHORTKEY) == 0) return sptr->uptr;
+    }
+    if (++islot == nslots) islot = 0;
   }
 
+  sptr->hash = hash;
+  sptr->keybytes = keybytes;
+  sptr->shortkey = shortkey;
+  slot = sptr;
   return NULL;
 }
 
-/* ----------------------------------------------------------------------
-   hash a key to a bucket
-------------------------------------------------------------------------- */
-
-int KeyMultiValue::hash(char *key, int keybytes)
-{
-  uint32_t ubucket = hashlittle(key,keybytes,0);
-  int ibucket = ubucket & hashmask;
-  return ibucket;
-}
-
 /* ----------------------------------------------------------------------
    create virtual page entry for in-memory page
 ------------------------------------------------------------------------- */
@@ -1482,7 +1550,8 @@ void KeyMultiValue::write_page()
     error->one("Cannot create KeyMultiValue file due to outofcore setting");
 
   if (fp == NULL) {
-    fp = fopen(filename,"wb");
+    if (mio) fp = fopen(filename,"w+b");
+    else fp = fopen(filename,"wb");
     if (fp == NULL) {
       char msg[1023];
       sprintf(msg,"Cannot open KeyMultiValue file %s for writing",filename);
@@ -1491,7 +1560,19 @@ void KeyMultiValue::write_page()
     fileflag = 1;
   }
 
+  // write thru mmap() if requested
+  // else write-behind if possible, caller keeps filling page meanwhile
+
   uint64_t fileoffset = pages[npage].fileoffset;
+  if (mio) {
+    mio->write(fp,fileoffset,page,pages[npage].filesize);
+    return;
+  }
+  if (async()) {
+    aio->write(fp,fileoffset,page,pages[npage].filesize);
+    return;
+  }
+
   int seekflag = fseek(fp,fileoffset,SEEK_SET);
   int nwrite = fwrite(page,pages[npage].filesize,1,fp);
   mr->wsize += pages[npage].filesize;
@@ -1516,6 +1597,8 @@ void KeyMultiValue::write_page()
 
 void KeyMultiValue::read_page(int ipage, int writeflag)
 {
+  if (aio) aio->wait();
+
   if (fp == NULL) {
     if (writeflag) fp = fopen(filename,"r+b");
     else fp = fopen(filename,"rb");
@@ -1524,6 +1607,11 @@ void KeyMultiValue::read_page(int ipage, int writeflag)
   }
 
   uint64_t fileoffset = pages[ipage].fileoffset;
+  if (mio) {
+    mio->read(fp,fileoffset,page,pages[ipage].filesize);
+    return;
+  }
+
   int seekflag = fseek(fp,fileoffset,SEEK_SET);
   int nread = fread(page,pages[ipage].filesize,1,fp);
   mr->rsize += pages[ipage].filesize;
@@ -1542,6 +1630,32 @@ void KeyMultiValue::read_page(int ipage, int writeflag)
   }
 }
 
+/* ----------------------------------------------------------------------
+   return 1 if page I/O can be done in the background
+   requires MR asyncio setting and a staging page from MR page pool
+------------------------------------------------------------------------- */
+
+int KeyMultiValue::async()
+{
+  if (!mr->asyncio || mio) return 0;
+  if (aio == NULL) aio = new AsyncIO(mr,error);
+  return aio->acquire();
+}
+
+/* ----------------------------------------------------------------------
+   finish background I/O and give up its page, close disk file if open
+------------------------------------------------------------------------- */
+
+void KeyMultiValue::close_fp()
+{
+  if (aio) aio->release();
+  if (mio) mio->unmap();
+  if (fp) {
+    fclose(fp);
+    fp = NULL;
+  }
+}
+
 /* ----------------------------------------------------------------------
    round N up to multiple of nalign and return it
 ------------------------------------------------------------------------- */
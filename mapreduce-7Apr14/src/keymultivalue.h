@@ -67,6 +67,7 @@ class KeyMultiValue {
   int talignm1,ualignm1;
   int twolenbytes;                   // size of key & value lengths
   int threelenbytes;                 // size of nvalue & key & value lengths
+  int kfixed,vfixed;                 // size of KV keys & values, 0 if variable
 
   // in-memory page
 
@@ -103,17 +104,24 @@ class KeyMultiValue {
     uint64_t mvbytes;        // total size of values associated with this key
     int *soffset;            // ptr to start of value sizes in KMV page
     char *voffset;           // ptr to start of values in KMV page
-    Unique *next;            // ptr to next key in this hash bucket
+    uint64_t islot;          // index of slot for this key in hash table
     int keybytes;            // size of this key
     int set;                 // which KMV set this key will be part of
   };
 
-  // hash of unique keys
+  // open-addressing hash table of unique keys, linear probing
 
-  Unique **buckets;     // ptr to 1st key in each hash bucket
-  int hashmask;         // bit mask for mapping hashed key into hash buckets
-                        // nbuckets = hashmask + 1
-  uint64_t bucketbytes; // byte size of hash buckets
+  struct Slot {
+    uint32_t hash;           // hashed key
+    int keybytes;            // size of key
+    uint64_t shortkey;       // 1st 8 bytes of key, zero-padded
+    Unique *uptr;            // ptr to Unique for key, NULL if slot is empty
+  };
+
+  Slot *slots;          // hash table
+  uint64_t nslots;      // # of slots in hash table
+  uint64_t maxunique;   // max # of unique keys, limits table load factor
+  int hashshift;        // # of hi-end hash bits that partitions split on
 
   char *memunique;      // ptr to where memory for hash+Uniques starts
   char *ustart;         // ptr to where memory for Uniques starts
@@ -124,6 +132,8 @@ class KeyMultiValue {
   int fileflag;         // 1 if file exists, 0 if not
   char *filename;       // filename to store KMV if needed
   FILE *fp;             // file ptr
+  class AsyncIO *aio;   // background page I/O, NULL if none
+  class MMapIO *mio;    // mmap() page I/O, NULL if stdio
 
   // partitions of KV data per unique list
 
@@ -180,13 +190,14 @@ class KeyMultiValue {
   class Spool *augment_partition(int);
   class Spool *create_partition(int);
   char *chunk_allocate();
-  Unique *find(int, char *, int, Unique *&);
-  int hash(char *, int);
+  Unique *find(char *, int, Slot *&);
 
   void init_page();
   void create_page();
   void write_page();
   void read_page(int, int);
+  int async();
+  void close_fp();
   uint64_t roundup(uint64_t, int);
 
   void spool_memory(class KeyValue *);
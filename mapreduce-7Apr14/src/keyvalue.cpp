@@ -19,6 +19,10 @@
 #include "keyvalue.h"
 #include "mapreduce.h"
 #include "memory.h"
+#include "asyncio.h"
+#include "mmapio.h"
+#include "codec.h"
+#include "threadpool.h"
 #include "error.h"
 
 using namespace MAPREDUCE_NS;
@@ -38,7 +42,7 @@ enum{KVFILE,KMVFILE,SORTFILE,PARTFILE,SETFILE};   // same as in mapreduce.cpp
 
 KeyValue::KeyValue(MapReduce *mr_caller, int memkalign, int memvalign,
 		   Memory *memory_caller, Error *error_caller,
-		   MPI_Comm comm_caller)
+		   MPI_Comm comm_caller, char *memblock, uint64_t memsize)
 {
   mr = mr_caller;
   memory = memory_caller;
@@ -49,6 +53,10 @@ KeyValue::KeyValue(MapReduce *mr_caller, int memkalign, int memvalign,
   filename = mr->file_create(KVFILE);
   fileflag = 0;
   fp = NULL;
+  aio = NULL;
+  mio = NULL;
+  if (mr->mmapio) mio = new MMapIO(mr,error);
+  codec = NULL;
 
   pages = NULL;
   npage = maxpage = 0;
@@ -66,19 +74,40 @@ KeyValue::KeyValue(MapReduce *mr_caller, int memkalign, int memvalign,
 
   twolenbytes = 2*sizeof(int);
 
+  // fixed-size pairs = key at start of pair, value after it, no lengths
+
+  kfixed = mr->kfixed;
+  vfixed = mr->vfixed;
+  voffset = roundup(kfixed,valign);
+  fixedbytes = roundup(voffset+vfixed,talign);
+
   nkv = ksize = vsize = esize = fsize = 0;
   msize = 0;
   init_page();
 
+  pinflag = 0;
+  npinned = 0;
+  pinhash = NULL;
+
+  pool = NULL;
+  ithread = 0;
+
+  // memblock = caller's buffer used instead of an MR page
+
   page = NULL;
   memtag = -1;
-  allocate();
+  if (memblock) set_page(memsize,memblock,-1);
+  else allocate();
 }
 
 /* ---------------------------------------------------------------------- */
 
 KeyValue::~KeyValue()
 {
+  close_fp();
+  delete aio;
+  delete mio;
+  delete codec;
   deallocate(1);
   memory->sfree(pages);
   if (fileflag) {
@@ -139,7 +168,8 @@ void KeyValue::truncate(int pagecut, int ncut, uint64_t sizecut)
   else {
     npage = pagecut+1;
     pages[pagecut].alignsize = sizecut;
-    pages[pagecut].filesize = roundup(sizecut,ALIGNFILE);
+    if (pages[pagecut].codesize == 0)
+      pages[pagecut].filesize = roundup(sizecut,ALIGNFILE);
     pages[pagecut].nkey = ncut;
   }
 }
@@ -175,6 +205,10 @@ void KeyValue::copy(KeyValue *kv)
   memcpy(page_hold,page,alignsize);
   msize = kv->msize;
   page = page_hold;
+
+  pinflag = kv->pinflag;
+  npinned = kv->npinned;
+  pinhash = kv->pinhash;
 }
 
 /* ----------------------------------------------------------------------
@@ -222,8 +256,7 @@ void KeyValue::complete()
 
   if (fileflag || mr->outofcore > 0) {
     write_page();
-    fclose(fp);
-    fp = NULL;
+    close_fp();
   }
 
   npage++;
@@ -289,16 +322,21 @@ int KeyValue::request_page(int ipage, uint64_t &keysize_page,
 			   uint64_t &valuesize_page,
 			   uint64_t &alignsize_page)
 {
-  // load page from file if necessary
+  // load page from file if necessary, unless it was prefetched
+  // prefetch next page while caller works on this one
 
-  if (fileflag) read_page(ipage,0);
+  if (fileflag) {
+    char *dest = pages[ipage].codesize ? codec->buf : page;
+    if (aio && aio->fetch(ipage,dest)) decode_page(ipage);
+    else read_page(ipage,0);
+    if (ipage < npage-1 && async())
+      aio->read(fp,ipage+1,pages[ipage+1].fileoffset,
+		pages[ipage+1].filesize);
+  }
 
   // close file if last page
 
-  if (ipage == npage-1 && fileflag) {
-    fclose(fp);
-    fp = NULL;
-  }
+  if (ipage == npage-1 && fileflag) close_fp();
 
   keysize_page = pages[ipage].keysize;
   valuesize_page = pages[ipage].valuesize;
@@ -329,10 +367,7 @@ void KeyValue::overwrite_page(int ipage)
 
 void KeyValue::close_file()
 {
-  if (fp) {
-    fclose(fp);
-    fp = NULL;
-  }
+  close_fp();
 }
 
 /* ----------------------------------------------------------------------
@@ -342,8 +377,12 @@ void KeyValue::close_file()
 
 void KeyValue::add(char *key, int keybytes, char *value, int valuebytes)
 {
+  if (kfixed && (keybytes != kfixed || valuebytes != vfixed))
+    error->one("Key/value size does not match fixedkey/fixedvalue setting");
+
   char *iptr = &page[alignsize];
-  char *kptr = iptr + twolenbytes;
+  char *kptr = iptr;
+  if (!kfixed) kptr += twolenbytes;
   kptr = ROUNDUP(kptr,kalignm1);
   char *vptr = kptr + keybytes;
   vptr = ROUNDUP(vptr,valignm1);
@@ -358,8 +397,13 @@ void KeyValue::add(char *key, int keybytes, char *value, int valuebytes)
 
   // page is full, write to disk
   // full page = pagesize exceeded or INTMAX KV pairs
+  // if I am a thread's buffer, pool flushes me instead
 
   if (alignsize + kvbytes > pagesize || nkey == INTMAX) {
+    if (pool) {
+      pool->flush(ithread,kvbytes,key,keybytes,value,valuebytes);
+      return;
+    }
     if (alignsize == 0) {
       printf("KeyValue pair size/limit: %d %u\n",kvbytes,pagesize);
       error->one("Single key/value pair exceeds page size");
@@ -373,8 +417,10 @@ void KeyValue::add(char *key, int keybytes, char *value, int valuebytes)
     return;
   }
 
-  *((int *) iptr) = keybytes;
-  *((int *) (iptr+sizeof(int))) = valuebytes;
+  if (!kfixed) {
+    *((int *) iptr) = keybytes;
+    *((int *) (iptr+sizeof(int))) = valuebytes;
+  }
   memcpy(kptr,key,keybytes);
   memcpy(vptr,value,valuebytes);
 
@@ -393,6 +439,11 @@ void KeyValue::add(char *key, int keybytes, char *value, int valuebytes)
 void KeyValue::add(int n, char *key, int keybytes,
 		   char *value, int valuebytes)
 {
+  if (kfixed && keybytes == kfixed && valuebytes == vfixed) {
+    add_n(n,key,value);
+    return;
+  }
+
   int koffset = 0;
   int voffset = 0;
 
@@ -421,6 +472,88 @@ void KeyValue::add(int n, char *key, int *keybytes,
   }
 }
 
+/* ----------------------------------------------------------------------
+   add N fixed-size key/value pairs from packed arrays of keys and values
+   requires fixedkey/fixedvalue settings, copies directly into page
+   called by user appmap() or appreduce() or appcompress()
+------------------------------------------------------------------------- */
+
+void KeyValue::add_n(int n, char *key, char *value)
+{
+  if (!kfixed) error->one("KeyValue add_n requires fixed-size key/values");
+
+  // thread buffer adds one pair at a time so pool can flush it
+
+  if (pool) {
+    for (int i = 0; i < n; i++) {
+      add(key,kfixed,value,vfixed);
+      key += kfixed;
+      value += vfixed;
+    }
+    return;
+  }
+
+  // fill current page with as many pairs as fit, write it if full
+
+  while (n) {
+    uint64_t nfit = (pagesize-alignsize) / fixedbytes;
+    int m = MIN(nfit,(uint64_t) n);
+    m = MIN(m,INTMAX-nkey);
+
+    if (m == 0) {
+      if (alignsize == 0) {
+	printf("KeyValue pair size/limit: %d %u\n",fixedbytes,pagesize);
+	error->one("Single key/value pair exceeds page size");
+      }
+      create_page();
+      write_page();
+      npage++;
+      init_page();
+      continue;
+    }
+
+    char *ptr = &page[alignsize];
+    for (int i = 0; i < m; i++) {
+      memcpy(ptr,key,kfixed);
+      memcpy(ptr+voffset,value,vfixed);
+      ptr += fixedbytes;
+      key += kfixed;
+      value += vfixed;
+    }
+
+    nkey += m;
+    keysize += (uint64_t) m * kfixed;
+    valuesize += (uint64_t) m * vfixed;
+    alignsize += (uint64_t) m * fixedbytes;
+    n -= m;
+  }
+
+  msize = MAX(msize,fixedbytes);
+}
+
+/* ----------------------------------------------------------------------
+   add N fixed-size key/value pairs already laid out as in a page
+   each pair is fixedbytes long with its value at voffset
+   copied into page in chunks, no per-pair work
+   called by user appmap() or appreduce() or appcompress()
+------------------------------------------------------------------------- */
+
+void KeyValue::add_n(int n, char *buf)
+{
+  if (!kfixed) error->one("KeyValue add_n requires fixed-size key/values");
+
+  if (pool) {
+    for (int i = 0; i < n; i++) {
+      add(buf,kfixed,buf+voffset,vfixed);
+      buf += fixedbytes;
+    }
+    return;
+  }
+
+  add(n,buf,(uint64_t) n*kfixed,(uint64_t) n*vfixed,(uint64_t) n*fixedbytes);
+  msize = MAX(msize,fixedbytes);
+}
+
 /* ----------------------------------------------------------------------
    add key/value pairs from another KV
    input KV should never be self
@@ -432,10 +565,10 @@ void KeyValue::add(KeyValue *kv)
 {
   if (kv == this) error->all("Cannot perform KeyValue add on self");
 
-  int kalign_other = kv->kalign;
-  int valign_other = kv->valign;
+  int same = (kalign == kv->kalign && valign == kv->valign &&
+	      kfixed == kv->kfixed && vfixed == kv->vfixed);
 
-  // which add() to call depends on same or different alignment
+  // which add() to call depends on same or different alignment and format
 
   int nkey_other;
   uint64_t keysize_other,valuesize_other,alignsize_other;
@@ -446,10 +579,82 @@ void KeyValue::add(KeyValue *kv)
   for (int ipage = 0; ipage < npage_other; ipage++) {
     nkey_other = kv->request_page(ipage,keysize_other,valuesize_other,
 				  alignsize_other);
-    if (kalign == kalign_other && valign == valign_other)
+    if (same)
       add(nkey_other,page_other,keysize_other,valuesize_other,alignsize_other);
     else
-      add(nkey_other,page_other,kalign_other,valign_other);
+      add(nkey_other,page_other,kv->kalign,kv->valign,kv->kfixed,kv->vfixed);
+  }
+
+  msize = MAX(msize,kv->msize);
+}
+
+/* ----------------------------------------------------------------------
+   add KV pairs first thru last-1 of another KV to me
+   whole pages are added as-is, pairs at either end are found by walking
+   called by MR::aggregate() to split off pairs that are pinned to a proc
+------------------------------------------------------------------------- */
+
+void KeyValue::add(KeyValue *kv, uint64_t first, uint64_t last)
+{
+  if (kv == this) error->all("Cannot perform KeyValue add on self");
+
+  int kalignm1_other = kv->kalignm1;
+  int valignm1_other = kv->valignm1;
+  int talignm1_other = kv->talignm1;
+  int kfixed_other = kv->kfixed;
+  int vfixed_other = kv->vfixed;
+  int same = (kalign == kv->kalign && valign == kv->valign &&
+	      kfixed == kfixed_other && vfixed == vfixed_other);
+
+  int nkey_other,keybytes,valuebytes;
+  uint64_t keysize_other,valuesize_other,alignsize_other;
+  uint64_t start,stop;
+  char *ptr,*ptr_start;
+
+  char *page_other;
+  int npage_other = kv->request_info(&page_other);
+  uint64_t offset = 0;
+
+  for (int ipage = 0; ipage < npage_other && offset < last; ipage++) {
+    nkey_other = kv->request_page(ipage,keysize_other,valuesize_other,
+				  alignsize_other);
+    start = MAX(first,offset);
+    start -= offset;
+    stop = MIN(last,offset+nkey_other);
+    stop -= offset;
+    offset += nkey_other;
+    if (start >= stop) continue;
+
+    if (start == 0 && stop == (uint64_t) nkey_other) {
+      if (same) add(nkey_other,page_other,keysize_other,valuesize_other,
+		    alignsize_other);
+      else add(nkey_other,page_other,kv->kalign,kv->valign,
+	       kfixed_other,vfixed_other);
+      continue;
+    }
+
+    ptr = page_other;
+    for (uint64_t i = 0; i < stop; i++) {
+      if (i == start) ptr_start = ptr;
+      if (kfixed_other) {
+	keybytes = kfixed_other;
+	valuebytes = vfixed_other;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
+      ptr = ROUNDUP(ptr,kalignm1_other);
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1_other);
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1_other);
+    }
+
+    if (same) add(stop-start,ptr_start);
+    else add(stop-start,ptr_start,kv->kalign,kv->valign,
+	     kfixed_other,vfixed_other);
   }
 
   msize = MAX(msize,kv->msize);
@@ -467,6 +672,12 @@ void KeyValue::add(int n, char *buf)
 {
   int keybytes,valuebytes;
 
+  if (kfixed) {
+    add(n,buf,(uint64_t) n*kfixed,(uint64_t) n*vfixed,
+	(uint64_t) n*fixedbytes);
+    return;
+  }
+
   uint64_t keysize_buf = 0;
   uint64_t valuesize_buf = 0;
   char *ptr = buf;
@@ -500,8 +711,13 @@ void KeyValue::add(int n, char *buf)
 
 void KeyValue::add(char *ptr)
 {
+  if (kfixed) {
+    add(ptr,kfixed,ptr+voffset,vfixed);
+    return;
+  }
+
   int keybytes = *((int *) ptr);
-  int valuebytes = *((int *) (ptr+sizeof(int)));;
+  int valuebytes = *((int *) (ptr+sizeof(int)));
   ptr += twolenbytes;
   ptr = ROUNDUP(ptr,kalignm1);
   char *key = ptr;
@@ -538,7 +754,18 @@ void KeyValue::add(int n, char *buf,
     nkeychunk = 0;
     keychunk = valuechunk = 0;
 
-    while (1) {
+    // fixed-size pairs: breakpoint is computed, not scanned for
+
+    if (kfixed) {
+      uint64_t nfit = (pagesize-alignsize) / fixedbytes;
+      nkeychunk = MIN(nfit,(uint64_t) nlimit);
+      keychunk = (uint64_t) nkeychunk * kfixed;
+      valuechunk = (uint64_t) nkeychunk * vfixed;
+      kvbytes = fixedbytes;
+      ptr_start = ptr_begin + (uint64_t) nkeychunk * fixedbytes;
+    }
+
+    while (!kfixed) {
       ptr_start = ptr;
       keybytes = *((int *) ptr);
       valuebytes = *((int *) (ptr+sizeof(int)));;
@@ -602,7 +829,8 @@ void KeyValue::add(int n, char *buf,
    called by add(kv)
 ------------------------------------------------------------------------- */
 
-void KeyValue::add(int n, char *buf, int kalign_buf, int valign_buf)
+void KeyValue::add(int n, char *buf, int kalign_buf, int valign_buf,
+		   int kfixed_buf, int vfixed_buf)
 {
   int keybytes,valuebytes;
   char *key,*value;
@@ -617,10 +845,15 @@ void KeyValue::add(int n, char *buf, int kalign_buf, int valign_buf)
   char *ptr = buf;
 
   for (int i = 0; i < n; i++) {
-    keybytes = *((int *) ptr);
-    valuebytes = *((int *) (ptr+sizeof(int)));;
+    if (kfixed_buf) {
+      keybytes = kfixed_buf;
+      valuebytes = vfixed_buf;
+    } else {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+    }
 
-    ptr += twolenbytes;
     ptr = ROUNDUP(ptr,kalignm1_buf);
     key = ptr;
     ptr += keybytes;
@@ -658,10 +891,11 @@ void KeyValue::create_page()
   pages[npage].nkey = nkey;
   pages[npage].keysize = keysize;
   pages[npage].valuesize = valuesize;
-  pages[npage].exactsize = ((uint64_t) nkey)*twolenbytes + 
-    keysize + valuesize;
+  pages[npage].exactsize = keysize + valuesize;
+  if (!kfixed) pages[npage].exactsize += ((uint64_t) nkey)*twolenbytes;
   pages[npage].alignsize = alignsize;
   pages[npage].filesize = roundup(alignsize,ALIGNFILE);
+  pages[npage].codesize = 0;
 
   if (npage)
     pages[npage].fileoffset = 
@@ -681,7 +915,8 @@ void KeyValue::write_page()
     error->one("Cannot create KeyValue file due to outofcore setting");
 
   if (fp == NULL) {
-    fp = fopen(filename,"wb");
+    if (mio) fp = fopen(filename,"w+b");
+    else fp = fopen(filename,"wb");
     if (fp == NULL) {
       char msg[1023];
       sprintf(msg,"Cannot open KeyValue file %s for writing",filename);
@@ -690,9 +925,37 @@ void KeyValue::write_page()
     fileflag = 1;
   }
 
+  // encode page if requested and it shrinks by at least one file block
+  // page stays as-is if it does not
+
+  char *src = page;
+  pages[npage].codesize = 0;
+  if (mr->codec & 1) {
+    if (codec == NULL) codec = new Codec(mr,pagesize,memory,error);
+    uint64_t ncode = codec->encode(page,pages[npage].alignsize,stride(),
+				   codec->buf,pages[npage].filesize-ALIGNFILE);
+    if (ncode) {
+      src = codec->buf;
+      pages[npage].codesize = ncode;
+      pages[npage].filesize = roundup(ncode,ALIGNFILE);
+    }
+  }
+
+  // write thru mmap() if requested
+  // else write-behind if possible, caller keeps filling page meanwhile
+
   uint64_t fileoffset = pages[npage].fileoffset;
+  if (mio) {
+    mio->write(fp,fileoffset,src,pages[npage].filesize);
+    return;
+  }
+  if (async()) {
+    aio->write(fp,fileoffset,src,pages[npage].filesize);
+    return;
+  }
+
   int seekflag = fseek(fp,fileoffset,SEEK_SET);
-  int nwrite = fwrite(page,pages[npage].filesize,1,fp);
+  int nwrite = fwrite(src,pages[npage].filesize,1,fp);
   mr->wsize += pages[npage].filesize;
 
   if (seekflag) {
@@ -715,16 +978,28 @@ void KeyValue::write_page()
 
 void KeyValue::read_page(int ipage, int writeflag)
 {
+  if (aio) aio->wait();
+
   if (fp == NULL) {
     if (writeflag) fp = fopen(filename,"r+b");
     else fp = fopen(filename,"rb");
     if (fp == NULL) error->one("Could not open KeyValue file for reading");
   }
 
+  // encoded page is read into codec buffer, then decoded into page
+
+  char *dest = pages[ipage].codesize ? codec->buf : page;
   uint64_t fileoffset = pages[ipage].fileoffset;
+  if (mio) {
+    mio->read(fp,fileoffset,dest,pages[ipage].filesize);
+    decode_page(ipage);
+    return;
+  }
+
   int seekflag = fseek(fp,fileoffset,SEEK_SET);
-  int nread = fread(page,pages[ipage].filesize,1,fp);
+  int nread = fread(dest,pages[ipage].filesize,1,fp);
   mr->rsize += pages[ipage].filesize;
+  decode_page(ipage);
 
   if (seekflag) {
     char str[128];
@@ -740,6 +1015,64 @@ void KeyValue::read_page(int ipage, int writeflag)
   }
 }
 
+/* ----------------------------------------------------------------------
+   size of first KV pair in page being written, used as codec stride
+   pairs of fixed size then line up with their predecessors
+------------------------------------------------------------------------- */
+
+int KeyValue::stride()
+{
+  if (pages[npage].nkey == 0) return 0;
+  if (kfixed) return fixedbytes;
+
+  int keybytes = *((int *) page);
+  int valuebytes = *((int *) (page+sizeof(int)));
+
+  char *ptr = page + twolenbytes;
+  ptr = ROUNDUP(ptr,kalignm1);
+  ptr += keybytes;
+  ptr = ROUNDUP(ptr,valignm1);
+  ptr += valuebytes;
+  ptr = ROUNDUP(ptr,talignm1);
+  return ptr - page;
+}
+
+/* ----------------------------------------------------------------------
+   decode page ipage from codec buffer into in-memory page if encoded
+------------------------------------------------------------------------- */
+
+void KeyValue::decode_page(int ipage)
+{
+  if (pages[ipage].codesize)
+    codec->decode(codec->buf,pages[ipage].codesize,page,pagesize);
+}
+
+/* ----------------------------------------------------------------------
+   return 1 if page I/O can be done in the background
+   requires MR asyncio setting and a staging page from MR page pool
+------------------------------------------------------------------------- */
+
+int KeyValue::async()
+{
+  if (!mr->asyncio || mio) return 0;
+  if (aio == NULL) aio = new AsyncIO(mr,error);
+  return aio->acquire();
+}
+
+/* ----------------------------------------------------------------------
+   finish background I/O and give up its page, close disk file if open
+------------------------------------------------------------------------- */
+
+void KeyValue::close_fp()
+{
+  if (aio) aio->release();
+  if (mio) mio->unmap();
+  if (fp) {
+    fclose(fp);
+    fp = NULL;
+  }
+}
+
 /* ----------------------------------------------------------------------
    round N up to multiple of nalign and return it
 ------------------------------------------------------------------------- */
@@ -768,10 +1101,15 @@ void KeyValue::print(FILE *fp, int nstride, int kflag, int vflag)
     ptr = page;
     for (int i = 0; i < nkey; i++) {
       ptr_start = ptr;
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-      ptr += twolenbytes;
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
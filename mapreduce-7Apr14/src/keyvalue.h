@@ -22,6 +22,7 @@ namespace MAPREDUCE_NS {
 
 class KeyValue {
   friend class MapReduce;
+  friend class ThreadPool;
 
  public:
   uint64_t nkv;                   // # of KV pairs in entire KV on this proc
@@ -35,8 +36,14 @@ class KeyValue {
   int memtag;                     // memory page ID
   int npage;                      // # of pages in entire KV
 
+  int pinflag;                    // 1 if pairs were placed by aggregate()
+  uint64_t npinned;               // # of leading pairs still on proc that
+                                  //   pinhash assigns them to
+  int (*pinhash)(char *, int);    // hash used by aggregate(), NULL = default
+
   KeyValue(class MapReduce *, int, int, 
-	   class Memory *, class Error *, MPI_Comm);
+	   class Memory *, class Error *, MPI_Comm,
+	   char *memblock = NULL, uint64_t memsize = 0);
   ~KeyValue();
 
   void allocate();
@@ -55,6 +62,8 @@ class KeyValue {
   void add(char *, int, char *, int);
   void add(int, char *, int, char *, int);
   void add(int, char *, int *, char *, int *);
+  void add_n(int, char *, char *);
+  void add_n(int, char *);
 
   void print(FILE *, int, int, int);
 
@@ -70,6 +79,10 @@ class KeyValue {
   int talign;                       // alignment of entire KV pair
   int kalignm1,valignm1,talignm1;   // alignments-1 for masking
   int twolenbytes;                  // size of single key,value lengths
+  int kfixed,vfixed;                // size of every key & value, 0 if variable
+                                    //   fixed-size pairs have no lengths
+  int voffset;                      // offset of value in fixed-size pair
+  int fixedbytes;                   // size of fixed-size pair with alignment
 
   // in-memory page
 
@@ -87,6 +100,7 @@ class KeyValue {
     uint64_t alignsize;             // aligned size of all data in page
     uint64_t filesize;              // rounded-up alignsize for file I/O
     uint64_t fileoffset;            // summed filesize of all previous pages
+    uint64_t codesize;              // encoded size in file, 0 if not encoded
     int nkey;                       // # of KV pairs
   };
 
@@ -98,19 +112,32 @@ class KeyValue {
   char *filename;                   // filename to store KV if needed
   FILE *fp;                         // file ptr
   int fileflag;                     // 1 if file exists, 0 if not
+  class AsyncIO *aio;               // background page I/O, NULL if none
+  class MMapIO *mio;                // mmap() page I/O, NULL if stdio
+  class Codec *codec;               // page compression, NULL if none yet
+
+  // thread buffer info
+
+  class ThreadPool *pool;           // pool whose thread fills me, else NULL
+  int ithread;                      // which thread of pool
 
   // private methods
 
   void add(KeyValue *);
+  void add(KeyValue *, uint64_t, uint64_t);
   void add(int, char *);
   void add(char *);
   void add(int, char *, uint64_t, uint64_t, uint64_t);
-  void add(int, char *, int, int);
+  void add(int, char *, int, int, int, int);
 
   void init_page();
   void create_page();
   void write_page();
   void read_page(int, int);
+  int async();
+  int stride();
+  void decode_page(int);
+  void close_fp();
   uint64_t roundup(uint64_t,int);
 };
 
@@ -17,6 +17,8 @@
 #include "stdio.h"
 #include "stdlib.h"
 #include "stdint.h"
+#include "limits.h"
+#include "float.h"
 #include "sys/types.h"
 #include "sys/stat.h"
 #include "dirent.h"
@@ -27,6 +29,9 @@
 #include "keymultivalue.h"
 #include "spool.h"
 #include "irregular.h"
+#include "sorter.h"
+#include "threadpool.h"
+#include "codec.h"
 #include "hash.h"
 #include "memory.h"
 #include "error.h"
@@ -45,12 +50,18 @@ uint64_t MapReduce::rsize = 0;
 uint64_t MapReduce::wsize = 0;
 uint64_t MapReduce::cssize = 0;
 uint64_t MapReduce::crsize = 0;
+uint64_t MapReduce::mapsize = 0;
+uint64_t MapReduce::majfault = 0;
+uint64_t MapReduce::minfault = 0;
+uint64_t MapReduce::zsize = 0;
+uint64_t MapReduce::zcsize = 0;
+uint64_t MapReduce::hotkeys = 0;
+double MapReduce::ztime = 0.0;
 double MapReduce::commtime = 0.0;
 
 // prototypes for non-class functions
 
 void map_file_standalone(int, KeyValue *, void *);
-int compare_standalone(const void *, const void *);
 
 int compare_int(char *, int, char *, int);
 int compare_uint64(char *, int, char *, int);
@@ -66,6 +77,8 @@ int compare_double_reverse(char *, int, char *, int);
 int compare_str_reverse(char *, int, char *, int);
 int compare_strn_reverse(char *, int, char *, int);
 
+int compare_bytes(char *, int, char *, int);
+
 #define MIN(A,B) ((A) < (B)) ? (A) : (B)
 #define MAX(A,B) ((A) > (B)) ? (A) : (B)
 
@@ -78,8 +91,12 @@ int compare_strn_reverse(char *, int, char *, int);
 #define MBYTES 64
 #define ALIGNKV 4
 #define INTMAX 0x7FFFFFFF
+#define SORTCHUNK 65536       // min buffer bytes per run in k-way merge
+#define NSAMPLE 1024          // avg # of samples per proc in a sample sort
 
 enum{KVFILE,KMVFILE,SORTFILE,PARTFILE,SETFILE};
+enum{MAPKV,REDUCE,SCANKV,SCANKMV};
+enum{SUM,MINVAL,MAXVAL};
 
 //#define MEMORY_DEBUG 1   // set if want debug output from memory requests
 
@@ -169,6 +186,14 @@ MapReduce::~MapReduce()
 
   delete kv;
   delete kmv;
+
+  if (nodecomm != MPI_COMM_NULL) {
+    MPI_Comm_free(&nodecomm);
+    if (leadercomm != MPI_COMM_NULL) MPI_Comm_free(&leadercomm);
+    delete [] nodeof;
+    delete [] localof;
+  }
+
   delete memory;
   delete error;
 
@@ -211,8 +236,15 @@ void MapReduce::defaults()
   maxpage = 0;
   freepage = 1;
   outofcore = 0;
+  asyncio = 0;
+  mmapio = 0;
+  codec = 0;
   zeropage = 0;
   keyalign = valuealign = ALIGNKV;
+  fixedkey = fixedvalue = 0;
+  nthreads = 1;
+  mapthreads = 1;
+  skewsplit = 0;
 
 #ifdef MRMPI_FPATH
 #define _QUOTEME(x) #x
@@ -231,6 +263,7 @@ void MapReduce::defaults()
     fcounter_part = fcounter_set = 0;
 
   twolenbytes = 2*sizeof(int);
+  kfixed = vfixed = fixedbytes = 0;
   kmv_block_valid = 0;
 
   allocated = 0;
@@ -245,6 +278,25 @@ void MapReduce::defaults()
 
   kv = NULL;
   kmv = NULL;
+  pool = NULL;
+  appcombine = NULL;
+  combineptr = NULL;
+
+  rangeflag = -1;
+  nsplit = 0;
+  splitptr = NULL;
+  splitlen = NULL;
+  splitbuf = NULL;
+
+  nhot = 0;
+  hotptr = NULL;
+  hotlen = NULL;
+  hotbuf = NULL;
+
+  nodecomm = leadercomm = MPI_COMM_NULL;
+  nodeof = localof = NULL;
+  routeflag = 0;
+  nnodes = 0;
 
   if (sizeof(uint64_t) != 8) error->all("Not compiled for 8-byte integers");
 
@@ -279,14 +331,24 @@ MapReduce *MapReduce::copy()
   mrnew->maxpage = maxpage;
   mrnew->freepage = freepage;
   mrnew->outofcore = outofcore;
+  mrnew->asyncio = asyncio;
+  mrnew->mmapio = mmapio;
+  mrnew->codec = codec;
   mrnew->zeropage = zeropage;
+  mrnew->nthreads = nthreads;
+  mrnew->mapthreads = mapthreads;
+  mrnew->skewsplit = skewsplit;
 
   if (allocated) {
     mrnew->keyalign = kalign;
     mrnew->valuealign = valign;
+    mrnew->fixedkey = kfixed;
+    mrnew->fixedvalue = vfixed;
   } else {
     mrnew->keyalign = keyalign;
     mrnew->valuealign = valuealign;
+    mrnew->fixedkey = fixedkey;
+    mrnew->fixedvalue = fixedvalue;
   }
 
   delete [] mrnew->fpath;
@@ -357,12 +419,26 @@ uint64_t MapReduce::add(MapReduce *mr)
   if (kv == NULL) kv = new KeyValue(this,kalign,valign,memory,error,comm);
   else kv->append();
 
+  // added pairs pinned by aggregate() stay pinned
+  //   if my pairs are all pinned by same hash or I have none
+
+  uint64_t nkv_old = kv->nkv;
+  int pinextend = (kv->npinned == nkv_old && mr->kv->pinflag &&
+		   (nkv_old == 0 || 
+		    (kv->pinflag && kv->pinhash == mr->kv->pinhash)));
+
   mr->kv->allocate();
   kv->add(mr->kv);
   mr->kv->deallocate(0);
   kv->complete();
   if (freepage) mem_cleanup();
 
+  if (pinextend) {
+    kv->pinflag = 1;
+    kv->npinned = nkv_old + mr->kv->npinned;
+    kv->pinhash = mr->kv->pinhash;
+  }
+
   stats("Add",0);
 
   uint64_t nkeyall;
@@ -381,30 +457,245 @@ uint64_t MapReduce::add(MapReduce *mr)
 
 uint64_t MapReduce::aggregate(int (*hash)(char *, int))
 {
-  int i,nkey_send,keybytes,valuebytes,nkey_recv;
-  int start,stop,done,mydone;
-  int memtag_cdpage,memtag_epage,memtag_fpage,memtag_gpage;
-  uint64_t dummy,dummy1,dummy2,dummy3;
-  double timestart,fraction,minfrac;
-  char *ptr,*key;
-  int *proclist,*kvsizes,*reorder;
-  char **kvptrs;
+  return aggregate(hash,NULL,NULL);
+}
+
+/* ----------------------------------------------------------------------
+   aggregate a KV across procs to create a new KV
+   appcombine = user function that merges pairs with equal keys
+     on each page of pairs before it is sent (NULL if not provided)
+------------------------------------------------------------------------- */
 
+uint64_t MapReduce::aggregate(int (*hash)(char *, int),
+			      void (*appcombine_caller)(char *, int, char *,
+							int, int *,
+							KeyValue *, void *),
+			      void *appptr)
+{
   if (kv == NULL) error->all("Cannot aggregate without KeyValue");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
   if (nprocs == 1) {
+    kv->pinflag = 1;
+    kv->npinned = kv->nkv;
+    kv->pinhash = hash;
     stats("Aggregate",0);
     return kv->nkv;
   }
 
   kv->allocate();
 
+  // if a previous aggregate() with same hash placed leading pairs of KV,
+  //   on every proc, they stay on this proc
+  // only the remaining pairs are split off and communicated
+
+  int pinme = (kv->pinflag && kv->pinhash == hash);
+  int pinall;
+  MPI_Allreduce(&pinme,&pinall,1,MPI_INT,MPI_MIN,comm);
+
+  KeyValue *kvpin = NULL;
+  if (pinall) {
+    kvpin = kv;
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
+    kv->add(kvpin,kvpin->npinned,kvpin->nkv);
+    kv->complete();
+    kvpin->deallocate(0);
+    kv->allocate();
+  }
+
+  // find hot keys whose pairs will be split across several procs
+
+  if (skewsplit > 1) hot_keys();
+
   // new KV that will be created
 
   KeyValue *kvnew = new KeyValue(this,kalign,valign,memory,error,comm);
 
+  appcombine = appcombine_caller;
+  combineptr = appptr;
+
+  if (all2all == 2) aggregate_hierarchy(hash,kvnew);
+  else if (all2all) aggregate_pipeline(hash,kv,kvnew,comm,NULL);
+  else aggregate_irregular(hash,kvnew);
+
+  appcombine = NULL;
+  combineptr = NULL;
+
+  delete kv;
+
+  if (kvpin) {
+    kvpin->allocate();
+    kvnew->add(kvpin,0,kvpin->npinned);
+    delete kvpin;
+  }
+
+  kv = kvnew;
+  kv->complete();
+  kv->pinflag = 1;
+  kv->npinned = kv->nkv;
+  kv->pinhash = hash;
+
+  // pairs of hot keys are no longer where hash places them
+
+  if (nhot) {
+    kv->pinflag = 0;
+    kv->npinned = 0;
+    hotkeys += nhot;
+    memory->sfree(hotptr);
+    memory->sfree(hotlen);
+    memory->sfree(hotbuf);
+    hotptr = NULL;
+    hotlen = NULL;
+    hotbuf = NULL;
+    nhot = 0;
+  }
+
+  if (freepage) mem_cleanup();
+
+  stats("Aggregate",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   find hot keys of KV that aggregate() will split across skewsplit procs
+   proc 0 sorts a sample of all procs' keys and counts equal keys,
+     a key is hot if it is more than 1/P of the sample,
+     i.e. its pairs alone would exceed the average load of a proc
+   hot keys are broadcast to all procs, nhot = 0 if there are none
+------------------------------------------------------------------------- */
+
+void MapReduce::hot_keys()
+{
+  int i,j;
+  char *ptr;
+
+  uint64_t nkvall;
+  MPI_Allreduce(&kv->nkv,&nkvall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  if (nkvall == 0) return;
+
+  int *alllens;
+  char *allbuf;
+  int ntotal = sample_gather(0,nkvall,alllens,allbuf);
+
+  // proc 0 sorts samples via Sorter so equal keys are adjacent
+  // hot keys are copied into hotbuf in sorted order
+
+  int nhotbytes = 0;
+
+  if (me == 0) {
+    int *order = (int *) memory->smalloc(ntotal*sizeof(int),"MR:samples");
+    int *slen = (int *) memory->smalloc(ntotal*sizeof(int),"MR:samples");
+    char **sptr = (char **) 
+      memory->smalloc(ntotal*sizeof(char *),"MR:samples");
+
+    ptr = allbuf;
+    for (i = 0; i < ntotal; i++) {
+      sptr[i] = ptr;
+      slen[i] = alllens[i];
+      ptr += alllens[i];
+    }
+
+    char *work = (char *)
+      memory->smalloc((uint64_t) ntotal*Sorter::workbytes(),"MR:samples");
+    Sorter *sampler = new Sorter(nthreads,memory,error);
+    sampler->sort(ntotal,order,sptr,slen,compare_bytes,Sorter::NOPREFIX,0,
+		  work);
+    delete sampler;
+    memory->sfree(work);
+
+    int maxhot = 0;
+    for (i = 0; i < ntotal; i = j) {
+      for (j = i+1; j < ntotal; j++)
+	if (compare_bytes(sptr[order[i]],slen[order[i]],
+			  sptr[order[j]],slen[order[j]])) break;
+      if ((uint64_t) (j-i)*nprocs <= (uint64_t) ntotal) continue;
+      if (nhot == maxhot) {
+	maxhot += 16;
+	hotlen = (int *) 
+	  memory->srealloc(hotlen,maxhot*sizeof(int),"MR:hotlen");
+      }
+      hotlen[nhot] = slen[order[i]];
+      order[nhot++] = order[i];
+      nhotbytes += slen[order[i]];
+    }
+
+    hotbuf = (char *) memory->smalloc(nhotbytes,"MR:hotbuf");
+    ptr = hotbuf;
+    for (i = 0; i < nhot; i++) {
+      memcpy(ptr,sptr[order[i]],hotlen[i]);
+      ptr += hotlen[i];
+    }
+
+    memory->sfree(order);
+    memory->sfree(slen);
+    memory->sfree(sptr);
+    memory->sfree(alllens);
+    memory->sfree(allbuf);
+  }
+
+  // broadcast hot keys to all procs
+
+  MPI_Bcast(&nhot,1,MPI_INT,0,comm);
+  if (nhot == 0) return;
+
+  if (me) hotlen = (int *) memory->smalloc(nhot*sizeof(int),"MR:hotlen");
+  MPI_Bcast(hotlen,nhot,MPI_INT,0,comm);
+  if (me) {
+    for (i = 0; i < nhot; i++) nhotbytes += hotlen[i];
+    hotbuf = (char *) memory->smalloc(nhotbytes,"MR:hotbuf");
+  }
+  MPI_Bcast(hotbuf,nhotbytes,MPI_BYTE,0,comm);
+
+  hotptr = (char **) memory->smalloc(nhot*sizeof(char *),"MR:hotptr");
+  ptr = hotbuf;
+  for (i = 0; i < nhot; i++) {
+    hotptr[i] = ptr;
+    ptr += hotlen[i];
+  }
+  hotcount = 0;
+}
+
+/* ----------------------------------------------------------------------
+   return 1 if KEY of length KEYBYTES is a hot key, else 0
+   binary search of hot keys, which are in compare_bytes() order
+------------------------------------------------------------------------- */
+
+int MapReduce::hot_key(char *key, int keybytes)
+{
+  int mid,n;
+
+  int lo = 0;
+  int hi = nhot;
+  while (lo < hi) {
+    mid = (lo+hi) / 2;
+    n = compare_bytes(hotptr[mid],hotlen[mid],key,keybytes);
+    if (n == 0) return 1;
+    if (n < 0) lo = mid+1;
+    else hi = mid;
+  }
+  return 0;
+}
+
+/* ----------------------------------------------------------------------
+   aggregate one page of KV pairs at a time via Irregular custom comm
+   used when all2all = 0
+------------------------------------------------------------------------- */
+
+void MapReduce::aggregate_irregular(int (*hash)(char *, int),
+				    KeyValue *kvnew)
+{
+  int nkey_send,nkey_recv;
+  int start,stop,done,mydone;
+  int memtag_cdpage,memtag_epage,memtag_fpage,memtag_gpage;
+  uint64_t dummy,dummy1,dummy2,dummy3;
+  double timestart,fraction,minfrac;
+  int *proclist,*kvsizes,*reorder;
+  char **kvptrs;
+
   // irregular communicator
 
   Irregular *irregular = new Irregular(all2all,memory,error,comm);
@@ -413,13 +704,24 @@ uint64_t MapReduce::aggregate(int (*hash)(char *, int))
 
   uint64_t twopage;
   char *cdpage = mem_request(2,twopage,memtag_cdpage);
-  char *epage = mem_request(1,dummy,memtag_epage);
-  char *fpage = mem_request(1,dummy,memtag_fpage);
+  char *epage = mem_request(workpages(1,3*sizeof(int)),dummy,memtag_epage);
+  char *fpage = mem_request(workpages(1,sizeof(char *)),dummy,memtag_fpage);
   char *gpage = mem_request(1,dummy,memtag_gpage);
 
+  // with a combiner, combined pairs of each page go to a page of their own
+
+  int memtag_xpage;
+  char *xpage;
+  KeyValue *kvcombine = NULL;
+  if (appcombine) {
+    xpage = mem_request(1,dummy,memtag_xpage);
+    kvcombine = new KeyValue(this,kalign,valign,memory,error,comm,
+			     xpage,pagesize);
+  }
+
   // maxpage = max # of pages in any proc's KV
 
-  char *page_send;
+  char *page_send,*page_hash;
   int npage_send = kv->request_info(&page_send);
   int maxpage;
   MPI_Allreduce(&npage_send,&maxpage,1,MPI_INT,MPI_MAX,comm);
@@ -434,6 +736,12 @@ uint64_t MapReduce::aggregate(int (*hash)(char *, int))
       nkey_send = kv->request_page(ipage,dummy1,dummy2,dummy3);
     else nkey_send = 0;
 
+    page_hash = page_send;
+    if (kvcombine) {
+      nkey_send = combine_page(nkey_send,page_send,kvcombine);
+      page_hash = xpage;
+    }
+
     // set ptrs to workspace memory
 
     proclist = (int *) epage;
@@ -442,27 +750,9 @@ uint64_t MapReduce::aggregate(int (*hash)(char *, int))
     kvptrs = (char **) fpage;
 
     // hash each key to a proc ID
-    // via user-provided hash function or hashlittle()
-
-    ptr = page_send;
-
-    for (i = 0; i < nkey_send; i++) {
-      kvptrs[i] = ptr;
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
-
-      ptr += twolenbytes;
-      ptr = ROUNDUP(ptr,kalignm1);
-      key = ptr;
-      ptr += keybytes;
-      ptr = ROUNDUP(ptr,valignm1);
-      ptr += valuebytes;
-      ptr = ROUNDUP(ptr,talignm1);
 
-      kvsizes[i] = ptr - kvptrs[i];
-      if (hash) proclist[i] = hash(key,keybytes) % nprocs;
-      else proclist[i] = hashlittle(key,keybytes,nprocs) % nprocs;
-    }
+    aggregate_hash(hash,NULL,nkey_send,page_hash,
+		   proclist,kvsizes,kvptrs);
 
     // perform irregular comm of each proc's page of KV pairs
     // add received KV pairs to kvnew
@@ -523,477 +813,846 @@ uint64_t MapReduce::aggregate(int (*hash)(char *, int))
   mem_unmark(memtag_fpage);
   mem_unmark(memtag_gpage);
 
-  delete kv;
-  kv = kvnew;
-  kv->complete();
-  if (freepage) mem_cleanup();
-
-  stats("Aggregate",0);
-
-  uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  if (kvcombine) {
+    kvcombine->page = NULL;
+    delete kvcombine;
+    mem_unmark(memtag_xpage);
+  }
 }
 
 /* ----------------------------------------------------------------------
-   broadcast the KV on proc root to all other procs
+   aggregate KV pairs from kvsrc to kvdest in pipelined steps
+     via MPI_Ialltoallv() on communicator xcomm
+   procmap = optional map of hashed proc IDs to ranks in xcomm
+   used when all2all = 1, and for each level when all2all = 2
+   each step sends all remaining pairs of one page from a proc to a proc,
+     or none of them, so no proc receives more than 1 page per step:
+     procs propose bytes + # of pairs for each receiver and whether
+       they have data left, one MPI_Alltoall()
+     each receiver grants whole proposals in rotating order while they
+       fit in a page, one MPI_Alltoall(), which also decides if all done
+     granted pairs are packed and exchanged by MPI_Ialltoallv()
+   sends/recvs are double-buffered, so while one step is in flight
+     the previous step is added to kvnew, the next page is loaded
+     and hashed, and the next step is negotiated and packed
+   if codec setting has bit 2, each proc's pairs from a page are
+     encoded as one block when the page is loaded, proposals are then
+     block sizes, and received blocks are decoded as they are added
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::broadcast(int root)
+void MapReduce::aggregate_pipeline(int (*hash)(char *, int),
+				   KeyValue *kvsrc, KeyValue *kvdest,
+				   MPI_Comm xcomm, int *procmap)
 {
-  int npage_kv;
-  char *buf;
-  uint64_t dummy,sizes[4];
+  int rank,np;
+  MPI_Comm_rank(xcomm,&rank);
+  MPI_Comm_size(xcomm,&np);
 
-  if (kv == NULL) error->all("Cannot broadcast without KeyValue");
-  if (root < 0 || root >= nprocs) error->all("Invalid root for broadcast");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  int i,j,iproc,nkey_send,memtag_cdpage,memtag_epage,memtag_fpage;
+  int memtag_ghpage;
+  uint64_t dummy,dummy1,dummy2,dummy3;
+  double timestart;
+  char *ptr;
+
+  // pages of workspace memory
+  // 2 recv pages, 2 send pages, pair info, pair ptrs
+  // with compression, recv/send buffers are 1.5 pages each, since
+  //   a block of pairs that does not shrink gains a header and padding
+
+  int nbuf = (codec & 2) ? 3 : 2;
+  char *cdpage = mem_request(nbuf,dummy,memtag_cdpage);
+  char *ghpage = mem_request(nbuf,dummy,memtag_ghpage);
+  char *epage = mem_request(workpages(1,3*sizeof(int)),dummy,memtag_epage);
+  char *fpage = mem_request(workpages(1,sizeof(char *)),dummy,memtag_fpage);
+
+  uint64_t bufsize = nbuf*pagesize/2;
+  char *recvbuf[2],*sendbuf[2];
+  recvbuf[0] = cdpage;
+  recvbuf[1] = &cdpage[bufsize];
+  sendbuf[0] = ghpage;
+  sendbuf[1] = &ghpage[bufsize];
+  int limit = MIN(bufsize,INTMAX);
+
+  // per-proc data for current page and each step
+  // first/next = start of each proc's pairs and next unsent one in reorder
+  // pending/npending = bytes and # of pairs left for each proc
+  // propose/offer = 3 values per proc: bytes, pairs, 1 if data left
+  // grant/granted = 1 if a proc may send its proposal in this step
+
+  int *first = new int[np+1];
+  int *next = new int[np];
+  uint64_t *pending = new uint64_t[np];
+  uint64_t *propose = new uint64_t[3*np];
+  uint64_t *offer = new uint64_t[3*np];
+  int *grant = new int[np];
+  int *granted = new int[np];
+  int *sendcounts[2],*sdispls[2],*recvcounts[2],*rdispls[2];
+  int nkey_recv[2];
+  for (i = 0; i < 2; i++) {
+    sendcounts[i] = new int[np];
+    sdispls[i] = new int[np];
+    recvcounts[i] = new int[np];
+    rdispls[i] = new int[np];
+  }
+  MPI_Request request[2];
+
+  int *proclist = (int *) epage;
+  int *kvsizes,*reorder;
+  char **kvptrs = (char **) fpage;
+
+  // compression of exchanged pairs
+  // zpage = encoded blocks of current page, zraw = one proc's pairs
+  // nkeys = # of pairs from each proc in each step
+
+  Codec *zcodec = NULL;
+  int memtag_zpage,memtag_zraw;
+  char *zpage,*zraw;
+  uint64_t *zstart;
+  int *nkeys[2];
+  int zhead = roundup(2*sizeof(int),talign);
+
+  if (codec & 2) {
+    zcodec = new Codec(this,pagesize,memory,error);
+    zpage = mem_request(2,dummy,memtag_zpage);
+    zraw = mem_request(1,dummy,memtag_zraw);
+    zstart = new uint64_t[np];
+    nkeys[0] = new int[np];
+    nkeys[1] = new int[np];
+  }
 
-  if (nprocs == 1) {
-    stats("Broadcast",0);
-    uint64_t nkeyall;
-    MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-    return nkeyall;
+  // with a combiner, combined pairs of each page go to a page of their own
+
+  int memtag_xpage;
+  char *xpage;
+  KeyValue *kvcombine = NULL;
+  if (appcombine) {
+    xpage = mem_request(1,dummy,memtag_xpage);
+    kvcombine = new KeyValue(this,kalign,valign,memory,error,comm,
+			     xpage,pagesize);
   }
 
-  // on non-root procs, delete existing KV and create empty KV
-  
-  double timestart = MPI_Wtime();
+  char *page_send,*page_hash;
+  int npage_send = kvsrc->request_info(&page_send);
+  int ipage = 0;
+  nkey_send = 0;
+  for (iproc = 0; iproc < np; iproc++) pending[iproc] = 0;
+  int npending = 0;
 
-  if (me != root) {
-    delete kv;
-    kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  } else kv->allocate();
+  int istep = 0;
+  int inflight = 0;
+
+  while (1) {
 
-  npage_kv = kv->request_info(&buf);
-  MPI_Bcast(&npage_kv,1,MPI_INT,root,comm);
+    // current page is fully sent, load and hash the next non-empty one
+    // bin its pairs by proc into reorder
 
-  // broadcast KV data, one page at a time, non-root procs add to their KV
+    while (npending == 0 && ipage < npage_send) {
+      nkey_send = kvsrc->request_page(ipage++,dummy1,dummy2,dummy3);
+      if (nkey_send == 0) continue;
 
-  for (int ipage = 0; ipage < npage_kv; ipage++) {
-    if (me == root)
-      sizes[0] = kv->request_page(ipage,sizes[1],sizes[2],sizes[3]);
-    MPI_Bcast(sizes,4,MRMPI_BIGINT,root,comm);
-    MPI_Bcast(buf,sizes[3],MPI_BYTE,root,comm);
-    if (me == root) cssize += sizes[3];
-    else {
-      crsize += sizes[3];
-      kv->add(sizes[0],buf,sizes[1],sizes[2],sizes[3]);
+      page_hash = page_send;
+      if (kvcombine) {
+	nkey_send = combine_page(nkey_send,page_send,kvcombine);
+	page_hash = xpage;
+      }
+
+      kvsizes = &proclist[nkey_send];
+      reorder = &proclist[2 * ((uint64_t) nkey_send)];
+      aggregate_hash(hash,procmap,nkey_send,page_hash,
+		     proclist,kvsizes,kvptrs);
+
+      for (iproc = 0; iproc <= np; iproc++) first[iproc] = 0;
+      for (i = 0; i < nkey_send; i++) {
+	first[proclist[i]+1]++;
+	pending[proclist[i]] += kvsizes[i];
+      }
+      for (iproc = 0; iproc < np; iproc++) {
+	first[iproc+1] += first[iproc];
+	next[iproc] = first[iproc];
+      }
+      for (i = 0; i < nkey_send; i++) reorder[next[proclist[i]]++] = i;
+      for (iproc = 0; iproc < np; iproc++) next[iproc] = first[iproc];
+      npending = nkey_send;
+
+      // encode each proc's pairs as a block: 2 ints = encoded flag and
+      // # of payload bytes, then payload, padded so pairs stay aligned
+      // payload is pairs as-is if encoding does not shrink them
+
+      if (zcodec) {
+	uint64_t zoffset = 0;
+	for (iproc = 0; iproc < np; iproc++) {
+	  zstart[iproc] = zoffset;
+	  if (first[iproc+1] == first[iproc]) continue;
+	  ptr = zraw;
+	  for (i = first[iproc]; i < first[iproc+1]; i++) {
+	    j = reorder[i];
+	    memcpy(ptr,kvptrs[j],kvsizes[j]);
+	    ptr += kvsizes[j];
+	  }
+	  uint64_t nraw = ptr - zraw;
+	  if (zoffset + zhead + roundup(nraw,talign) > 2*pagesize)
+	    error->one("Encoded blocks exceed aggregate workspace");
+
+	  int *header = (int *) &zpage[zoffset];
+	  char *payload = &zpage[zoffset+zhead];
+	  int stride = kvsizes[reorder[first[iproc]]];
+	  uint64_t ncode = zcodec->encode(zraw,nraw,stride,payload,nraw-1);
+	  header[0] = (ncode > 0);
+	  if (ncode == 0) {
+	    memcpy(payload,zraw,nraw);
+	    ncode = nraw;
+	  }
+	  header[1] = ncode;
+	  pending[iproc] = zhead + roundup(ncode,talign);
+	  zoffset += pending[iproc];
+	}
+      }
     }
-  }
 
-  commtime += MPI_Wtime() - timestart;
-  if (me != root) kv->complete();
-  else kv->complete_dummy();
-  if (freepage) mem_cleanup();
+    // negotiate this step
 
-  stats("Broadcast",0);
+    timestart = MPI_Wtime();
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
-}
+    for (iproc = 0; iproc < np; iproc++) {
+      propose[3*iproc] = pending[iproc];
+      propose[3*iproc+1] = first[iproc+1] - next[iproc];
+      propose[3*iproc+2] = (npending > 0);
+    }
+    if (npending == 0)
+      for (iproc = 0; iproc < np; iproc++) 
+	propose[3*iproc] = propose[3*iproc+1] = 0;
 
-/* ----------------------------------------------------------------------
-   clone KV to KMV so that KMV pairs are one-to-one copies of KV pairs
-   each proc clones only its data
-   assume each KV key is unique, but is not required
-------------------------------------------------------------------------- */
+    MPI_Alltoall(propose,3,MRMPI_BIGINT,offer,3,MRMPI_BIGINT,xcomm);
 
-uint64_t MapReduce::clone()
-{
-  if (kv == NULL) error->all("Cannot clone without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+    int more = 0;
+    for (iproc = 0; iproc < np; iproc++)
+      if (offer[3*iproc+2]) more = 1;
 
-  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
-  kv->allocate();
+    if (!more) {
+      commtime += MPI_Wtime() - timestart;
+      break;
+    }
 
-  kmv->clone(kv);
-  kmv->complete();
+    int ibuf = istep % 2;
+    uint64_t recvtotal = 0;
+    for (j = 0; j < np; j++) {
+      iproc = (rank + istep + j) % np;
+      grant[iproc] = 0;
+      if (offer[3*iproc] && recvtotal + offer[3*iproc] <= limit) {
+	grant[iproc] = 1;
+	recvtotal += offer[3*iproc];
+      }
+    }
 
-  delete kv;
-  kv = NULL;
-  if (freepage) mem_cleanup();
+    MPI_Alltoall(grant,1,MPI_INT,granted,1,MPI_INT,xcomm);
+    commtime += MPI_Wtime() - timestart;
+
+    // pack all pending pairs for each granting proc into send buffer
+    // recv counts are the granted proposals
+
+    int offset = 0;
+    for (iproc = 0; iproc < np; iproc++) {
+      sdispls[ibuf][iproc] = offset;
+      sendcounts[ibuf][iproc] = 0;
+      if (!granted[iproc]) continue;
+      ptr = &sendbuf[ibuf][offset];
+      if (zcodec) memcpy(ptr,&zpage[zstart[iproc]],pending[iproc]);
+      else
+	for (i = next[iproc]; i < first[iproc+1]; i++) {
+	  j = reorder[i];
+	  memcpy(ptr,kvptrs[j],kvsizes[j]);
+	  ptr += kvsizes[j];
+	}
+      sendcounts[ibuf][iproc] = pending[iproc];
+      offset += pending[iproc];
+      npending -= first[iproc+1] - next[iproc];
+      next[iproc] = first[iproc+1];
+      pending[iproc] = 0;
+      if (iproc != rank) cssize += sendcounts[ibuf][iproc];
+    }
 
-  stats("Clone",1);
+    offset = 0;
+    nkey_recv[ibuf] = 0;
+    for (iproc = 0; iproc < np; iproc++) {
+      rdispls[ibuf][iproc] = offset;
+      recvcounts[ibuf][iproc] = grant[iproc] ? offer[3*iproc] : 0;
+      offset += recvcounts[ibuf][iproc];
+      if (grant[iproc]) nkey_recv[ibuf] += offer[3*iproc+1];
+      if (zcodec) nkeys[ibuf][iproc] = grant[iproc] ? offer[3*iproc+1] : 0;
+      if (iproc != rank) crsize += recvcounts[ibuf][iproc];
+    }
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+    // start this step, then finish previous one while it is in flight
+
+    timestart = MPI_Wtime();
+    MPI_Ialltoallv(sendbuf[ibuf],sendcounts[ibuf],sdispls[ibuf],MPI_BYTE,
+		   recvbuf[ibuf],recvcounts[ibuf],rdispls[ibuf],MPI_BYTE,
+		   xcomm,&request[ibuf]);
+
+    if (inflight) {
+      MPI_Wait(&request[1-ibuf],MPI_STATUS_IGNORE);
+      commtime += MPI_Wtime() - timestart;
+      if (zcodec) aggregate_decode(zcodec,kvdest,recvbuf[1-ibuf],np,
+				  recvcounts[1-ibuf],rdispls[1-ibuf],
+				  nkeys[1-ibuf],zraw);
+      else kvdest->add(nkey_recv[1-ibuf],recvbuf[1-ibuf]);
+    } else commtime += MPI_Wtime() - timestart;
+
+    inflight = 1;
+    istep++;
+  }
+
+  // finish last step
+
+  if (inflight) {
+    int ibuf = (istep-1) % 2;
+    timestart = MPI_Wtime();
+    MPI_Wait(&request[ibuf],MPI_STATUS_IGNORE);
+    commtime += MPI_Wtime() - timestart;
+    if (zcodec) aggregate_decode(zcodec,kvdest,recvbuf[ibuf],np,
+				recvcounts[ibuf],rdispls[ibuf],nkeys[ibuf],zraw);
+    else kvdest->add(nkey_recv[ibuf],recvbuf[ibuf]);
+  }
+
+  delete [] first;
+  delete [] next;
+  delete [] pending;
+  delete [] propose;
+  delete [] offer;
+  delete [] grant;
+  delete [] granted;
+  for (i = 0; i < 2; i++) {
+    delete [] sendcounts[i];
+    delete [] sdispls[i];
+    delete [] recvcounts[i];
+    delete [] rdispls[i];
+  }
+
+  mem_unmark(memtag_cdpage);
+  mem_unmark(memtag_ghpage);
+  mem_unmark(memtag_epage);
+  mem_unmark(memtag_fpage);
+
+  if (zcodec) {
+    delete zcodec;
+    delete [] zstart;
+    delete [] nkeys[0];
+    delete [] nkeys[1];
+    mem_unmark(memtag_zpage);
+    mem_unmark(memtag_zraw);
+  }
+
+  if (kvcombine) {
+    kvcombine->page = NULL;
+    delete kvcombine;
+    mem_unmark(memtag_xpage);
+  }
 }
 
 /* ----------------------------------------------------------------------
-   close a KV that KV pairs were added to by another MR's map()
+   add pairs received in one pipelined step to kvdest
+   buf holds one encoded block from each proc with counts > 0,
+     decode each into zraw unless its payload is pairs as-is
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::close()
+void MapReduce::aggregate_decode(Codec *zcodec, KeyValue *kvdest, char *buf,
+				 int np, int *counts, int *displs, int *nkeys,
+				 char *zraw)
 {
-  if (kv == NULL) error->all("Cannot close without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
-
-  kv->complete();
-  if (freepage) mem_cleanup();
-
-  stats("Close",0);
-
-  uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  int zhead = roundup(2*sizeof(int),talign);
+
+  for (int iproc = 0; iproc < np; iproc++) {
+    if (counts[iproc] == 0) continue;
+    int *header = (int *) &buf[displs[iproc]];
+    char *payload = &buf[displs[iproc]+zhead];
+    if (header[0]) {
+      zcodec->decode(payload,header[1],zraw,pagesize);
+      kvdest->add(nkeys[iproc],zraw);
+    } else kvdest->add(nkeys[iproc],payload);
+  }
 }
 
 /* ----------------------------------------------------------------------
-   collapse KV into a KMV with a single key/value
-   each proc collapses only its data
-   new key = provided key name (same on every proc)
-   new value = list of old key,value,key,value,etc
+   aggregate KV pairs in 3 pipelined levels, used when all2all = 2
+   procs on a node send all their pairs to the node leader,
+   node leaders exchange pairs with each other by destination node,
+   node leaders send pairs to the procs on their node
+   only node leaders communicate between nodes, so a collective over
+     nprocs ranks becomes one over nnodes ranks
+   if every node has 1 proc or there is only 1 node,
+     aggregate in a single level as for all2all = 1
+   if a pair's proc is not a function of the pair alone, as for pairs
+     spread across equal splitters in a sample sort or across procs for
+     a hot key, the proc is chosen once on the sending proc and carried
+     by the pair through all levels
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::collapse(char *key, int keybytes)
+void MapReduce::aggregate_hierarchy(int (*hash)(char *, int),
+				    KeyValue *kvnew)
 {
-  if (kv == NULL) error->all("Cannot collapse without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  if (nodecomm == MPI_COMM_NULL) node_setup();
 
-  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
-  kv->allocate();
+  if (nnodes == 1 || nnodes == nprocs) {
+    aggregate_pipeline(hash,kv,kvnew,comm,NULL);
+    return;
+  }
 
-  kmv->collapse(key,keybytes,kv);
-  kmv->complete();
+  // intermediate KVs hold pairs on node leaders
+  // kvnew and kv give up their pages when not in use,
+  //   so no more pages are needed than for all2all = 1
 
-  delete kv;
-  kv = NULL;
-  if (freepage) mem_cleanup();
+  kvnew->deallocate(1);
 
-  stats("Collapse",1);
+  // routed pairs are variable-size and already combined,
+  //   so fixed-size pairs and combiner are turned off until unwrapped
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  int route = (rangeflag >= 0 || nhot);
+  KeyValue *kvsrc = kv;
+  int kfixed_save = kfixed;
+  int vfixed_save = vfixed;
+  int fixedbytes_save = fixedbytes;
+  ReduceFunc *appcombine_save = appcombine;
+
+  if (route) {
+    kvsrc = route_wrap(hash);
+    routeflag = 1;
+    kfixed = vfixed = fixedbytes = 0;
+    appcombine = NULL;
+  }
+
+  int *toleader = new int[nprocs];
+  for (int iproc = 0; iproc < nprocs; iproc++) toleader[iproc] = 0;
+
+  KeyValue *kvnode = new KeyValue(this,kalign,valign,memory,error,comm);
+  aggregate_pipeline(hash,kvsrc,kvnode,nodecomm,toleader);
+  kvnode->complete();
+  if (route) delete kvsrc;
+  else kv->deallocate(1);
+  delete [] toleader;
+
+  KeyValue *kvleader = new KeyValue(this,kalign,valign,memory,error,comm);
+  if (leadercomm != MPI_COMM_NULL) {
+    kvnode->allocate();
+    aggregate_pipeline(hash,kvnode,kvleader,leadercomm,nodeof);
+  }
+  kvleader->complete();
+  delete kvnode;
+
+  kvleader->allocate();
+  if (route) {
+    KeyValue *kvout = new KeyValue(this,kalign,valign,memory,error,comm);
+    aggregate_pipeline(hash,kvleader,kvout,nodecomm,localof);
+    delete kvleader;
+    kvout->complete();
+
+    routeflag = 0;
+    kfixed = kfixed_save;
+    vfixed = vfixed_save;
+    fixedbytes = fixedbytes_save;
+    appcombine = appcombine_save;
+
+    kvout->allocate();
+    kvnew->allocate();
+    route_unwrap(kvout,kvnew);
+    delete kvout;
+    return;
+  }
+
+  kvnew->allocate();
+  aggregate_pipeline(hash,kvleader,kvnew,nodecomm,localof);
+  delete kvleader;
 }
 
 /* ----------------------------------------------------------------------
-   collate KV to create a KMV
-   aggregate followed by a convert
-   hash = user hash function (NULL if not provided)
+   return new KV of routed pairs for aggregate_hierarchy()
+   each pair of kv is assigned its final proc, as aggregate_hash() does,
+     then stored with that proc prepended to its key,
+     so later levels read the proc instead of computing it again
+   pairs are combined first if there is a combiner
+   kv gives up its pages
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::collate(int (*hash)(char *, int))
+KeyValue *MapReduce::route_wrap(int (*hash)(char *, int))
 {
-  if (kv == NULL) error->all("Cannot collate without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  int i,keybytes,valuebytes,memtag_epage,memtag_fpage,memtag_gpage;
+  uint64_t dummy,dummy1,dummy2,dummy3;
+  char *ptr,*key,*value;
 
-  collateflag = 1;
-  int verbosity_hold = verbosity;
-  int timer_hold = timer;
-  verbosity = timer = 0;
+  char *epage = mem_request(workpages(1,3*sizeof(int)),dummy,memtag_epage);
+  char *fpage = mem_request(workpages(1,sizeof(char *)),dummy,memtag_fpage);
+  char *gpage = mem_request(1,dummy,memtag_gpage);
 
-  aggregate(hash);
-  convert();
+  int memtag_xpage;
+  char *xpage;
+  KeyValue *kvcombine = NULL;
+  if (appcombine) {
+    xpage = mem_request(1,dummy,memtag_xpage);
+    kvcombine = new KeyValue(this,kalign,valign,memory,error,comm,
+			     xpage,pagesize);
+  }
 
-  verbosity = verbosity_hold;
-  timer = timer_hold;
-  stats("Collate",1);
-  collateflag = 0;
-  fcounter_part = fcounter_set = 0;
+  // routed pairs have variable-size keys even if kv pairs are fixed-size
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
-}
+  KeyValue *kvroute = new KeyValue(this,kalign,valign,memory,error,comm);
+  kvroute->kfixed = kvroute->vfixed = 0;
 
-/* ----------------------------------------------------------------------
-   compress KV to create a smaller KV
-   duplicate keys are replaced with a single key/value
-   each proc compresses only its data
-   create a KMV temporarily
-   call appcompress() with each key/multivalue in KMV
-   appcompress() returns single key/value to new KV
-------------------------------------------------------------------------- */
+  int *proclist = (int *) epage;
+  char **kvptrs = (char **) fpage;
 
-uint64_t MapReduce::compress(void (*appcompress)(char *, int, char *, int,
-						 int *, KeyValue *, void *),
-			     void *appptr)
-{
-  if (kv == NULL) error->all("Cannot compress without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  char *page_kv,*page_hash;
+  int npage_kv = kv->request_info(&page_kv);
 
-  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
-  kv->allocate();
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    int nkey = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    page_hash = page_kv;
+    if (kvcombine) {
+      nkey = combine_page(nkey,page_kv,kvcombine);
+      page_hash = xpage;
+    }
 
-  // convert KV into KMV
-  // KMV convert will delete kv
+    aggregate_hash(hash,NULL,nkey,page_hash,proclist,&proclist[nkey],kvptrs);
 
-  kmv->convert(kv);
-  kmv->complete();
-  if (freepage) mem_cleanup();
+    for (i = 0; i < nkey; i++) {
+      ptr = kvptrs[i];
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-  // create new KV
+      ptr = ROUNDUP(ptr,kalignm1);
+      key = ptr;
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      value = ptr;
 
-  kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  kmv->allocate();
+      if (keybytes + sizeof(int) > pagesize)
+	error->one("Routed key is larger than a page");
+      memcpy(gpage,&proclist[i],sizeof(int));
+      memcpy(&gpage[sizeof(int)],key,keybytes);
+      kvroute->add(gpage,keybytes+sizeof(int),value,valuebytes);
+    }
+  }
 
-  uint64_t dummy;
-  int memtag1,memtag2;
-  char *mvpage1 = mem_request(1,dummy,memtag1);
-  char *mvpage2 = mem_request(1,dummy,memtag2);
+  kvroute->complete();
+  kv->deallocate(1);
+  kvroute->allocate();
 
-  int nkey_kmv,nvalues,keybytes,mvaluebytes;
-  uint64_t dummy1,dummy2,dummy3;
-  int *valuesizes;
-  char *ptr,*key,*multivalue;
+  mem_unmark(memtag_epage);
+  mem_unmark(memtag_fpage);
+  mem_unmark(memtag_gpage);
 
-  char *page_kmv;
-  int npage_kmv = kmv->request_info(&page_kmv);
-  char *page_hold = page_kmv;
+  if (kvcombine) {
+    kvcombine->page = NULL;
+    delete kvcombine;
+    mem_unmark(memtag_xpage);
+  }
 
-  for (int ipage = 0; ipage < npage_kmv; ipage++) {
-    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
-    ptr = page_kmv;
+  return kvroute;
+}
 
-    for (int i = 0; i < nkey_kmv; i++) {
-      nvalues = *((int *) ptr);
-      ptr += sizeof(int);
+/* ----------------------------------------------------------------------
+   add routed pairs of kvroute to kvdest without the proc they carry
+------------------------------------------------------------------------- */
 
-      if (nvalues > 0) {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	mvaluebytes = *((int *) ptr);
-	ptr += sizeof(int);
-	valuesizes = (int *) ptr;
-	ptr += ((uint64_t) nvalues) * sizeof(int);
-	
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
-	ptr += keybytes;
-	ptr = ROUNDUP(ptr,valignm1);
-	multivalue = ptr;
-	ptr += mvaluebytes;
-	ptr = ROUNDUP(ptr,talignm1);
-	
-	appcompress(key,keybytes,multivalue,nvalues,valuesizes,kv,appptr);
+void MapReduce::route_unwrap(KeyValue *kvroute, KeyValue *kvdest)
+{
+  int keybytes,valuebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  char *ptr,*key,*value;
 
-      } else {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
+  char *page_kv;
+  int npage_kv = kvroute->request_info(&page_kv);
 
-	// set KMV page to mvpage1 so key will not be overwritten
-	// when multivalue_block() loads new pages of values
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    int nkey = kvroute->request_page(ipage,dummy1,dummy2,dummy3);
+    ptr = page_kv;
 
-	kmv_block_valid = 1;
-	kmv_key_page = ipage;
-	kmv_mvpage1 = mvpage1;
-	kmv_mvpage2 = mvpage2;
-	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
-	kmv->page = mvpage1;
-	appcompress(key,keybytes,NULL,0,(int *) this,kv,appptr);
-	kmv_block_valid = 0;
-	ipage += kmv_nblock;
-	kmv->page = page_hold;
-      }
+    for (int i = 0; i < nkey; i++) {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+
+      ptr = ROUNDUP(ptr,kalignm1);
+      key = ptr;
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      value = ptr;
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1);
+
+      kvdest->add(&key[sizeof(int)],keybytes-sizeof(int),value,valuebytes);
     }
   }
+}
 
-  kv->complete();
-  mem_unmark(memtag1);
-  mem_unmark(memtag2);
+/* ----------------------------------------------------------------------
+   create node and node leader communicators for all2all = 2
+   nodeof/localof = node ID and rank within node of each proc
+------------------------------------------------------------------------- */
 
-  // delete KMV
+void MapReduce::node_setup()
+{
+  int nodeme;
+  MPI_Comm_split_type(comm,MPI_COMM_TYPE_SHARED,me,MPI_INFO_NULL,&nodecomm);
+  MPI_Comm_rank(nodecomm,&nodeme);
+
+  int color = (nodeme == 0) ? 0 : MPI_UNDEFINED;
+  MPI_Comm_split(comm,color,me,&leadercomm);
+
+  int info[2];
+  info[0] = 0;
+  if (leadercomm != MPI_COMM_NULL) MPI_Comm_rank(leadercomm,&info[0]);
+  MPI_Bcast(&info[0],1,MPI_INT,0,nodecomm);
+  info[1] = nodeme;
+
+  int *all = new int[2*nprocs];
+  MPI_Allgather(info,2,MPI_INT,all,2,MPI_INT,comm);
+
+  nodeof = new int[nprocs];
+  localof = new int[nprocs];
+  nnodes = 0;
+  for (int iproc = 0; iproc < nprocs; iproc++) {
+    nodeof[iproc] = all[2*iproc];
+    localof[iproc] = all[2*iproc+1];
+    nnodes = MAX(nnodes,nodeof[iproc]+1);
+  }
+  delete [] all;
+}
 
-  delete kmv;
-  kmv = NULL;
-  if (freepage) mem_cleanup();
+/* ----------------------------------------------------------------------
+   hash each key in a page of N KV pairs to a proc ID
+   via user-provided hash function or hashkey()
+   or assign it to a proc by its key or value range during a sample sort
+   or read the proc a routed pair carries, see route_wrap()
+   a hot key's pairs are spread across skewsplit procs, starting at its own
+   procmap = optional map of proc IDs to ranks in a sub-communicator
+   set proclist, kvsizes, and kvptrs for each pair
+------------------------------------------------------------------------- */
 
-  stats("Compress",0);
-  fcounter_part = fcounter_set = 0;
+void MapReduce::aggregate_hash(int (*hash)(char *, int), int *procmap,
+			       int n, char *page,
+			       int *proclist, int *kvsizes, char **kvptrs)
+{
+  int keybytes,valuebytes;
+  char *key,*value;
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  char *ptr = page;
+
+  for (int i = 0; i < n; i++) {
+    kvptrs[i] = ptr;
+    if (kfixed) {
+      keybytes = kfixed;
+      valuebytes = vfixed;
+    } else {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+    }
+
+    ptr = ROUNDUP(ptr,kalignm1);
+    key = ptr;
+    ptr += keybytes;
+    ptr = ROUNDUP(ptr,valignm1);
+    value = ptr;
+    ptr += valuebytes;
+    ptr = ROUNDUP(ptr,talignm1);
+
+    kvsizes[i] = ptr - kvptrs[i];
+    if (routeflag) memcpy(&proclist[i],key,sizeof(int));
+    else if (rangeflag >= 0)
+      proclist[i] = range_proc(key,keybytes,value,valuebytes);
+    else if (hash) proclist[i] = hash(key,keybytes) % nprocs;
+    else proclist[i] = hashkey(key,keybytes,nprocs) % nprocs;
+    if (nhot && !routeflag && hot_key(key,keybytes))
+      proclist[i] = (proclist[i] + hotcount++ % skewsplit) % nprocs;
+    if (procmap) proclist[i] = procmap[proclist[i]];
+  }
 }
 
 /* ----------------------------------------------------------------------
-   convert KV to KMV
-   duplicate keys are replaced with a single key/multivalue
-   each proc converts only its data
-   new key = old unique key
-   new multivalue = concatenated list of all values for that key in KV
+   merge pairs with equal keys in one page of N KV pairs before it is sent
+   pairs are grouped by key via a hash table, then appcombine() is called
+     once per unique key with its values as a multivalue, in page order
+   appcombine() adds merged pairs to kvc, whose one page is sent instead
+   return # of pairs in kvc
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::convert()
+int MapReduce::combine_page(int n, char *page, KeyValue *kvc)
 {
-  if (kv == NULL) error->all("Cannot convert without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  int i,j,ikey,keybytes,valuebytes;
+  char *key,*value;
+
+  kvc->init_page();
+  if (n == 0) return 0;
+
+  // per-pair key/value ptrs and lengths, next pair with same key
+  // per-key first/last pair, # of pairs, next key in same hash bucket
+
+  int nbucket = 1;
+  while (nbucket < n) nbucket *= 2;
+  int mask = nbucket-1;
+
+  char **kptr = (char **) memory->smalloc(n*sizeof(char *),"MR:combine");
+  char **vptr = (char **) memory->smalloc(n*sizeof(char *),"MR:combine");
+  int *klen = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *vlen = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *pnext = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *ufirst = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *ulast = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *ucount = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *unext = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+  int *bucket = (int *) memory->smalloc(nbucket*sizeof(int),"MR:combine");
+
+  for (i = 0; i < nbucket; i++) bucket[i] = -1;
+
+  int nunique = 0;
+  uint64_t nvbytes = 0;
+  char *ptr = page;
+
+  for (i = 0; i < n; i++) {
+    if (kfixed) {
+      keybytes = kfixed;
+      valuebytes = vfixed;
+    } else {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+    }
 
-  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
-  kv->allocate();
+    ptr = ROUNDUP(ptr,kalignm1);
+    key = ptr;
+    ptr += keybytes;
+    ptr = ROUNDUP(ptr,valignm1);
+    value = ptr;
+    ptr += valuebytes;
+    ptr = ROUNDUP(ptr,talignm1);
 
-  // KMV will delete kv and free its memory
+    kptr[i] = key;
+    klen[i] = keybytes;
+    vptr[i] = value;
+    vlen[i] = valuebytes;
+    pnext[i] = -1;
+    nvbytes += valuebytes;
+
+    int ibucket = hashkey(key,keybytes,0) & mask;
+    for (ikey = bucket[ibucket]; ikey >= 0; ikey = unext[ikey]) {
+      j = ufirst[ikey];
+      if (klen[j] == keybytes && memcmp(kptr[j],key,keybytes) == 0) break;
+    }
 
-  kmv->convert(kv);
-  kmv->complete();
-  kv = NULL;
-  if (freepage) mem_cleanup();
+    if (ikey < 0) {
+      ikey = nunique++;
+      ufirst[ikey] = i;
+      ucount[ikey] = 0;
+      unext[ikey] = bucket[ibucket];
+      bucket[ibucket] = ikey;
+    } else pnext[ulast[ikey]] = i;
+    ulast[ikey] = i;
+    ucount[ikey]++;
+  }
 
-  stats("Convert",1);
-  if (!collateflag) fcounter_part = fcounter_set = 0;
+  // copy each key's values into one multivalue and call appcombine()
+  // valuesizes = lengths of all values, in multivalue order
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  char *multivalue = (char *) memory->smalloc(nvbytes,"MR:combine");
+  int *valuesizes = (int *) memory->smalloc(n*sizeof(int),"MR:combine");
+
+  uint64_t offset = 0;
+  int nvalues = 0;
+
+  for (ikey = 0; ikey < nunique; ikey++) {
+    uint64_t start = offset;
+    int istart = nvalues;
+    for (j = ufirst[ikey]; j >= 0; j = pnext[j]) {
+      memcpy(&multivalue[offset],vptr[j],vlen[j]);
+      offset += vlen[j];
+      valuesizes[nvalues++] = vlen[j];
+    }
+    j = ufirst[ikey];
+    appcombine(kptr[j],klen[j],&multivalue[start],ucount[ikey],
+	       &valuesizes[istart],kvc,combineptr);
+  }
+
+  if (kvc->npage) error->one("Combined pairs of a page exceed one page");
+
+  memory->sfree(kptr);
+  memory->sfree(vptr);
+  memory->sfree(klen);
+  memory->sfree(vlen);
+  memory->sfree(pnext);
+  memory->sfree(ufirst);
+  memory->sfree(ulast);
+  memory->sfree(ucount);
+  memory->sfree(unext);
+  memory->sfree(bucket);
+  memory->sfree(multivalue);
+  memory->sfree(valuesizes);
+
+  return kvc->nkey;
 }
 
 /* ----------------------------------------------------------------------
-   gather a distributed KV to a new KV on fewer procs
-   numprocs = # of procs new KV resides on (0 to numprocs-1)
+   broadcast the KV on proc root to all other procs
+   pages are streamed down a binomial tree, log(P) levels deep
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::gather(int numprocs)
+uint64_t MapReduce::broadcast(int root)
 {
-  int flag,npage_kv,memtag;
-  int nkey,rkey,skey,keybytes,valuebytes;
-  int sizes[4];
-  uint64_t dummy;
-  uint64_t keysize,valuesize,alignsize;
-  uint64_t rkeysize,rvaluesize,ralignsize;
-  uint64_t skeysize,svaluesize,salignsize;
-  char *buf,*rbuf,*sbuf,*ptr,*ptrprev;
-  MPI_Status status;
-  MPI_Request request;
-
-  if (kv == NULL) error->all("Cannot gather without KeyValue");
-  if (numprocs < 1 || numprocs > nprocs) 
-    error->all("Invalid processor count for gather");
+  if (kv == NULL) error->all("Cannot broadcast without KeyValue");
+  if (root < 0 || root >= nprocs) error->all("Invalid root for broadcast");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
-  if (nprocs == 1 || numprocs == nprocs) {
-    stats("Gather",0);
+  if (nprocs == 1) {
+    stats("Broadcast",0);
     uint64_t nkeyall;
     MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
     return nkeyall;
   }
 
-  // lo procs collect key/value pairs from hi procs
-  // lo procs are those with ID < numprocs
-  // lo procs recv from set of hi procs with same (ID % numprocs)
+  // binomial tree rooted at root, rank = my rank relative to root
+  // parent = rank with its lowest set bit cleared
+  // children = rank + mask for each mask below lowest set bit,
+  //   largest subtree first
 
   double timestart = MPI_Wtime();
 
-  if (me < numprocs) {
-    kv->append();
-    buf = mem_request(1,dummy,memtag);
+  int rank = (me - root + nprocs) % nprocs;
+  int lowbit = rank & -rank;
+  if (rank == 0) lowbit = nprocs;
 
-    for (int iproc = me+numprocs; iproc < nprocs; iproc += numprocs) {
-      MPI_Send(&flag,0,MPI_INT,iproc,0,comm);
-      MPI_Recv(&npage_kv,1,MPI_INT,iproc,0,comm,&status);
-      
-      for (int ipage = 0; ipage < npage_kv; ipage++) {
-	MPI_Send(&flag,0,MPI_INT,iproc,0,comm);
-	MPI_Recv(&nkey,1,MPI_INT,iproc,0,comm,&status);
-	rkey = 0;
-	rkeysize = svaluesize = salignsize = 0;
-	rbuf = buf;
-
-	// recv sections of pages that fit in INTMAX as required by MPI_Irecv
-
-	while (rkey < nkey) {
-	  MPI_Irecv(rbuf,INTMAX,MPI_BYTE,iproc,1,comm,&request);
-	  MPI_Send(&flag,0,MPI_INT,iproc,0,comm);
-	  MPI_Recv(sizes,4,MPI_INT,iproc,0,comm,&status);
-	  MPI_Wait(&request,&status);
-	  crsize += sizes[3];
-	  rkey += sizes[0];
-	  rkeysize += sizes[1];
-	  rvaluesize += sizes[2];
-	  ralignsize += sizes[3];
-	  kv->add(sizes[0],rbuf,
-		  (uint64_t) sizes[1],(uint64_t) sizes[2],(uint64_t) sizes[3]);
-	  rbuf += sizes[3];
-	}
-      }
-    }
+  int nchild = 0;
+  int children[32];
+  int mask = 1;
+  while (mask < lowbit && rank+mask < nprocs) mask <<= 1;
+  for (mask >>= 1; mask > 0; mask >>= 1)
+    if (mask < lowbit && rank+mask < nprocs)
+      children[nchild++] = (rank + mask + root) % nprocs;
 
-    mem_unmark(memtag);
+  // root streams its KV pages down the tree
+  // non-root procs replace their KV with pages streamed from parent,
+  //   forwarding each page to their children as it arrives
 
-  } else {
+  if (me == root) {
     kv->allocate();
-    npage_kv = kv->request_info(&buf);
-
-    int iproc = me % numprocs;
-    MPI_Recv(&flag,0,MPI_INT,iproc,0,comm,&status);
-    MPI_Send(&npage_kv,1,MPI_INT,iproc,0,comm);
-
-    for (int ipage = 0; ipage < npage_kv; ipage++) {
-      nkey = kv->request_page(ipage,keysize,valuesize,alignsize);
-      MPI_Recv(&flag,0,MPI_INT,iproc,0,comm,&status);
-      MPI_Send(&nkey,1,MPI_INT,iproc,0,comm);
-      skey = 0;
-      skeysize = svaluesize = salignsize = 0;
-      sbuf = buf;
-
-      // send sections of pages that fit in INTMAX as required by MPI_Send
-
-      while (skey < nkey) {
-	if (alignsize-salignsize <= INTMAX) {
-	  sizes[0] = nkey - skey;
-	  sizes[1] = keysize - skeysize;
-	  sizes[2] = valuesize - svaluesize;
-	  sizes[3] = alignsize - salignsize;
-
-	} else {
-	  sizes[0] = sizes[1] = sizes[2] = 0;
-	  ptr = sbuf;
-	  while (ptr-sbuf <= INTMAX) {
-	    ptrprev = ptr;
-	    keybytes = *((int *) ptr);
-	    valuebytes = *((int *) (ptr+sizeof(int)));;
-	    ptr += twolenbytes;
-	    ptr = ROUNDUP(ptr,kalignm1);
-	    ptr += keybytes;
-	    ptr = ROUNDUP(ptr,valignm1);
-	    ptr += valuebytes;
-	    ptr = ROUNDUP(ptr,talignm1);
-	    sizes[0]++;
-	    sizes[1] += keybytes;
-	    sizes[2] += valuebytes;
-	  }
-	  sizes[0]--;
-	  sizes[1] -= keybytes;
-	  sizes[2] -= valuebytes;
-	  sizes[3] = ptrprev - sbuf;;
-	}
-
-	MPI_Recv(&flag,0,MPI_INT,iproc,0,comm,&status);
-	MPI_Send(sizes,4,MPI_INT,iproc,0,comm);
-	MPI_Send(sbuf,sizes[3],MPI_BYTE,iproc,1,comm);
-	cssize += sizes[3];
-	skey += sizes[0];
-	skeysize += sizes[1];
-	svaluesize += sizes[2];
-	salignsize += sizes[3];
-	sbuf += sizes[3];
-      }
-    }
-
-    // leave empty KV on vacated procs
-
+    stream_kv(1,0,NULL,nchild,children,0);
+  } else {
+    int parent = (rank - lowbit + root) % nprocs;
     delete kv;
     kv = new KeyValue(this,kalign,valign,memory,error,comm);
+    stream_kv(0,1,&parent,nchild,children,1);
   }
 
   commtime += MPI_Wtime() - timestart;
-  kv->complete();
+  if (me != root) kv->complete();
+  else kv->complete_dummy();
   if (freepage) mem_cleanup();
 
-  stats("Gather",0);
+  stats("Broadcast",0);
 
   uint64_t nkeyall;
   MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
@@ -1001,148 +1660,48 @@ uint64_t MapReduce::gather(int numprocs)
 }
 
 /* ----------------------------------------------------------------------
-   user call: create a KV via a parallel map operation for nmap tasks
-   make one call to appmap() for each task
-   mapstyle determines how tasks are partitioned to processors
+   clone KV to KMV so that KMV pairs are one-to-one copies of KV pairs
+   each proc clones only its data
+   assume each KV key is unique, but is not required
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map(int nmap, void (*appmap)(int, KeyValue *, void *),
-			void *appptr, int addflag)
+uint64_t MapReduce::clone()
 {
-  return map_tasks(nmap,NULL,appmap,NULL,appptr,addflag,0);
-}
+  if (kv == NULL) error->all("Cannot clone without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-/* ----------------------------------------------------------------------
-   user call: create a KV via a parallel map operation on nstr file/dir names
-   input nstr/strings are used to generate list of filenames
-   selfflag = 0, just proc 0 generates file list and bcasts it
-   selfflag = 1, each proc generates its own file list
-------------------------------------------------------------------------- */
+  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
+  kv->allocate();
 
-uint64_t MapReduce::map(int nstr, char **strings,
-			int selfflag, int recurse, int readflag,
-			void (*appmap)(int, char *, KeyValue *, void *),
-			void *appptr, int addflag)
-{
-  int nfile = 0;
-  int maxfile = 0;
-  char **files = NULL;
+  kmv->clone(kv);
+  kmv->complete();
 
-  if (selfflag || me == 0)
-    for (int i = 0; i < nstr; i++)
-      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+  delete kv;
+  kv = NULL;
+  if (freepage) mem_cleanup();
 
-  if (selfflag == 0) bcastfiles(nfile,files);
-  if (selfflag) MPI_Allreduce(&nfile,&mapfilecount,1,MPI_INT,MPI_SUM,comm);
-  else mapfilecount = nfile;
+  stats("Clone",1);
 
-  uint64_t nkeyall = map_tasks(nfile,files,NULL,appmap,appptr,addflag,selfflag);
-  for (int i = 0; i < nfile; i++) delete [] files[i];
-  memory->sfree(files);
+  uint64_t nkeyall;
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   called by 2 user map methods above (task count, list of files)
-   assign out and process the tasks
-   ntasks can be generic (files = NULL), or number of files
-   make one call to two different flavors of appmap() for each task
-   mapstyle and selfflag determine how tasks are partitioned to processors
+   close a KV that KV pairs were added to by another MR's map()
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map_tasks(int ntask, char **files,
-			      void (*appmaptask)(int, KeyValue *, void *),
-			      void (*appmapfile)(int, char *, 
-						 KeyValue *, void *),
-			      void *appptr, int addflag, int selfflag)
+uint64_t MapReduce::close()
 {
-  MPI_Status status;
-
+  if (kv == NULL) error->all("Cannot close without KeyValue");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
-  if (!allocated) allocate();
-  delete kmv;
-  kmv = NULL;
-
-  if (addflag == 0) {
-    delete kv;
-    kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  } else if (kv == NULL) {
-    kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  } else {
-    kv->append();
-  }
-
-  // selfflag = 1 = each processor performs own tasks
-  // nprocs = 1 = all tasks to single processor
-  // mapstyle 0 = chunk of tasks to each proc
-  // mapstyle 1 = strided tasks to each proc
-  // mapstyle 2 = master/slave assignment of tasks
-
-  if (selfflag == 1 || nprocs == 1) {
-    for (int itask = 0; itask < ntask; itask++)
-      if (files) appmapfile(itask,files[itask],kv,appptr);
-      else appmaptask(itask,kv,appptr);
-
-  } else if (mapstyle == 0) {
-    uint64_t nmap64 = ntask;
-    int lo = me * nmap64 / nprocs;
-    int hi = (me+1) * nmap64 / nprocs;
-    for (int itask = lo; itask < hi; itask++)
-      if (files) appmapfile(itask,files[itask],kv,appptr);
-      else appmaptask(itask,kv,appptr);
-
-  } else if (mapstyle == 1) {
-    for (int itask = me; itask < ntask; itask += nprocs)
-      if (files) appmapfile(itask,files[itask],kv,appptr);
-      else appmaptask(itask,kv,appptr);
-
-  } else if (mapstyle == 2) {
-    if (me == 0) {
-      int doneflag = -1;
-      int ndone = 0;
-      int itask = 0;
-      for (int iproc = 1; iproc < nprocs; iproc++) {
-	if (itask < ntask) {
-	  MPI_Send(&itask,1,MPI_INT,iproc,0,comm);
-	  itask++;
-	} else {
-	  MPI_Send(&doneflag,1,MPI_INT,iproc,0,comm);
-	  ndone++;
-	}
-      }
-      while (ndone < nprocs-1) {
-	int iproc,tmp;
-	MPI_Recv(&tmp,1,MPI_INT,MPI_ANY_SOURCE,0,comm,&status);
-	iproc = status.MPI_SOURCE;
-
-	if (itask < ntask) {
-	  MPI_Send(&itask,1,MPI_INT,iproc,0,comm);
-	  itask++;
-	} else {
-	  MPI_Send(&doneflag,1,MPI_INT,iproc,0,comm);
-	  ndone++;
-	}
-      }
-
-    } else {
-      while (1) {
-	int itask;
-	MPI_Recv(&itask,1,MPI_INT,0,0,comm,&status);
-	if (itask < 0) break;
-	if (files) appmapfile(itask,files[itask],kv,appptr);
-	else appmaptask(itask,kv,appptr);
-	MPI_Send(&itask,1,MPI_INT,0,0,comm);
-      }
-    }
-
-  } else error->all("Invalid mapstyle setting");
-
   kv->complete();
   if (freepage) mem_cleanup();
 
-  stats("Map",0);
+  stats("Close",0);
 
   uint64_t nkeyall;
   MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
@@ -1150,903 +1709,2600 @@ uint64_t MapReduce::map_tasks(int ntask, char **files,
 }
 
 /* ----------------------------------------------------------------------
-   user call: create a KV via a parallel map operation on file splitting
-   nfile filenames are split into nmap pieces based on separator character
+   collapse KV into a KMV with a single key/value
+   each proc collapses only its data
+   new key = provided key name (same on every proc)
+   new value = list of old key,value,key,value,etc
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map(int nmap, int nstr, char **strings,
-			int recurse, int readflag,
-			char sepchar, int delta,
-			void (*appmap)(int, char *, int, KeyValue *, void *),
-			void *appptr, int addflag)
+uint64_t MapReduce::collapse(char *key, int keybytes)
 {
-  int nfile = 0;
-  int maxfile = 0;
-  char **files = NULL;
+  if (kv == NULL) error->all("Cannot collapse without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-  if (me == 0)
-    for (int i = 0; i < nstr; i++)
-      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
+  kv->allocate();
 
-  bcastfiles(nfile,files);
+  kmv->collapse(key,keybytes,kv);
+  kmv->complete();
 
-  filemap.sepwhich = 1;
-  filemap.sepchar = sepchar;
-  filemap.delta = delta;
+  delete kv;
+  kv = NULL;
+  if (freepage) mem_cleanup();
 
-  uint64_t nkeyall = map_chunks(nmap,nfile,files,appmap,appptr,addflag);
-  for (int i = 0; i < nfile; i++) delete [] files[i];
-  memory->sfree(files);
+  stats("Collapse",1);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   user call: create a KV via a parallel map operation on file splitting
-   nfile filenames are split into nmap pieces based on separator string
+   collate KV to create a KMV
+   aggregate followed by a convert
+   hash = user hash function (NULL if not provided)
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map(int nmap, int nstr, char **strings,
-			int recurse, int readflag,
-			char *sepstr, int delta,
-			void (*appmap)(int, char *, int, KeyValue *, void *),
-			void *appptr, int addflag)
+uint64_t MapReduce::collate(int (*hash)(char *, int))
 {
-  int nfile = 0;
-  int maxfile = 0;
-  char **files = NULL;
+  return collate(hash,NULL,NULL);
+}
 
-  if (me == 0)
-    for (int i = 0; i < nstr; i++)
-      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+/* ----------------------------------------------------------------------
+   collate KV to create a KMV
+   appcombine = user function passed to aggregate() (NULL if not provided)
+------------------------------------------------------------------------- */
 
-  bcastfiles(nfile,files);
+uint64_t MapReduce::collate(int (*hash)(char *, int),
+			    void (*appcombine)(char *, int, char *,
+					       int, int *, KeyValue *, void *),
+			    void *appptr)
+{
+  if (kv == NULL) error->all("Cannot collate without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-  filemap.sepwhich = 0;
-  int n = strlen(sepstr) + 1;
-  filemap.sepstr = new char[n];
-  strcpy(filemap.sepstr,sepstr);
-  filemap.delta = delta;
+  collateflag = 1;
+  int verbosity_hold = verbosity;
+  int timer_hold = timer;
+  verbosity = timer = 0;
 
-  uint64_t nkeyall = map_chunks(nmap,nfile,files,appmap,appptr,addflag);
-  for (int i = 0; i < nfile; i++) delete [] files[i];
-  memory->sfree(files);
+  aggregate(hash,appcombine,appptr);
+  convert();
+
+  verbosity = verbosity_hold;
+  timer = timer_hold;
+  stats("Collate",1);
+  collateflag = 0;
+  fcounter_part = fcounter_set = 0;
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   called by 2 user map methods above (char/str separator for splitting files)
-   nfile filenames are split into nmap pieces based on separator
-   FileMap struct stores info on how to split files
-   calls non-file map() to partition tasks to processors
-     with callback to non-class map_file_standalone()
-   map_file_standalone() reads chunk of file and passes it to user appmap()
+   compress KV to create a smaller KV
+   duplicate keys are replaced with a single key/value
+   each proc compresses only its data
+   create a KMV temporarily
+   call appcompress() with each key/multivalue in KMV
+   appcompress() returns single key/value to new KV
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map_chunks(int nmap, int nfile, char **files,
-			       void (*appmap)(int, char *, 
-					      int, KeyValue *, void *),
-			       void *appptr, int addflag)
+uint64_t MapReduce::compress(void (*appcompress)(char *, int, char *, int,
+						 int *, KeyValue *, void *),
+			     void *appptr)
 {
+  if (kv == NULL) error->all("Cannot compress without KeyValue");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
-  if (!allocated) allocate();
-  delete kmv;
+  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
+  kv->allocate();
+
+  // convert KV into KMV
+  // KMV convert will delete kv
+
+  kmv->convert(kv);
+  kmv->complete();
+  if (freepage) mem_cleanup();
+
+  // create new KV
+
+  kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  kmv->allocate();
+
+  uint64_t dummy;
+  int memtag1,memtag2;
+  char *mvpage1 = mem_request(1,dummy,memtag1);
+  char *mvpage2 = mem_request(1,dummy,memtag2);
+
+  int nkey_kmv,nvalues,keybytes,mvaluebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  int *valuesizes;
+  char *ptr,*key,*multivalue;
+
+  char *page_kmv;
+  int npage_kmv = kmv->request_info(&page_kmv);
+  char *page_hold = page_kmv;
+
+  for (int ipage = 0; ipage < npage_kmv; ipage++) {
+    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
+    ptr = page_kmv;
+
+    for (int i = 0; i < nkey_kmv; i++) {
+      nvalues = *((int *) ptr);
+      ptr += sizeof(int);
+
+      if (nvalues > 0) {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	mvaluebytes = *((int *) ptr);
+	ptr += sizeof(int);
+	valuesizes = (int *) ptr;
+	ptr += ((uint64_t) nvalues) * sizeof(int);
+	
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
+	ptr += keybytes;
+	ptr = ROUNDUP(ptr,valignm1);
+	multivalue = ptr;
+	ptr += mvaluebytes;
+	ptr = ROUNDUP(ptr,talignm1);
+	
+	appcompress(key,keybytes,multivalue,nvalues,valuesizes,kv,appptr);
+
+      } else {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
+
+	// set KMV page to mvpage1 so key will not be overwritten
+	// when multivalue_block() loads new pages of values
+
+	kmv_block_valid = 1;
+	kmv_key_page = ipage;
+	kmv_mvpage1 = mvpage1;
+	kmv_mvpage2 = mvpage2;
+	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
+	kmv->page = mvpage1;
+	appcompress(key,keybytes,NULL,0,(int *) this,kv,appptr);
+	kmv_block_valid = 0;
+	ipage += kmv_nblock;
+	kmv->page = page_hold;
+      }
+    }
+  }
+
+  kv->complete();
+  mem_unmark(memtag1);
+  mem_unmark(memtag2);
+
+  // delete KMV
+
+  delete kmv;
   kmv = NULL;
+  if (freepage) mem_cleanup();
 
-  // must have at least as many chunks as files
+  stats("Compress",0);
+  fcounter_part = fcounter_set = 0;
 
-  if (nfile > nmap) nmap = nfile;
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
 
-  // copy filenames into FileMap
+/* ----------------------------------------------------------------------
+   convert KV to KMV
+   duplicate keys are replaced with a single key/multivalue
+   each proc converts only its data
+   new key = old unique key
+   new multivalue = concatenated list of all values for that key in KV
+------------------------------------------------------------------------- */
 
-  filemap.filename = new char*[nfile];
-  for (int i = 0; i < nfile; i++) {
-    int n = strlen(files[i]) + 1;
-    filemap.filename[i] = new char[n];
-    strcpy(filemap.filename[i],files[i]);
+uint64_t MapReduce::convert()
+{
+  if (kv == NULL) error->all("Cannot convert without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kmv = new KeyMultiValue(this,kalign,valign,memory,error,comm);
+  kv->allocate();
+
+  // KMV will delete kv and free its memory
+
+  kmv->convert(kv);
+  kmv->complete();
+  kv = NULL;
+  if (freepage) mem_cleanup();
+
+  stats("Convert",1);
+  if (!collateflag) fcounter_part = fcounter_set = 0;
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   gather a distributed KV to a new KV on fewer procs
+   numprocs = # of procs new KV resides on (0 to numprocs-1)
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::gather(int numprocs)
+{
+  if (kv == NULL) error->all("Cannot gather without KeyValue");
+  if (numprocs < 1 || numprocs > nprocs) 
+    error->all("Invalid processor count for gather");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (nprocs == 1 || numprocs == nprocs) {
+    stats("Gather",0);
+    uint64_t nkeyall;
+    MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+    return nkeyall;
   }
 
-  // get filesize of each file via stat()
-  // proc 0 queries files, bcasts results to all procs
+  // lo procs collect key/value pairs from hi procs
+  // lo procs are those with ID < numprocs
+  // lo procs collect from set of hi procs with same (ID % numprocs)
+  // each set is a binomial tree, rank = ID / numprocs, lo proc is rank 0
+  // parent = rank with its lowest set bit cleared
+  // children = rank + mask for each mask below lowest set bit,
+  //   smallest first, so pairs arrive in ascending proc order
 
-  filemap.filesize = new uint64_t[nfile];
-  struct stat stbuf;
+  double timestart = MPI_Wtime();
 
-  if (me == 0) {
-    for (int i = 0; i < nfile; i++) {
-      int flag = stat(files[i],&stbuf);
-      if (flag < 0) error->one("Could not query file size");
-      filemap.filesize[i] = stbuf.st_size;
-    }
+  int iset = me % numprocs;
+  int rank = me / numprocs;
+  int nrank = (nprocs - iset + numprocs-1) / numprocs;
+  int lowbit = rank & -rank;
+  if (rank == 0) lowbit = nrank;
+
+  int nchild = 0;
+  int children[32];
+  for (int mask = 1; mask < lowbit && rank+mask < nrank; mask <<= 1)
+    children[nchild++] = (rank+mask)*numprocs + iset;
+
+  // lo procs add pages streamed from their children to their KV
+  // hi procs stream their own pages, then their children's, to parent
+
+  if (me < numprocs) {
+    kv->append();
+    stream_kv(0,nchild,children,0,NULL,1);
+
+  } else {
+    int parent = (rank-lowbit)*numprocs + iset;
+    kv->allocate();
+    stream_kv(1,nchild,children,1,&parent,0);
+
+    // leave empty KV on vacated procs
+
+    delete kv;
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
   }
 
-  MPI_Bcast(filemap.filesize,nfile*sizeof(uint64_t),MPI_BYTE,0,comm);
+  commtime += MPI_Wtime() - timestart;
+  kv->complete();
+  if (freepage) mem_cleanup();
 
-  // ntotal = total size of all files
-  // nideal = ideal # of bytes per task
+  stats("Gather",0);
 
-  uint64_t ntotal = 0;
-  for (int i = 0; i < nfile; i++) ntotal += filemap.filesize[i];
-  uint64_t nideal = MAX(1,ntotal/nmap);
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
 
-  // tasksperfile[i] = # of tasks for Ith file
-  // initial assignment based on ideal chunk size
-  // increment/decrement tasksperfile until reach target # of tasks
-  // even small files must have 1 task
+/* ----------------------------------------------------------------------
+   stream KV pages from my KV and/or procs in src to procs in dest
+   used by gather() and broadcast() to move pages along a tree
+   selfflag = 1 to send pages of my KV first, caller has allocated it
+   src = procs whose streams are relayed in order after my pages
+   addflag = 1 to add each relayed page to my KV
+   a stream is a page count, then per page 4 sizes and the page bytes,
+     in a fixed # of pieces that fit in INTMAX as required by MPI
+   pages alternate between 2 buffers, so while one page is sent
+     via nonblocking sends, the next is received or read from my KV
+------------------------------------------------------------------------- */
 
-  filemap.tasksperfile = new int[nfile];
+void MapReduce::stream_kv(int selfflag, int nsrc, int *src,
+			  int ndest, int *dest, int addflag)
+{
+  int i,j,k,b,memtag;
+  uint64_t dummy,offset,nbytes;
+  char *page_kv;
+  MPI_Status status;
 
-  int ntasks = 0;
-  for (int i = 0; i < nfile; i++) {
-    filemap.tasksperfile[i] = MAX(1,filemap.filesize[i]/nideal);
-    ntasks += filemap.tasksperfile[i];
+  int npiece = (pagesize + INTMAX-1) / INTMAX;
+
+  // page counts of my KV and of each src stream
+  // forward total count to each dest
+
+  int npage_self = 0;
+  if (selfflag) npage_self = kv->request_info(&page_kv);
+
+  uint64_t npage,ntotal;
+  int *srcpage = new int[nsrc];
+  ntotal = npage_self;
+  for (i = 0; i < nsrc; i++) {
+    MPI_Recv(&npage,1,MRMPI_BIGINT,src[i],0,comm,&status);
+    srcpage[i] = npage;
+    ntotal += npage;
   }
+  for (i = 0; i < ndest; i++) 
+    MPI_Send(&ntotal,1,MRMPI_BIGINT,dest[i],0,comm);
 
-  while (ntasks < nmap)
-    for (int i = 0; i < nfile; i++)
-      if (filemap.filesize[i] > nideal) {
-	filemap.tasksperfile[i]++;
-	ntasks++;
-	if (ntasks == nmap) break;
+  if (ntotal == 0) {
+    delete [] srcpage;
+    return;
+  }
+
+  // 2 page buffers with their sizes, data ptrs, and pending requests
+
+  char *bufs = mem_request(2,dummy,memtag);
+  char *buf[2],*data[2];
+  uint64_t sizes[2][4];
+  buf[0] = bufs;
+  buf[1] = &bufs[pagesize];
+
+  int nsreq[2],nrreq[2];
+  MPI_Request *sreq[2],*rreq[2];
+  for (b = 0; b < 2; b++) {
+    nsreq[b] = nrreq[b] = 0;
+    sreq[b] = new MPI_Request[ndest*(npiece+1)];
+    rreq[b] = new MPI_Request[npiece+1];
+  }
+
+  // loop over pages of stream, start fetching page K+1 before using page K
+  // iproc/ipage = src and page within src of next page to fetch
+
+  int iproc = 0;
+  int ipage = 0;
+
+  int nstream = ntotal;
+
+  for (k = 0; k <= nstream; k++) {
+
+    // fetch page K into buffer K%2, once sends from that buffer are done
+    // my pages are copied to buffer, unless page_kv is never reloaded
+
+    if (k < nstream) {
+      b = k % 2;
+      MPI_Waitall(nsreq[b],sreq[b],MPI_STATUSES_IGNORE);
+      nsreq[b] = 0;
+
+      if (k < npage_self) {
+	sizes[b][0] = kv->request_page(k,sizes[b][1],sizes[b][2],sizes[b][3]);
+	if (npage_self > 1) {
+	  memcpy(buf[b],page_kv,sizes[b][3]);
+	  data[b] = buf[b];
+	} else data[b] = page_kv;
+
+      } else {
+	while (ipage == srcpage[iproc]) {
+	  iproc++;
+	  ipage = 0;
+	}
+	MPI_Irecv(sizes[b],4,MRMPI_BIGINT,src[iproc],0,comm,&rreq[b][0]);
+	nrreq[b] = 1;
+	for (j = 0; j < npiece; j++) {
+	  offset = (uint64_t) j * INTMAX;
+	  nbytes = MIN(pagesize-offset,INTMAX);
+	  MPI_Irecv(&buf[b][offset],nbytes,MPI_BYTE,src[iproc],1,comm,
+		    &rreq[b][nrreq[b]++]);
+	}
+	data[b] = buf[b];
+	ipage++;
       }
-  while (ntasks > nmap)
-    for (int i = 0; i < nfile; i++)
-      if (filemap.tasksperfile[i] > 1) {
-	filemap.tasksperfile[i]--;
-	ntasks--;
-	if (ntasks == nmap) break;
+    }
+
+    // page K-1 is complete when its recvs are done
+    // send it to each dest and add it to my KV
+
+    if (k == 0) continue;
+    b = (k-1) % 2;
+    MPI_Waitall(nrreq[b],rreq[b],MPI_STATUSES_IGNORE);
+    if (k-1 >= npage_self) crsize += sizes[b][3];
+    nrreq[b] = 0;
+
+    for (i = 0; i < ndest; i++) {
+      MPI_Isend(sizes[b],4,MRMPI_BIGINT,dest[i],0,comm,&sreq[b][nsreq[b]++]);
+      for (j = 0; j < npiece; j++) {
+	offset = (uint64_t) j * INTMAX;
+	nbytes = 0;
+	if (offset < sizes[b][3]) nbytes = MIN(sizes[b][3]-offset,INTMAX);
+	MPI_Isend(&data[b][offset],nbytes,MPI_BYTE,dest[i],1,comm,
+		  &sreq[b][nsreq[b]++]);
       }
+      cssize += sizes[b][3];
+    }
 
-  // check if any tasks are so small they will cause overlapping reads w/ delta
-  // if so, reduce number of tasks for that file and issue warning
+    if (addflag) kv->add(sizes[b][0],data[b],
+			 sizes[b][1],sizes[b][2],sizes[b][3]);
+  }
 
-  int flag = 0;
-  for (int i = 0; i < nfile; i++) {
-    if (filemap.filesize[i] / filemap.tasksperfile[i] > filemap.delta)
-      continue;
-    flag = 1;
-    while (filemap.tasksperfile[i] > 1) {
-      filemap.tasksperfile[i]--;
-      nmap--;
-      if (filemap.filesize[i] / filemap.tasksperfile[i] > filemap.delta) break;
-    }
+  for (b = 0; b < 2; b++) {
+    MPI_Waitall(nsreq[b],sreq[b],MPI_STATUSES_IGNORE);
+    delete [] sreq[b];
+    delete [] rreq[b];
   }
+  delete [] srcpage;
+  mem_unmark(memtag);
+}
+
+/* ----------------------------------------------------------------------
+   user call: create a KV via a parallel map operation for nmap tasks
+   make one call to appmap() for each task
+   mapstyle determines how tasks are partitioned to processors
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map(int nmap, void (*appmap)(int, KeyValue *, void *),
+			void *appptr, int addflag)
+{
+  return map_tasks(nmap,NULL,appmap,NULL,appptr,addflag,0);
+}
+
+/* ----------------------------------------------------------------------
+   user call: create a KV via a parallel map operation on nstr file/dir names
+   input nstr/strings are used to generate list of filenames
+   selfflag = 0, just proc 0 generates file list and bcasts it
+   selfflag = 1, each proc generates its own file list
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map(int nstr, char **strings,
+			int selfflag, int recurse, int readflag,
+			void (*appmap)(int, char *, KeyValue *, void *),
+			void *appptr, int addflag)
+{
+  int nfile = 0;
+  int maxfile = 0;
+  char **files = NULL;
+
+  if (selfflag || me == 0)
+    for (int i = 0; i < nstr; i++)
+      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+
+  if (selfflag == 0) bcastfiles(nfile,files);
+  if (selfflag) MPI_Allreduce(&nfile,&mapfilecount,1,MPI_INT,MPI_SUM,comm);
+  else mapfilecount = nfile;
+
+  uint64_t nkeyall = map_tasks(nfile,files,NULL,appmap,appptr,addflag,selfflag);
+  for (int i = 0; i < nfile; i++) delete [] files[i];
+  memory->sfree(files);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   called by 2 user map methods above (task count, list of files)
+   assign out and process the tasks
+   ntasks can be generic (files = NULL), or number of files
+   make one call to two different flavors of appmap() for each task
+   mapstyle and selfflag determine how tasks are partitioned to processors
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map_tasks(int ntask, char **files,
+			      void (*appmaptask)(int, KeyValue *, void *),
+			      void (*appmapfile)(int, char *, 
+						 KeyValue *, void *),
+			      void *appptr, int addflag, int selfflag)
+{
+  MPI_Status status;
+
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  if (addflag == 0) {
+    delete kv;
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  } else if (kv == NULL) {
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  } else {
+    kv->append();
+  }
+
+  // selfflag = 1 = each processor performs own tasks
+  // nprocs = 1 = all tasks to single processor
+  // mapstyle 0 = chunk of tasks to each proc
+  // mapstyle 1 = strided tasks to each proc
+  // mapstyle 2 = master/slave assignment of tasks
+
+  if (selfflag == 1 || nprocs == 1) {
+    for (int itask = 0; itask < ntask; itask++)
+      if (files) appmapfile(itask,files[itask],kv,appptr);
+      else appmaptask(itask,kv,appptr);
+
+  } else if (mapstyle == 0) {
+    uint64_t nmap64 = ntask;
+    int lo = me * nmap64 / nprocs;
+    int hi = (me+1) * nmap64 / nprocs;
+    for (int itask = lo; itask < hi; itask++)
+      if (files) appmapfile(itask,files[itask],kv,appptr);
+      else appmaptask(itask,kv,appptr);
+
+  } else if (mapstyle == 1) {
+    for (int itask = me; itask < ntask; itask += nprocs)
+      if (files) appmapfile(itask,files[itask],kv,appptr);
+      else appmaptask(itask,kv,appptr);
+
+  } else if (mapstyle == 2) {
+    if (me == 0) {
+      int doneflag = -1;
+      int ndone = 0;
+      int itask = 0;
+      for (int iproc = 1; iproc < nprocs; iproc++) {
+	if (itask < ntask) {
+	  MPI_Send(&itask,1,MPI_INT,iproc,0,comm);
+	  itask++;
+	} else {
+	  MPI_Send(&doneflag,1,MPI_INT,iproc,0,comm);
+	  ndone++;
+	}
+      }
+      while (ndone < nprocs-1) {
+	int iproc,tmp;
+	MPI_Recv(&tmp,1,MPI_INT,MPI_ANY_SOURCE,0,comm,&status);
+	iproc = status.MPI_SOURCE;
+
+	if (itask < ntask) {
+	  MPI_Send(&itask,1,MPI_INT,iproc,0,comm);
+	  itask++;
+	} else {
+	  MPI_Send(&doneflag,1,MPI_INT,iproc,0,comm);
+	  ndone++;
+	}
+      }
+
+    } else {
+      while (1) {
+	int itask;
+	MPI_Recv(&itask,1,MPI_INT,0,0,comm,&status);
+	if (itask < 0) break;
+	if (files) appmapfile(itask,files[itask],kv,appptr);
+	else appmaptask(itask,kv,appptr);
+	MPI_Send(&itask,1,MPI_INT,0,0,comm);
+      }
+    }
+
+  } else error->all("Invalid mapstyle setting");
+
+  kv->complete();
+  if (freepage) mem_cleanup();
+
+  stats("Map",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   user call: create a KV via a parallel map operation on file splitting
+   nfile filenames are split into nmap pieces based on separator character
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map(int nmap, int nstr, char **strings,
+			int recurse, int readflag,
+			char sepchar, int delta,
+			void (*appmap)(int, char *, int, KeyValue *, void *),
+			void *appptr, int addflag)
+{
+  int nfile = 0;
+  int maxfile = 0;
+  char **files = NULL;
+
+  if (me == 0)
+    for (int i = 0; i < nstr; i++)
+      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+
+  bcastfiles(nfile,files);
+
+  filemap.sepwhich = 1;
+  filemap.sepchar = sepchar;
+  filemap.delta = delta;
+
+  uint64_t nkeyall = map_chunks(nmap,nfile,files,appmap,appptr,addflag);
+  for (int i = 0; i < nfile; i++) delete [] files[i];
+  memory->sfree(files);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   user call: create a KV via a parallel map operation on file splitting
+   nfile filenames are split into nmap pieces based on separator string
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map(int nmap, int nstr, char **strings,
+			int recurse, int readflag,
+			char *sepstr, int delta,
+			void (*appmap)(int, char *, int, KeyValue *, void *),
+			void *appptr, int addflag)
+{
+  int nfile = 0;
+  int maxfile = 0;
+  char **files = NULL;
+
+  if (me == 0)
+    for (int i = 0; i < nstr; i++)
+      findfiles(strings[i],recurse,readflag,nfile,maxfile,files);
+
+  bcastfiles(nfile,files);
+
+  filemap.sepwhich = 0;
+  int n = strlen(sepstr) + 1;
+  filemap.sepstr = new char[n];
+  strcpy(filemap.sepstr,sepstr);
+  filemap.delta = delta;
+
+  uint64_t nkeyall = map_chunks(nmap,nfile,files,appmap,appptr,addflag);
+  for (int i = 0; i < nfile; i++) delete [] files[i];
+  memory->sfree(files);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   called by 2 user map methods above (char/str separator for splitting files)
+   nfile filenames are split into nmap pieces based on separator
+   FileMap struct stores info on how to split files
+   calls non-file map() to partition tasks to processors
+     with callback to non-class map_file_standalone()
+   map_file_standalone() reads chunk of file and passes it to user appmap()
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map_chunks(int nmap, int nfile, char **files,
+			       void (*appmap)(int, char *, 
+					      int, KeyValue *, void *),
+			       void *appptr, int addflag)
+{
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  // must have at least as many chunks as files
+
+  if (nfile > nmap) nmap = nfile;
+
+  // copy filenames into FileMap
+
+  filemap.filename = new char*[nfile];
+  for (int i = 0; i < nfile; i++) {
+    int n = strlen(files[i]) + 1;
+    filemap.filename[i] = new char[n];
+    strcpy(filemap.filename[i],files[i]);
+  }
+
+  // get filesize of each file via stat()
+  // proc 0 queries files, bcasts results to all procs
+
+  filemap.filesize = new uint64_t[nfile];
+  struct stat stbuf;
+
+  if (me == 0) {
+    for (int i = 0; i < nfile; i++) {
+      int flag = stat(files[i],&stbuf);
+      if (flag < 0) error->one("Could not query file size");
+      filemap.filesize[i] = stbuf.st_size;
+    }
+  }
+
+  MPI_Bcast(filemap.filesize,nfile*sizeof(uint64_t),MPI_BYTE,0,comm);
+
+  // ntotal = total size of all files
+  // nideal = ideal # of bytes per task
+
+  uint64_t ntotal = 0;
+  for (int i = 0; i < nfile; i++) ntotal += filemap.filesize[i];
+  uint64_t nideal = MAX(1,ntotal/nmap);
+
+  // tasksperfile[i] = # of tasks for Ith file
+  // initial assignment based on ideal chunk size
+  // increment/decrement tasksperfile until reach target # of tasks
+  // even small files must have 1 task
+
+  filemap.tasksperfile = new int[nfile];
+
+  int ntasks = 0;
+  for (int i = 0; i < nfile; i++) {
+    filemap.tasksperfile[i] = MAX(1,filemap.filesize[i]/nideal);
+    ntasks += filemap.tasksperfile[i];
+  }
+
+  while (ntasks < nmap)
+    for (int i = 0; i < nfile; i++)
+      if (filemap.filesize[i] > nideal) {
+	filemap.tasksperfile[i]++;
+	ntasks++;
+	if (ntasks == nmap) break;
+      }
+  while (ntasks > nmap)
+    for (int i = 0; i < nfile; i++)
+      if (filemap.tasksperfile[i] > 1) {
+	filemap.tasksperfile[i]--;
+	ntasks--;
+	if (ntasks == nmap) break;
+      }
+
+  // check if any tasks are so small they will cause overlapping reads w/ delta
+  // if so, reduce number of tasks for that file and issue warning
+
+  int flag = 0;
+  for (int i = 0; i < nfile; i++) {
+    if (filemap.filesize[i] / filemap.tasksperfile[i] > filemap.delta)
+      continue;
+    flag = 1;
+    while (filemap.tasksperfile[i] > 1) {
+      filemap.tasksperfile[i]--;
+      nmap--;
+      if (filemap.filesize[i] / filemap.tasksperfile[i] > filemap.delta) break;
+    }
+  }
+
+  if (flag & me == 0) {
+    char str[128];
+    sprintf(str,"File(s) too small for file delta - decreased map tasks to %d",
+	    nmap);
+    error->warning(str);
+  }
+
+  // whichfile[i] = which file is associated with the Ith task
+  // whichtask[i] = which task in that file the Ith task is
+
+  filemap.whichfile = new int[nmap];
+  filemap.whichtask = new int[nmap];
+
+  int itask = 0;
+  for (int i = 0; i < nfile; i++)
+    for (int j = 0; j < filemap.tasksperfile[i]; j++) {
+      filemap.whichfile[itask] = i;
+      filemap.whichtask[itask++] = j;
+    }
+
+  // use non-file map() to partition tasks to procs
+  // it calls map_file_standalone once for each task
+
+  int verbosity_hold = verbosity;
+  int timer_hold = timer;
+  verbosity = timer = 0;
+
+  filemap.appmapfile = appmap;
+  filemap.appptr = appptr;
+  map(nmap,&map_file_standalone,this,addflag);
+
+  verbosity = verbosity_hold;
+  timer = timer_hold;
+  stats("Map",0);
+
+  // destroy FileMap
+
+  if (filemap.sepwhich == 0) delete [] filemap.sepstr;
+  for (int i = 0; i < nfile; i++) delete [] filemap.filename[i];
+  delete [] filemap.filename;
+  delete [] filemap.filesize;
+  delete [] filemap.tasksperfile;
+  delete [] filemap.whichfile;
+  delete [] filemap.whichtask;
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   wrappers on user-provided appmapfile function
+   2-level wrapper needed b/c file map() calls non-file map()
+     and cannot pass it a class method unless it were static,
+     but then it couldn't access MR class data
+   so non-file map() is passed standalone non-class method
+   standalone calls back into class wrapper which calls user appmapfile()
+------------------------------------------------------------------------- */
+
+void map_file_standalone(int imap, KeyValue *kv, void *ptr)
+{
+  MapReduce *mr = (MapReduce *) ptr;
+  mr->map_file_wrapper(imap,kv);
+}
+
+void MapReduce::map_file_wrapper(int imap, KeyValue *kv)
+{
+  // readstart = position in file to start reading for this task
+  // readsize = # of bytes to read including delta
+
+  uint64_t filesize = filemap.filesize[filemap.whichfile[imap]];
+  int itask = filemap.whichtask[imap];
+  int ntask = filemap.tasksperfile[filemap.whichfile[imap]];
+
+  uint64_t readstart = itask*filesize/ntask;
+  uint64_t readnext = (itask+1)*filesize/ntask;
+  if (readnext - readstart + filemap.delta + 1 > INTMAX)
+    error->one("Single file read exceeds int size");
+  int readsize = readnext - readstart + filemap.delta;
+  readsize = MIN(readsize,filesize-readstart);
+
+  // read from appropriate file
+  // terminate string with NULL
+
+  char *str = (char *) memory->smalloc(readsize+1,"MR:fileread");
+  FILE *fp = fopen(filemap.filename[filemap.whichfile[imap]],"rb");
+  fseek(fp,readstart,SEEK_SET);
+  fread(str,1,readsize,fp);
+  str[readsize] = '\0';
+  fclose(fp);
+
+  // if not first task in file, trim start of string
+  // separator can be single char or a string
+  // str[strstart] = 1st char in string
+  // if separator = char, strstart is char after separator
+  // if separator = string, strstart is 1st char of separator
+
+  int strstart = 0;
+  if (itask > 0) {
+    char *ptr;
+    if (filemap.sepwhich) ptr = strchr(str,filemap.sepchar);
+    else ptr = strstr(str,filemap.sepstr);
+    if (ptr == NULL || ptr-str > filemap.delta)
+      error->one("Could not find file separator within delta");
+    strstart = ptr-str + filemap.sepwhich;
+  }
+
+  // if not last task in file, trim end of string
+  // separator can be single char or a string
+  // str[strstop] = last char in string = inserted NULL
+  // if separator = char, NULL is char after separator
+  // if separator = string, NULL is 1st char of separator
+
+  int strstop = readsize;
+  if (itask < ntask-1) {
+    char *ptr;
+    if (filemap.sepwhich) 
+      ptr = strchr(&str[readnext-readstart],filemap.sepchar);
+    else 
+      ptr = strstr(&str[readnext-readstart],filemap.sepstr);
+    if (ptr == NULL) error->one("Could not find file separator within delta");
+    if (filemap.sepwhich) ptr++;
+    *ptr = '\0';
+    strstop = ptr-str;
+  }
+
+  // call user appmapfile() function with user data ptr
+
+  int strsize = strstop - strstart + 1;
+  filemap.appmapfile(imap,&str[strstart],strsize,kv,filemap.appptr);
+  memory->sfree(str);
+}
+
+/* ----------------------------------------------------------------------
+   user call: create a KV via a parallel map operation on an existing MR's KV
+   make one call to appmap() for each key/value pair in the input MR's KV
+   each proc operates on key/value pairs it owns
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map(MapReduce *mr, 
+			void (*appmap)(uint64_t, char *, int, char *, int, 
+				       KeyValue *, void *),
+			void *appptr, int addflag)
+{
+  if (mr->kv == NULL)
+    error->all("MapReduce passed to map() does not have KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  // kv_src = KeyValue object which sends KV pairs to appmap()
+  // kv_dest = KeyValue object which stores new KV pairs
+  // if mr = this, then 2 KVs are the same:
+  //   if addflag, make copy so can add to it, delete kv_src at end
+  //   if not addflag, add to new KV, delete kv_src at end
+
+  KeyValue *kv_src = mr->kv;
+  kv_src->allocate();
+  KeyValue *kv_dest;
+
+  if (mr == this) {
+    if (addflag) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+      kv_dest->copy(kv_src);
+      kv_dest->append();
+    } else {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    }
+  } else {
+    if (addflag == 0) {
+      delete kv;
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else if (kv == NULL) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else {
+      kv->append();
+      kv_dest = kv;
+    }
+  }
+
+  int nkey_kv,keybytes,valuebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv,*ptr,*key,*value;
+  int npage_kv = kv_src->request_info(&page_kv);
+  uint64_t n = 0;
+
+  callback.style = MAPKV;
+  callback.appmap = appmap;
+  callback.appptr = appptr;
+  callback.kfixed = kv_src->kfixed;
+  callback.vfixed = kv_src->vfixed;
+  pool_create();
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv_src->request_page(ipage,dummy1,dummy2,dummy3);
+    if (pool_page(page_kv,nkey_kv,n,kv_dest)) {
+      n += nkey_kv;
+      continue;
+    }
+    ptr = page_kv;
+
+    for (int i = 0; i < nkey_kv; i++) {
+      if (kv_src->kfixed) {
+	keybytes = kv_src->kfixed;
+	valuebytes = kv_src->vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
+      ptr = ROUNDUP(ptr,kalignm1);
+      key = ptr;
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      value = ptr;
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1);
+
+      appmap(n++,key,keybytes,value,valuebytes,kv_dest,appptr);
+    }
+  }
+
+  pool_destroy();
+  if (mr == this) delete kv_src;
+  else kv_src->deallocate(0);
+  kv = kv_dest;
+  kv->complete();
+  if (freepage) mem_cleanup();
+
+  stats("Map",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   map fixed-size key/value pairs of an existing KV to a KV
+   input mr must have fixedkey/fixedvalue settings
+   make one call to appmap() for each page of KV pairs
+   appmap() gets index of first pair, # of pairs, ptr to first key and value,
+     and stride between successive keys or values
+   each proc operates on key/value pairs it owns
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map_fixed(MapReduce *mr,
+			      void (*appmap)(uint64_t, int, char *, char *, int,
+					     KeyValue *, void *),
+			      void *appptr, int addflag)
+{
+  if (mr->kv == NULL)
+    error->all("MapReduce passed to map() does not have KeyValue");
+  if (mr->kv->kfixed == 0)
+    error->all("MapReduce passed to map_fixed() does not have "
+	       "fixed-size key/values");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  // kv_src,kv_dest same as in map(mr)
+
+  KeyValue *kv_src = mr->kv;
+  kv_src->allocate();
+  KeyValue *kv_dest;
+
+  if (mr == this) {
+    if (addflag) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+      kv_dest->copy(kv_src);
+      kv_dest->append();
+    } else {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    }
+  } else {
+    if (addflag == 0) {
+      delete kv;
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else if (kv == NULL) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else {
+      kv->append();
+      kv_dest = kv;
+    }
+  }
+
+  int nkey_kv;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv;
+  int npage_kv = kv_src->request_info(&page_kv);
+  int voffset = kv_src->voffset;
+  int stride = kv_src->fixedbytes;
+  uint64_t n = 0;
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv_src->request_page(ipage,dummy1,dummy2,dummy3);
+    appmap(n,nkey_kv,page_kv,page_kv+voffset,stride,kv_dest,appptr);
+    n += nkey_kv;
+  }
+
+  if (mr == this) delete kv_src;
+  else kv_src->deallocate(0);
+  kv = kv_dest;
+  kv->complete();
+  if (freepage) mem_cleanup();
+
+  stats("Map",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   map KV pairs of an existing KV to a KV, one page of pairs at a time
+   make one call to appmap() for each page of KV pairs
+   appmap() gets index of first pair, # of pairs,
+     and vectors of key ptrs, key lengths, value ptrs, value lengths
+   each proc operates on key/value pairs it owns
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::map_batch(MapReduce *mr,
+			      void (*appmap)(uint64_t, int, char **, int *,
+					     char **, int *,
+					     KeyValue *, void *),
+			      void *appptr, int addflag)
+{
+  if (mr->kv == NULL)
+    error->all("MapReduce passed to map() does not have KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  // kv_src,kv_dest same as in map(mr)
+
+  KeyValue *kv_src = mr->kv;
+  kv_src->allocate();
+  KeyValue *kv_dest;
+
+  if (mr == this) {
+    if (addflag) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+      kv_dest->copy(kv_src);
+      kv_dest->append();
+    } else {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    }
+  } else {
+    if (addflag == 0) {
+      delete kv;
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else if (kv == NULL) {
+      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
+    } else {
+      kv->append();
+      kv_dest = kv;
+    }
+  }
+
+  int nkey_kv;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv;
+  int npage_kv = kv_src->request_info(&page_kv);
+  uint64_t n = 0;
+
+  int maxbatch = 0;
+  char **keys = NULL;
+  char **values = NULL;
+  int *keybytes = NULL;
+  int *valuebytes = NULL;
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv_src->request_page(ipage,dummy1,dummy2,dummy3);
+    batch_page(kv_src,page_kv,nkey_kv,maxbatch,
+	       keys,keybytes,values,valuebytes);
+    appmap(n,nkey_kv,keys,keybytes,values,valuebytes,kv_dest,appptr);
+    n += nkey_kv;
+  }
+
+  memory->sfree(keys);
+  memory->sfree(keybytes);
+  memory->sfree(values);
+  memory->sfree(valuebytes);
+
+  if (mr == this) delete kv_src;
+  else kv_src->deallocate(0);
+  kv = kv_dest;
+  kv->complete();
+  if (freepage) mem_cleanup();
+
+  stats("Map",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   open a KV so KV pairs can be added to it by another MR's map
+------------------------------------------------------------------------- */
+
+void MapReduce::open(int addflag)
+{
+  if (!allocated) allocate();
+  delete kmv;
+  kmv = NULL;
+
+  if (addflag == 0) {
+    delete kv;
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  } else if (kv == NULL) {
+    kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  } else {
+    kv->append();
+  }
+
+  if (freepage) mem_cleanup();
+}
+
+/* ----------------------------------------------------------------------
+   print of KV or KMV pairs to screen
+   if all procs are printing, pass print token from proc to proc
+------------------------------------------------------------------------- */
+
+void MapReduce::print(int proc, int nstride, int kflag, int vflag)
+{
+  MPI_Status status;
+
+  if (kv == NULL && kmv == NULL)
+    error->all("Cannot print without KeyValue or KeyMultiValue");
+  if (kflag < 0 || vflag < 0) error->all("Invalid print args");
+  if (kflag > 7 || vflag > 7) error->all("Invalid print args");
+
+  if (proc == me) {
+    if (kv) {
+      kv->allocate();
+      kv->print(stdout,nstride,kflag,vflag);
+      kv->deallocate(0);
+    }
+    if (kmv) {
+      kmv->allocate();
+      kmv->print(stdout,nstride,kflag,vflag);
+      kmv->deallocate(0);
+    }
+  }
+
+  if (proc >= 0) return;
+
+  int token;
+  MPI_Barrier(comm);
+  if (me > 0) MPI_Recv(&token,0,MPI_INT,me-1,0,comm,&status);
+  if (kv) {
+    kv->allocate();
+    kv->print(stdout,nstride,kflag,vflag);
+    kv->deallocate(0);
+  }
+  if (kmv) {
+    kmv->allocate();
+    kmv->print(stdout,nstride,kflag,vflag);
+    kmv->deallocate(0);
+  }
+  if (me < nprocs-1) MPI_Send(&token,0,MPI_INT,me+1,0,comm);
+  MPI_Barrier(comm);
+}
+
+/* ----------------------------------------------------------------------
+   print of KV or KMV pairs to file(s)
+   if one proc is printing, write to filename
+   if all procs are printing and fflag = 0, all write to one file
+   if all procs are printing and fflag = 1, each proc writes to own file
+------------------------------------------------------------------------- */
+
+void MapReduce::print(char *file, int fflag,
+		      int proc, int nstride, int kflag, int vflag)
+{
+  MPI_Status status;
+
+  if (kv == NULL && kmv == NULL)
+    error->all("Cannot print without KeyValue or KeyMultiValue");
+  if (kflag < 0 || vflag < 0) error->all("Invalid print args");
+  if (kflag > 7 || vflag > 7) error->all("Invalid print args");
+
+  if (proc == me) {
+    FILE *fp = fopen(file,"w");
+    if (fp == NULL) error->one("Could not open print file");
+    if (kv) {
+      kv->allocate();
+      kv->print(fp,nstride,kflag,vflag);
+      kv->deallocate(0);
+    }
+    if (kmv) {
+      kmv->allocate();
+      kmv->print(fp,nstride,kflag,vflag);
+      kmv->deallocate(0);
+    }
+    fclose(fp);
+  }
+
+  if (proc >= 0) return;
+
+  if (fflag == 1) {
+    int n = strlen(file) + 8;
+    char *procfile = new char[n];
+    sprintf(procfile,"%s.%d",file,me);
+    FILE *fp = fopen(procfile,"w");
+    if (fp == NULL) error->one("Could not open print file");
+    if (kv) {
+      kv->allocate();
+      kv->print(fp,nstride,kflag,vflag);
+      kv->deallocate(0);
+    }
+    if (kmv) {
+      kmv->allocate();
+      kmv->print(fp,nstride,kflag,vflag);
+      kmv->deallocate(0);
+    }
+    fclose(fp);
+
+  } else {
+    int token;
+    MPI_Barrier(comm);
+    if (me > 0) MPI_Recv(&token,0,MPI_INT,me-1,0,comm,&status);
+    FILE *fp = fopen(file,"a");
+    if (fp == NULL) error->one("Could not open print file");
+    if (kv) {
+      kv->allocate();
+      kv->print(fp,nstride,kflag,vflag);
+      kv->deallocate(0);
+    }
+    if (kmv) {
+      kmv->allocate();
+      kmv->print(fp,nstride,kflag,vflag);
+      kmv->deallocate(0);
+    }
+    fclose(fp);
+    if (me < nprocs-1) MPI_Send(&token,0,MPI_INT,me+1,0,comm);
+    MPI_Barrier(comm);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   create a KV from a KMV via a parallel reduce operation for nmap tasks
+   make one call to appreduce() for each KMV pair
+   each proc processes its owned KMV pairs
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::reduce(void (*appreduce)(char *, int, char *, int,
+					     int *, KeyValue *, void *),
+			   void *appptr)
+{
+  if (kmv == NULL) error->all("Cannot reduce without KeyMultiValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  kmv->allocate();
+
+  uint64_t dummy;
+  int memtag1,memtag2;
+  char *mvpage1 = mem_request(1,dummy,memtag1);
+  char *mvpage2 = mem_request(1,dummy,memtag2);
+
+  int nkey_kmv,nvalues,keybytes,mvaluebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  int *valuesizes;
+  char *ptr,*key,*multivalue;
+
+  char *page_kmv;
+  int npage_kmv = kmv->request_info(&page_kmv);
+  char *page_hold = page_kmv;
+
+  callback.style = REDUCE;
+  callback.appreduce = appreduce;
+  callback.appptr = appptr;
+  pool_create();
+
+  for (int ipage = 0; ipage < npage_kmv; ipage++) {
+    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
+    if (pool_page(page_kmv,nkey_kmv,0,kv)) continue;
+    ptr = page_kmv;
+
+    for (int i = 0; i < nkey_kmv; i++) {
+      nvalues = *((int *) ptr);
+      ptr += sizeof(int);
+
+      if (nvalues > 0) {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	mvaluebytes = *((int *) ptr);
+	ptr += sizeof(int);
+	valuesizes = (int *) ptr;
+	ptr += ((uint64_t) nvalues) * sizeof(int);
+	
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
+	ptr += keybytes;
+	ptr = ROUNDUP(ptr,valignm1);
+	multivalue = ptr;
+	ptr += mvaluebytes;
+	ptr = ROUNDUP(ptr,talignm1);
+	
+	appreduce(key,keybytes,multivalue,nvalues,valuesizes,kv,appptr);
+
+      } else {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
+
+	// set KMV page to mvpage1 so key will not be overwritten
+	// when multivalue_block() loads new pages of values
+
+	kmv_block_valid = 1;
+	kmv_key_page = ipage;
+	kmv_mvpage1 = mvpage1;
+	kmv_mvpage2 = mvpage2;
+	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
+	kmv->page = mvpage1;
+	appreduce(key,keybytes,NULL,0,(int *) this,kv,appptr);
+	kmv_block_valid = 0;
+	ipage += kmv_nblock;
+	kmv->page = page_hold;
+      }
+    }
+  }
+
+  pool_destroy();
+  kv->complete();
+  mem_unmark(memtag1);
+  mem_unmark(memtag2);
+
+  // delete KMV
+
+  delete kmv;
+  kmv = NULL;
+  if (freepage) mem_cleanup();
+
+  stats("Reduce",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   query total # of values and # of value blocks in a single multi-page KMV
+   called from user myreduce() or mycompress() function
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::multivalue_blocks(int &nblock)
+{
+  if (!kmv_block_valid) error->one("Invalid call to multivalue_blocks()");
+  nblock = kmv_nblock;
+  return kmv_nvalue_total;
+}
+
+/* ----------------------------------------------------------------------
+   query total # of values and # of value blocks in a single multi-page KMV
+   called from user myreduce() or mycompress() function
+------------------------------------------------------------------------- */
+
+void MapReduce::multivalue_block_select(int which)
+{
+  if (!kmv_block_valid) error->one("Invalid call to multivalue_block_select()");
+  if (which == 1) kmv->page = kmv_mvpage1;
+  else if (which == 2) kmv->page = kmv_mvpage2;
+  else error->one("Invalid arg to multivalue_block_select()");
+}
+
+/* ----------------------------------------------------------------------
+   query info for 1 block of a single KMV that spans multiple pages
+   called from user myreduce() or mycompress() function
+   iblock = 0 to nblock_kmv-1
+------------------------------------------------------------------------- */
+
+int MapReduce::multivalue_block(int iblock, 
+				char **pmultivalue, int **pvaluesizes)
+{
+  if (!kmv_block_valid) error->one("Invalid call to multivalue_block()");
+  if (iblock < 0 || iblock >= kmv_nblock)
+    error->one("Invalid page request to multivalue_block()");
+
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kmv;
+  kmv->request_info(&page_kmv);
+  kmv->request_page(kmv_key_page+iblock+1,0,dummy1,dummy2,dummy3);
+
+  char *ptr = page_kmv;
+  int nvalues = *((int *) ptr);
+  ptr += sizeof(int);
+  *pvaluesizes = (int *) ptr;
+  ptr += nvalues*sizeof(int);
+  *pmultivalue = ROUNDUP(ptr,valignm1);
+
+  return nvalues;
+}
+
+/* ----------------------------------------------------------------------
+   scan KV pairs without altering them
+   make one call to appscan() for each KV pair
+   each proc processes its owned KV pairs
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::scan(void (*appscan)(char *, int, char *, int, 
+					 void *), void *appptr)
+{
+  if (kv == NULL) error->all("Cannot scan without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kv->allocate();
+
+  int nkey_kv,keybytes,valuebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv,*ptr,*key,*value;
+  int npage_kv = kv->request_info(&page_kv);
+
+  callback.style = SCANKV;
+  callback.appscankv = appscan;
+  callback.appptr = appptr;
+  callback.kfixed = kv->kfixed;
+  callback.vfixed = kv->vfixed;
+  pool_create();
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    if (pool_page(page_kv,nkey_kv,0,NULL)) continue;
+    ptr = page_kv;
+
+    for (int i = 0; i < nkey_kv; i++) {
+      if (kfixed) {
+	keybytes = kfixed;
+	valuebytes = vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
+
+      ptr = ROUNDUP(ptr,kalignm1);
+      key = ptr;
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      value = ptr;
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1);
+
+      appscan(key,keybytes,value,valuebytes,appptr);
+    }
+  }
+
+  pool_destroy();
+  kv->deallocate(0);
+  if (freepage) mem_cleanup();
+
+  stats("Scan",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   scan fixed-size KV pairs without altering them
+   make one call to appscan() for each page of KV pairs
+   appscan() gets # of pairs, ptr to first key and value,
+     and stride between successive keys or values
+   each proc processes its owned KV pairs
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::scan_fixed(void (*appscan)(int, char *, char *, int,
+					       void *), void *appptr)
+{
+  if (kv == NULL) error->all("Cannot scan without KeyValue");
+  if (kv->kfixed == 0)
+    error->all("Cannot scan_fixed without fixed-size key/values");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kv->allocate();
+
+  int nkey_kv;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv;
+  int npage_kv = kv->request_info(&page_kv);
+  int voffset = kv->voffset;
+  int stride = kv->fixedbytes;
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    appscan(nkey_kv,page_kv,page_kv+voffset,stride,appptr);
+  }
+
+  kv->deallocate(0);
+  if (freepage) mem_cleanup();
+
+  stats("Scan",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   scan KV pairs without altering them, one page of pairs at a time
+   make one call to appscan() for each page of KV pairs
+   appscan() gets # of pairs,
+     and vectors of key ptrs, key lengths, value ptrs, value lengths
+   each proc processes its owned KV pairs
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::scan_batch(void (*appscan)(int, char **, int *,
+					       char **, int *, void *),
+			       void *appptr)
+{
+  if (kv == NULL) error->all("Cannot scan without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kv->allocate();
+
+  int nkey_kv;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv;
+  int npage_kv = kv->request_info(&page_kv);
+
+  int maxbatch = 0;
+  char **keys = NULL;
+  char **values = NULL;
+  int *keybytes = NULL;
+  int *valuebytes = NULL;
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    batch_page(kv,page_kv,nkey_kv,maxbatch,keys,keybytes,values,valuebytes);
+    appscan(nkey_kv,keys,keybytes,values,valuebytes,appptr);
+  }
+
+  memory->sfree(keys);
+  memory->sfree(keybytes);
+  memory->sfree(values);
+  memory->sfree(valuebytes);
+
+  kv->deallocate(0);
+  if (freepage) mem_cleanup();
+
+  stats("Scan",0);
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
+
+/* ----------------------------------------------------------------------
+   fill vectors of key/value ptrs and lengths for N pairs in page of a KV
+   grow vectors if they hold fewer than N pairs, maxbatch = their length
+   use alignment and fixed sizes of the KV, not of this MR
+------------------------------------------------------------------------- */
+
+void MapReduce::batch_page(KeyValue *kv, char *page, int n, int &maxbatch,
+			   char **&keys, int *&keybytes,
+			   char **&values, int *&valuebytes)
+{
+  if (n > maxbatch) {
+    maxbatch = n;
+    keys = (char **)
+      memory->srealloc(keys,maxbatch*sizeof(char *),"MR:keys");
+    keybytes = (int *)
+      memory->srealloc(keybytes,maxbatch*sizeof(int),"MR:keybytes");
+    values = (char **)
+      memory->srealloc(values,maxbatch*sizeof(char *),"MR:values");
+    valuebytes = (int *)
+      memory->srealloc(valuebytes,maxbatch*sizeof(int),"MR:valuebytes");
+  }
+
+  int kalignm1_kv = kv->kalignm1;
+  int valignm1_kv = kv->valignm1;
+  int talignm1_kv = kv->talignm1;
+  char *ptr = page;
+
+  for (int i = 0; i < n; i++) {
+    if (kv->kfixed) {
+      keybytes[i] = kv->kfixed;
+      valuebytes[i] = kv->vfixed;
+    } else {
+      keybytes[i] = *((int *) ptr);
+      valuebytes[i] = *((int *) (ptr+sizeof(int)));
+      ptr += kv->twolenbytes;
+    }
+
+    ptr = ROUNDUP(ptr,kalignm1_kv);
+    keys[i] = ptr;
+    ptr += keybytes[i];
+    ptr = ROUNDUP(ptr,valignm1_kv);
+    values[i] = ptr;
+    ptr += valuebytes[i];
+    ptr = ROUNDUP(ptr,talignm1_kv);
+  }
+}
+
+/* ----------------------------------------------------------------------
+   scan KMV pairs without altering them
+   make one call to appscan() for each KMV pair
+   each proc processes its owned KMV pairs
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::scan(void (*appscan)(char *, int, 
+					 char *, int, int *,
+					 void *), void *appptr)
+{
+  if (kmv == NULL) error->all("Cannot scan without KeyMultiValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  kmv->allocate();
+
+  uint64_t dummy;
+  int memtag1,memtag2;
+  char *mvpage1 = mem_request(1,dummy,memtag1);
+  char *mvpage2 = mem_request(1,dummy,memtag2);
 
-  if (flag & me == 0) {
-    char str[128];
-    sprintf(str,"File(s) too small for file delta - decreased map tasks to %d",
-	    nmap);
-    error->warning(str);
-  }
+  int nkey_kmv,nvalues,keybytes,mvaluebytes;
+  uint64_t dummy1,dummy2,dummy3;
+  int *valuesizes;
+  char *ptr,*key,*multivalue;
 
-  // whichfile[i] = which file is associated with the Ith task
-  // whichtask[i] = which task in that file the Ith task is
+  char *page_kmv;
+  int npage_kmv = kmv->request_info(&page_kmv);
+  char *page_hold = page_kmv;
 
-  filemap.whichfile = new int[nmap];
-  filemap.whichtask = new int[nmap];
+  callback.style = SCANKMV;
+  callback.appscankmv = appscan;
+  callback.appptr = appptr;
+  pool_create();
 
-  int itask = 0;
-  for (int i = 0; i < nfile; i++)
-    for (int j = 0; j < filemap.tasksperfile[i]; j++) {
-      filemap.whichfile[itask] = i;
-      filemap.whichtask[itask++] = j;
-    }
+  for (int ipage = 0; ipage < npage_kmv; ipage++) {
+    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
+    if (pool_page(page_kmv,nkey_kmv,0,NULL)) continue;
+    ptr = page_kmv;
 
-  // use non-file map() to partition tasks to procs
-  // it calls map_file_standalone once for each task
+    for (int i = 0; i < nkey_kmv; i++) {
+      nvalues = *((int *) ptr);
+      ptr += sizeof(int);
 
-  int verbosity_hold = verbosity;
-  int timer_hold = timer;
-  verbosity = timer = 0;
+      if (nvalues > 0) {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	mvaluebytes = *((int *) ptr);
+	ptr += sizeof(int);
+	valuesizes = (int *) ptr;
+	ptr += ((uint64_t) nvalues) * sizeof(int);
+	
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
+	ptr += keybytes;
+	ptr = ROUNDUP(ptr,valignm1);
+	multivalue = ptr;
+	ptr += mvaluebytes;
+	ptr = ROUNDUP(ptr,talignm1);
+	
+	appscan(key,keybytes,multivalue,nvalues,valuesizes,appptr);
 
-  filemap.appmapfile = appmap;
-  filemap.appptr = appptr;
-  map(nmap,&map_file_standalone,this,addflag);
+      } else {
+	keybytes = *((int *) ptr);
+	ptr += sizeof(int);
+	ptr = ROUNDUP(ptr,kalignm1);
+	key = ptr;
 
-  verbosity = verbosity_hold;
-  timer = timer_hold;
-  stats("Map",0);
+	// set KMV page to mvpage1 so key will not be overwritten
+	// when multivalue_block() loads new pages of values
 
-  // destroy FileMap
+	kmv_block_valid = 1;
+	kmv_key_page = ipage;
+	kmv_mvpage1 = mvpage1;
+	kmv_mvpage2 = mvpage2;
+	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
+	kmv->page = mvpage1;
+	appscan(key,keybytes,NULL,0,(int *) this,appptr);
+	kmv_block_valid = 0;
+	ipage += kmv_nblock;
+	kmv->page = page_hold;
+      }
+    }
+  }
 
-  if (filemap.sepwhich == 0) delete [] filemap.sepstr;
-  for (int i = 0; i < nfile; i++) delete [] filemap.filename[i];
-  delete [] filemap.filename;
-  delete [] filemap.filesize;
-  delete [] filemap.tasksperfile;
-  delete [] filemap.whichfile;
-  delete [] filemap.whichtask;
+  pool_destroy();
+  kmv->deallocate(0);
+  if (freepage) mem_cleanup();
+
+  stats("Scan",0);
 
   uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   wrappers on user-provided appmapfile function
-   2-level wrapper needed b/c file map() calls non-file map()
-     and cannot pass it a class method unless it were static,
-     but then it couldn't access MR class data
-   so non-file map() is passed standalone non-class method
-   standalone calls back into class wrapper which calls user appmapfile()
+   create a ThreadPool for the callbacks of one operation
+   if mapthreads setting is > 1
 ------------------------------------------------------------------------- */
 
-void map_file_standalone(int imap, KeyValue *kv, void *ptr)
+void MapReduce::pool_create()
 {
-  MapReduce *mr = (MapReduce *) ptr;
-  mr->map_file_wrapper(imap,kv);
+  if (mapthreads > 1)
+    pool = new ThreadPool(mapthreads,this,kalign,valign,memory,error);
 }
 
-void MapReduce::map_file_wrapper(int imap, KeyValue *kv)
+/* ---------------------------------------------------------------------- */
+
+void MapReduce::pool_destroy()
 {
-  // readstart = position in file to start reading for this task
-  // readsize = # of bytes to read including delta
+  delete pool;
+  pool = NULL;
+}
 
-  uint64_t filesize = filemap.filesize[filemap.whichfile[imap]];
-  int itask = filemap.whichtask[imap];
-  int ntask = filemap.tasksperfile[filemap.whichfile[imap]];
+/* ----------------------------------------------------------------------
+   make callbacks for the N pairs of a KV or KMV page on several threads
+   split page into one chunk of consecutive pairs per thread
+   index = index of first pair in page, passed to MAPKV callback
+   kvdest = KV that callbacks add new pairs to, NULL for scan()
+   return 1 if done, 0 if caller should make callbacks itself
+     since no pool or too few pairs to split
+------------------------------------------------------------------------- */
 
-  uint64_t readstart = itask*filesize/ntask;
-  uint64_t readnext = (itask+1)*filesize/ntask;
-  if (readnext - readstart + filemap.delta + 1 > INTMAX)
-    error->one("Single file read exceeds int size");
-  int readsize = readnext - readstart + filemap.delta;
-  readsize = MIN(readsize,filesize-readstart);
+int MapReduce::pool_page(char *page, int n, uint64_t index, KeyValue *kvdest)
+{
+  if (pool == NULL) return 0;
+  int nthr = pool->split(n);
+  if (nthr == 1) return 0;
 
-  // read from appropriate file
-  // terminate string with NULL
+  int nvalues,keybytes,valuebytes,mvaluebytes;
+  int ithread = 0;
+  int next = 0;
+  char *ptr = page;
 
-  char *str = (char *) memory->smalloc(readsize+1,"MR:fileread");
-  FILE *fp = fopen(filemap.filename[filemap.whichfile[imap]],"rb");
-  fseek(fp,readstart,SEEK_SET);
-  fread(str,1,readsize,fp);
-  str[readsize] = '\0';
-  fclose(fp);
+  for (int i = 0; i < n; i++) {
+    if (i == next) {
+      pool->start[ithread] = ptr;
+      pool->index[ithread] = index + i;
+      ithread++;
+      next = ((uint64_t) n) * ithread / nthr;
+      pool->count[ithread-1] = next - i;
+    }
 
-  // if not first task in file, trim start of string
-  // separator can be single char or a string
-  // str[strstart] = 1st char in string
-  // if separator = char, strstart is char after separator
-  // if separator = string, strstart is 1st char of separator
+    if (callback.style == MAPKV || callback.style == SCANKV) {
+      if (callback.kfixed) {
+	keybytes = callback.kfixed;
+	valuebytes = callback.vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-  int strstart = 0;
-  if (itask > 0) {
-    char *ptr;
-    if (filemap.sepwhich) ptr = strchr(str,filemap.sepchar);
-    else ptr = strstr(str,filemap.sepstr);
-    if (ptr == NULL || ptr-str > filemap.delta)
-      error->one("Could not find file separator within delta");
-    strstart = ptr-str + filemap.sepwhich;
-  }
+      ptr = ROUNDUP(ptr,kalignm1);
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1);
 
-  // if not last task in file, trim end of string
-  // separator can be single char or a string
-  // str[strstop] = last char in string = inserted NULL
-  // if separator = char, NULL is char after separator
-  // if separator = string, NULL is 1st char of separator
+    } else {
+      nvalues = *((int *) ptr);
+      ptr += sizeof(int);
+      keybytes = *((int *) ptr);
+      ptr += sizeof(int);
+      mvaluebytes = *((int *) ptr);
+      ptr += sizeof(int);
+      ptr += ((uint64_t) nvalues) * sizeof(int);
 
-  int strstop = readsize;
-  if (itask < ntask-1) {
-    char *ptr;
-    if (filemap.sepwhich) 
-      ptr = strchr(&str[readnext-readstart],filemap.sepchar);
-    else 
-      ptr = strstr(&str[readnext-readstart],filemap.sepstr);
-    if (ptr == NULL) error->one("Could not find file separator within delta");
-    if (filemap.sepwhich) ptr++;
-    *ptr = '\0';
-    strstop = ptr-str;
+      ptr = ROUNDUP(ptr,kalignm1);
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      ptr += mvaluebytes;
+      ptr = ROUNDUP(ptr,talignm1);
+    }
   }
 
-  // call user appmapfile() function with user data ptr
-
-  int strsize = strstop - strstart + 1;
-  filemap.appmapfile(imap,&str[strstart],strsize,kv,filemap.appptr);
-  memory->sfree(str);
+  pool->run(nthr,pool_standalone,this,kvdest);
+  return 1;
 }
 
 /* ----------------------------------------------------------------------
-   user call: create a KV via a parallel map operation on an existing MR's KV
-   make one call to appmap() for each key/value pair in the input MR's KV
-   each proc operates on key/value pairs it owns
+   make callbacks for one thread's chunk of a page
+   new pairs go to the thread's KV buffer
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::map(MapReduce *mr, 
-			void (*appmap)(uint64_t, char *, int, char *, int, 
-				       KeyValue *, void *),
-			void *appptr, int addflag)
+void MapReduce::pool_standalone(void *ptr, int ithread)
 {
-  if (mr->kv == NULL)
-    error->all("MapReduce passed to map() does not have KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
-
-  if (!allocated) allocate();
-  delete kmv;
-  kmv = NULL;
+  MapReduce *mr = (MapReduce *) ptr;
+  mr->pool_chunk(ithread);
+}
 
-  // kv_src = KeyValue object which sends KV pairs to appmap()
-  // kv_dest = KeyValue object which stores new KV pairs
-  // if mr = this, then 2 KVs are the same:
-  //   if addflag, make copy so can add to it, delete kv_src at end
-  //   if not addflag, add to new KV, delete kv_src at end
+void MapReduce::pool_chunk(int ithread)
+{
+  int nvalues,keybytes,valuebytes,mvaluebytes;
+  int *valuesizes;
+  char *key,*value,*multivalue;
+
+  char *ptr = pool->start[ithread];
+  int n = pool->count[ithread];
+  uint64_t index = pool->index[ithread];
+  KeyValue *kvthread = NULL;
+  if (callback.style == MAPKV || callback.style == REDUCE)
+    kvthread = pool->buffer(ithread);
+  void *appptr = callback.appptr;
+
+  if (callback.style == MAPKV || callback.style == SCANKV) {
+    for (int i = 0; i < n; i++) {
+      if (callback.kfixed) {
+	keybytes = callback.kfixed;
+	valuebytes = callback.vfixed;
+      } else {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	ptr += twolenbytes;
+      }
 
-  KeyValue *kv_src = mr->kv;
-  kv_src->allocate();
-  KeyValue *kv_dest;
+      ptr = ROUNDUP(ptr,kalignm1);
+      key = ptr;
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      value = ptr;
+      ptr += valuebytes;
+      ptr = ROUNDUP(ptr,talignm1);
 
-  if (mr == this) {
-    if (addflag) {
-      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
-      kv_dest->copy(kv_src);
-      kv_dest->append();
-    } else {
-      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
-    }
-  } else {
-    if (addflag == 0) {
-      delete kv;
-      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
-    } else if (kv == NULL) {
-      kv_dest = new KeyValue(this,kalign,valign,memory,error,comm);
-    } else {
-      kv->append();
-      kv_dest = kv;
+      if (callback.style == MAPKV)
+	callback.appmap(index++,key,keybytes,value,valuebytes,
+			kvthread,appptr);
+      else callback.appscankv(key,keybytes,value,valuebytes,appptr);
     }
-  }
-
-  int nkey_kv,keybytes,valuebytes;
-  uint64_t dummy1,dummy2,dummy3;
-  char *page_kv,*ptr,*key,*value;
-  int npage_kv = kv_src->request_info(&page_kv);
-  uint64_t n = 0;
-
-  for (int ipage = 0; ipage < npage_kv; ipage++) {
-    nkey_kv = kv_src->request_page(ipage,dummy1,dummy2,dummy3);
-    ptr = page_kv;
 
-    for (int i = 0; i < nkey_kv; i++) {
+  } else {
+    for (int i = 0; i < n; i++) {
+      nvalues = *((int *) ptr);
+      ptr += sizeof(int);
       keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
+      ptr += sizeof(int);
+      mvaluebytes = *((int *) ptr);
+      ptr += sizeof(int);
+      valuesizes = (int *) ptr;
+      ptr += ((uint64_t) nvalues) * sizeof(int);
 
-      ptr += twolenbytes;
       ptr = ROUNDUP(ptr,kalignm1);
       key = ptr;
       ptr += keybytes;
       ptr = ROUNDUP(ptr,valignm1);
-      value = ptr;
-      ptr += valuebytes;
+      multivalue = ptr;
+      ptr += mvaluebytes;
       ptr = ROUNDUP(ptr,talignm1);
 
-      appmap(n++,key,keybytes,value,valuebytes,kv_dest,appptr);
+      if (callback.style == REDUCE)
+	callback.appreduce(key,keybytes,multivalue,nvalues,valuesizes,
+			   kvthread,appptr);
+      else callback.appscankmv(key,keybytes,multivalue,nvalues,valuesizes,
+			       appptr);
     }
   }
+}
 
-  if (mr == this) delete kv_src;
-  else kv_src->deallocate(0);
-  kv = kv_dest;
-  kv->complete();
-  if (freepage) mem_cleanup();
+/* ----------------------------------------------------------------------
+   scrunch KV to create a KMV on fewer processors, each with a single pair
+   gather followed by a collapse
+   numprocs = # of procs new KMV resides on (0 to numprocs-1)
+   new key = provided key name (same on every proc)
+   new value = list of old key,value,key,value,etc
+------------------------------------------------------------------------- */
 
-  stats("Map",0);
+uint64_t MapReduce::scrunch(int numprocs, char *key, int keybytes)
+{
+  if (kv == NULL) error->all("Cannot scrunch without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  int verbosity_hold = verbosity;
+  int timer_hold = timer;
+  verbosity = timer = 0;
+
+  gather(numprocs);
+  collapse(key,keybytes);
+
+  verbosity = verbosity_hold;
+  timer = timer_hold;
+  stats("Scrunch",1);
 
   uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   open a KV so KV pairs can be added to it by another MR's map
+   sort keys in a KV to create a new KV
+   call sort_keys(appcompare) with pre-defined compare method
 ------------------------------------------------------------------------- */
 
-void MapReduce::open(int addflag)
+uint64_t MapReduce::sort_keys(int flag)
 {
-  if (!allocated) allocate();
-  delete kmv;
-  kmv = NULL;
-
-  if (addflag == 0) {
-    delete kv;
-    kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  } else if (kv == NULL) {
-    kv = new KeyValue(this,kalign,valign,memory,error,comm);
-  } else {
-    kv->append();
+  int absflag = flag;
+  if (flag < 0) absflag = -flag;
+  if (absflag == 1) {
+    if (flag > 0) return sort_keys(compare_int);
+    else return sort_keys(compare_int_reverse);
+  } else if (absflag == 2) {
+    if (flag > 0) return sort_keys(compare_uint64);
+    else return sort_keys(compare_uint64_reverse);
+  } else if (absflag == 3) {
+    if (flag > 0) return sort_keys(compare_float);
+    else return sort_keys(compare_float_reverse);
+  } else if (absflag == 4) {
+    if (flag > 0) return sort_keys(compare_double);
+    else return sort_keys(compare_double_reverse);
+  } else if (absflag == 5) {
+    if (flag > 0) return sort_keys(compare_str);
+    else return sort_keys(compare_str_reverse);
+  } else if (absflag == 6) {
+    if (flag > 0) return sort_keys(compare_strn);
+    else return sort_keys(compare_strn_reverse);
   }
-
-  if (freepage) mem_cleanup();
+  error->all("Invalid compare method for sort keys");
 }
 
 /* ----------------------------------------------------------------------
-   print of KV or KMV pairs to screen
-   if all procs are printing, pass print token from proc to proc
+   sort keys in a KV to create a new KV
+   use appcompare() to compare 2 keys
+   each proc sorts only its data
 ------------------------------------------------------------------------- */
 
-void MapReduce::print(int proc, int nstride, int kflag, int vflag)
+uint64_t MapReduce::sort_keys(int (*appcompare)(char *, int, char *, int))
 {
-  MPI_Status status;
+  if (kv == NULL) error->all("Cannot sort_keys without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-  if (kv == NULL && kmv == NULL)
-    error->all("Cannot print without KeyValue or KeyMultiValue");
-  if (kflag < 0 || vflag < 0) error->all("Invalid print args");
-  if (kflag > 7 || vflag > 7) error->all("Invalid print args");
+  compare = appcompare;
+  sort_kv(0);
 
-  if (proc == me) {
-    if (kv) {
-      kv->allocate();
-      kv->print(stdout,nstride,kflag,vflag);
-      kv->deallocate(0);
-    }
-    if (kmv) {
-      kmv->allocate();
-      kmv->print(stdout,nstride,kflag,vflag);
-      kmv->deallocate(0);
-    }
-  }
+  stats("Sort_keys",0);
+  fcounter_sort = 0;
 
-  if (proc >= 0) return;
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
 
-  int token;
-  MPI_Barrier(comm);
-  if (me > 0) MPI_Recv(&token,0,MPI_INT,me-1,0,comm,&status);
-  if (kv) {
-    kv->allocate();
-    kv->print(stdout,nstride,kflag,vflag);
-    kv->deallocate(0);
-  }
-  if (kmv) {
-    kmv->allocate();
-    kmv->print(stdout,nstride,kflag,vflag);
-    kmv->deallocate(0);
+/* ----------------------------------------------------------------------
+   sort values in a KV to create a new KV
+   call sort_values(appcompare) with pre-defined compare method
+------------------------------------------------------------------------- */
+
+uint64_t MapReduce::sort_values(int flag)
+{
+  int absflag = flag;
+  if (flag < 0) absflag = -flag;
+  if (absflag == 1) {
+    if (flag > 0) return sort_values(compare_int);
+    else return sort_values(compare_int_reverse);
+  } else if (absflag == 2) {
+    if (flag > 0) return sort_values(compare_uint64);
+    else return sort_values(compare_uint64_reverse);
+  } else if (absflag == 3) {
+    if (flag > 0) return sort_values(compare_float);
+    else return sort_values(compare_float_reverse);
+  } else if (absflag == 4) {
+    if (flag > 0) return sort_values(compare_double);
+    else return sort_values(compare_double_reverse);
+  } else if (absflag == 5) {
+    if (flag > 0) return sort_values(compare_str);
+    else return sort_values(compare_str_reverse);
+  } else if (absflag == 6) {
+    if (flag > 0) return sort_values(compare_strn);
+    else return sort_values(compare_strn_reverse);
   }
-  if (me < nprocs-1) MPI_Send(&token,0,MPI_INT,me+1,0,comm);
-  MPI_Barrier(comm);
+  error->all("Invalid compare method for sort values");
 }
 
 /* ----------------------------------------------------------------------
-   print of KV or KMV pairs to file(s)
-   if one proc is printing, write to filename
-   if all procs are printing and fflag = 0, all write to one file
-   if all procs are printing and fflag = 1, each proc writes to own file
+   sort values in a KV to create a new KV
+   use appcompare() to compare 2 values
+   each proc sorts only its data
 ------------------------------------------------------------------------- */
 
-void MapReduce::print(char *file, int fflag,
-		      int proc, int nstride, int kflag, int vflag)
+uint64_t MapReduce::sort_values(int (*appcompare)(char *, int, char *, int))
 {
-  MPI_Status status;
+  if (kv == NULL) error->all("Cannot sort_values without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-  if (kv == NULL && kmv == NULL)
-    error->all("Cannot print without KeyValue or KeyMultiValue");
-  if (kflag < 0 || vflag < 0) error->all("Invalid print args");
-  if (kflag > 7 || vflag > 7) error->all("Invalid print args");
+  compare = appcompare;
+  sort_kv(1);
 
-  if (proc == me) {
-    FILE *fp = fopen(file,"w");
-    if (fp == NULL) error->one("Could not open print file");
-    if (kv) {
-      kv->allocate();
-      kv->print(fp,nstride,kflag,vflag);
-      kv->deallocate(0);
-    }
-    if (kmv) {
-      kmv->allocate();
-      kmv->print(fp,nstride,kflag,vflag);
-      kmv->deallocate(0);
-    }
-    fclose(fp);
-  }
+  stats("Sort_values",0);
+  fcounter_sort = 0;
 
-  if (proc >= 0) return;
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
+}
 
-  if (fflag == 1) {
-    int n = strlen(file) + 8;
-    char *procfile = new char[n];
-    sprintf(procfile,"%s.%d",file,me);
-    FILE *fp = fopen(procfile,"w");
-    if (fp == NULL) error->one("Could not open print file");
-    if (kv) {
-      kv->allocate();
-      kv->print(fp,nstride,kflag,vflag);
-      kv->deallocate(0);
-    }
-    if (kmv) {
-      kmv->allocate();
-      kmv->print(fp,nstride,kflag,vflag);
-      kmv->deallocate(0);
-    }
-    fclose(fp);
+/* ----------------------------------------------------------------------
+   sort values within each multivalue in a KMV
+   call sort_multivalues(appcompare) with pre-defined compare method
+------------------------------------------------------------------------- */
 
-  } else {
-    int token;
-    MPI_Barrier(comm);
-    if (me > 0) MPI_Recv(&token,0,MPI_INT,me-1,0,comm,&status);
-    FILE *fp = fopen(file,"a");
-    if (fp == NULL) error->one("Could not open print file");
-    if (kv) {
-      kv->allocate();
-      kv->print(fp,nstride,kflag,vflag);
-      kv->deallocate(0);
-    }
-    if (kmv) {
-      kmv->allocate();
-      kmv->print(fp,nstride,kflag,vflag);
-      kmv->deallocate(0);
-    }
-    fclose(fp);
-    if (me < nprocs-1) MPI_Send(&token,0,MPI_INT,me+1,0,comm);
-    MPI_Barrier(comm);
+uint64_t MapReduce::sort_multivalues(int flag)
+{
+  int absflag = flag;
+  if (flag < 0) absflag = -flag;
+  if (absflag == 1) {
+    if (flag > 0) return sort_multivalues(compare_int);
+    else return sort_multivalues(compare_int_reverse);
+  } else if (absflag == 2) {
+    if (flag > 0) return sort_multivalues(compare_uint64);
+    else return sort_multivalues(compare_uint64_reverse);
+  } else if (absflag == 3) {
+    if (flag > 0) return sort_multivalues(compare_float);
+    else return sort_multivalues(compare_float_reverse);
+  } else if (absflag == 4) {
+    if (flag > 0) return sort_multivalues(compare_double);
+    else return sort_multivalues(compare_double_reverse);
+  } else if (absflag == 5) {
+    if (flag > 0) return sort_multivalues(compare_str);
+    else return sort_multivalues(compare_str_reverse);
+  } else if (absflag == 6) {
+    if (flag > 0) return sort_multivalues(compare_strn);
+    else return sort_multivalues(compare_strn_reverse);
   }
+  error->all("Invalid compare method for sort multivalues");
 }
 
 /* ----------------------------------------------------------------------
-   create a KV from a KMV via a parallel reduce operation for nmap tasks
-   make one call to appreduce() for each KMV pair
-   each proc processes its owned KMV pairs
+   sort values within each multivalue in a KMV
+   sorts in place, does not create a new KMV
+   use appcompare() to compare 2 values within a multivalue
+   each proc sorts only its data
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::reduce(void (*appreduce)(char *, int, char *, int,
-					     int *, KeyValue *, void *),
-			   void *appptr)
+uint64_t MapReduce::sort_multivalues(int (*appcompare)(char *, int, 
+						       char *, int))
 {
-  if (kmv == NULL) error->all("Cannot reduce without KeyMultiValue");
+  int i,j,k;
+  int *order;
+  uint64_t offset;
+  char *page_kmv;
+
+  if (kmv == NULL) error->all("Cannot sort_multivalues without KeyMultiValue");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
-  kv = new KeyValue(this,kalign,valign,memory,error,comm);
   kmv->allocate();
+  int npage_kmv = kmv->request_info(&page_kmv);
+
+  compare = appcompare;
+  sort_style();
+  sorter = new Sorter(nthreads,memory,error);
 
   uint64_t dummy;
-  int memtag1,memtag2;
-  char *mvpage1 = mem_request(1,dummy,memtag1);
-  char *mvpage2 = mem_request(1,dummy,memtag2);
+  int memtag1,memtag2,memtag_work;
+  char *twopage = mem_request(2,dummy,memtag2);
+  char *scratch = mem_request(1,dummy,memtag1);
+
+  // Sorter workspace, grown by whole pages for multivalues that need more
+
+  uint64_t worksize;
+  char *work = mem_request(1,worksize,memtag_work);
 
   int nkey_kmv,nvalues,keybytes,mvaluebytes;
   uint64_t dummy1,dummy2,dummy3;
   int *valuesizes;
-  char *ptr,*key,*multivalue;
-
-  char *page_kmv;
-  int npage_kmv = kmv->request_info(&page_kmv);
-  char *page_hold = page_kmv;
+  char *ptr,*multivalue,*ptr2;
 
   for (int ipage = 0; ipage < npage_kmv; ipage++) {
-    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
+    nkey_kmv = kmv->request_page(ipage,1,dummy1,dummy2,dummy3);
     ptr = page_kmv;
 
-    for (int i = 0; i < nkey_kmv; i++) {
+    for (i = 0; i < nkey_kmv; i++) {
       nvalues = *((int *) ptr);
       ptr += sizeof(int);
 
-      if (nvalues > 0) {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	mvaluebytes = *((int *) ptr);
-	ptr += sizeof(int);
-	valuesizes = (int *) ptr;
-	ptr += ((uint64_t) nvalues) * sizeof(int);
-	
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
-	ptr += keybytes;
-	ptr = ROUNDUP(ptr,valignm1);
-	multivalue = ptr;
-	ptr += mvaluebytes;
-	ptr = ROUNDUP(ptr,talignm1);
-	
-	appreduce(key,keybytes,multivalue,nvalues,valuesizes,kv,appptr);
+      if (nvalues == 0)
+	error->one("Sort_multivalue of multi-page KeyMultiValue "
+		   "not yet supported");
 
-      } else {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
+      keybytes = *((int *) ptr);
+      ptr += sizeof(int);
+      mvaluebytes = *((int *) ptr);
+      ptr += sizeof(int);
+      valuesizes = (int *) ptr;
+      ptr += ((uint64_t) nvalues) * sizeof(int);
+      
+      ptr = ROUNDUP(ptr,kalignm1);
+      ptr += keybytes;
+      ptr = ROUNDUP(ptr,valignm1);
+      multivalue = ptr;
+      ptr += mvaluebytes;
+      ptr = ROUNDUP(ptr,talignm1);
 
-	// set KMV page to mvpage1 so key will not be overwritten
-	// when multivalue_block() loads new pages of values
+      // setup 2 arrays from 2 pages of memory
+      // order = ordering of values in multivalue, initially 0 to N-1
+      // dptr = ptr to each value
+      // slength = length of each value = valuesizes
 
-	kmv_block_valid = 1;
-	kmv_key_page = ipage;
-	kmv_mvpage1 = mvpage1;
-	kmv_mvpage2 = mvpage2;
-	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
-	kmv->page = mvpage1;
-	appreduce(key,keybytes,NULL,0,(int *) this,kv,appptr);
-	kmv_block_valid = 0;
-	ipage += kmv_nblock;
-	kmv->page = page_hold;
+      offset = ((uint64_t) nvalues) * sizeof(int);
+      order = (int *) twopage;
+      dptr = (char **) &twopage[offset];
+      slength = valuesizes;
+
+      ptr2 = multivalue;
+      for (j = 0; j < nvalues; j++) {
+	dptr[j] = ptr2;
+	ptr2 += valuesizes[j];
+      }
+
+      // sort values within multivalue via Sorter
+      // simply creates new order array
+
+      if ((uint64_t) nvalues*Sorter::workbytes() > worksize) {
+	mem_unmark(memtag_work);
+	int nwork = ((uint64_t) nvalues*Sorter::workbytes() + pagesize-1) /
+	  pagesize;
+	work = mem_request(nwork,worksize,memtag_work);
+      }
+      sorter->sort(nvalues,order,dptr,slength,compare,sortstyle,sortreverse,
+		   work);
+      
+      // reorder the multivalue, using scratch space
+      // copy back into original page
+
+      ptr2 = scratch;
+      for (j = 0; j < nvalues; j++) {
+	k = order[j];
+	memcpy(ptr2,dptr[k],slength[k]);
+	ptr2 += slength[k];
       }
+      memcpy(multivalue,scratch,mvaluebytes);
+
+      // likewise reorder the valuesizes, using scratch space
+      // copy back into original valuesizes
+
+      int *newsizes = (int *) scratch;
+      for (j = 0; j < nvalues; j++)
+        newsizes[j] = valuesizes[order[j]];
+      memcpy(valuesizes,newsizes,nvalues*sizeof(int));
     }
+
+    // overwrite the changed KMV page to disk
+
+    kmv->overwrite_page(ipage);
   }
 
-  kv->complete();
-  mem_unmark(memtag1);
-  mem_unmark(memtag2);
+  // close KMV file if necessary
 
-  // delete KMV
+  kmv->close_file();
+  delete sorter;
 
-  delete kmv;
-  kmv = NULL;
+  // free memory pages
+
+  kmv->deallocate(0);
+  mem_unmark(memtag1);
+  mem_unmark(memtag2);
+  mem_unmark(memtag_work);
   if (freepage) mem_cleanup();
 
-  stats("Reduce",0);
+  stats("Sort_multivalues",1);
 
   uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
   return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   query total # of values and # of value blocks in a single multi-page KMV
-   called from user myreduce() or mycompress() function
+   sort keys across all procs to create a new KV
+   call sample_sort_keys(appcompare) with pre-defined compare method
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::multivalue_blocks(int &nblock)
+uint64_t MapReduce::sample_sort_keys(int flag)
 {
-  if (!kmv_block_valid) error->one("Invalid call to multivalue_blocks()");
-  nblock = kmv_nblock;
-  return kmv_nvalue_total;
+  CompareFunc *appcompare = compare_builtin(flag);
+  if (appcompare == NULL) 
+    error->all("Invalid compare method for sample sort keys");
+  return sample_sort_keys(appcompare);
 }
 
 /* ----------------------------------------------------------------------
-   query total # of values and # of value blocks in a single multi-page KMV
-   called from user myreduce() or mycompress() function
+   sort keys across all procs to create a new KV
+   use appcompare() to compare 2 keys
+   proc 0 holds the smallest keys, proc P-1 the largest
 ------------------------------------------------------------------------- */
 
-void MapReduce::multivalue_block_select(int which)
+uint64_t MapReduce::sample_sort_keys(int (*appcompare)(char *, int, 
+						       char *, int))
 {
-  if (!kmv_block_valid) error->one("Invalid call to multivalue_block_select()");
-  if (which == 1) kmv->page = kmv_mvpage1;
-  else if (which == 2) kmv->page = kmv_mvpage2;
-  else error->one("Invalid arg to multivalue_block_select()");
+  if (kv == NULL) error->all("Cannot sample_sort_keys without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
+
+  compare = appcompare;
+  sample_sort(0);
+
+  stats("Sample_sort_keys",0);
+  fcounter_sort = 0;
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   query info for 1 block of a single KMV that spans multiple pages
-   called from user myreduce() or mycompress() function
-   iblock = 0 to nblock_kmv-1
+   sort values across all procs to create a new KV
+   call sample_sort_values(appcompare) with pre-defined compare method
 ------------------------------------------------------------------------- */
 
-int MapReduce::multivalue_block(int iblock, 
-				char **pmultivalue, int **pvaluesizes)
+uint64_t MapReduce::sample_sort_values(int flag)
 {
-  if (!kmv_block_valid) error->one("Invalid call to multivalue_block()");
-  if (iblock < 0 || iblock >= kmv_nblock)
-    error->one("Invalid page request to multivalue_block()");
+  CompareFunc *appcompare = compare_builtin(flag);
+  if (appcompare == NULL) 
+    error->all("Invalid compare method for sample sort values");
+  return sample_sort_values(appcompare);
+}
 
-  uint64_t dummy1,dummy2,dummy3;
-  char *page_kmv;
-  kmv->request_info(&page_kmv);
-  kmv->request_page(kmv_key_page+iblock+1,0,dummy1,dummy2,dummy3);
+/* ----------------------------------------------------------------------
+   sort values across all procs to create a new KV
+   use appcompare() to compare 2 values
+   proc 0 holds the smallest values, proc P-1 the largest
+------------------------------------------------------------------------- */
 
-  char *ptr = page_kmv;
-  int nvalues = *((int *) ptr);
-  ptr += sizeof(int);
-  *pvaluesizes = (int *) ptr;
-  ptr += nvalues*sizeof(int);
-  *pmultivalue = ROUNDUP(ptr,valignm1);
+uint64_t MapReduce::sample_sort_values(int (*appcompare)(char *, int, 
+							 char *, int))
+{
+  if (kv == NULL) error->all("Cannot sample_sort_values without KeyValue");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-  return nvalues;
+  compare = appcompare;
+  sample_sort(1);
+
+  stats("Sample_sort_values",0);
+  fcounter_sort = 0;
+
+  uint64_t nkeyall;
+  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  return nkeyall;
 }
 
 /* ----------------------------------------------------------------------
-   scan KV pairs without altering them
-   make one call to appscan() for each KV pair
-   each proc processes its owned KV pairs
+   sort keys or values of a KV across all procs via a sample sort
+   flag = 0 = sort keys, flag = 1 = sort values
+   pick P-1 splitters from a sample of keys or values,
+     range partition pairs between splitters via aggregate exchange,
+     then sort each proc's pairs locally
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::scan(void (*appscan)(char *, int, char *, int, 
-					 void *), void *appptr)
+void MapReduce::sample_sort(int flag)
 {
-  if (kv == NULL) error->all("Cannot scan without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  if (nprocs > 1) {
+    kv->allocate();
+    sample_splitters(flag);
 
-  kv->allocate();
+    if (nsplit) {
+      rangeflag = flag;
+      rangecount = 0;
 
-  int nkey_kv,keybytes,valuebytes;
-  uint64_t dummy1,dummy2,dummy3;
-  char *page_kv,*ptr,*key,*value;
-  int npage_kv = kv->request_info(&page_kv);
+      KeyValue *kvnew = new KeyValue(this,kalign,valign,memory,error,comm);
 
-  for (int ipage = 0; ipage < npage_kv; ipage++) {
-    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
-    ptr = page_kv;
+      if (all2all == 2) aggregate_hierarchy(NULL,kvnew);
+      else if (all2all) aggregate_pipeline(NULL,kv,kvnew,comm,NULL);
+      else aggregate_irregular(NULL,kvnew);
 
-    for (int i = 0; i < nkey_kv; i++) {
-      keybytes = *((int *) ptr);
-      valuebytes = *((int *) (ptr+sizeof(int)));;
+      delete kv;
+      kv = kvnew;
+      kv->complete();
+      rangeflag = -1;
+
+      memory->sfree(splitptr);
+      memory->sfree(splitlen);
+      memory->sfree(splitbuf);
+      splitptr = NULL;
+      splitlen = NULL;
+      splitbuf = NULL;
+      nsplit = 0;
+    }
+  }
 
-      ptr += twolenbytes;
-      ptr = ROUNDUP(ptr,kalignm1);
-      key = ptr;
-      ptr += keybytes;
-      ptr = ROUNDUP(ptr,valignm1);
-      value = ptr;
-      ptr += valuebytes;
-      ptr = ROUNDUP(ptr,talignm1);
+  sort_kv(flag);
+}
+
+/* ----------------------------------------------------------------------
+   choose nprocs-1 splitters that divide keys or values into equal ranges
+   proc 0 sorts a sample of all procs' pairs
+     and broadcasts every Nth one as a splitter
+   set nsplit = 0 if there are no pairs on any proc
+------------------------------------------------------------------------- */
+
+void MapReduce::sample_splitters(int flag)
+{
+  int i;
+  char *ptr;
+
+  uint64_t nkvall;
+  MPI_Allreduce(&kv->nkv,&nkvall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  if (nkvall == 0) return;
+
+  int *alllens;
+  char *allbuf;
+  int ntotal = sample_gather(flag,nkvall,alllens,allbuf);
+
+  // proc 0 sorts samples via Sorter
+  // splitter I = sample with rank (I+1)*ntotal/nprocs
 
-      appscan(key,keybytes,value,valuebytes,appptr);
+  nsplit = nprocs-1;
+  splitlen = (int *) memory->smalloc(nsplit*sizeof(int),"MR:splitlen");
+  splitptr = (char **) memory->smalloc(nsplit*sizeof(char *),"MR:splitptr");
+  int nsplitbytes = 0;
+
+  if (me == 0) {
+    int *order = (int *) memory->smalloc(ntotal*sizeof(int),"MR:samples");
+    int *slen = (int *) memory->smalloc(ntotal*sizeof(int),"MR:samples");
+    char **sptr = (char **) 
+      memory->smalloc(ntotal*sizeof(char *),"MR:samples");
+
+    ptr = allbuf;
+    for (i = 0; i < ntotal; i++) {
+      sptr[i] = ptr;
+      slen[i] = alllens[i];
+      ptr += alllens[i];
+    }
+
+    sort_style();
+    char *work = (char *)
+      memory->smalloc((uint64_t) ntotal*Sorter::workbytes(),"MR:samples");
+    Sorter *sampler = new Sorter(nthreads,memory,error);
+    sampler->sort(ntotal,order,sptr,slen,compare,sortstyle,sortreverse,work);
+    delete sampler;
+    memory->sfree(work);
+
+    for (i = 0; i < nsplit; i++) {
+      splitlen[i] = slen[order[(uint64_t) (i+1)*ntotal/nprocs]];
+      nsplitbytes += splitlen[i];
+    }
+    splitbuf = (char *) memory->smalloc(nsplitbytes,"MR:splitbuf");
+    ptr = splitbuf;
+    for (i = 0; i < nsplit; i++) {
+      memcpy(ptr,sptr[order[(uint64_t) (i+1)*ntotal/nprocs]],splitlen[i]);
+      ptr += splitlen[i];
     }
+
+    memory->sfree(order);
+    memory->sfree(slen);
+    memory->sfree(sptr);
+    memory->sfree(alllens);
+    memory->sfree(allbuf);
   }
 
-  kv->deallocate(0);
-  if (freepage) mem_cleanup();
+  // broadcast splitters to all procs
 
-  stats("Scan",0);
+  MPI_Bcast(splitlen,nsplit,MPI_INT,0,comm);
+  if (me) {
+    for (i = 0; i < nsplit; i++) nsplitbytes += splitlen[i];
+    splitbuf = (char *) memory->smalloc(nsplitbytes,"MR:splitbuf");
+  }
+  MPI_Bcast(splitbuf,nsplitbytes,MPI_BYTE,0,comm);
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  ptr = splitbuf;
+  for (i = 0; i < nsplit; i++) {
+    splitptr[i] = ptr;
+    ptr += splitlen[i];
+  }
 }
 
 /* ----------------------------------------------------------------------
-   scan KMV pairs without altering them
-   make one call to appscan() for each KMV pair
-   each proc processes its owned KMV pairs
+   gather a sample of keys or values from all procs on proc 0
+   flag = 0 = sample keys, flag = 1 = sample values
+   each proc samples evenly spaced pairs, in proportion to its # of pairs
+   return # of samples on proc 0, with their lengths in alllens
+     and their bytes concatenated in allbuf, caller frees both
+   return 0 and NULL arrays on other procs
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::scan(void (*appscan)(char *, int, 
-					 char *, int, int *,
-					 void *), void *appptr)
+int MapReduce::sample_gather(int flag, uint64_t nkvall, 
+			     int *&alllens, char *&allbuf)
 {
-  if (kmv == NULL) error->all("Cannot scan without KeyMultiValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  int i,nkey_kv,nbytes,kvbytes;
+  uint64_t dummy1,dummy2,alignsize;
+  char *page_kv,*ptr,*str;
+
+  int nsample = 0;
+  if (kv->nkv) {
+    uint64_t n = (uint64_t) NSAMPLE*nprocs * kv->nkv / nkvall + 1;
+    nsample = MIN(n,kv->nkv);
+  }
 
-  kmv->allocate();
+  // copy sampled keys or values into buf
+  // sample I is the pair with index I*nkv/nsample
 
-  uint64_t dummy;
-  int memtag1,memtag2;
-  char *mvpage1 = mem_request(1,dummy,memtag1);
-  char *mvpage2 = mem_request(1,dummy,memtag2);
+  int *lens = (int *) memory->smalloc(nsample*sizeof(int),"MR:samples");
+  char *buf = NULL;
+  int maxbuf = 0;
+  int nbuf = 0;
 
-  int nkey_kmv,nvalues,keybytes,mvaluebytes;
-  uint64_t dummy1,dummy2,dummy3;
-  int *valuesizes;
-  char *ptr,*key,*multivalue;
+  int isample = 0;
+  uint64_t next = 0;
+  uint64_t index = 0;
 
-  char *page_kmv;
-  int npage_kmv = kmv->request_info(&page_kmv);
-  char *page_hold = page_kmv;
+  int npage_kv = kv->request_info(&page_kv);
 
-  for (int ipage = 0; ipage < npage_kmv; ipage++) {
-    nkey_kmv = kmv->request_page(ipage,0,dummy1,dummy2,dummy3);
-    ptr = page_kmv;
+  for (int ipage = 0; ipage < npage_kv && isample < nsample; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,alignsize);
+    ptr = page_kv;
 
-    for (int i = 0; i < nkey_kmv; i++) {
-      nvalues = *((int *) ptr);
-      ptr += sizeof(int);
+    for (i = 0; i < nkey_kv && isample < nsample; i++) {
+      kvbytes = extract(flag,ptr,str,nbytes);
+      if (index == next) {
+	if (nbuf + nbytes > maxbuf) {
+	  maxbuf = 2*(nbuf + nbytes);
+	  buf = (char *) memory->srealloc(buf,maxbuf,"MR:samples");
+	}
+	memcpy(&buf[nbuf],str,nbytes);
+	nbuf += nbytes;
+	lens[isample++] = nbytes;
+	next = (uint64_t) isample * kv->nkv / nsample;
+      }
+      ptr += kvbytes;
+      index++;
+    }
+  }
 
-      if (nvalues > 0) {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	mvaluebytes = *((int *) ptr);
-	ptr += sizeof(int);
-	valuesizes = (int *) ptr;
-	ptr += ((uint64_t) nvalues) * sizeof(int);
-	
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
-	ptr += keybytes;
-	ptr = ROUNDUP(ptr,valignm1);
-	multivalue = ptr;
-	ptr += mvaluebytes;
-	ptr = ROUNDUP(ptr,talignm1);
-	
-	appscan(key,keybytes,multivalue,nvalues,valuesizes,appptr);
+  // gather all samples on proc 0
 
-      } else {
-	keybytes = *((int *) ptr);
-	ptr += sizeof(int);
-	ptr = ROUNDUP(ptr,kalignm1);
-	key = ptr;
+  int info[2];
+  info[0] = nsample;
+  info[1] = nbuf;
 
-	// set KMV page to mvpage1 so key will not be overwritten
-	// when multivalue_block() loads new pages of values
+  int *allinfo = NULL;
+  int *ncounts = NULL,*ndispls = NULL,*bcounts = NULL,*bdispls = NULL;
+  int ntotal = 0;
+  int nbytes_total = 0;
+  alllens = NULL;
+  allbuf = NULL;
 
-	kmv_block_valid = 1;
-	kmv_key_page = ipage;
-	kmv_mvpage1 = mvpage1;
-	kmv_mvpage2 = mvpage2;
-	kmv_nvalue_total = kmv->multivalue_blocks(ipage,kmv_nblock);
-	kmv->page = mvpage1;
-	appscan(key,keybytes,NULL,0,(int *) this,appptr);
-	kmv_block_valid = 0;
-	ipage += kmv_nblock;
-	kmv->page = page_hold;
-      }
+  if (me == 0) {
+    allinfo = new int[2*nprocs];
+    ncounts = new int[nprocs];
+    ndispls = new int[nprocs];
+    bcounts = new int[nprocs];
+    bdispls = new int[nprocs];
+  }
+
+  MPI_Gather(info,2,MPI_INT,allinfo,2,MPI_INT,0,comm);
+
+  if (me == 0) {
+    for (int iproc = 0; iproc < nprocs; iproc++) {
+      ncounts[iproc] = allinfo[2*iproc];
+      bcounts[iproc] = allinfo[2*iproc+1];
+      ndispls[iproc] = ntotal;
+      bdispls[iproc] = nbytes_total;
+      ntotal += ncounts[iproc];
+      nbytes_total += bcounts[iproc];
     }
+    alllens = (int *) memory->smalloc(ntotal*sizeof(int),"MR:samples");
+    allbuf = (char *) memory->smalloc(nbytes_total,"MR:samples");
   }
 
-  kmv->deallocate(0);
-  if (freepage) mem_cleanup();
+  MPI_Gatherv(lens,nsample,MPI_INT,alllens,ncounts,ndispls,MPI_INT,0,comm);
+  MPI_Gatherv(buf,nbuf,MPI_BYTE,allbuf,bcounts,bdispls,MPI_BYTE,0,comm);
 
-  stats("Scan",0);
+  memory->sfree(lens);
+  memory->sfree(buf);
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  if (me == 0) {
+    delete [] allinfo;
+    delete [] ncounts;
+    delete [] ndispls;
+    delete [] bcounts;
+    delete [] bdispls;
+  }
+
+  return ntotal;
 }
 
 /* ----------------------------------------------------------------------
-   scrunch KV to create a KMV on fewer processors, each with a single pair
-   gather followed by a collapse
-   numprocs = # of procs new KMV resides on (0 to numprocs-1)
-   new key = provided key name (same on every proc)
-   new value = list of old key,value,key,value,etc
+   return proc that owns a KV pair in a sample sort, by its key or value
+   proc I owns the range from splitter I-1 to splitter I, inclusive
+   a datum equal to several splitters may go to any proc between them,
+     successive such pairs are spread across those procs for balance
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::scrunch(int numprocs, char *key, int keybytes)
+int MapReduce::range_proc(char *key, int keybytes, char *value, int valuebytes)
 {
-  if (kv == NULL) error->all("Cannot scrunch without KeyValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  int mid;
 
-  int verbosity_hold = verbosity;
-  int timer_hold = timer;
-  verbosity = timer = 0;
+  char *str = key;
+  int nbytes = keybytes;
+  if (rangeflag == 1) {
+    str = value;
+    nbytes = valuebytes;
+  }
 
-  gather(numprocs);
-  collapse(key,keybytes);
+  // first = # of splitters < str, last = # of splitters <= str
 
-  verbosity = verbosity_hold;
-  timer = timer_hold;
-  stats("Scrunch",1);
+  int lo = 0;
+  int hi = nsplit;
+  while (lo < hi) {
+    mid = (lo+hi) / 2;
+    if (compare(splitptr[mid],splitlen[mid],str,nbytes) < 0) lo = mid+1;
+    else hi = mid;
+  }
+  int first = lo;
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  hi = nsplit;
+  while (lo < hi) {
+    mid = (lo+hi) / 2;
+    if (compare(splitptr[mid],splitlen[mid],str,nbytes) <= 0) lo = mid+1;
+    else hi = mid;
+  }
+  int last = lo;
+
+  if (first == last) return first;
+  return first + rangecount++ % (last-first+1);
 }
 
 /* ----------------------------------------------------------------------
-   sort keys in a KV to create a new KV
-   call sort_keys(appcompare) with pre-defined compare method
+   keep the first K pairs of a KV ordered by key
+   call topk_keys(k,appcompare) with pre-defined compare method
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_keys(int flag)
+uint64_t MapReduce::topk_keys(int k, int flag)
 {
-  int absflag = flag;
-  if (flag < 0) absflag = -flag;
-  if (absflag == 1) {
-    if (flag > 0) return sort_keys(compare_int);
-    else return sort_keys(compare_int_reverse);
-  } else if (absflag == 2) {
-    if (flag > 0) return sort_keys(compare_uint64);
-    else return sort_keys(compare_uint64_reverse);
-  } else if (absflag == 3) {
-    if (flag > 0) return sort_keys(compare_float);
-    else return sort_keys(compare_float_reverse);
-  } else if (absflag == 4) {
-    if (flag > 0) return sort_keys(compare_double);
-    else return sort_keys(compare_double_reverse);
-  } else if (absflag == 5) {
-    if (flag > 0) return sort_keys(compare_str);
-    else return sort_keys(compare_str_reverse);
-  } else if (absflag == 6) {
-    if (flag > 0) return sort_keys(compare_strn);
-    else return sort_keys(compare_strn_reverse);
-  }
-  error->all("Invalid compare method for sort keys");
+  CompareFunc *appcompare = compare_builtin(flag);
+  if (appcompare == NULL) error->all("Invalid compare method for topk keys");
+  return topk_keys(k,appcompare);
 }
 
 /* ----------------------------------------------------------------------
-   sort keys in a KV to create a new KV
-   use appcompare() to compare 2 keys
-   each proc sorts only its data
+   keep the first K pairs of a KV ordered by key via appcompare()
+   result is a KV on proc 0 with the K pairs in sorted order
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_keys(int (*appcompare)(char *, int, char *, int))
+uint64_t MapReduce::topk_keys(int k, int (*appcompare)(char *, int, 
+						       char *, int))
 {
-  if (kv == NULL) error->all("Cannot sort_keys without KeyValue");
+  if (kv == NULL) error->all("Cannot topk_keys without KeyValue");
+  if (k < 0) error->all("Invalid count for topk_keys");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
   compare = appcompare;
-  sort_kv(0);
+  topk(k,0);
 
-  stats("Sort_keys",0);
-  fcounter_sort = 0;
+  stats("Topk_keys",0);
 
   uint64_t nkeyall;
   MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
@@ -2054,53 +4310,35 @@ uint64_t MapReduce::sort_keys(int (*appcompare)(char *, int, char *, int))
 }
 
 /* ----------------------------------------------------------------------
-   sort values in a KV to create a new KV
-   call sort_values(appcompare) with pre-defined compare method
+   keep the first K pairs of a KV ordered by value
+   call topk_values(k,appcompare) with pre-defined compare method
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_values(int flag)
+uint64_t MapReduce::topk_values(int k, int flag)
 {
-  int absflag = flag;
-  if (flag < 0) absflag = -flag;
-  if (absflag == 1) {
-    if (flag > 0) return sort_values(compare_int);
-    else return sort_values(compare_int_reverse);
-  } else if (absflag == 2) {
-    if (flag > 0) return sort_values(compare_uint64);
-    else return sort_values(compare_uint64_reverse);
-  } else if (absflag == 3) {
-    if (flag > 0) return sort_values(compare_float);
-    else return sort_values(compare_float_reverse);
-  } else if (absflag == 4) {
-    if (flag > 0) return sort_values(compare_double);
-    else return sort_values(compare_double_reverse);
-  } else if (absflag == 5) {
-    if (flag > 0) return sort_values(compare_str);
-    else return sort_values(compare_str_reverse);
-  } else if (absflag == 6) {
-    if (flag > 0) return sort_values(compare_strn);
-    else return sort_values(compare_strn_reverse);
-  }
-  error->all("Invalid compare method for sort values");
+  CompareFunc *appcompare = compare_builtin(flag);
+  if (appcompare == NULL) 
+    error->all("Invalid compare method for topk values");
+  return topk_values(k,appcompare);
 }
 
 /* ----------------------------------------------------------------------
-   sort values in a KV to create a new KV
-   use appcompare() to compare 2 values
-   each proc sorts only its data
+   keep the first K pairs of a KV ordered by value via appcompare()
+   result is a KV on proc 0 with the K pairs in sorted order
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_values(int (*appcompare)(char *, int, char *, int))
+uint64_t MapReduce::topk_values(int k, int (*appcompare)(char *, int, 
+							 char *, int))
 {
-  if (kv == NULL) error->all("Cannot sort_values without KeyValue");
+  if (kv == NULL) error->all("Cannot topk_values without KeyValue");
+  if (k < 0) error->all("Invalid count for topk_values");
   if (timer) start_timer();
   if (verbosity) file_stats(0);
 
   compare = appcompare;
-  sort_kv(1);
+  topk(k,1);
 
-  stats("Sort_values",0);
-  fcounter_sort = 0;
+  stats("Topk_values",0);
 
   uint64_t nkeyall;
   MPI_Allreduce(&kv->nkv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
@@ -2108,160 +4346,339 @@ uint64_t MapReduce::sort_values(int (*appcompare)(char *, int, char *, int))
 }
 
 /* ----------------------------------------------------------------------
-   sort values within each multivalue in a KMV
-   call sort_multivalues(appcompare) with pre-defined compare method
+   keep the first K pairs of a KV, ordered by compare()
+   flag = 0 = order by keys, flag = 1 = order by values
+   each proc keeps its first K pairs in a heap whose root is the last one,
+   heaps are merged up a binomial tree to proc 0, which creates
+     a KV with the K pairs in sorted order, other procs have an empty KV
+   a heap item is a copy of a pair: keybytes, valuebytes, key, value
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_multivalues(int flag)
+void MapReduce::topk(int k, int flag)
 {
-  int absflag = flag;
-  if (flag < 0) absflag = -flag;
-  if (absflag == 1) {
-    if (flag > 0) return sort_multivalues(compare_int);
-    else return sort_multivalues(compare_int_reverse);
-  } else if (absflag == 2) {
-    if (flag > 0) return sort_multivalues(compare_uint64);
-    else return sort_multivalues(compare_uint64_reverse);
-  } else if (absflag == 3) {
-    if (flag > 0) return sort_multivalues(compare_float);
-    else return sort_multivalues(compare_float_reverse);
-  } else if (absflag == 4) {
-    if (flag > 0) return sort_multivalues(compare_double);
-    else return sort_multivalues(compare_double_reverse);
-  } else if (absflag == 5) {
-    if (flag > 0) return sort_multivalues(compare_str);
-    else return sort_multivalues(compare_str_reverse);
-  } else if (absflag == 6) {
-    if (flag > 0) return sort_multivalues(compare_strn);
-    else return sort_multivalues(compare_strn_reverse);
+  int i,nkey_kv,kvbytes,keybytes,valuebytes,nbytes;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv,*ptr,*key,*value,*str;
+  MPI_Status status;
+
+  char **heap = (char **) memory->smalloc(k*sizeof(char *),"MR:topk");
+  int nheap = 0;
+
+  // add my pairs to heap
+
+  kv->allocate();
+  int npage_kv = kv->request_info(&page_kv);
+
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    ptr = page_kv;
+    for (i = 0; i < nkey_kv; i++) {
+      kvbytes = extract(0,ptr,key,keybytes);
+      extract(1,ptr,value,valuebytes);
+      topk_add(heap,nheap,k,flag,key,keybytes,value,valuebytes);
+      ptr += kvbytes;
+    }
   }
-  error->all("Invalid compare method for sort multivalues");
+
+  // merge heaps up a binomial tree to proc 0
+  // recv heap items from each child, then send all my items to parent
+
+  for (int mask = 1; mask < nprocs; mask <<= 1) {
+    if (me & mask) {
+      nbytes = 0;
+      for (i = 0; i < nheap; i++)
+	nbytes += 2*sizeof(int) + topk_datum(heap[i],0,str) + 
+	  topk_datum(heap[i],1,str);
+      char *buf = (char *) memory->smalloc(nbytes,"MR:topk");
+      ptr = buf;
+      for (i = 0; i < nheap; i++) {
+	int len = 2*sizeof(int) + topk_datum(heap[i],0,str) + 
+	  topk_datum(heap[i],1,str);
+	memcpy(ptr,heap[i],len);
+	ptr += len;
+      }
+      MPI_Send(buf,nbytes,MPI_BYTE,me-mask,0,comm);
+      cssize += nbytes;
+      memory->sfree(buf);
+      for (i = 0; i < nheap; i++) memory->sfree(heap[i]);
+      nheap = 0;
+      break;
+    }
+
+    if (me+mask < nprocs) {
+      MPI_Probe(me+mask,0,comm,&status);
+      MPI_Get_count(&status,MPI_BYTE,&nbytes);
+      char *buf = (char *) memory->smalloc(nbytes,"MR:topk");
+      MPI_Recv(buf,nbytes,MPI_BYTE,me+mask,0,comm,&status);
+      crsize += nbytes;
+      ptr = buf;
+      while (ptr < buf+nbytes) {
+	keybytes = *((int *) ptr);
+	valuebytes = *((int *) (ptr+sizeof(int)));
+	key = ptr + 2*sizeof(int);
+	value = key + keybytes;
+	topk_add(heap,nheap,k,flag,key,keybytes,value,valuebytes);
+	ptr = value + valuebytes;
+      }
+      memory->sfree(buf);
+    }
+  }
+
+  // proc 0 pops heap from last to first item, then adds them in order
+
+  delete kv;
+  kv = new KeyValue(this,kalign,valign,memory,error,comm);
+
+  char **order = (char **) memory->smalloc(nheap*sizeof(char *),"MR:topk");
+  int n = nheap;
+  while (nheap) {
+    order[nheap-1] = heap[0];
+    heap[0] = heap[--nheap];
+    topk_sift(heap,nheap,0,flag);
+  }
+
+  for (i = 0; i < n; i++) {
+    keybytes = *((int *) order[i]);
+    valuebytes = *((int *) (order[i]+sizeof(int)));
+    key = order[i] + 2*sizeof(int);
+    kv->add(key,keybytes,key+keybytes,valuebytes);
+    memory->sfree(order[i]);
+  }
+
+  kv->complete();
+  memory->sfree(order);
+  memory->sfree(heap);
+  if (freepage) mem_cleanup();
+}
+
+/* ----------------------------------------------------------------------
+   offer a pair to a heap that holds up to K pairs
+   if heap is full, pair replaces root if it comes before it
+------------------------------------------------------------------------- */
+
+void MapReduce::topk_add(char **heap, int &nheap, int k, int flag,
+			 char *key, int keybytes, char *value, int valuebytes)
+{
+  char *str;
+  int i,parent;
+
+  char *datum = flag ? value : key;
+  int nbytes = flag ? valuebytes : keybytes;
+  int n = 2*sizeof(int) + keybytes + valuebytes;
+
+  if (nheap == k) {
+    if (k == 0) return;
+    int len = topk_datum(heap[0],flag,str);
+    if (compare(datum,nbytes,str,len) >= 0) return;
+    heap[0] = (char *) memory->srealloc(heap[0],n,"MR:topk");
+    i = 0;
+  } else {
+    heap[nheap] = (char *) memory->smalloc(n,"MR:topk");
+    i = nheap++;
+  }
+
+  char *item = heap[i];
+  *((int *) item) = keybytes;
+  *((int *) (item+sizeof(int))) = valuebytes;
+  memcpy(item+2*sizeof(int),key,keybytes);
+  memcpy(item+2*sizeof(int)+keybytes,value,valuebytes);
+
+  if (i) {
+    while (i > 0) {
+      parent = (i-1) / 2;
+      int len = topk_datum(heap[parent],flag,str);
+      if (compare(datum,nbytes,str,len) <= 0) break;
+      heap[i] = heap[parent];
+      i = parent;
+    }
+    heap[i] = item;
+  } else topk_sift(heap,nheap,0,flag);
 }
 
 /* ----------------------------------------------------------------------
-   sort values within each multivalue in a KMV
-   sorts in place, does not create a new KMV
-   use appcompare() to compare 2 values within a multivalue
-   each proc sorts only its data
+   restore heap order below item I, root of heap is its last item
 ------------------------------------------------------------------------- */
 
-uint64_t MapReduce::sort_multivalues(int (*appcompare)(char *, int, 
-						       char *, int))
+void MapReduce::topk_sift(char **heap, int n, int i, int flag)
 {
-  int i,j,k;
-  int *order;
-  uint64_t offset;
-  char *page_kmv;
+  char *str1,*str2;
 
-  if (kmv == NULL) error->all("Cannot sort_multivalues without KeyMultiValue");
-  if (timer) start_timer();
-  if (verbosity) file_stats(0);
+  while (1) {
+    int largest = i;
+    int left = 2*i + 1;
+    int right = left + 1;
+    int len1 = topk_datum(heap[largest],flag,str1);
+    if (left < n) {
+      int len2 = topk_datum(heap[left],flag,str2);
+      if (compare(str2,len2,str1,len1) > 0) {
+	largest = left;
+	str1 = str2;
+	len1 = len2;
+      }
+    }
+    if (right < n) {
+      int len2 = topk_datum(heap[right],flag,str2);
+      if (compare(str2,len2,str1,len1) > 0) largest = right;
+    }
+    if (largest == i) return;
+    char *tmp = heap[i];
+    heap[i] = heap[largest];
+    heap[largest] = tmp;
+    i = largest;
+  }
+}
 
-  kmv->allocate();
-  int npage_kmv = kmv->request_info(&page_kmv);
+/* ----------------------------------------------------------------------
+   set str to key (flag = 0) or value (flag = 1) of a heap item
+   return its length
+------------------------------------------------------------------------- */
 
-  compare = appcompare;
-  mrptr = this;
+int MapReduce::topk_datum(char *item, int flag, char *&str)
+{
+  int keybytes = *((int *) item);
+  str = item + 2*sizeof(int);
+  if (flag == 0) return keybytes;
+  str += keybytes;
+  return *((int *) (item+sizeof(int)));
+}
 
-  uint64_t dummy;
-  int memtag1,memtag2;
-  char *twopage = mem_request(2,dummy,memtag2);
-  char *scratch = mem_request(1,dummy,memtag1);
+/* ----------------------------------------------------------------------
+   sum values of a KV across all procs
+   flag = 1,2,3,4 for values that are int, uint64, float, double
+   result = sum, of same type as values, on every proc
+   return # of values summed
+------------------------------------------------------------------------- */
 
-  int nkey_kmv,nvalues,keybytes,mvaluebytes;
-  uint64_t dummy1,dummy2,dummy3;
-  int *valuesizes;
-  char *ptr,*multivalue,*ptr2;
+uint64_t MapReduce::sum_values(int flag, void *result)
+{
+  return reduce_values(SUM,flag,result);
+}
 
-  for (int ipage = 0; ipage < npage_kmv; ipage++) {
-    nkey_kmv = kmv->request_page(ipage,1,dummy1,dummy2,dummy3);
-    ptr = page_kmv;
+/* ----------------------------------------------------------------------
+   min of values of a KV across all procs, see sum_values()
+------------------------------------------------------------------------- */
 
-    for (i = 0; i < nkey_kmv; i++) {
-      nvalues = *((int *) ptr);
-      ptr += sizeof(int);
+uint64_t MapReduce::min_values(int flag, void *result)
+{
+  return reduce_values(MINVAL,flag,result);
+}
 
-      if (nvalues == 0)
-	error->one("Sort_multivalue of multi-page KeyMultiValue "
-		   "not yet supported");
+/* ----------------------------------------------------------------------
+   max of values of a KV across all procs, see sum_values()
+------------------------------------------------------------------------- */
 
-      keybytes = *((int *) ptr);
-      ptr += sizeof(int);
-      mvaluebytes = *((int *) ptr);
-      ptr += sizeof(int);
-      valuesizes = (int *) ptr;
-      ptr += ((uint64_t) nvalues) * sizeof(int);
-      
-      ptr = ROUNDUP(ptr,kalignm1);
-      ptr += keybytes;
-      ptr = ROUNDUP(ptr,valignm1);
-      multivalue = ptr;
-      ptr += mvaluebytes;
-      ptr = ROUNDUP(ptr,talignm1);
+uint64_t MapReduce::max_values(int flag, void *result)
+{
+  return reduce_values(MAXVAL,flag,result);
+}
 
-      // setup 2 arrays from 2 pages of memory
-      // order = ordering of values in multivalue, initially 0 to N-1
-      // dptr = ptr to each value
-      // slength = length of each value = valuesizes
+/* ----------------------------------------------------------------------
+   reduce fixed-size numeric values of a KV to one number on every proc
+   op = SUM, MINVAL, MAXVAL
+   flag = 1,2,3,4 for int, uint64, float, double values
+   values are read in place from KV pages, no KMV is created
+   float sums are accumulated as doubles
+------------------------------------------------------------------------- */
 
-      offset = ((uint64_t) nvalues) * sizeof(int);
-      order = (int *) twopage;
-      dptr = (char **) &twopage[offset];
-      slength = valuesizes;
+uint64_t MapReduce::reduce_values(int op, int flag, void *result)
+{
+  int i,nkey_kv,kvbytes,nbytes;
+  uint64_t dummy1,dummy2,dummy3;
+  char *page_kv,*ptr,*value;
 
-      ptr2 = multivalue;
-      for (j = 0; j < nvalues; j++) {
-	order[j] = j;
-	dptr[j] = ptr2;
-	ptr2 += valuesizes[j];
-      }
+  if (kv == NULL) error->all("Cannot reduce values without KeyValue");
+  if (flag < 1 || flag > 4) error->all("Invalid value type for reduce values");
+  if (timer) start_timer();
+  if (verbosity) file_stats(0);
 
-      // sort values within multivalue via qsort()
-      // simply creates new order array
+  int size[5] = {0,sizeof(int),sizeof(uint64_t),sizeof(float),sizeof(double)};
+
+  // init accumulators to identity of op
+
+  int ivalue = 0;
+  uint64_t uvalue = 0;
+  float fvalue = 0.0;
+  double dvalue = 0.0;
+
+  if (op == MINVAL) {
+    ivalue = INT_MAX;
+    uvalue = UINT64_MAX;
+    fvalue = FLT_MAX;
+    dvalue = DBL_MAX;
+  } else if (op == MAXVAL) {
+    ivalue = INT_MIN;
+    uvalue = 0;
+    fvalue = -FLT_MAX;
+    dvalue = -DBL_MAX;
+  }
 
-      qsort(order,nvalues,sizeof(int),compare_standalone);
-      
-      // reorder the multivalue, using scratch space
-      // copy back into original page
+  kv->allocate();
+  int npage_kv = kv->request_info(&page_kv);
 
-      ptr2 = scratch;
-      for (j = 0; j < nvalues; j++) {
-	k = order[j];
-	memcpy(ptr2,dptr[k],slength[k]);
-	ptr2 += slength[k];
+  for (int ipage = 0; ipage < npage_kv; ipage++) {
+    nkey_kv = kv->request_page(ipage,dummy1,dummy2,dummy3);
+    ptr = page_kv;
+    for (i = 0; i < nkey_kv; i++) {
+      kvbytes = extract(1,ptr,value,nbytes);
+      if (nbytes != size[flag])
+	error->one("Value size does not match type for reduce values");
+      ptr += kvbytes;
+
+      if (flag == 1) {
+	int v = *((int *) value);
+	if (op == SUM) ivalue += v;
+	else if (op == MINVAL) ivalue = MIN(ivalue,v);
+	else ivalue = MAX(ivalue,v);
+      } else if (flag == 2) {
+	uint64_t v = *((uint64_t *) value);
+	if (op == SUM) uvalue += v;
+	else if (op == MINVAL) uvalue = MIN(uvalue,v);
+	else uvalue = MAX(uvalue,v);
+      } else if (flag == 3) {
+	float v = *((float *) value);
+	if (op == SUM) dvalue += v;
+	else if (op == MINVAL) fvalue = MIN(fvalue,v);
+	else fvalue = MAX(fvalue,v);
+      } else {
+	double v = *((double *) value);
+	if (op == SUM) dvalue += v;
+	else if (op == MINVAL) dvalue = MIN(dvalue,v);
+	else dvalue = MAX(dvalue,v);
       }
-      memcpy(multivalue,scratch,mvaluebytes);
-
-      // likewise reorder the valuesizes, using scratch space
-      // copy back into original valuesizes
-
-      int *newsizes = (int *) scratch;
-      for (j = 0; j < nvalues; j++)
-        newsizes[j] = valuesizes[order[j]];
-      memcpy(valuesizes,newsizes,nvalues*sizeof(int));
     }
-
-    // overwrite the changed KMV page to disk
-
-    kmv->overwrite_page(ipage);
   }
 
-  // close KMV file if necessary
-
-  kmv->close_file();
-
-  // free memory pages
-
-  kmv->deallocate(0);
-  mem_unmark(memtag1);
-  mem_unmark(memtag2);
-  if (freepage) mem_cleanup();
+  kv->deallocate(0);
 
-  stats("Sort_multivalues",1);
+  // reduce across procs, result = 0 if there are no values
+
+  MPI_Op mpiop = MPI_SUM;
+  if (op == MINVAL) mpiop = MPI_MIN;
+  else if (op == MAXVAL) mpiop = MPI_MAX;
+
+  uint64_t nall;
+  MPI_Allreduce(&kv->nkv,&nall,1,MRMPI_BIGINT,MPI_SUM,comm);
+
+  if (flag == 1) {
+    MPI_Allreduce(&ivalue,result,1,MPI_INT,mpiop,comm);
+    if (nall == 0) *((int *) result) = 0;
+  } else if (flag == 2) {
+    MPI_Allreduce(&uvalue,result,1,MRMPI_BIGINT,mpiop,comm);
+    if (nall == 0) *((uint64_t *) result) = 0;
+  } else if (flag == 3 && op == SUM) {
+    double dall;
+    MPI_Allreduce(&dvalue,&dall,1,MPI_DOUBLE,mpiop,comm);
+    *((float *) result) = dall;
+  } else if (flag == 3) {
+    MPI_Allreduce(&fvalue,result,1,MPI_FLOAT,mpiop,comm);
+    if (nall == 0) *((float *) result) = 0.0;
+  } else {
+    MPI_Allreduce(&dvalue,result,1,MPI_DOUBLE,mpiop,comm);
+    if (nall == 0) *((double *) result) = 0.0;
+  }
 
-  uint64_t nkeyall;
-  MPI_Allreduce(&kmv->nkmv,&nkeyall,1,MRMPI_BIGINT,MPI_SUM,comm);
-  return nkeyall;
+  stats("Reduce_values",0);
+  return nall;
 }
 
 /* ----------------------------------------------------------------------
@@ -2271,97 +4688,125 @@ uint64_t MapReduce::sort_multivalues(int (*appcompare)(char *, int,
 
 void MapReduce::sort_kv(int flag)
 {
-  int nkey_kv,memtag_kv,memtag1,memtag2,memtag_twopage,src1,src2;
-  uint64_t dummy,dummy1,dummy2,dummy3;
+  int i,nkey_kv,memtag_kv,memtag1,memtag_twopage,maxbytes;
+  uint64_t dummy,dummy1,dummy2,alignsize;
   char *page_kv;
-  void *src1ptr,*src2ptr,*destptr;
 
   kv->allocate();
-  mrptr = this;
+  sort_style();
+  sorter = new Sorter(nthreads,memory,error);
   int npage_kv = kv->request_info(&page_kv);
   memtag_kv = kv->memtag;
 
   // KV has single page
   // sort into newpage, assign newpage to KV, and return
+  // complete_dummy() matches complete() on procs with multiple pages
   
+  int ntwo = workpages(2,2*sizeof(int)+sizeof(char *));
+
   if (npage_kv == 1) {
-    char *twopage = mem_request(2,dummy,memtag_twopage);
+    char *twopage = mem_request(ntwo,dummy,memtag_twopage);
     char *newpage = mem_request(1,dummy,memtag1);
-    nkey_kv = kv->request_page(0,dummy1,dummy2,dummy3);
+    nkey_kv = kv->request_page(0,dummy1,dummy2,alignsize);
     sort_onepage(flag,nkey_kv,page_kv,newpage,twopage);
+    if (kv->npinned < kv->nkv) kv->npinned = 0;
     mem_unmark(memtag_twopage);
     mem_unmark(memtag_kv);
     kv->set_page(pagesize,newpage,memtag1);
     kv->overwrite_page(0);
     kv->close_file();
-    kv->deallocate(0);
+    kv->complete_dummy();
+    delete sorter;
     if (freepage) mem_cleanup();
     return;
   }
 
   // KV has multiple pages
-  // perform merge sort, two sources at a time into destination
-  // each pass thru while loop increments I by 2 and N by 1
-  // sources can be sorted page or Spool file
-  // destination can be Spool file or final sorted KV
+  // sort each page and write it as its own page of a Spool file = a run
+  // 4 pages hold Sorter data structs and the sorted page while sorting,
+  //   then are split into one buffer per run for a k-way merge
+  //   more pages if Sorter data structs for small fixed-size pairs need them
+  // K is bounded by the smallest buffer that holds the longest KV pair,
+  //   if there are more runs, groups of K are merged into new Spool files
+  //   until K or fewer remain, then they are merged into the final KV
   
-  char *twopage = mem_request(2,dummy,memtag_twopage);
-  char *page1 = mem_request(1,dummy,memtag1);
-  char *page2 = mem_request(1,dummy,memtag2);
-  
-  Spool **spools = new Spool*[2*npage_kv];
-  int n = npage_kv;
-  int i = 0;
-  
-  while (i < n) {
-    if (i < npage_kv) {
-      kv->set_page(pagesize,page_kv,memtag_kv);
-      nkey_kv = kv->request_page(i++,dummy1,dummy2,dummy3);
-      sort_onepage(flag,nkey_kv,page_kv,page1,twopage);
-      src1ptr = (void *) page1;
-      src1 = nkey_kv;
-    } else {
-      spools[i]->set_page(pagesize,page1);
-      src1ptr = (void *) spools[i++];
-      src1 = 0;
-    }
-    if (i < npage_kv) {
-      kv->set_page(pagesize,page_kv,memtag_kv);
-      nkey_kv = kv->request_page(i++,dummy1,dummy2,dummy3);
-      sort_onepage(flag,nkey_kv,page_kv,page2,twopage);
-      src2ptr = (void *) page2;
-      src2 = nkey_kv;
-    } else {
-      spools[i]->set_page(pagesize,page2);
-      src2ptr = (void *) spools[i++];
-      src2 = 0;
-    }
-    
-    if (i < n) {
-      spools[n] = new Spool(SORTFILE,this,memory,error);
-      spools[n]->set_page(pagesize,page_kv);
-      destptr = (void *) spools[n];
-      merge(flag,src1,src1ptr,src2,src2ptr,0,destptr);
-      if (!src1) delete spools[i-2];
-      if (!src2) delete spools[i-1];
-      spools[n++]->complete();
-    } else {
-      delete kv;
-      kv = new KeyValue(this,kalign,valign,memory,error,comm);
-      kv->set_page(pagesize,page_kv,memtag_kv);
-      destptr = (void *) kv;
-      merge(flag,src1,src1ptr,src2,src2ptr,1,destptr);
-      if (!src1) delete spools[i-2];
-      if (!src2) delete spools[i-1];
-      kv->complete();
+  char *fourpage = mem_request(ntwo+2,dummy,memtag1);
+  char *twopage = fourpage;
+  char *newpage = &fourpage[ntwo*pagesize];
+
+  Spool *spool = new Spool(SORTFILE,this,memory,error);
+  spool->set_page(pagesize,&fourpage[(ntwo+1)*pagesize]);
+  maxbytes = 0;
+
+  for (i = 0; i < npage_kv; i++) {
+    nkey_kv = kv->request_page(i,dummy1,dummy2,alignsize);
+    int nbytes = sort_onepage(flag,nkey_kv,page_kv,newpage,twopage);
+    maxbytes = MAX(maxbytes,nbytes);
+    spool->add_page(nkey_kv,alignsize,newpage);
+  }
+  spool->complete();
+  delete sorter;
+
+  int calign = MAX(ALIGNFILE,talign);
+  uint64_t bufsize = (ntwo+2)*pagesize;
+  uint64_t chunkmin = roundup(MAX(maxbytes,SORTCHUNK),calign);
+  int kmax = bufsize/chunkmin;
+
+  int nrun = npage_kv;
+  MergeRun *runs = (MergeRun *) 
+    memory->smalloc(nrun*sizeof(MergeRun),"MR:runs");
+  for (i = 0; i < nrun; i++) {
+    runs[i].spool = spool;
+    runs[i].ipage = runs[i].lastpage = i;
+  }
+
+  Spool **spools = new Spool*[nrun];
+  int nspool = 1;
+  spools[0] = spool;
+
+  while (nrun > kmax) {
+    int ngroup = (nrun+kmax-1) / kmax;
+    Spool **spools_new = new Spool*[ngroup];
+    MergeRun *runs_new = (MergeRun *) 
+      memory->smalloc(ngroup*sizeof(MergeRun),"MR:runs");
+
+    for (int igroup = 0; igroup < ngroup; igroup++) {
+      int first = igroup*kmax;
+      int n = MIN(kmax,nrun-first);
+      Spool *spdest = new Spool(SORTFILE,this,memory,error);
+      spdest->set_page(pagesize,page_kv);
+      uint64_t chunk = bufsize/n;
+      chunk -= chunk % calign;
+      merge_runs(flag,n,&runs[first],fourpage,chunk,0,spdest);
+      spdest->complete();
+      spools_new[igroup] = spdest;
+      runs_new[igroup].spool = spdest;
+      runs_new[igroup].ipage = 0;
+      runs_new[igroup].lastpage = spdest->npage-1;
     }
+
+    for (i = 0; i < nspool; i++) delete spools[i];
+    delete [] spools;
+    memory->sfree(runs);
+    spools = spools_new;
+    nspool = ngroup;
+    runs = runs_new;
+    nrun = ngroup;
   }
-  
+
+  delete kv;
+  kv = new KeyValue(this,kalign,valign,memory,error,comm);
+  kv->set_page(pagesize,page_kv,memtag_kv);
+  uint64_t chunk = bufsize/nrun;
+  chunk -= chunk % calign;
+  merge_runs(flag,nrun,runs,fourpage,chunk,1,kv);
+  kv->complete();
+
+  for (i = 0; i < nspool; i++) delete spools[i];
   delete [] spools;
+  memory->sfree(runs);
   
-  mem_unmark(memtag_twopage);
   mem_unmark(memtag1);
-  mem_unmark(memtag2);
   if (freepage) mem_cleanup();
 }
 
@@ -2369,14 +4814,16 @@ void MapReduce::sort_kv(int flag)
    sort keys or values in one page of a KV to create a new KV
    flag = 0 for sort keys, flag = 1 for sort values
    unsorted KVs are in pagesrc, final sorted KVs are put in pagedest
-   twopage is used for qsort() data structs
+   twopage is used for Sorter data structs,
+     Sorter workspace is requested as pages for this page's # of pairs
+   return byte length of longest KV pair
 ------------------------------------------------------------------------- */
 
-void MapReduce::sort_onepage(int flag, int nkey_kv,
+int MapReduce::sort_onepage(int flag, int nkey_kv,
 			     char *pagesrc, char *pagedest, char *twopage)
 {
   int i,j;
-  int keybytes,valuebytes;
+  int keybytes,valuebytes,maxbytes;
   char *ptr,*key,*value;
 
   // setup 3 arrays from twopage of memory
@@ -2392,12 +4839,15 @@ void MapReduce::sort_onepage(int flag, int nkey_kv,
   ptr = pagesrc;
 
   for (i = 0; i < nkey_kv; i++) {
-    order[i] = i;
-    
-    keybytes = *((int *) ptr);
-    valuebytes = *((int *) (ptr+sizeof(int)));;
-    
-    ptr += twolenbytes;
+    if (kfixed) {
+      keybytes = kfixed;
+      valuebytes = vfixed;
+    } else {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+    }
+
     ptr = ROUNDUP(ptr,kalignm1);
     key = ptr;
     ptr += keybytes;
@@ -2415,22 +4865,33 @@ void MapReduce::sort_onepage(int flag, int nkey_kv,
     }
   }
   
-  // sort keys or values via qsort()
+  // sort keys or values via Sorter
   // simply creates new order array
   
-  qsort(order,nkey_kv,sizeof(int),compare_standalone);
+  int memtag_work;
+  uint64_t dummy;
+  int nwork = ((uint64_t) nkey_kv*Sorter::workbytes() + pagesize-1) / pagesize;
+  char *work = mem_request(MAX(nwork,1),dummy,memtag_work);
+  sorter->sort(nkey_kv,order,dptr,slength,compare,sortstyle,sortreverse,work);
+  mem_unmark(memtag_work);
   
   // dptr = start of each KV pair
   // slength = length of entire KV pair
   
   ptr = pagesrc;
+  maxbytes = 0;
   
   for (i = 0; i < nkey_kv; i++) {
     dptr[i] = ptr;
-    keybytes = *((int *) ptr);
-    valuebytes = *((int *) (ptr+sizeof(int)));;
-    
-    ptr += twolenbytes;
+    if (kfixed) {
+      keybytes = kfixed;
+      valuebytes = vfixed;
+    } else {
+      keybytes = *((int *) ptr);
+      valuebytes = *((int *) (ptr+sizeof(int)));
+      ptr += twolenbytes;
+    }
+
     ptr = ROUNDUP(ptr,kalignm1);
     ptr += keybytes;
     ptr = ROUNDUP(ptr,valignm1);
@@ -2438,6 +4899,7 @@ void MapReduce::sort_onepage(int flag, int nkey_kv,
     ptr = ROUNDUP(ptr,talignm1);
     
     slength[i] = ptr - dptr[i];
+    maxbytes = MAX(maxbytes,slength[i]);
   }
   
   // reorder KV pairs into dest page
@@ -2448,101 +4910,117 @@ void MapReduce::sort_onepage(int flag, int nkey_kv,
     memcpy(ptr,dptr[j],slength[j]);
     ptr += slength[j];
   }
+
+  return maxbytes;
 }
 
 /* ----------------------------------------------------------------------
-   merge of 2 sources into a destination
+   k-way merge of N sorted runs into a destination
    flag = 0 for key sort, flag = 1 for value sort
-   src1,src2 can each be Spool file (src = 0) or KV page (src = nkey_kv)
-   dest can be Spool file (dest = 0)  or final KV (dest = 1)
+   each run streams through its own CHUNK bytes of buf
+   runs are kept in a binary heap on their next KV pair,
+     ties go to the lower run so the merge is stable
+   dest can be Spool file (dest = 0) or final KV (dest = 1)
 ------------------------------------------------------------------------- */
 
-void MapReduce::merge(int flag, int src1, void *src1ptr,
-		      int src2, void *src2ptr, int dest, void *destptr)
+void MapReduce::merge_runs(int flag, int n, MergeRun *runs, 
+			   char *buf, uint64_t chunk, int dest, void *destptr)
 {
-  int result,ientry1,ientry2,nbytes1,nbytes2,ipage1,ipage2;
-  int npage1,npage2,nentry1,nentry2;
-  char *str1,*str2,*page1,*page2;
-  Spool *sp1,*sp2,*spdest;
+  int i;
+  Spool *spdest;
   KeyValue *kvdest;
 
-  if (src1) {
-    npage1 = 1;
-    page1 = (char *) src1ptr;
-    nentry1 = src1;
-  } else {
-    sp1 = (Spool *) src1ptr;
-    npage1 = sp1->request_info(&page1);
-    nentry1 = sp1->request_page(0);
-  }
-  if (src2) {
-    npage2 = 1;
-    page2 = (char *) src2ptr;
-    nentry2 = src2;
-  } else {
-    sp2 = (Spool *) src2ptr;
-    npage2 = sp2->request_info(&page2);
-    nentry2 = sp2->request_page(0);
-  }
-
   if (dest) kvdest = (KeyValue *) destptr;
   else spdest = (Spool *) destptr;
 
-  ipage1 = ipage2 = 0;
-  ientry1 = ientry2 = 0;
+  int *heap = (int *) memory->smalloc(n*sizeof(int),"MR:heap");
+  int nheap = 0;
+
+  for (i = 0; i < n; i++) {
+    runs[i].offset = 0;
+    runs[i].buf = runs[i].ptr = runs[i].end = &buf[i*chunk];
+    if (merge_fill(flag,&runs[i],chunk)) heap[nheap++] = i;
+  }
+  for (i = nheap/2 - 1; i >= 0; i--) merge_sift(heap,nheap,i,runs);
+
+  while (nheap) {
+    MergeRun *run = &runs[heap[0]];
+    if (dest) kvdest->add(run->ptr);
+    else spdest->add(run->len,run->ptr);
+    run->ptr += run->len;
+
+    if (!merge_fill(flag,run,chunk)) heap[0] = heap[--nheap];
+    if (nheap) merge_sift(heap,nheap,0,runs);
+  }
 
-  char *ptr1 = page1;
-  char *ptr2 = page2;
-  int len1 = extract(flag,ptr1,str1,nbytes1);
-  int len2 = extract(flag,ptr2,str2,nbytes2);
+  memory->sfree(heap);
+}
 
-  int done = 0;
+/* ----------------------------------------------------------------------
+   insure next KV pair of run is entirely in its buffer
+   if not, move the partial pair to the start of the buffer
+     and read more of the run behind it, next page when one is exhausted
+   partial pair stays aligned since pairs start on talign boundaries
+   return 1 with str,nbytes,len set for the pair, 0 if run is exhausted
+------------------------------------------------------------------------- */
 
+int MapReduce::merge_fill(int flag, MergeRun *run, uint64_t chunk)
+{
   while (1) {
-    if (done == 0) result = compare(str1,nbytes1,str2,nbytes2);
-
-    if (result <= 0) {
-      if (dest) kvdest->add(ptr1);
-      else spdest->add(len1,ptr1);
-      ptr1 += len1;
-      ientry1++;
-
-      if (ientry1 == nentry1) {
-	ipage1++;
-	if (ipage1 < npage1) {
-	  nentry1 = sp1->request_page(ipage1);
-	  ientry1 = 0;
-	  ptr1 = page1;
-	  len1 = extract(flag,ptr1,str1,nbytes1);
-	} else {
-	  done++;
-	  if (done == 2) break;
-	  result = 1;
-	}
-      } else len1 = extract(flag,ptr1,str1,nbytes1);
-    }
-
-    if (result >= 0) {
-      if (dest) kvdest->add(ptr2);
-      else spdest->add(len2,ptr2);
-      ptr2 += len2;
-      ientry2++;
-
-      if (ientry2 == nentry2) {
-	ipage2++;
-	if (ipage2 < npage2) {
-	  nentry2 = sp2->request_page(ipage2);
-	  ientry2 = 0;
-	  ptr2 = page2;
-	  len2 = extract(flag,ptr2,str2,nbytes2);
-	} else {
-	  done++;
-	  if (done == 2) break;
-	  result = -1;
-	}
-      } else len2 = extract(flag,ptr2,str2,nbytes2);
+    uint64_t avail = run->end - run->ptr;
+    if (kfixed || avail >= twolenbytes) {
+      run->len = extract(flag,run->ptr,run->str,run->nbytes);
+      if (run->len <= avail) return 1;
+    }
+
+    memmove(run->buf,run->ptr,avail);
+    run->ptr = run->buf;
+    run->end = run->buf + avail;
+
+    uint64_t nread = 0;
+    while (run->ipage <= run->lastpage) {
+      nread = run->spool->read_bytes(run->ipage,run->offset,
+				     chunk-avail,run->end);
+      if (nread) break;
+      run->ipage++;
+      run->offset = 0;
+    }
+
+    if (nread == 0) {
+      if (avail) error->one("Partial KV pair at end of sorted run");
+      return 0;
+    }
+
+    run->offset += nread;
+    run->end += nread;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   sift heap entry I down to its place in a heap of N runs
+------------------------------------------------------------------------- */
+
+void MapReduce::merge_sift(int *heap, int n, int i, MergeRun *runs)
+{
+  int child,result;
+  MergeRun *r1,*r2;
+
+  int item = heap[i];
+  while ((child = 2*i + 1) < n) {
+    if (child+1 < n) {
+      r1 = &runs[heap[child]];
+      r2 = &runs[heap[child+1]];
+      result = compare(r2->str,r2->nbytes,r1->str,r1->nbytes);
+      if (result < 0 || (result == 0 && heap[child+1] < heap[child])) child++;
     }
+    r1 = &runs[heap[child]];
+    r2 = &runs[item];
+    result = compare(r1->str,r1->nbytes,r2->str,r2->nbytes);
+    if (result > 0 || (result == 0 && heap[child] > item)) break;
+    heap[i] = heap[child];
+    i = child;
   }
+  heap[i] = item;
 }
 
 /* ----------------------------------------------------------------------
@@ -2555,10 +5033,17 @@ void MapReduce::merge(int flag, int src1, void *src1ptr,
 int MapReduce::extract(int flag, char *ptr_start, char *&str, int &nbytes)
 {
   char *ptr = ptr_start;
-  int keybytes = *((int *) ptr);
-  int valuebytes = *((int *) (ptr+sizeof(int)));;
+  int keybytes,valuebytes;
+
+  if (kfixed) {
+    keybytes = kfixed;
+    valuebytes = vfixed;
+  } else {
+    keybytes = *((int *) ptr);
+    valuebytes = *((int *) (ptr+sizeof(int)));
+    ptr += twolenbytes;
+  }
 
-  ptr += twolenbytes;
   ptr = ROUNDUP(ptr,kalignm1);
   char *key = ptr;
   ptr += keybytes;
@@ -2579,23 +5064,55 @@ int MapReduce::extract(int flag, char *ptr_start, char *&str, int &nbytes)
 }
 
 /* ----------------------------------------------------------------------
-   wrappers on user-provided key or value comparison functions
-   necessary so can extract 2 keys or values to pass back to application
-   2-level wrapper needed b/c qsort() cannot be passed a class method
-     unless it were static, but then it couldn't access MR class data
-   so qsort() is passed standalone non-class method
-   it accesses static class member mrptr, set before call to qsort()
-   standalone calls back into class wrapper which calls user compare()
+   set prefix style of compare function for Sorter
+   built-in compare functions order datums by a fixed-width prefix
+   user-provided compare functions can only be called
 ------------------------------------------------------------------------- */
 
-int compare_standalone(const void *iptr, const void *jptr)
+void MapReduce::sort_style()
 {
-  return MapReduce::mrptr->compare_wrapper(*((int *) iptr),*((int *) jptr));
+  sortstyle = Sorter::NOPREFIX;
+  sortreverse = 0;
+
+  if (compare == compare_int) sortstyle = Sorter::INTPREFIX;
+  else if (compare == compare_uint64) sortstyle = Sorter::UINT64PREFIX;
+  else if (compare == compare_float) sortstyle = Sorter::FLOATPREFIX;
+  else if (compare == compare_double) sortstyle = Sorter::DOUBLEPREFIX;
+  else if (compare == compare_str) sortstyle = Sorter::STRPREFIX;
+  else if (compare == compare_strn) sortstyle = Sorter::STRNPREFIX;
+  else {
+    sortreverse = 1;
+    if (compare == compare_int_reverse) sortstyle = Sorter::INTPREFIX;
+    else if (compare == compare_uint64_reverse) 
+      sortstyle = Sorter::UINT64PREFIX;
+    else if (compare == compare_float_reverse) 
+      sortstyle = Sorter::FLOATPREFIX;
+    else if (compare == compare_double_reverse)
+      sortstyle = Sorter::DOUBLEPREFIX;
+    else if (compare == compare_str_reverse) sortstyle = Sorter::STRPREFIX;
+    else if (compare == compare_strn_reverse) sortstyle = Sorter::STRNPREFIX;
+    else sortreverse = 0;
+  }
 }
 
-int MapReduce::compare_wrapper(int i, int j)
+/* ----------------------------------------------------------------------
+   return pre-defined compare method for flag = +/- 1 to 6
+   return NULL if flag is invalid
+------------------------------------------------------------------------- */
+
+MapReduce::CompareFunc *MapReduce::compare_builtin(int flag)
 {
-  return compare(dptr[i],slength[i],dptr[j],slength[j]);
+  int absflag = flag;
+  if (flag < 0) absflag = -flag;
+  if (absflag == 1) return (flag > 0) ? compare_int : compare_int_reverse;
+  if (absflag == 2) 
+    return (flag > 0) ? compare_uint64 : compare_uint64_reverse;
+  if (absflag == 3) return (flag > 0) ? compare_float : compare_float_reverse;
+  if (absflag == 4) 
+    return (flag > 0) ? compare_double : compare_double_reverse;
+  if (absflag == 5) return (flag > 0) ? compare_str : compare_str_reverse;
+  if (absflag == 6) return (flag > 0) ? compare_strn : compare_strn_reverse;
+  return NULL;
 }
 
 /* ----------------------------------------------------------------------
@@ -2714,6 +5231,18 @@ int compare_strn_reverse(char *str1, int len1, char *str2, int len2)
   return -strncmp(str1,str2,MIN(len1,len2));
 }
 
+/* ----------------------------------------------------------------------
+   compare raw bytes, a shorter datum that is a prefix of a longer one
+     comes first, so datums are equal only if identical
+------------------------------------------------------------------------- */
+
+int compare_bytes(char *str1, int len1, char *str2, int len2)
+{
+  int n = memcmp(str1,str2,MIN(len1,len2));
+  if (n) return n;
+  return len1 - len2;
+}
+
 /* ----------------------------------------------------------------------
    use str to find files to add to list of filenames
    if str is a file, add it to list
@@ -2967,9 +5496,53 @@ void MapReduce::cummulative_stats(int level, int reset)
     }
   }
 
+  uint64_t maps[3] = {mapsize,majfault,minfault};
+  uint64_t allmaps[3];
+  MPI_Allreduce(maps,allmaps,3,MRMPI_BIGINT,MPI_SUM,comm);
+
+  if (allmaps[0]) {
+    if (me == 0) printf("Cummulative mmap = %.3g Mb, %.3g major faults, "
+			"%.3g minor faults\n",allmaps[0]/mbyte,
+			(double) allmaps[1],(double) allmaps[2]);
+
+    if (level == 2) {
+      write_histo(maps[0]/mbyte,"  Mmap (Mb):");
+      write_histo((double) maps[1],"  Majflt:");
+    }
+  }
+
+  // compression
+
+  uint64_t zsizes[2] = {zsize,zcsize};
+  uint64_t allzsizes[2];
+  MPI_Allreduce(zsizes,allzsizes,2,MRMPI_BIGINT,MPI_SUM,comm);
+
+  double allztime;
+  MPI_Allreduce(&ztime,&allztime,1,MPI_DOUBLE,MPI_SUM,comm);
+
+  if (allzsizes[0]) {
+    if (me == 0) printf("Cummulative codec = "
+			"%.3g Mb to %.3g Mb, ratio %.3g, %.3g secs\n",
+			allzsizes[0]/mbyte,allzsizes[1]/mbyte,
+			(double) allzsizes[0]/allzsizes[1],allztime/nprocs);
+    if (level == 2) {
+      write_histo(zsizes[0]/mbyte,"  Encoded (Mb):");
+      write_histo(ztime,"  Codec (secs):");
+    }
+  }
+
+  // hot keys
+
+  if (hotkeys && me == 0)
+    printf("Cummulative skew = %g hot keys split\n",(double) hotkeys);
+
   if (reset) {
     rsize = wsize = 0;
     cssize = crsize = 0;
+    mapsize = majfault = minfault = 0;
+    zsize = zcsize = 0;
+    ztime = 0.0;
+    hotkeys = 0;
   }
 }
 
@@ -3067,6 +5640,34 @@ void MapReduce::stats(const char *heading, int which)
     }
   }
 
+  MPI_Allreduce(&mapsize_one,&rall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  if (rall) {
+    uint64_t fault[2] = {majfault_one,minfault_one};
+    uint64_t allfault[2];
+    MPI_Allreduce(fault,allfault,2,MRMPI_BIGINT,MPI_SUM,comm);
+    if (me == 0) printf("%s mmap = %.3g Mb, %.3g major faults, "
+			"%.3g minor faults\n",heading,rall/mbyte,
+			(double) allfault[0],(double) allfault[1]);
+    if (verbosity == 2) {
+      write_histo(mapsize_one/mbyte,"  Mmap (Mb):");
+      write_histo((double) majfault_one,"  Majflt:");
+    }
+  }
+
+  MPI_Allreduce(&zsize_one,&rall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  MPI_Allreduce(&zcsize_one,&wall,1,MRMPI_BIGINT,MPI_SUM,comm);
+  if (rall) {
+    if (me == 0) printf("%s Codec = %.3g Mb to %.3g Mb, ratio %.3g\n",
+			heading,rall/mbyte,wall/mbyte,(double) rall/wall);
+    if (verbosity == 2) write_histo(zsize_one/mbyte,"  Encoded (Mb):");
+  }
+
+  // hot keys are the same on all procs, so no need to sum them
+
+  if (hotkeys_one && me == 0)
+    printf("%s Skew = %d hot keys split across %d procs\n",
+	   heading,(int) hotkeys_one,MIN(skewsplit,nprocs));
+
   int partall,setall,sortall;
   MPI_Allreduce(&fcounter_part,&partall,1,MPI_INT,MPI_SUM,comm);
   MPI_Allreduce(&fcounter_set,&setall,1,MPI_INT,MPI_SUM,comm);
@@ -3121,11 +5722,23 @@ void MapReduce::file_stats(int flag)
     wsize_one = wsize;
     cssize_one = cssize;
     crsize_one = crsize;
+    mapsize_one = mapsize;
+    majfault_one = majfault;
+    minfault_one = minfault;
+    zsize_one = zsize;
+    zcsize_one = zcsize;
+    hotkeys_one = hotkeys;
   } else {
     rsize_one = rsize - rsize_one;
     wsize_one = wsize - wsize_one;
     cssize_one = cssize - cssize_one;
     crsize_one = crsize - crsize_one;
+    mapsize_one = mapsize - mapsize_one;
+    majfault_one = majfault - majfault_one;
+    minfault_one = minfault - minfault_one;
+    zsize_one = zsize - zsize_one;
+    zcsize_one = zcsize - zcsize_one;
+    hotkeys_one = hotkeys - hotkeys_one;
   }
 }
 
@@ -3235,6 +5848,17 @@ void MapReduce::allocate()
   valignm1 = valign - 1;
   talignm1 = talign - 1;
 
+  // fixed-size KV pairs only if both key and value sizes are set
+
+  if (fixedkey < 0 || fixedvalue < 0)
+    error->all("Invalid fixedkey or fixedvalue setting");
+  kfixed = vfixed = 0;
+  if (fixedkey && fixedvalue) {
+    kfixed = fixedkey;
+    vfixed = fixedvalue;
+  }
+  fixedbytes = roundup(roundup(kfixed,valign)+vfixed,talign);
+
   // error checks
 
   if (memsize == 0) error->all("Invalid memsize setting");
@@ -3344,6 +5968,20 @@ char *MapReduce::mem_request(int n, uint64_t &size, int &tag)
   return memptr[i];
 }
 
+/* ----------------------------------------------------------------------
+   return # of pages for per-pair workspace of nbytes per pair of a page
+   npage suffices for KV pairs with lengths
+   fixed-size pairs can be smaller, so they may need more pages
+------------------------------------------------------------------------- */
+
+int MapReduce::workpages(int npage, int nbytes)
+{
+  if (!kfixed) return npage;
+  uint64_t npair = pagesize/fixedbytes;
+  uint64_t n = (npair*nbytes + pagesize-1) / pagesize;
+  return MAX(npage,n);
+}
+
 /* ----------------------------------------------------------------------
    mark pages with tag as unused, could be one or more contiguous pages
 ------------------------------------------------------------------------- */
@@ -23,10 +23,13 @@ class MapReduce {
   friend class KeyValue;
   friend class KeyMultiValue;
   friend class Spool;
+  friend class AsyncIO;
+  friend class ThreadPool;
 
  public:
   int mapstyle;       // 0 = chunks, 1 = strided, 2 = master/slave
-  int all2all;        // 0 = irregular comm, 1 = use MPI_Alltoallv()
+  int all2all;        // 0 = irregular comm, 1 = use MPI_Ialltoallv(),
+                      // 2 = node-aware MPI_Ialltoallv()
   int verbosity;      // 0 = none, 1 = totals, 2 = proc histograms
   int timer;          // 0 = none, 1 = summary, 2 = proc histograms
   int memsize;        // # of Mbytes per page
@@ -34,10 +37,20 @@ class MapReduce {
   int maxpage;        // max # of pages that can be allocated per proc, 0 = inf
   int freepage;       // 1 to free unused pages after every operation, 0 if keep
   int outofcore;      // 1 to force data out-of-core, 0 = only if exceeds 1 pg
+  int asyncio;        // 1 to overlap out-of-core page I/O in a thread, 0 = no
+  int mmapio;         // 1 to do out-of-core page I/O thru mmap(), 0 = stdio
+  int codec;          // bitmask, 1 = encode KV pages written to disk,
+                      // 2 = encode pipelined aggregate() exchange
   int zeropage;       // 1 to init allocated pages to 0, 0 if don't bother
   int keyalign;       // align keys to this byte count
   int valuealign;     // align values to this byte count
+  int fixedkey;       // byte size of every key, 0 = variable
+  int fixedvalue;     // byte size of every value, 0 = variable
   char *fpath;        // prefix path added to intermediate out-of-core files
+  int nthreads;       // # of threads per proc for local sorts, 1 = serial
+  int mapthreads;     // # of threads per proc for map/reduce/scan callbacks
+  int skewsplit;      // # of procs each hot key is split across by
+                      // aggregate(), 0/1 = never split keys
   int mapfilecount;   // number of files processed by map file variants
 
   class KeyValue *kv;              // single KV stored by MR
@@ -54,6 +67,11 @@ class MapReduce {
   static uint64_t msize,msizemax;  // current and hi-water memory allocation
   static uint64_t rsize,wsize;     // total read/write bytes for all I/O
   static uint64_t cssize,crsize;   // total send/recv bytes for all comm
+  static uint64_t mapsize;         // total bytes copied thru mmap() for all I/O
+  static uint64_t majfault,minfault;  // page faults taken by mmap() copies
+  static uint64_t zsize,zcsize;    // total bytes before/after compression
+  static uint64_t hotkeys;         // total # of hot keys split by aggregate()
+  static double ztime;             // total time for compression
   static double commtime;          // total time for all comm
 
   // library API
@@ -67,11 +85,19 @@ class MapReduce {
 
   uint64_t add(MapReduce *);
   uint64_t aggregate(int (*)(char *, int));
+  uint64_t aggregate(int (*)(char *, int),
+		     void (*)(char *, int, char *,
+			      int, int *, class KeyValue *, void *),
+		     void *);
   uint64_t broadcast(int);
   uint64_t clone();
   uint64_t close();
   uint64_t collapse(char *, int);
   uint64_t collate(int (*)(char *, int));
+  uint64_t collate(int (*)(char *, int),
+		   void (*)(char *, int, char *,
+			    int, int *, class KeyValue *, void *),
+		   void *);
   uint64_t compress(void (*)(char *, int, char *,
 			     int, int *, class KeyValue *, void *),
 		    void *);
@@ -92,6 +118,13 @@ class MapReduce {
   uint64_t map(MapReduce *, void (*)(uint64_t, char *, int, char *, int, 
 				     class KeyValue *, void *),
 	       void *, int addflag = 0);
+  uint64_t map_fixed(MapReduce *, void (*)(uint64_t, int, char *, char *, int,
+					   class KeyValue *, void *),
+		     void *, int addflag = 0);
+  uint64_t map_batch(MapReduce *, void (*)(uint64_t, int, char **, int *,
+					   char **, int *,
+					   class KeyValue *, void *),
+		     void *, int addflag = 0);
 
   void open(int addflag = 0);
   void print(int, int, int, int);
@@ -100,6 +133,9 @@ class MapReduce {
 			   int, int *, class KeyValue *, void *), void *);
   uint64_t scan(void (*)(char *, int, char *, int, void *), void *);
   uint64_t scan(void (*)(char *, int, char *, int, int *, void *), void *);
+  uint64_t scan_fixed(void (*)(int, char *, char *, int, void *), void *);
+  uint64_t scan_batch(void (*)(int, char **, int *, char **, int *, void *),
+		      void *);
   uint64_t scrunch(int, char *, int);
 
   uint64_t multivalue_blocks(int &);
@@ -112,6 +148,18 @@ class MapReduce {
   uint64_t sort_values(int (*)(char *, int, char *, int));
   uint64_t sort_multivalues(int);
   uint64_t sort_multivalues(int (*)(char *, int, char *, int));
+  uint64_t sample_sort_keys(int);
+  uint64_t sample_sort_keys(int (*)(char *, int, char *, int));
+  uint64_t sample_sort_values(int);
+  uint64_t sample_sort_values(int (*)(char *, int, char *, int));
+  uint64_t topk_keys(int, int);
+  uint64_t topk_keys(int, int (*)(char *, int, char *, int));
+  uint64_t topk_values(int, int);
+  uint64_t topk_values(int, int (*)(char *, int, char *, int));
+
+  uint64_t sum_values(int, void *);
+  uint64_t min_values(int, void *);
+  uint64_t max_values(int, void *);
 
   uint64_t kv_stats(int);
   uint64_t kmv_stats(int);
@@ -128,7 +176,6 @@ class MapReduce {
   // functions accessed thru non-class wrapper functions
 
   void map_file_wrapper(int, class KeyValue *);
-  int compare_wrapper(int, int);
 
  private:
   MPI_Comm comm;
@@ -141,6 +188,10 @@ class MapReduce {
 
   uint64_t rsize_one,wsize_one;     // file read/write bytes for one operation
   uint64_t crsize_one,cssize_one;   // send/recv comm bytes for one operation
+  uint64_t mapsize_one;             // mmap() bytes for one operation
+  uint64_t majfault_one,minfault_one;  // mmap() page faults for one operation
+  uint64_t zsize_one,zcsize_one;    // compressed bytes for one operation
+  uint64_t hotkeys_one;             // hot keys split for one operation
 
   int collateflag;          // flag for when convert() is called from collate()
 
@@ -164,6 +215,8 @@ class MapReduce {
   int talign;               // alignment of entire KV or KMV pair
   int kalignm1,valignm1;    // alignments-1 for masking
   int talignm1;
+  int kfixed,vfixed;        // finalized fixed key/value sizes, 0 if variable
+  int fixedbytes;           // aligned size of a fixed-size KV pair
 
   // file info
 
@@ -183,6 +236,74 @@ class MapReduce {
 
   char **dptr;              // ptrs to datums being sorted
   int *slength;             // length of each datum being sorted
+  class Sorter *sorter;     // sort engine for one page of datums
+  int sortstyle;            // prefix style of compare for Sorter
+  int sortreverse;          // 1 if compare is a reverse built-in
+
+  struct MergeRun {         // one sorted run of a k-way merge
+    class Spool *spool;     // Spool file holding the run
+    int ipage,lastpage;     // current and last page of run in Spool
+    uint64_t offset;        // bytes of current page read so far
+    char *buf;              // run's slice of merge buffer
+    char *ptr,*end;         // next KV pair, end of bytes read into buf
+    char *str;              // key or value of next KV pair
+    int nbytes,len;         // its length, length of entire KV pair
+  };
+
+  // global sample sort
+
+  int rangeflag;            // -1 = aggregate() hashes pairs to procs
+                            // 0/1 = range partition pairs by key/value
+  int nsplit;               // # of splitters = nprocs-1
+  char **splitptr;          // ptr to each splitter key or value
+  int *splitlen;            // length of each splitter
+  char *splitbuf;           // bytes of all splitters
+  uint64_t rangecount;      // # of pairs spread across equal splitters
+
+  // skewed aggregate
+
+  int nhot;                 // # of hot keys split across procs, 0 if none
+  char **hotptr;            // ptr to each hot key, in compare_bytes() order
+  int *hotlen;              // length of each hot key
+  char *hotbuf;             // bytes of all hot keys
+  uint64_t hotcount;        // # of hot pairs spread across procs
+
+  // node-aware aggregate
+
+  MPI_Comm nodecomm;        // procs on same node, MPI_COMM_NULL until used
+  MPI_Comm leadercomm;      // rank 0 of each nodecomm, else MPI_COMM_NULL
+  int nnodes;               // # of nodes
+  int *nodeof;              // node ID of each proc
+  int *localof;             // rank within its node of each proc
+  int routeflag;            // 1 if pairs carry their proc, see route_wrap()
+
+  // threaded callbacks
+
+  typedef void (MapKVFunc)(uint64_t, char *, int, char *, int, 
+			   class KeyValue *, void *);
+  typedef void (ReduceFunc)(char *, int, char *, int, int *, 
+			    class KeyValue *, void *);
+  typedef void (ScanKVFunc)(char *, int, char *, int, void *);
+  typedef void (ScanKMVFunc)(char *, int, char *, int, int *, void *);
+
+  struct Callback {
+    int style;                // MAPKV, REDUCE, SCANKV, SCANKMV
+    MapKVFunc *appmap;        // user callback of that style
+    ReduceFunc *appreduce;
+    ScanKVFunc *appscankv;
+    ScanKMVFunc *appscankmv;
+    void *appptr;             // user data ptr
+    int kfixed,vfixed;        // fixed key/value sizes of KV pages, 0 if not
+  };
+  Callback callback;
+
+  class ThreadPool *pool;   // runs callbacks of a page, NULL if serial
+
+  // aggregate combiner
+
+  ReduceFunc *appcombine;   // merges pairs of a page with equal keys
+                            // before they are sent, NULL if none
+  void *combineptr;         // user data ptr passed to appcombine
 
   // multi-block KMV info
 
@@ -229,9 +350,44 @@ class MapReduce {
   void addfiles(char *, int, int &, int &, char **&);
   void bcastfiles(int &, char **&);
 
+  void aggregate_irregular(int (*)(char *, int), class KeyValue *);
+  void aggregate_pipeline(int (*)(char *, int), class KeyValue *,
+			  class KeyValue *, MPI_Comm, int *);
+  void aggregate_hierarchy(int (*)(char *, int), class KeyValue *);
+  class KeyValue *route_wrap(int (*)(char *, int));
+  void route_unwrap(class KeyValue *, class KeyValue *);
+  void aggregate_decode(class Codec *, class KeyValue *, char *, int,
+			int *, int *, int *, char *);
+  void node_setup();
+  void aggregate_hash(int (*)(char *, int), int *, int, char *, 
+		      int *, int *, char **);
+  int combine_page(int, char *, class KeyValue *);
+  void stream_kv(int, int, int *, int, int *, int);
+
+  void pool_create();
+  void pool_destroy();
+  int pool_page(char *, int, uint64_t, class KeyValue *);
+  static void pool_standalone(void *, int);
+  void pool_chunk(int);
+
+  void sort_style();
+  CompareFunc *compare_builtin(int);
+  void sample_sort(int);
+  void sample_splitters(int);
+  int sample_gather(int, uint64_t, int *&, char *&);
+  void hot_keys();
+  int hot_key(char *, int);
+  int range_proc(char *, int, char *, int);
+  void topk(int, int);
+  void topk_add(char **, int &, int, int, char *, int, char *, int);
+  void topk_sift(char **, int, int, int);
+  int topk_datum(char *, int, char *&);
+  uint64_t reduce_values(int, int, void *);
   void sort_kv(int);
-  void sort_onepage(int, int, char *, char *, char *);
-  void merge(int, int, void *, int, void *, int, void *);
+  int sort_onepage(int, int, char *, char *, char *);
+  void merge_runs(int, int, MergeRun *, char *, uint64_t, int, void *);
+  int merge_fill(int, MergeRun *, uint64_t);
+  void merge_sift(int *, int, int, MergeRun *);
   int extract(int, char *, char *&, int &);
 
   void stats(const char *, int);
@@ -247,6 +403,9 @@ class MapReduce {
   void allocate();
   void allocate_page(int);
   char *mem_request(int, uint64_t &, int &);
+  int workpages(int, int);
+  void batch_page(class KeyValue *, char *, int, int &,
+		  char **&, int *&, char **&, int *&);
   void mem_unmark(int);
   void mem_cleanup();
   int mem_query(int &, int &);
@@ -0,0 +1,131 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#include "stdio.h"
+#include "string.h"
+#include "stdint.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "sys/resource.h"
+#include "mmapio.h"
+#include "mapreduce.h"
+#include "error.h"
+
+using namespace MAPREDUCE_NS;
+
+/* ----------------------------------------------------------------------
+   page reads and writes of a KV, KMV, or Spool file through mmap()
+   instead of fread()/fwrite(), the kernel caches and writes back the file
+   reads use one read-only map of the whole file, remapped as it grows
+   writes map just the page being written, extending the file as needed
+   bytes moved and page faults taken are tallied separately from
+     explicit file I/O
+------------------------------------------------------------------------- */
+
+MMapIO::MMapIO(MapReduce *mr_caller, Error *error_caller)
+{
+  mr = mr_caller;
+  error = error_caller;
+
+  map = NULL;
+  mapbytes = 0;
+  syspage = sysconf(_SC_PAGESIZE);
+}
+
+/* ---------------------------------------------------------------------- */
+
+MMapIO::~MMapIO()
+{
+  unmap();
+}
+
+/* ----------------------------------------------------------------------
+   write N bytes of page to fp at offset
+   fp must be open for reading and writing
+------------------------------------------------------------------------- */
+
+void MMapIO::write(FILE *fp, uint64_t offset, char *page, uint64_t n)
+{
+  if (n == 0) return;
+
+  int fd = fileno(fp);
+  struct stat st;
+  if (fstat(fd,&st) < 0) error->one("Could not stat file for mmap");
+  if ((uint64_t) st.st_size < offset+n && ftruncate(fd,offset+n) < 0)
+    error->one("Could not extend file for mmap");
+
+  uint64_t start = offset - offset % syspage;
+  uint64_t length = offset+n - start;
+  char *ptr = (char *) mmap(NULL,length,PROT_READ | PROT_WRITE,MAP_SHARED,
+			    fd,start);
+  if (ptr == MAP_FAILED) error->one("Could not mmap file for writing");
+
+  copy(ptr + (offset-start),page,n);
+  munmap(ptr,length);
+}
+
+/* ----------------------------------------------------------------------
+   read N bytes at offset in fp into page
+   remap whole file if it does not cover the bytes
+------------------------------------------------------------------------- */
+
+void MMapIO::read(FILE *fp, uint64_t offset, char *page, uint64_t n)
+{
+  if (n == 0) return;
+
+  if (map == NULL || offset+n > mapbytes) {
+    unmap();
+    int fd = fileno(fp);
+    struct stat st;
+    if (fstat(fd,&st) < 0) error->one("Could not stat file for mmap");
+    mapbytes = st.st_size;
+    if (offset+n > mapbytes) error->one("Reading past end of mmap file");
+
+    map = (char *) mmap(NULL,mapbytes,PROT_READ,MAP_SHARED,fd,0);
+    if (map == MAP_FAILED) {
+      map = NULL;
+      error->one("Could not mmap file for reading");
+    }
+    madvise(map,mapbytes,MADV_SEQUENTIAL);
+  }
+
+  copy(page,map+offset,n);
+}
+
+/* ----------------------------------------------------------------------
+   release read map, must be done before its file is closed or removed
+------------------------------------------------------------------------- */
+
+void MMapIO::unmap()
+{
+  if (map) munmap(map,mapbytes);
+  map = NULL;
+  mapbytes = 0;
+}
+
+/* ----------------------------------------------------------------------
+   copy N bytes to or from a map, tally bytes and page faults it induced
+------------------------------------------------------------------------- */
+
+void MMapIO::copy(char *dest, char *src, uint64_t n)
+{
+  struct rusage before,after;
+  getrusage(RUSAGE_SELF,&before);
+  memcpy(dest,src,n);
+  getrusage(RUSAGE_SELF,&after);
+
+  mr->mapsize += n;
+  mr->majfault += after.ru_majflt - before.ru_majflt;
+  mr->minfault += after.ru_minflt - before.ru_minflt;
+}
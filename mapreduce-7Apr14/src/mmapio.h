@@ -0,0 +1,44 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#ifndef MMAPIO_H
+#define MMAPIO_H
+
+#include "stdio.h"
+#include "stdint.h"
+
+namespace MAPREDUCE_NS {
+
+class MMapIO {
+ public:
+  MMapIO(class MapReduce *, class Error *);
+  ~MMapIO();
+
+  void write(FILE *, uint64_t, char *, uint64_t);
+  void read(FILE *, uint64_t, char *, uint64_t);
+  void unmap();
+
+ private:
+  class MapReduce *mr;
+  class Error *error;
+
+  char *map;                    // read-only map of entire file, NULL if none
+  uint64_t mapbytes;            // # of bytes in map
+  uint64_t syspage;             // OS page size, map offsets are multiples
+
+  void copy(char *, char *, uint64_t);
+};
+
+}
+
+#endif
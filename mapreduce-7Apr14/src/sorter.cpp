@@ -0,0 +1,349 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#include "pthread.h"
+#include "string.h"
+#include "stdint.h"
+#include <algorithm>
+#include "sorter.h"
+#include "memory.h"
+#include "error.h"
+
+using namespace MAPREDUCE_NS;
+
+#define MIN(A,B) ((A) < (B)) ? (A) : (B)
+#define MAX(A,B) ((A) > (B)) ? (A) : (B)
+
+#define MAXTHREADS 256
+#define NBUCKET 256           // radix digits of 8 bits
+#define NSMALL 256            // fewer datums are sorted without radix passes
+#define NTHREADMIN 65536      // min # of datums per thread
+
+enum{EXTRACT,HISTOGRAM,SCATTER,TIES,CHUNK,MERGE};
+
+struct SortTask {
+  Sorter *ptr;
+  int which;
+  int ithread;
+};
+
+// orderings passed to std::sort() and std::merge()
+
+struct Sorter::PrefixLess {
+  bool operator()(const Entry &a, const Entry &b) const {
+    return a.prefix < b.prefix;
+  }
+};
+
+struct Sorter::EntryLess {
+  Sorter *s;
+  EntryLess(Sorter *s_caller) : s(s_caller) {}
+  bool operator()(const Entry &a, const Entry &b) const {
+    return s->compare(s->dptr[a.index],s->slength[a.index],
+		      s->dptr[b.index],s->slength[b.index]) < 0;
+  }
+};
+
+struct Sorter::IndexLess {
+  Sorter *s;
+  IndexLess(Sorter *s_caller) : s(s_caller) {}
+  bool operator()(int i, int j) const {
+    return s->compare(s->dptr[i],s->slength[i],s->dptr[j],s->slength[j]) < 0;
+  }
+};
+
+/* ---------------------------------------------------------------------- */
+
+Sorter::Sorter(int nthreads_caller, Memory *memory_caller, Error *error_caller)
+{
+  memory = memory_caller;
+  error = error_caller;
+
+  nthreads = MAX(nthreads_caller,1);
+  nthreads = MIN(nthreads,MAXTHREADS);
+
+  varies = (uint64_t *) memory->smalloc(nthreads*sizeof(uint64_t),"sort:varies");
+  counts = (int *) memory->smalloc(nthreads*NBUCKET*sizeof(int),"sort:counts");
+  bounds = (int *) memory->smalloc((nthreads+1)*sizeof(int),"sort:bounds");
+}
+
+/* ---------------------------------------------------------------------- */
+
+Sorter::~Sorter()
+{
+  memory->sfree(varies);
+  memory->sfree(counts);
+  memory->sfree(bounds);
+}
+
+/* ----------------------------------------------------------------------
+   sort N datums, return their sorted order in order_caller
+   dptr/slength = ptr to and length of each datum
+   style = prefix style of the compare function, reverse = 1 if descending
+   datums with a prefix style are sorted by an LSD radix sort
+     on 8-byte prefixes extracted into a flat array,
+     only radix digits that differ between datums are sorted on,
+     runs of equal prefixes are finished with the compare function
+     unless the prefix is the entire datum
+   datums without one are sorted by the compare function in chunks
+     that are merged pairwise
+   each phase is split across threads when N is large enough
+   work = caller's workspace of N*workbytes() bytes, such as MR pages,
+     so that sort data counts against the caller's memory
+------------------------------------------------------------------------- */
+
+void Sorter::sort(int n_caller, int *order_caller,
+		  char **dptr_caller, int *slength_caller,
+		  CompareFunc *compare_caller, int style_caller,
+		  int reverse_caller, char *work)
+{
+  int i;
+
+  n = n_caller;
+  order = order_caller;
+  dptr = dptr_caller;
+  slength = slength_caller;
+  compare = compare_caller;
+  style = style_caller;
+  reverse = reverse_caller;
+  exact = (style != NOPREFIX && style != STRPREFIX && style != STRNPREFIX);
+
+  if (n <= 1) {
+    if (n == 1) order[0] = 0;
+    return;
+  }
+
+  nthr = MIN(nthreads,n/NTHREADMIN);
+  nthr = MAX(nthr,1);
+
+  entries = (Entry *) work;
+  scratch = &entries[n];
+
+  // no prefix: sort chunks of order by compare function, then merge them
+  // merge levels alternate between order and scratch
+
+  if (style == NOPREFIX) {
+    for (i = 0; i < n; i++) order[i] = i;
+    for (i = 0; i <= nthr; i++) bounds[i] = lo(i);
+    parallel(CHUNK);
+
+    msrc = order;
+    mdst = (int *) scratch;
+    for (width = 1; width < nthr; width *= 2) {
+      parallel(MERGE);
+      int *tmp = msrc;
+      msrc = mdst;
+      mdst = tmp;
+    }
+    if (msrc != order) memcpy(order,msrc,n*sizeof(int));
+    return;
+  }
+
+  // extract prefixes and find which bits differ between them
+
+  first = prefix(0);
+  parallel(EXTRACT);
+
+  uint64_t diff = 0;
+  for (i = 0; i < nthr; i++) diff |= varies[i];
+
+  // LSD radix passes, each stable so earlier digits stay ordered
+  // counts are turned into per-thread scatter offsets, digit-major
+
+  if (n < NSMALL) std::sort(entries,entries+n,PrefixLess());
+  else {
+    for (shift = 0; shift < 64; shift += 8) {
+      if (((diff >> shift) & 0xFF) == 0) continue;
+      parallel(HISTOGRAM);
+      int offset = 0;
+      for (int d = 0; d < NBUCKET; d++)
+	for (i = 0; i < nthr; i++) {
+	  int count = counts[i*NBUCKET+d];
+	  counts[i*NBUCKET+d] = offset;
+	  offset += count;
+	}
+      parallel(SCATTER);
+      Entry *tmp = entries;
+      entries = scratch;
+      scratch = tmp;
+    }
+  }
+
+  if (!exact) parallel(TIES);
+
+  for (i = 0; i < n; i++) order[i] = entries[i].index;
+}
+
+/* ----------------------------------------------------------------------
+   bytes of workspace per datum needed by sort()
+------------------------------------------------------------------------- */
+
+int Sorter::workbytes()
+{
+  return 2*sizeof(Entry);
+}
+
+/* ----------------------------------------------------------------------
+   order-preserving 8-byte prefix of datum I
+   numeric keys map to unsigned ints with the same order,
+   strings are packed big-endian up to the NULL or 8 bytes
+------------------------------------------------------------------------- */
+
+uint64_t Sorter::prefix(int i)
+{
+  char *ptr = dptr[i];
+  uint64_t key = 0;
+
+  if (style == INTPREFIX) {
+    int ivalue;
+    memcpy(&ivalue,ptr,sizeof(int));
+    key = ((uint32_t) ivalue) ^ 0x80000000U;
+  } else if (style == UINT64PREFIX) {
+    memcpy(&key,ptr,sizeof(uint64_t));
+  } else if (style == FLOATPREFIX) {
+    uint32_t bits;
+    memcpy(&bits,ptr,sizeof(uint32_t));
+    key = (bits & 0x80000000U) ? ~bits : bits | 0x80000000U;
+  } else if (style == DOUBLEPREFIX) {
+    memcpy(&key,ptr,sizeof(uint64_t));
+    key = (key & 0x8000000000000000ULL) ? ~key : key | 0x8000000000000000ULL;
+  } else {
+    int len = 8;
+    if (style == STRNPREFIX) len = MIN(slength[i],8);
+    for (int k = 0; k < len && ptr[k]; k++)
+      key |= ((uint64_t) ((unsigned char) ptr[k])) << (56 - 8*k);
+  }
+
+  if (reverse) key = ~key;
+  return key;
+}
+
+/* ----------------------------------------------------------------------
+   phases of the sort, each thread works on datums lo(ithread) to
+     lo(ithread+1)
+------------------------------------------------------------------------- */
+
+void Sorter::histogram(int ithread, int lo1, int hi1)
+{
+  int *count = &counts[ithread*NBUCKET];
+  for (int d = 0; d < NBUCKET; d++) count[d] = 0;
+  for (int i = lo1; i < hi1; i++)
+    count[(entries[i].prefix >> shift) & 0xFF]++;
+}
+
+void Sorter::scatter(int ithread, int lo1, int hi1)
+{
+  int *offset = &counts[ithread*NBUCKET];
+  for (int i = lo1; i < hi1; i++)
+    scratch[offset[(entries[i].prefix >> shift) & 0xFF]++] = entries[i];
+}
+
+/* ----------------------------------------------------------------------
+   sort runs of equal prefix by the compare function
+   a thread owns each run that starts in its range, even if it extends
+     past the end of the range
+------------------------------------------------------------------------- */
+
+void Sorter::ties(int lo1, int hi1)
+{
+  int i = lo1;
+  if (i > 0)
+    while (i < hi1 && entries[i].prefix == entries[i-1].prefix) i++;
+
+  while (i < hi1) {
+    int j = i+1;
+    while (j < n && entries[j].prefix == entries[i].prefix) j++;
+    if (j-i > 1) std::sort(entries+i,entries+j,EntryLess(this));
+    i = j;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   merge the 2 sorted runs of pair ITHREAD at the current width
+   a run without a partner is copied
+------------------------------------------------------------------------- */
+
+void Sorter::mergeruns(int ithread)
+{
+  int first1 = 2*width*ithread;
+  if (first1 >= nthr) return;
+  int first2 = MIN(first1+width,nthr);
+  int last = MIN(first1+2*width,nthr);
+
+  int *src = msrc;
+  int *dest = mdst;
+  std::merge(src+bounds[first1],src+bounds[first2],
+	     src+bounds[first2],src+bounds[last],
+	     dest+bounds[first1],IndexLess(this));
+}
+
+/* ----------------------------------------------------------------------
+   perform one phase with nthr threads, calling thread is thread 0
+------------------------------------------------------------------------- */
+
+void Sorter::parallel(int which)
+{
+  SortTask tasks[MAXTHREADS];
+  pthread_t threads[MAXTHREADS];
+
+  for (int i = 0; i < nthr; i++) {
+    tasks[i].ptr = this;
+    tasks[i].which = which;
+    tasks[i].ithread = i;
+  }
+
+  for (int i = 1; i < nthr; i++)
+    if (pthread_create(&threads[i],NULL,thread_standalone,&tasks[i]))
+      error->one("Could not create sort thread");
+
+  phase(which,0);
+
+  for (int i = 1; i < nthr; i++) pthread_join(threads[i],NULL);
+}
+
+void *Sorter::thread_standalone(void *ptr)
+{
+  SortTask *task = (SortTask *) ptr;
+  task->ptr->phase(task->which,task->ithread);
+  return NULL;
+}
+
+void Sorter::phase(int which, int ithread)
+{
+  int lo1 = lo(ithread);
+  int hi1 = lo(ithread+1);
+
+  if (which == EXTRACT) {
+    uint64_t diff = 0;
+    for (int i = lo1; i < hi1; i++) {
+      entries[i].prefix = prefix(i);
+      entries[i].index = i;
+      diff |= entries[i].prefix ^ first;
+    }
+    varies[ithread] = diff;
+  } else if (which == HISTOGRAM) histogram(ithread,lo1,hi1);
+  else if (which == SCATTER) scatter(ithread,lo1,hi1);
+  else if (which == TIES) ties(lo1,hi1);
+  else if (which == CHUNK)
+    std::stable_sort(order+lo1,order+hi1,IndexLess(this));
+  else if (which == MERGE) mergeruns(ithread);
+}
+
+/* ----------------------------------------------------------------------
+   first datum of thread ITHREAD, lo(nthr) = N
+------------------------------------------------------------------------- */
+
+int Sorter::lo(int ithread)
+{
+  return (int) (((uint64_t) n) * ithread / nthr);
+}
@@ -0,0 +1,89 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#ifndef SORTER_H
+#define SORTER_H
+
+#include "stdint.h"
+
+namespace MAPREDUCE_NS {
+
+class Sorter {
+ public:
+  // key styles with an order-preserving 8-byte prefix
+
+  enum{NOPREFIX,INTPREFIX,UINT64PREFIX,FLOATPREFIX,DOUBLEPREFIX,
+       STRPREFIX,STRNPREFIX};
+
+  Sorter(int, class Memory *, class Error *);
+  ~Sorter();
+
+  void sort(int, int *, char **, int *,
+	    int (*)(char *, int, char *, int), int, int, char *);
+  static int workbytes();
+
+ private:
+  class Memory *memory;
+  class Error *error;
+
+  typedef int (CompareFunc)(char *, int, char *, int);
+
+  struct Entry {
+    uint64_t prefix;            // order-preserving prefix of datum
+    int index;                  // index of datum
+  };
+
+  int nthreads;                 // max # of threads to sort with
+  int nthr;                     // # of threads used for current sort
+
+  Entry *entries;               // prefix + index of each datum
+  Entry *scratch;               // destination of each radix pass
+
+  // current sort
+
+  int n;                        // # of datums
+  int *order;                   // sorted order returned to caller
+  char **dptr;                  // ptrs to datums
+  int *slength;                 // length of each datum
+  CompareFunc *compare;         // caller's compare function
+  int style;                    // prefix style
+  int reverse;                  // 1 if prefix is complemented
+  int exact;                    // 1 if equal prefixes are equal datums
+
+  uint64_t *varies;             // per-thread bits that differ from datum 0
+  int *counts;                  // per-thread digit histograms
+  int *bounds;                  // sorted runs being merged, by thread
+  uint64_t first;               // prefix of datum 0
+  int shift;                    // bit shift of current radix digit
+  int width;                    // # of runs per merge at current level
+  int *msrc,*mdst;              // source and destination of merge level
+
+  struct PrefixLess;
+  struct EntryLess;
+  struct IndexLess;
+
+  uint64_t prefix(int);
+  void histogram(int, int, int);
+  void scatter(int, int, int);
+  void ties(int, int);
+  void mergeruns(int);
+
+  void parallel(int);
+  void phase(int, int);
+  int lo(int);
+  static void *thread_standalone(void *);
+};
+
+}
+
+#endif
@@ -17,6 +17,8 @@
 #include "spool.h"
 #include "mapreduce.h"
 #include "memory.h"
+#include "asyncio.h"
+#include "mmapio.h"
 #include "error.h"
 
 using namespace MAPREDUCE_NS;
@@ -38,6 +40,9 @@ Spool::Spool(int style,
   filename = mr->file_create(style);
   fileflag = 0;
   fp = NULL;
+  aio = NULL;
+  mio = NULL;
+  if (mr->mmapio) mio = new MMapIO(mr,error);
 
   pages = NULL;
   npage = maxpage = 0;
@@ -51,6 +56,9 @@ Spool::Spool(int style,
 Spool::~Spool()
 {
   memory->sfree(pages);
+  close_fp();
+  delete aio;
+  delete mio;
   if (fileflag) {
     remove(filename);
     mr->hiwater(1,fsize);
@@ -77,8 +85,7 @@ void Spool::complete()
 {
   create_page();
   write_page();
-  fclose(fp);
-  fp = NULL;
+  close_fp();
 
   npage++;
   nkey = size = 0;
@@ -133,14 +140,16 @@ int Spool::request_info(char **ptr)
 
 int Spool::request_page(int ipage)
 {
-  read_page(ipage);
+  // load page unless it was prefetched
+  // prefetch next page while caller works on this one
+
+  if (!aio || !aio->fetch(ipage,page)) read_page(ipage);
+  if (ipage < npage-1 && async())
+    aio->read(fp,ipage+1,pages[ipage+1].fileoffset,pages[ipage+1].filesize);
 
   // close file if last request
 
-  if (ipage == npage-1) {
-    fclose(fp);
-    fp = NULL;
-  }
+  if (ipage == npage-1) close_fp();
 
   return pages[ipage].nkey;
 }
@@ -195,6 +204,70 @@ void Spool::add(int n, uint64_t nbytes, char *entries)
   nkey += n;
 }
 
+/* ----------------------------------------------------------------------
+   add N entries of total nbytes as a page of their own
+   entries are written to disk directly from caller's memory
+   called by MR::sort_kv() to write each sorted page as one run
+------------------------------------------------------------------------- */
+
+void Spool::add_page(int n, uint64_t nbytes, char *entries)
+{
+  if (size) {
+    create_page();
+    write_page();
+    npage++;
+  }
+
+  nkey = n;
+  size = nbytes;
+  create_page();
+
+  char *pagehold = page;
+  page = entries;
+  write_page();
+  page = pagehold;
+
+  npage++;
+  nkey = size = 0;
+}
+
+/* ----------------------------------------------------------------------
+   read up to nbytes of ipage, starting offset bytes into the page
+   return # of bytes read, 0 if page is exhausted
+   called by MR::merge_fill() to stream a run in pieces
+------------------------------------------------------------------------- */
+
+uint64_t Spool::read_bytes(int ipage, uint64_t offset, uint64_t nbytes,
+			   char *buf)
+{
+  if (offset >= pages[ipage].size) return 0;
+  if (nbytes > pages[ipage].size - offset) nbytes = pages[ipage].size - offset;
+
+  if (aio) aio->wait();
+  if (fp == NULL) {
+    fp = fopen(filename,"rb");
+    if (fp == NULL) error->one("Could not open Spool file for reading");
+  }
+
+  if (mio) {
+    mio->read(fp,pages[ipage].fileoffset+offset,buf,nbytes);
+    return nbytes;
+  }
+
+  fseek(fp,pages[ipage].fileoffset+offset,SEEK_SET);
+  int nread = fread(buf,nbytes,1,fp);
+  mr->rsize += nbytes;
+
+  if (nread != 1 || ferror(fp)) {
+    char str[128];
+    sprintf(str,"Bad SP fread: %d %u",nread,nbytes);
+    error->warning(str);
+    clearerr(fp);
+  }
+
+  return nbytes;
+}
+
 /* ----------------------------------------------------------------------
    create virtual page entry for in-memory page
 ------------------------------------------------------------------------- */
@@ -209,6 +282,9 @@ void Spool::create_page()
   pages[npage].nkey = nkey;
   pages[npage].size = size;
   pages[npage].filesize = roundup(size,ALIGNFILE);
+  if (npage) pages[npage].fileoffset = 
+	       pages[npage-1].fileoffset + pages[npage-1].filesize;
+  else pages[npage].fileoffset = 0;
 }
 
 /* ----------------------------------------------------------------------
@@ -221,7 +297,8 @@ void Spool::write_page()
     error->one("Cannot create Spool file due to outofcore setting");
 
   if (fp == NULL) {
-    fp = fopen(filename,"wb");
+    if (mio) fp = fopen(filename,"w+b");
+    else fp = fopen(filename,"wb");
     if (fp == NULL) {
       char msg[1023];
       sprintf(msg,"Cannot open Spool file %s for writing",filename);
@@ -230,6 +307,19 @@ void Spool::write_page()
     fileflag = 1;
   }
 
+  // write thru mmap() if requested
+  // else write-behind if possible, caller keeps filling page meanwhile
+
+  if (mio) {
+    mio->write(fp,pages[npage].fileoffset,page,pages[npage].filesize);
+    return;
+  }
+  if (async()) {
+    aio->write(fp,pages[npage].fileoffset,page,pages[npage].filesize);
+    return;
+  }
+
+  fseek(fp,pages[npage].fileoffset,SEEK_SET);
   int nwrite = fwrite(page,pages[npage].filesize,1,fp);
   mr->wsize += pages[npage].filesize;
 
@@ -246,11 +336,18 @@ void Spool::write_page()
 
 void Spool::read_page(int ipage)
 {
+  if (aio) aio->wait();
   if (fp == NULL) {
     fp = fopen(filename,"rb");
     if (fp == NULL) error->one("Could not open Spool file for reading");
   }
 
+  if (mio) {
+    mio->read(fp,pages[ipage].fileoffset,page,pages[ipage].filesize);
+    return;
+  }
+
+  fseek(fp,pages[ipage].fileoffset,SEEK_SET);
   int nread = fread(page,pages[ipage].filesize,1,fp);
   mr->rsize += pages[ipage].filesize;
 
@@ -262,6 +359,34 @@ void Spool::read_page(int ipage)
   }
 }
 
+/* ----------------------------------------------------------------------
+   return 1 if page I/O can be done in the background
+   requires MR asyncio setting and a staging page from MR page pool,
+     only done for Spools with a full page, not the small Spools
+     that a KMV page is split into
+------------------------------------------------------------------------- */
+
+int Spool::async()
+{
+  if (!mr->asyncio || mio || pagesize < mr->pagesize) return 0;
+  if (aio == NULL) aio = new AsyncIO(mr,error);
+  return aio->acquire();
+}
+
+/* ----------------------------------------------------------------------
+   finish background I/O and give up its page, close disk file if open
+------------------------------------------------------------------------- */
+
+void Spool::close_fp()
+{
+  if (aio) aio->release();
+  if (mio) mio->unmap();
+  if (fp) {
+    fclose(fp);
+    fp = NULL;
+  }
+}
+
 /* ----------------------------------------------------------------------
    round N up to multiple of nalign and return it
 ------------------------------------------------------------------------- */
@@ -37,6 +37,8 @@ class Spool {
   int request_page(int);
   void add(int, char *);
   void add(int, uint64_t, char *);
+  void add_page(int, uint64_t, char *);
+  uint64_t read_bytes(int, uint64_t, uint64_t, char *);
 
  private:
   class MapReduce *mr;
@@ -55,6 +57,7 @@ class Spool {
   struct Page {
     uint64_t size;              // size of entries
     uint64_t filesize;          // rounded-up size for file I/O
+    uint64_t fileoffset;        // start of page in file
     int nkey;                   // # of entries
   };
 
@@ -66,12 +69,16 @@ class Spool {
   char *filename;               // filename to store Spool if needed
   int fileflag;                 // 1 if file exists, 0 if not
   FILE *fp;                     // file ptr
+  class AsyncIO *aio;           // background page I/O, NULL if none
+  class MMapIO *mio;            // mmap() page I/O, NULL if stdio
 
   // private methods
 
   void create_page();
   void write_page();
   void read_page(int);
+  int async();
+  void close_fp();
   uint64_t roundup(uint64_t,int);
 };
 
@@ -0,0 +1,227 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#include "pthread.h"
+#include "stdint.h"
+#include "threadpool.h"
+#include "mapreduce.h"
+#include "keyvalue.h"
+#include "memory.h"
+#include "error.h"
+
+using namespace MAPREDUCE_NS;
+
+#define MIN(A,B) ((A) < (B)) ? (A) : (B)
+#define MAX(A,B) ((A) > (B)) ? (A) : (B)
+
+#define MAXTHREADS 256
+#define NTHREADMIN 1024       // min # of pairs per thread
+#define ALIGNFILE 512         // same as in mapreduce.cpp
+
+struct PoolTask {
+  ThreadPool *ptr;
+  int ithread;
+};
+
+/* ----------------------------------------------------------------------
+   run user callbacks for the pairs of one page on several threads
+   each thread gets a contiguous chunk of the page's pairs
+   new KV pairs go to a per-thread KV buffer, a slice of one MR page,
+     which is appended to the destination KV:
+     in thread order when a thread finishes its chunk, so the result
+       is the same as a serial pass if no buffer fills up
+     under a lock whenever a buffer fills up
+------------------------------------------------------------------------- */
+
+ThreadPool::ThreadPool(int nthreads_caller, MapReduce *mr_caller,
+		       int kalign_caller, int valign_caller,
+		       Memory *memory_caller, Error *error_caller)
+{
+  mr = mr_caller;
+  memory = memory_caller;
+  error = error_caller;
+  kalign = kalign_caller;
+  valign = valign_caller;
+
+  nthreads = MAX(nthreads_caller,1);
+  nthreads = MIN(nthreads,MAXTHREADS);
+
+  start = (char **) memory->smalloc(nthreads*sizeof(char *),"pool:start");
+  count = (int *) memory->smalloc(nthreads*sizeof(int),"pool:count");
+  index = (uint64_t *)
+    memory->smalloc(nthreads*sizeof(uint64_t),"pool:index");
+
+  kvdest = NULL;
+  page = NULL;
+  memtag = -1;
+  kvs = NULL;
+
+  pthread_mutex_init(&mutex,NULL);
+  pthread_cond_init(&cond,NULL);
+}
+
+/* ---------------------------------------------------------------------- */
+
+ThreadPool::~ThreadPool()
+{
+  if (kvs) {
+    for (int i = 0; i < nthreads; i++) {
+      kvs[i]->page = NULL;
+      delete kvs[i];
+    }
+    delete [] kvs;
+    mr->mem_unmark(memtag);
+  }
+
+  memory->sfree(start);
+  memory->sfree(count);
+  memory->sfree(index);
+
+  pthread_mutex_destroy(&mutex);
+  pthread_cond_destroy(&cond);
+}
+
+/* ----------------------------------------------------------------------
+   return # of threads to use for a page of N pairs
+------------------------------------------------------------------------- */
+
+int ThreadPool::split(int n)
+{
+  int n1 = MIN(nthreads,n/NTHREADMIN);
+  return MAX(n1,1);
+}
+
+/* ----------------------------------------------------------------------
+   return KV buffer that thread ITHREAD adds new pairs to
+------------------------------------------------------------------------- */
+
+KeyValue *ThreadPool::buffer(int ithread)
+{
+  return kvs[ithread];
+}
+
+/* ----------------------------------------------------------------------
+   create per-thread KV buffers, if do not have them
+   each is a slice of one MR page, so memory use does not grow with threads
+------------------------------------------------------------------------- */
+
+void ThreadPool::buffers()
+{
+  if (kvs) return;
+
+  uint64_t pagesize;
+  page = mr->mem_request(1,pagesize,memtag);
+  uint64_t slice = (pagesize/nthreads) & ~((uint64_t) ALIGNFILE-1);
+  if (slice == 0) error->one("Page size too small for mapthreads setting");
+
+  kvs = new KeyValue*[nthreads];
+  for (int i = 0; i < nthreads; i++) {
+    kvs[i] = new KeyValue(mr,kalign,valign,memory,error,mr->communicator(),
+			  &page[i*slice],slice);
+    kvs[i]->pool = this;
+    kvs[i]->ithread = i;
+  }
+}
+
+/* ----------------------------------------------------------------------
+   perform func(ptr,ithread) with N threads, calling thread is thread 0
+   kv = KV that new pairs are appended to, NULL if callbacks add none
+------------------------------------------------------------------------- */
+
+void ThreadPool::run(int n, void (*func_caller)(void *, int), void *ptr_caller,
+		     KeyValue *kv)
+{
+  PoolTask tasks[MAXTHREADS];
+  pthread_t threads[MAXTHREADS];
+
+  nthr = n;
+  func = func_caller;
+  ptr = ptr_caller;
+  kvdest = kv;
+  if (kvdest) buffers();
+  turn = 0;
+
+  for (int i = 0; i < nthr; i++) {
+    tasks[i].ptr = this;
+    tasks[i].ithread = i;
+  }
+
+  for (int i = 1; i < nthr; i++)
+    if (pthread_create(&threads[i],NULL,thread_standalone,&tasks[i]))
+      error->one("Could not create callback thread");
+
+  work(0);
+
+  for (int i = 1; i < nthr; i++) pthread_join(threads[i],NULL);
+  kvdest = NULL;
+}
+
+void *ThreadPool::thread_standalone(void *ptr)
+{
+  PoolTask *task = (PoolTask *) ptr;
+  task->ptr->work(task->ithread);
+  return NULL;
+}
+
+/* ----------------------------------------------------------------------
+   perform one thread's chunk
+   then wait for preceding threads to append their buffers before mine
+------------------------------------------------------------------------- */
+
+void ThreadPool::work(int ithread)
+{
+  func(ptr,ithread);
+  if (kvdest == NULL) return;
+
+  pthread_mutex_lock(&mutex);
+  while (turn != ithread) pthread_cond_wait(&cond,&mutex);
+  append(ithread);
+  turn++;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+
+/* ----------------------------------------------------------------------
+   buffer of thread ITHREAD cannot hold a new pair
+   append buffer to kvdest, then add pair to emptied buffer
+     or directly to kvdest if it is larger than the buffer
+   called by KeyValue::add()
+------------------------------------------------------------------------- */
+
+void ThreadPool::flush(int ithread, int kvbytes, char *key, int keybytes,
+		       char *value, int valuebytes)
+{
+  KeyValue *kv = kvs[ithread];
+  int fit = ((uint64_t) kvbytes <= kv->pagesize);
+
+  pthread_mutex_lock(&mutex);
+  append(ithread);
+  if (!fit) kvdest->add(key,keybytes,value,valuebytes);
+  pthread_mutex_unlock(&mutex);
+
+  if (fit) kv->add(key,keybytes,value,valuebytes);
+}
+
+/* ----------------------------------------------------------------------
+   append pairs in buffer of thread ITHREAD to kvdest and empty it
+   caller holds mutex
+------------------------------------------------------------------------- */
+
+void ThreadPool::append(int ithread)
+{
+  KeyValue *kv = kvs[ithread];
+  if (kv->nkey)
+    kvdest->add(kv->nkey,kv->page,kv->keysize,kv->valuesize,kv->alignsize);
+  kvdest->msize = MAX(kvdest->msize,kv->msize);
+  kv->init_page();
+}
@@ -0,0 +1,64 @@
+/* ----------------------------------------------------------------------
+   MR-MPI = MapReduce-MPI library
+   http://www.cs.sandia.gov/~sjplimp/mapreduce.html
+   Steve Plimpton, sjplimp@sandia.gov, Sandia National Laboratories
+
+   Copyright (2009) Sandia Corporation.  Under the terms of Contract
+   DE-AC04-94AL85000 with Sandia Corporation, the U.S. Government retains
+   certain rights in this software.  This software is distributed under
+   the modified Berkeley Software Distribution (BSD) License.
+
+   See the README file in the top-level MapReduce directory.
+------------------------------------------------------------------------- */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "pthread.h"
+#include "stdint.h"
+
+namespace MAPREDUCE_NS {
+
+class ThreadPool {
+ public:
+  int nthreads;                 // max # of threads to run callbacks on
+  char **start;                 // first pair of each thread's chunk of a page
+  int *count;                   // # of pairs in each thread's chunk
+  uint64_t *index;              // index of first pair of each chunk
+  class KeyValue *kvdest;       // KV that buffers are flushed to, NULL if none
+
+  ThreadPool(int, class MapReduce *, int, int,
+	     class Memory *, class Error *);
+  ~ThreadPool();
+
+  int split(int);
+  class KeyValue *buffer(int);
+  void run(int, void (*)(void *, int), void *, class KeyValue *);
+  void flush(int, int, char *, int, char *, int);
+
+ private:
+  class MapReduce *mr;
+  class Memory *memory;
+  class Error *error;
+
+  int kalign,valign;            // alignment of KV buffers
+  char *page;                   // MR page split into per-thread buffers
+  int memtag;                   // MR page ID of page
+  class KeyValue **kvs;         // per-thread KV buffers, NULL until needed
+
+  int nthr;                     // # of threads in current run
+  int turn;                     // thread whose buffer is flushed next in order
+  void (*func)(void *, int);    // work done by each thread
+  void *ptr;                    // caller's data passed to func
+  pthread_mutex_t mutex;        // guards kvdest and turn
+  pthread_cond_t cond;          // signaled when turn advances
+
+  void buffers();
+  void work(int);
+  void append(int);
+  static void *thread_standalone(void *);
+};
+
+}
+
+#endif
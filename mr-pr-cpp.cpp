@@ -7,6 +7,7 @@
 #include <numeric>
 #include <chrono>
 #include "include/mapreduce.hpp"
+#include "pgrank.hpp"
 
 const double DEFAULT_ALPHA = 0.85;
 const double DEFAULT_CONVERGENCE = 0.00001;
@@ -107,91 +108,21 @@ parse_hlfile(std::istream &input_file, std::vector<std::pair<std::uint32_t, std:
     }
 }
 
-std::vector<double>
-run(std::vector<std::vector<std::uint32_t>> &incoming,
-        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
-        double convergence,
-        int max_iterations,
-        double alpha) {
-
-    // incoming[i] = vector of all pg ids that have a link to pg i
-    // num_outgoing[i] = number of outgoing links out of pg i
-    int n = incoming.size();    // websize
-    double sum_pr;
-    double dangling_pr;
-    double diff = 1;
-    unsigned long num_iterations = 0;
-
-    std::vector<double> old_pr(n, 0); // prev iteration pgrank table
-    std::vector<double> pr(n, 0);     // current pgrank table
-
-    pr[0] = 1;                        // initialize (1,0,...,0)
-
-    while (diff > convergence && num_iterations < max_iterations) {
-        sum_pr = 0;
-        dangling_pr = 0;
-        for(unsigned k = 0;k < n;k++) {
-            double cpr= pr[k];
-            sum_pr += cpr;
-            if (num_outgoing[k] == 0)
-                dangling_pr += cpr;
-        }
-
-        if (num_iterations == 0) {
-            old_pr = pr;
-        } else {
-            /* Normalize so that we start with sum equal to one */
-            for (unsigned i = 0; i < n; i++) {
-                old_pr[i] = pr[i] / sum_pr;
-            }
-        }
-
-        /*
-         * After normalisation the elements of the pagerank vector sum
-         * to one
-         */
-        sum_pr = 1;
-
-        /* An element of the A x I vector; all elements are identical */
-        double one_Av = alpha * dangling_pr / n;
-
-        /* An element of the 1 x I vector; all elements are identical */
-        double one_Iv = (1 - alpha) * sum_pr / n;
-
-        /* The difference to be checked for convergence */
-        diff = 0;
-        for(unsigned i = 0;i < n;i++) {
-            /* The corresponding element of the H multiplication */
-            double h = 0.0;
-            for(int pg : incoming[i]) {
-                // pg -> i
-                assert(num_outgoing[pg]);   // TODO: remove this after testing
-                h += 1.0 / num_outgoing[pg] * old_pr[pg];
-            }
-            h *= alpha;
-            pr[i] = h + one_Av + one_Iv;
-            diff += fabs(pr[i] - old_pr[i]);
-        }
-
-        num_iterations++;
-    }
-
-    return pr;
-}
 
 
 };   // namespace pgrank
 
 
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        std::cerr << "Usage : ./mr-pr-cpp.o ${filename}.txt -o ${filename}-pr-cpp.txt" << std::endl;
+    pgrank::options opts;
+    if (argc < 4 || !pgrank::parse_options(argc, argv, 4, opts)) {
+        std::cerr << "Usage : ./mr-pr-cpp.o ${filename}.txt -o ${filename}-pr-cpp.txt " << pgrank::USAGE_OPTIONS << std::endl;
         exit(1);
     }
     if (strcmp(argv[2], "-o")) {
         std::cerr << "flag `-o` expected but provided `" << argv[2] << "`" << std::endl;
     }
-    // argc == 4 and !strcmp(argv[2], "-o")
+    // argc >= 4 and !strcmp(argv[2], "-o")
 
     std::filebuf fb1;
     if (fb1.open(argv[1], std::ios::in)) {
@@ -244,7 +175,7 @@ int main(int argc, char **argv) {
 
         // incoming, num_outgoing sets are set up now
         auto start = std::chrono::high_resolution_clock::now();
-        auto pgrankv = pgrank::run(incoming, num_outgoing, DEFAULT_CONVERGENCE, DEFAULT_MAX_ITERATIONS, DEFAULT_ALPHA);
+        auto pgrankv = pgrank::run_kernel(opts, incoming, num_outgoing, DEFAULT_CONVERGENCE, DEFAULT_MAX_ITERATIONS, DEFAULT_ALPHA);
         auto end = std::chrono::high_resolution_clock::now();
 
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
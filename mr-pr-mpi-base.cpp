@@ -10,6 +10,7 @@
 #include <iomanip>
 #include "mpi.h"
 #include <chrono>
+#include "pgrank.hpp"
 #include "mapreduce-7Apr14/src/mapreduce.h"
 #include "mapreduce-7Apr14/src/keyvalue.h"
 
@@ -37,77 +38,6 @@ std::vector<std::string> split(const std::string &s, char seperator) {
 }
 
 
-std::vector<double>
-run_pgrank(std::vector<std::vector<std::uint32_t>> &incoming,
-        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
-        double convergence,
-        int max_iterations,
-        double alpha) {
-
-    // incoming[i] = vector of all pg ids that have a link to pg i
-    // num_outgoing[i] = number of outgoing links out of pg i
-    int n = incoming.size();    // websize
-    double sum_pr;
-    double dangling_pr;
-    double diff = 1;
-    unsigned long num_iterations = 0;
-
-    std::vector<double> old_pr(n, 0); // prev iteration pgrank table
-    std::vector<double> pr(n, 0);     // current pgrank table
-
-    pr[0] = 1;                        // initialize (1,0,...,0)
-
-    while (diff > convergence && num_iterations < max_iterations) {
-        sum_pr = 0;
-        dangling_pr = 0;
-        for(unsigned k = 0;k < n;k++) {
-            double cpr= pr[k];
-            sum_pr += cpr;
-            if (num_outgoing[k] == 0)
-                dangling_pr += cpr;
-        }
-
-        if (num_iterations == 0) {
-            old_pr = pr;
-        } else {
-            /* Normalize so that we start with sum equal to one */
-            for (unsigned i = 0; i < n; i++) {
-                old_pr[i] = pr[i] / sum_pr;
-            }
-        }
-
-        /*
-         * After normalisation the elements of the pagerank vector sum
-         * to one
-         */
-        sum_pr = 1;
-
-        /* An element of the A x I vector; all elements are identical */
-        double one_Av = alpha * dangling_pr / n;
-
-        /* An element of the 1 x I vector; all elements are identical */
-        double one_Iv = (1 - alpha) * sum_pr / n;
-
-        /* The difference to be checked for convergence */
-        diff = 0;
-        for(unsigned i = 0;i < n;i++) {
-            /* The corresponding element of the H multiplication */
-            double h = 0.0;
-            for(int pg : incoming[i]) {
-                // pg -> i
-                assert(num_outgoing[pg]);   // TODO: remove this after testing
-                h += 1.0 / num_outgoing[pg] * old_pr[pg];
-            }
-            h *= alpha;
-            pr[i] = h + one_Av + one_Iv;
-            diff += fabs(pr[i] - old_pr[i]);
-        }
-
-        num_iterations++;
-    }
-
-    return pr;
-}
 
 void fileread(int rank, KeyValue *kv, void* /*ptr*/) {
     int size;
@@ -125,18 +55,22 @@ void fileread(int rank, KeyValue *kv, void* /*ptr*/) {
     }
 }
 
-void collect_incoming(uint64_t /*itask*/, char *key, int keybytes, 
-    char *value, int valuebytes, KeyValue *kv, void * ptr) {
+void collect_incoming(uint64_t /*itask*/, int npairs, char **keys, int * /*keybytes*/,
+    char **values, int *valuebytes, KeyValue *kv, void * ptr) {
     
     int rank = *reinterpret_cast<int*>(ptr);
     if (rank != 0) return;
     
-    std::uint32_t k = *reinterpret_cast<std::uint32_t*>(key);
-    int nvalues = valuebytes / sizeof(std::uint32_t);
-    std::uint32_t *val = reinterpret_cast<std::uint32_t*>(value);
-    for(int i = 0;i < nvalues; i++) {
-        assert(val[i] < websize && val[i] >= 0);
-        incoming[k].push_back(val[i]);
+    for(int p = 0;p < npairs; p++) {
+        std::uint32_t k = *reinterpret_cast<std::uint32_t*>(keys[p]);
+        int nvalues = valuebytes[p] / sizeof(std::uint32_t);
+        std::uint32_t *val = reinterpret_cast<std::uint32_t*>(values[p]);
+        std::vector<std::uint32_t> &in = incoming[k];
+        in.reserve(in.size() + nvalues);
+        for(int i = 0;i < nvalues; i++) {
+            assert(val[i] < websize && val[i] >= 0);
+            in.push_back(val[i]);
+        }
     }
 }
 
@@ -154,11 +88,12 @@ int main(int argc, char **argv) {
     MPI_Comm_rank(MPI_COMM_WORLD, &rank);
     MPI_Comm_size(MPI_COMM_WORLD, &size);
 
-    if (argc != 4) {
-        if (rank == 0) fprintf(stderr, "Usage : ./mr-pr-mpi-base.o ${filename}.txt -o ${filename}-pr-mpi-base.txt\n");
+    pgrank::options opts;
+    if (argc < 4 || !pgrank::parse_options(argc, argv, 4, opts)) {
+        if (rank == 0) fprintf(stderr, "Usage : ./mr-pr-mpi-base.o ${filename}.txt -o ${filename}-pr-mpi-base.txt %s\n", pgrank::USAGE_OPTIONS);
         MPI_Abort(MPI_COMM_WORLD,1);
     }
-    // argc == 4
+    // argc >= 4
     if (strcmp(argv[2], "-o")) {
         if (rank == 0) fprintf(stderr, "flag `-o` expected but provided `%s`\n", argv[2]);
         MPI_Abort(MPI_COMM_WORLD,1);
@@ -205,7 +140,7 @@ int main(int argc, char **argv) {
     if (rank == 0) {
         incoming.resize(websize);
     }
-    mr->map(mr, collect_incoming, &rank);
+    mr->map_batch(mr, collect_incoming, &rank);
     if (rank == 0) {   
         double stop = MPI_Wtime();
         std::cout << "\nBaseMPI-MapReduce job finished in " << (stop - start) << " s" << std::endl;
@@ -221,7 +156,7 @@ int main(int argc, char **argv) {
         // ===== DEBUG verify incoming vector =====
 
         auto pgstart = std::chrono::high_resolution_clock::now();
-        auto pgrankv = run_pgrank(incoming, num_outgoing, DEFAULT_CONVERGENCE, DEFAULT_MAX_ITERATIONS, DEFAULT_ALPHA);
+        auto pgrankv = pgrank::run_kernel(opts, incoming, num_outgoing, DEFAULT_CONVERGENCE, DEFAULT_MAX_ITERATIONS, DEFAULT_ALPHA);
         auto pgend = std::chrono::high_resolution_clock::now();
 
         auto duration = std::chrono::duration_cast<std::chrono::microseconds>(pgend - pgstart);
@@ -0,0 +1,597 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <cmath>
+#include <chrono>
+#include <iostream>
+#include <unistd.h>
+#include "reorder.hpp"
+#include "simd.hpp"
+
+// pagerank kernels shared by mr-pr-cpp, mr-pr-mpi and mr-pr-mpi-base
+//
+// every kernel takes the same inputs
+//   incoming[i] = vector of all pg ids that have a link to pg i
+//   num_outgoing[i] = number of outgoing links out of pg i
+// and returns the (unnormalized) pagerank vector in double precision
+
+namespace pgrank {
+
+// usage string for the options below
+const char USAGE_OPTIONS[] = "[-k double|float|blocked|simd|fused] [-p polish] [-B block] [-r none|degree|rcm|cluster] [-b]";
+
+// command line options that follow `${input} -o ${output}`
+struct options {
+    std::string kernel = "double";  // -k : which kernel runs the iteration
+    unsigned polish = 0;            // -p : double precision iterations after a float run
+    unsigned block = 0;             // -B : vertices per destination block of `blocked`, 0 = from cache size
+    std::string order = "none";     // -r : vertex ordering applied before the iteration
+    bool bench = false;             // -b : time the iteration under every ordering
+};
+
+// parses USAGE_OPTIONS starting at argv[first], returns false on bad input
+inline bool
+parse_options(int argc, char **argv, int first, options &opts) {
+    for (int i = first; i < argc; i++) {
+        if (!strcmp(argv[i], "-b")) {
+            opts.bench = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            return false;
+        if (!strcmp(argv[i], "-k")) {
+            opts.kernel = argv[++i];
+        } else if (!strcmp(argv[i], "-p")) {
+            opts.polish = std::strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-B")) {
+            opts.block = std::strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "-r")) {
+            opts.order = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    const char *kernels[] = {"double", "float", "blocked", "simd", "fused"};
+    const char *orders[] = {"none", "degree", "rcm", "cluster"};
+    bool known_kernel = false, known_order = false;
+    for (const char *k : kernels)
+        known_kernel |= opts.kernel == k;
+    for (const char *o : orders)
+        known_order |= opts.order == o;
+    return known_kernel && known_order;
+}
+
+// dense out-degree table, avoids a hash lookup per vertex (and per edge) in the kernels
+inline std::vector<std::uint32_t>
+outdegree(std::unordered_map<std::uint32_t, std::uint32_t> const &num_outgoing, int n) {
+    std::vector<std::uint32_t> outdeg(n, 0);
+    for (auto const &kv : num_outgoing) {
+        if (kv.first < (std::uint32_t) n)
+            outdeg[kv.first] = kv.second;
+    }
+    return outdeg;
+}
+
+// reference double precision kernel, iterates starting from the rank vector `pr`
+inline std::vector<double>
+run_from(std::vector<double> pr,
+        std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        unsigned long *iterations = nullptr) {
+
+    int n = incoming.size();    // websize
+    double sum_pr;
+    double dangling_pr;
+    double diff = 1;
+    unsigned long num_iterations = 0;
+
+    std::vector<double> old_pr(n, 0); // prev iteration pgrank table
+
+    while (diff > convergence && num_iterations < max_iterations) {
+        sum_pr = 0;
+        dangling_pr = 0;
+        for(unsigned k = 0;k < n;k++) {
+            double cpr= pr[k];
+            sum_pr += cpr;
+            if (num_outgoing[k] == 0)
+                dangling_pr += cpr;
+        }
+
+        if (num_iterations == 0) {
+            old_pr = pr;
+        } else {
+            /* Normalize so that we start with sum equal to one */
+            for (unsigned i = 0; i < n; i++) {
+                old_pr[i] = pr[i] / sum_pr;
+            }
+        }
+
+        /*
+         * After normalisation the elements of the pagerank vector sum
+         * to one
+         */
+        sum_pr = 1;
+
+        /* An element of the A x I vector; all elements are identical */
+        double one_Av = alpha * dangling_pr / n;
+
+        /* An element of the 1 x I vector; all elements are identical */
+        double one_Iv = (1 - alpha) * sum_pr / n;
+
+        /* The difference to be checked for convergence */
+        diff = 0;
+        for(unsigned i = 0;i < n;i++) {
+            /* The corresponding element of the H multiplication */
+            double h = 0.0;
+            for(int pg : incoming[i]) {
+                // pg -> i
+                assert(num_outgoing[pg]);   // TODO: remove this after testing
+                h += 1.0 / num_outgoing[pg] * old_pr[pg];
+            }
+            h *= alpha;
+            pr[i] = h + one_Av + one_Iv;
+            diff += fabs(pr[i] - old_pr[i]);
+        }
+
+        num_iterations++;
+    }
+
+    if (iterations)
+        *iterations = num_iterations;
+    return pr;
+}
+
+inline std::vector<double>
+run(std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    std::vector<double> pr(incoming.size(), 0);
+    if (!pr.empty())
+        pr[start] = 1;                // initialize (1,0,...,0) in the original page order
+    return run_from(std::move(pr), incoming, num_outgoing, convergence, max_iterations, alpha, iterations);
+}
+
+/*
+ * Mixed precision kernel : the rank vector and the per-vertex contributions
+ * old_pr[v] / num_outgoing[v] are stored as `Real` (float halves the bytes of
+ * every random access in the gather), while each row, the sums and the diff
+ * are accumulated in double. The normalization by sum_pr is folded into the
+ * contribution so old_pr is never materialized.
+ *
+ * `polish` double precision iterations are run on the result afterwards to
+ * recover the digits lost to the narrow storage.
+ */
+template<typename Real>
+std::vector<double>
+run_mixed(std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        unsigned polish,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    int n = incoming.size();    // websize
+    double diff = 1;
+    unsigned long num_iterations = 0;
+
+    std::vector<std::uint32_t> outdeg = outdegree(num_outgoing, n);
+    std::vector<Real> pr(n, 0);       // current pgrank table
+    std::vector<Real> contrib(n, 0);  // old_pr[v] / num_outgoing[v] of the prev iteration
+
+    if (n > 0)
+        pr[start] = 1;                // initialize (1,0,...,0) in the original page order
+
+    while (diff > convergence && num_iterations < max_iterations) {
+        double sum_pr = 0;
+        double dangling_pr = 0;
+        for(unsigned k = 0;k < n;k++) {
+            double cpr = pr[k];
+            sum_pr += cpr;
+            if (outdeg[k] == 0)
+                dangling_pr += cpr;
+        }
+
+        /* the first iteration uses pr as is, later ones normalize to sum one */
+        double inv_sum = num_iterations == 0 ? 1.0 : 1.0 / sum_pr;
+        for(unsigned k = 0;k < n;k++) {
+            if (outdeg[k])
+                contrib[k] = (Real) (pr[k] * inv_sum / outdeg[k]);
+        }
+
+        double one_Av = alpha * dangling_pr / n;
+        double one_Iv = (1 - alpha) / n;
+
+        diff = 0;
+        for(unsigned i = 0;i < n;i++) {
+            double h = 0.0;
+            for(std::uint32_t pg : incoming[i]) {
+                // pg -> i
+                h += contrib[pg];
+            }
+            double old = pr[i] * inv_sum;
+            double cur = alpha * h + one_Av + one_Iv;
+            pr[i] = (Real) cur;
+            diff += fabs(cur - old);
+        }
+
+        num_iterations++;
+    }
+
+    if (iterations)
+        *iterations = num_iterations + polish;
+    std::vector<double> result(pr.begin(), pr.end());
+    if (polish == 0)
+        return result;
+    // convergence 0 runs exactly `polish` iterations
+    return run_from(std::move(result), incoming, num_outgoing, 0, polish, alpha);
+}
+
+/*
+ * Propagation blocking kernel for rank vectors larger than the cache : instead
+ * of gathering old_pr[pg] from anywhere in memory, every iteration
+ *   1. walks the pages in order and appends the contribution of each out-link
+ *      to the bin of its destination block (a few sequential write streams)
+ *   2. accumulates one bin at a time into a block of the new rank vector that
+ *      fits in cache
+ * The destination of every bin entry never changes, so it is laid out once
+ * and only the contributions are rewritten per iteration.
+ *
+ * `block` is the number of vertices per destination block, rounded down to a
+ * power of two, 0 sizes it from the L2 cache.
+ */
+
+// vertices per destination block so that a block of doubles fills half the L2 cache
+inline unsigned
+cache_block_vertices() {
+    long cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (cache <= 0)
+        cache = 256 * 1024;
+    return cache / 2 / sizeof(double);
+}
+
+inline std::vector<double>
+run_blocked(std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        unsigned block,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    int n = incoming.size();    // websize
+    double diff = 1;
+    unsigned long num_iterations = 0;
+
+    if (block == 0)
+        block = cache_block_vertices();
+    unsigned shift = 0;
+    while ((2u << shift) <= block)
+        shift++;
+    std::uint32_t nblocks = ((std::uint64_t) n + (1u << shift) - 1) >> shift;
+
+    // out_dest = out-links of every page in page order (the binning walk)
+    // bin_start[b] = first entry of bin b, bin_dest = destination page of each entry
+    std::vector<std::uint32_t> outdeg = outdegree(num_outgoing, n);
+    std::vector<std::uint32_t> out_dest;
+    {
+        std::vector<std::vector<std::uint32_t>> outgoing = transpose(incoming);
+        for(int v = 0;v < n;v++) {
+            assert(outgoing[v].size() == outdeg[v]);
+            out_dest.insert(out_dest.end(), outgoing[v].begin(), outgoing[v].end());
+        }
+    }
+    std::vector<std::uint64_t> bin_start(nblocks + 1, 0);
+    for(std::uint32_t u : out_dest)
+        bin_start[(u >> shift) + 1]++;
+    for(std::uint32_t b = 0;b < nblocks;b++)
+        bin_start[b + 1] += bin_start[b];
+
+    std::vector<std::uint64_t> cursor(bin_start.begin(), bin_start.end() - 1);
+    std::vector<std::uint32_t> bin_dest(out_dest.size());
+    for(std::uint32_t u : out_dest)
+        bin_dest[cursor[u >> shift]++] = u;
+
+    std::vector<double> bin_val(bin_dest.size());
+    std::vector<double> pr(n, 0);     // current pgrank table
+    std::vector<double> h(n, 0);      // H multiplication of the current iteration
+
+    if (n > 0)
+        pr[start] = 1;                // initialize (1,0,...,0) in the original page order
+
+    while (diff > convergence && num_iterations < max_iterations) {
+        double sum_pr = 0;
+        double dangling_pr = 0;
+        for(int k = 0;k < n;k++) {
+            sum_pr += pr[k];
+            if (outdeg[k] == 0)
+                dangling_pr += pr[k];
+        }
+
+        /* the first iteration uses pr as is, later ones normalize to sum one */
+        double inv_sum = num_iterations == 0 ? 1.0 : 1.0 / sum_pr;
+        double one_Av = alpha * dangling_pr / n;
+        double one_Iv = (1 - alpha) / n;
+
+        // binning phase, pages are visited in the same order as when the bins were laid out
+        std::copy(bin_start.begin(), bin_start.end() - 1, cursor.begin());
+        std::uint64_t e = 0;
+        for(int v = 0;v < n;v++) {
+            if (outdeg[v] == 0)
+                continue;
+            double c = pr[v] * inv_sum / outdeg[v];
+            for(std::uint32_t d = 0;d < outdeg[v];d++, e++)
+                bin_val[cursor[out_dest[e] >> shift]++] = c;
+        }
+
+        // accumulation phase, one cache sized block of h at a time
+        diff = 0;
+        for(std::uint32_t b = 0;b < nblocks;b++) {
+            int lo = b << shift;
+            int hi = std::min<std::uint64_t>(n, (std::uint64_t) (b + 1) << shift);
+            std::fill(h.begin() + lo, h.begin() + hi, 0.0);
+            for(std::uint64_t k = bin_start[b];k < bin_start[b + 1];k++)
+                h[bin_dest[k]] += bin_val[k];
+            for(int i = lo;i < hi;i++) {
+                double old = pr[i] * inv_sum;
+                double cur = alpha * h[i] + one_Av + one_Iv;
+                pr[i] = cur;
+                diff += fabs(cur - old);
+            }
+        }
+
+        num_iterations++;
+    }
+
+    if (iterations)
+        *iterations = num_iterations;
+    return pr;
+}
+
+/*
+ * Vectorized kernel : per-vertex work is done in three passes over flat arrays
+ *   contrib  c[v] = pr[v] / sum_pr * inv_outdeg[v], no division per edge
+ *   gather   h[i] = sum of c[pg] over the incoming CSR row (hardware gathers)
+ *   finalize pr[i] = alpha * h[i] + one_Av + one_Iv, fused with the diff,
+ *            sum_pr and dangling_pr reductions the next iteration needs
+ * Each pass dispatches to the widest ISA the cpu supports, see simd.hpp.
+ */
+inline std::vector<double>
+run_simd(std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    int n = incoming.size();    // websize
+    double diff = 1;
+    unsigned long num_iterations = 0;
+    simd::ops ops = simd::select_ops();
+
+    // incoming as CSR, int32 indices as the gather instructions expect
+    std::vector<std::uint64_t> row_start(n + 1, 0);
+    for(int i = 0;i < n;i++)
+        row_start[i + 1] = row_start[i] + incoming[i].size();
+    std::vector<std::int32_t> src(row_start[n]);
+    for(int i = 0;i < n;i++)
+        std::copy(incoming[i].begin(), incoming[i].end(), src.begin() + row_start[i]);
+
+    std::vector<std::uint32_t> outdeg = outdegree(num_outgoing, n);
+    std::vector<double> inv_outdeg(n), dangling_mask(n);
+    for(int v = 0;v < n;v++) {
+        inv_outdeg[v] = outdeg[v] ? 1.0 / outdeg[v] : 0.0;
+        dangling_mask[v] = outdeg[v] ? 0.0 : 1.0;
+    }
+
+    std::vector<double> pr(n, 0);     // current pgrank table
+    std::vector<double> c(n, 0);      // contributions of the prev iteration
+    std::vector<double> h(n, 0);      // H multiplication of the current iteration
+
+    if (n > 0)
+        pr[start] = 1;                // initialize (1,0,...,0) in the original page order
+    double sum_pr = n > 0 ? 1 : 0;
+    double dangling_pr = n > 0 ? dangling_mask[start] : 0;
+
+    while (diff > convergence && num_iterations < max_iterations) {
+        /* the first iteration uses pr as is, later ones normalize to sum one */
+        double inv_sum = num_iterations == 0 ? 1.0 : 1.0 / sum_pr;
+        double one_Av = alpha * dangling_pr / n;
+        double one_Iv = (1 - alpha) / n;
+
+        ops.contrib(c.data(), pr.data(), inv_outdeg.data(), n, inv_sum);
+        ops.gather(h.data(), src.data(), row_start.data(), c.data(), n);
+        simd::reduction r = ops.finalize(pr.data(), h.data(), dangling_mask.data(), n,
+                                         alpha, one_Av + one_Iv, inv_sum);
+        diff = r.diff;
+        sum_pr = r.sum;
+        dangling_pr = r.dangling;
+
+        num_iterations++;
+    }
+
+    if (iterations)
+        *iterations = num_iterations;
+    return pr;
+}
+
+/*
+ * Fused kernel : one sweep over the pages per iteration. The contributions
+ * are kept unnormalized, c[v] = pr[v] * inv_outdeg[v], and written by the
+ * same loop that computes pr[v], which also accumulates sum_pr and
+ * dangling_pr for the next iteration. The normalization by 1 / sum_pr is
+ * linear, so it is applied once to each gathered row instead of to every
+ * page, and the rank vector is read once and written once per iteration.
+ * Contributions are double buffered since the gather reads the previous
+ * iteration's values at random.
+ */
+inline std::vector<double>
+run_fused(std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    int n = incoming.size();    // websize
+    double diff = 1;
+    unsigned long num_iterations = 0;
+
+    std::vector<std::uint64_t> row_start(n + 1, 0);
+    for(int i = 0;i < n;i++)
+        row_start[i + 1] = row_start[i] + incoming[i].size();
+    std::vector<std::uint32_t> src(row_start[n]);
+    for(int i = 0;i < n;i++)
+        std::copy(incoming[i].begin(), incoming[i].end(), src.begin() + row_start[i]);
+
+    std::vector<std::uint32_t> outdeg = outdegree(num_outgoing, n);
+    std::vector<double> inv_outdeg(n);
+    for(int v = 0;v < n;v++)
+        inv_outdeg[v] = outdeg[v] ? 1.0 / outdeg[v] : 0.0;
+
+    std::vector<double> pr(n, 0);     // current pgrank table
+    std::vector<double> c(n, 0);      // unnormalized contributions of the prev iteration
+    std::vector<double> c_next(n, 0); // contributions written by the current iteration
+
+    if (n > 0) {
+        pr[start] = 1;                // initialize (1,0,...,0) in the original page order
+        c[start] = inv_outdeg[start];
+    }
+    double sum_pr = n > 0 ? 1 : 0;
+    double dangling_pr = n > 0 && outdeg[start] == 0 ? 1 : 0;
+
+    while (diff > convergence && num_iterations < max_iterations) {
+        /* the first iteration uses pr as is, later ones normalize to sum one */
+        double inv_sum = num_iterations == 0 ? 1.0 : 1.0 / sum_pr;
+        double one_Av = alpha * dangling_pr / n;
+        double one_Iv = (1 - alpha) / n;
+        double scale = alpha * inv_sum;
+
+        diff = 0;
+        sum_pr = 0;
+        dangling_pr = 0;
+        for(int i = 0;i < n;i++) {
+            double h = 0.0;
+            for(std::uint64_t k = row_start[i];k < row_start[i + 1];k++)
+                h += c[src[k]];
+            double cur = scale * h + one_Av + one_Iv;
+            diff += fabs(cur - pr[i] * inv_sum);
+            pr[i] = cur;
+            c_next[i] = cur * inv_outdeg[i];
+            sum_pr += cur;
+            if (outdeg[i] == 0)
+                dangling_pr += cur;
+        }
+        c.swap(c_next);
+
+        num_iterations++;
+    }
+
+    if (iterations)
+        *iterations = num_iterations;
+    return pr;
+}
+
+// runs the kernel selected by `opts.kernel` on the graph as given
+// `start` = vertex holding the initial rank, original page 0 after relabeling
+inline std::vector<double>
+run_iteration(options const &opts,
+        std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha,
+        std::uint32_t start = 0,
+        unsigned long *iterations = nullptr) {
+
+    if (opts.kernel == "float")
+        return run_mixed<float>(incoming, num_outgoing, convergence, max_iterations, alpha, opts.polish, start, iterations);
+    if (opts.kernel == "fused")
+        return run_fused(incoming, num_outgoing, convergence, max_iterations, alpha, start, iterations);
+    if (opts.kernel == "simd")
+        return run_simd(incoming, num_outgoing, convergence, max_iterations, alpha, start, iterations);
+    if (opts.kernel == "blocked")
+        return run_blocked(incoming, num_outgoing, convergence, max_iterations, alpha, opts.block, start, iterations);
+    return run(incoming, num_outgoing, convergence, max_iterations, alpha, start, iterations);
+}
+
+// prints reorder and iteration time of the selected kernel under every ordering
+// orderings may converge in a different number of iterations (summation order
+// differs), so the speedup compares time per iteration
+inline void
+bench_orders(options const &opts,
+        std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha) {
+
+    const char *orders[] = {"none", "degree", "rcm", "cluster"};
+    double base_us = 0;
+    std::cout << "\nordering benchmark, kernel `" << opts.kernel << "`" << std::endl;
+    for (const char *order : orders) {
+        auto rstart = std::chrono::high_resolution_clock::now();
+        permutation perm = make_order(order, incoming);
+        std::vector<std::vector<std::uint32_t>> new_incoming;
+        std::unordered_map<std::uint32_t, std::uint32_t> new_num_outgoing;
+        relabel(perm, incoming, num_outgoing, new_incoming, new_num_outgoing);
+        auto istart = std::chrono::high_resolution_clock::now();
+        unsigned long iterations = 0;
+        run_iteration(opts, new_incoming, new_num_outgoing, convergence, max_iterations, alpha,
+                      perm.empty() ? 0 : perm[0], &iterations);
+        auto iend = std::chrono::high_resolution_clock::now();
+
+        double reorder_us = std::chrono::duration_cast<std::chrono::microseconds>(istart - rstart).count();
+        double iterate_us = std::chrono::duration_cast<std::chrono::microseconds>(iend - istart).count();
+        double per_iter_us = iterations ? iterate_us / iterations : iterate_us;
+        if (base_us == 0)
+            base_us = per_iter_us;
+        std::cout << "  " << order << " : reorder " << reorder_us << "us, iterate " << iterate_us
+                  << "us over " << iterations << " iterations, " << per_iter_us << "us/iteration, speedup "
+                  << (per_iter_us > 0 ? base_us / per_iter_us : 1.0) << "x" << std::endl;
+    }
+}
+
+// runs the selected kernel, relabeling the graph with `opts.order` first
+// the iteration starts from original page 0 under every ordering
+inline std::vector<double>
+run_kernel(options const &opts,
+        std::vector<std::vector<std::uint32_t>> &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &num_outgoing,
+        double convergence,
+        int max_iterations,
+        double alpha) {
+
+    if (opts.bench)
+        bench_orders(opts, incoming, num_outgoing, convergence, max_iterations, alpha);
+    if (opts.order == "none")
+        return run_iteration(opts, incoming, num_outgoing, convergence, max_iterations, alpha);
+
+    permutation perm = make_order(opts.order, incoming);
+    std::vector<std::vector<std::uint32_t>> new_incoming;
+    std::unordered_map<std::uint32_t, std::uint32_t> new_num_outgoing;
+    relabel(perm, incoming, num_outgoing, new_incoming, new_num_outgoing);
+    auto pr = run_iteration(opts, new_incoming, new_num_outgoing, convergence, max_iterations, alpha,
+                            perm.empty() ? 0 : perm[0]);
+    return unrelabel(perm, pr);
+}
+
+};   // namespace pgrank
@@ -0,0 +1,232 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <string>
+#include <queue>
+#include <deque>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+#include <cstdint>
+#include <cmath>
+
+// vertex reordering for the pagerank kernels
+//
+// an ordering is a permutation perm[old id] = new id, the graph is relabeled
+// before the iteration so that pages read together in the gather
+// `old_pr[pg]` sit close together in memory, and the ranks are mapped back
+// to the input ids afterwards
+
+namespace pgrank {
+
+typedef std::vector<std::uint32_t> permutation;
+
+// out-links of every page, transpose of incoming
+inline std::vector<std::vector<std::uint32_t>>
+transpose(std::vector<std::vector<std::uint32_t>> const &incoming) {
+    std::vector<std::vector<std::uint32_t>> outgoing(incoming.size());
+    for(std::uint32_t i = 0;i < incoming.size();i++) {
+        for(std::uint32_t pg : incoming[i])
+            outgoing[pg].push_back(i);
+    }
+    return outgoing;
+}
+
+// pages sorted by in + out degree, largest first, hubs end up in one dense block
+inline permutation
+order_degree(std::vector<std::vector<std::uint32_t>> const &incoming,
+        std::vector<std::vector<std::uint32_t>> const &outgoing) {
+    std::uint32_t n = incoming.size();
+    std::vector<std::uint32_t> byrank(n);
+    std::iota(byrank.begin(), byrank.end(), 0);
+    std::stable_sort(byrank.begin(), byrank.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return incoming[a].size() + outgoing[a].size() > incoming[b].size() + outgoing[b].size();
+    });
+    permutation perm(n);
+    for(std::uint32_t k = 0;k < n;k++)
+        perm[byrank[k]] = k;
+    return perm;
+}
+
+/*
+ * Reverse Cuthill-McKee on the symmetrized link graph : a BFS from a low
+ * degree page of every component, visiting neighbours in increasing degree,
+ * and the visit order reversed. Keeps the bandwidth of the matrix small so
+ * that neighbouring rows gather from neighbouring pages.
+ */
+inline permutation
+order_rcm(std::vector<std::vector<std::uint32_t>> const &incoming,
+        std::vector<std::vector<std::uint32_t>> const &outgoing) {
+    std::uint32_t n = incoming.size();
+    auto degree = [&](std::uint32_t v) { return incoming[v].size() + outgoing[v].size(); };
+
+    std::vector<std::uint32_t> bydegree(n);
+    std::iota(bydegree.begin(), bydegree.end(), 0);
+    std::stable_sort(bydegree.begin(), bydegree.end(), [&](std::uint32_t a, std::uint32_t b) {
+        return degree(a) < degree(b);
+    });
+
+    std::vector<bool> visited(n, false);
+    std::vector<std::uint32_t> visit;
+    std::vector<std::uint32_t> neigh;
+    visit.reserve(n);
+    for(std::uint32_t root : bydegree) {
+        if (visited[root])
+            continue;
+        visited[root] = true;
+        std::size_t head = visit.size();
+        visit.push_back(root);
+        while (head < visit.size()) {
+            std::uint32_t v = visit[head++];
+            neigh.clear();
+            for(std::uint32_t u : incoming[v])
+                if (!visited[u]) { visited[u] = true; neigh.push_back(u); }
+            for(std::uint32_t u : outgoing[v])
+                if (!visited[u]) { visited[u] = true; neigh.push_back(u); }
+            std::sort(neigh.begin(), neigh.end(), [&](std::uint32_t a, std::uint32_t b) {
+                return degree(a) < degree(b);
+            });
+            visit.insert(visit.end(), neigh.begin(), neigh.end());
+        }
+    }
+
+    permutation perm(n);
+    for(std::uint32_t k = 0;k < n;k++)
+        perm[visit[k]] = n - 1 - k;
+    return perm;
+}
+
+/*
+ * Locality clustering in the spirit of Gorder : pages are placed one at a
+ * time, always picking the page that shares the most links with the last
+ * `window` placed pages (direct links both ways plus common in-neighbours),
+ * so pages gathered by the same rows share cache lines.
+ *
+ * Scores live in a lazy max-heap, stale entries are re-pushed when popped.
+ * Hubs above `hubcap` out-links are skipped when counting common
+ * in-neighbours, as in the original algorithm, to bound the cost.
+ */
+inline permutation
+order_cluster(std::vector<std::vector<std::uint32_t>> const &incoming,
+        std::vector<std::vector<std::uint32_t>> const &outgoing,
+        unsigned window = 5) {
+    std::uint32_t n = incoming.size();
+    std::size_t hubcap = std::max<std::size_t>(16, (std::size_t) std::sqrt((double) n));
+
+    std::vector<std::int64_t> score(n, 0);
+    std::vector<bool> placed(n, false);
+    std::priority_queue<std::pair<std::int64_t, std::uint32_t>> heap;
+
+    auto update = [&](std::uint32_t v, int delta) {
+        auto bump = [&](std::uint32_t u) {
+            if (placed[u])
+                return;
+            score[u] += delta;
+            if (delta > 0)
+                heap.push(std::make_pair(score[u], u));
+        };
+        for(std::uint32_t u : outgoing[v]) bump(u);
+        for(std::uint32_t w : incoming[v]) {
+            bump(w);
+            if (outgoing[w].size() <= hubcap)
+                for(std::uint32_t u : outgoing[w]) bump(u);
+        }
+    };
+
+    // start from the page with the most in-links, fall back to id order when the heap runs dry
+    std::uint32_t start = 0;
+    for(std::uint32_t v = 1;v < n;v++)
+        if (incoming[v].size() > incoming[start].size())
+            start = v;
+
+    permutation perm(n);
+    std::deque<std::uint32_t> recent;
+    std::uint32_t next_unplaced = 0;
+    for(std::uint32_t k = 0;k < n;k++) {
+        std::uint32_t v = n;
+        if (k == 0) {
+            v = start;
+        } else {
+            while (!heap.empty()) {
+                auto top = heap.top();
+                heap.pop();
+                if (placed[top.second])
+                    continue;
+                if (top.first != score[top.second]) {
+                    heap.push(std::make_pair(score[top.second], top.second));
+                    continue;
+                }
+                if (top.first > 0)
+                    v = top.second;
+                break;
+            }
+            if (v == n) {
+                while (placed[next_unplaced])
+                    next_unplaced++;
+                v = next_unplaced;
+            }
+        }
+
+        placed[v] = true;
+        perm[v] = k;
+        update(v, +1);
+        recent.push_back(v);
+        if (recent.size() > window) {
+            update(recent.front(), -1);
+            recent.pop_front();
+        }
+    }
+    return perm;
+}
+
+// computes the ordering `name` (none, degree, rcm or cluster)
+inline permutation
+make_order(std::string const &name, std::vector<std::vector<std::uint32_t>> const &incoming) {
+    std::uint32_t n = incoming.size();
+    if (name == "none") {
+        permutation perm(n);
+        std::iota(perm.begin(), perm.end(), 0);
+        return perm;
+    }
+    auto outgoing = transpose(incoming);
+    if (name == "degree")
+        return order_degree(incoming, outgoing);
+    if (name == "rcm")
+        return order_rcm(incoming, outgoing);
+    return order_cluster(incoming, outgoing);
+}
+
+// relabels the graph with `perm`, sources of every row are sorted so the gather walks forward
+inline void
+relabel(permutation const &perm,
+        std::vector<std::vector<std::uint32_t>> const &incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> const &num_outgoing,
+        std::vector<std::vector<std::uint32_t>> &new_incoming,
+        std::unordered_map<std::uint32_t, std::uint32_t> &new_num_outgoing) {
+    std::uint32_t n = incoming.size();
+    new_incoming.assign(n, std::vector<std::uint32_t>());
+    for(std::uint32_t i = 0;i < n;i++) {
+        auto &row = new_incoming[perm[i]];
+        row.reserve(incoming[i].size());
+        for(std::uint32_t pg : incoming[i])
+            row.push_back(perm[pg]);
+        std::sort(row.begin(), row.end());
+    }
+    new_num_outgoing.clear();
+    for(auto const &kv : num_outgoing) {
+        if (kv.first < n)
+            new_num_outgoing[perm[kv.first]] = kv.second;
+    }
+}
+
+// maps ranks of the relabeled graph back to the input page ids
+inline std::vector<double>
+unrelabel(permutation const &perm, std::vector<double> const &pr) {
+    std::vector<double> orig(pr.size());
+    for(std::uint32_t v = 0;v < pr.size();v++)
+        orig[v] = pr[perm[v]];
+    return orig;
+}
+
+};   // namespace pgrank
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdint>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PGRANK_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// vectorized passes of the `simd` pagerank kernel
+//
+// every pass has a scalar, an AVX2 and an AVX-512 version, the AVX ones are
+// compiled with target attributes so no -m flags are needed, and
+// select_ops() picks the widest one the running cpu supports
+
+namespace pgrank {
+namespace simd {
+
+// reductions of the finalize pass
+struct reduction {
+    double diff;        // sum of |pr_new - pr_old|
+    double sum;         // sum of pr_new
+    double dangling;    // sum of pr_new over pages without out-links
+};
+
+// c[v] = pr[v] * scale * inv_outdeg[v]
+typedef void (*contrib_fn)(double *c, const double *pr, const double *inv_outdeg, int n, double scale);
+
+// h[i] = sum of c[src[k]] for k in [row_start[i], row_start[i+1])
+typedef void (*gather_fn)(double *h, const std::int32_t *src, const std::uint64_t *row_start, const double *c, int n);
+
+// pr[i] = alpha * h[i] + base, with diff against pr[i] * inv_sum, sum and dangling mass of the new pr
+typedef reduction (*finalize_fn)(double *pr, const double *h, const double *dangling_mask, int n,
+                                 double alpha, double base, double inv_sum);
+
+struct ops {
+    const char *isa;
+    contrib_fn contrib;
+    gather_fn gather;
+    finalize_fn finalize;
+};
+
+inline void
+contrib_scalar(double *c, const double *pr, const double *inv_outdeg, int n, double scale) {
+    for(int v = 0;v < n;v++)
+        c[v] = pr[v] * scale * inv_outdeg[v];
+}
+
+inline void
+gather_scalar(double *h, const std::int32_t *src, const std::uint64_t *row_start, const double *c, int n) {
+    for(int i = 0;i < n;i++) {
+        double acc = 0.0;
+        for(std::uint64_t k = row_start[i];k < row_start[i + 1];k++)
+            acc += c[src[k]];
+        h[i] = acc;
+    }
+}
+
+inline reduction
+finalize_scalar(double *pr, const double *h, const double *dangling_mask, int n,
+        double alpha, double base, double inv_sum) {
+    reduction r = {0, 0, 0};
+    for(int i = 0;i < n;i++) {
+        double cur = alpha * h[i] + base;
+        r.diff += fabs(cur - pr[i] * inv_sum);
+        r.sum += cur;
+        r.dangling += cur * dangling_mask[i];
+        pr[i] = cur;
+    }
+    return r;
+}
+
+#ifdef PGRANK_X86_SIMD
+
+__attribute__((target("avx2,fma"))) inline double
+hsum_avx2(__m256d v) {
+    __m128d lo = _mm256_castpd256_pd128(v);
+    __m128d hi = _mm256_extractf128_pd(v, 1);
+    lo = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+__attribute__((target("avx2,fma"))) inline void
+contrib_avx2(double *c, const double *pr, const double *inv_outdeg, int n, double scale) {
+    __m256d vscale = _mm256_set1_pd(scale);
+    int v = 0;
+    for(;v + 4 <= n;v += 4)
+        _mm256_storeu_pd(c + v, _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(pr + v), vscale),
+                                              _mm256_loadu_pd(inv_outdeg + v)));
+    contrib_scalar(c + v, pr + v, inv_outdeg + v, n - v, scale);
+}
+
+__attribute__((target("avx2,fma"))) inline void
+gather_avx2(double *h, const std::int32_t *src, const std::uint64_t *row_start, const double *c, int n) {
+    for(int i = 0;i < n;i++) {
+        std::uint64_t k = row_start[i], end = row_start[i + 1];
+        __m256d acc = _mm256_setzero_pd();
+        for(;k + 4 <= end;k += 4) {
+            __m128i idx = _mm_loadu_si128((const __m128i *) (src + k));
+            acc = _mm256_add_pd(acc, _mm256_i32gather_pd(c, idx, 8));
+        }
+        double tail = 0.0;
+        for(;k < end;k++)
+            tail += c[src[k]];
+        h[i] = hsum_avx2(acc) + tail;
+    }
+}
+
+__attribute__((target("avx2,fma"))) inline reduction
+finalize_avx2(double *pr, const double *h, const double *dangling_mask, int n,
+        double alpha, double base, double inv_sum) {
+    __m256d valpha = _mm256_set1_pd(alpha), vbase = _mm256_set1_pd(base), vinv = _mm256_set1_pd(inv_sum);
+    __m256d vsign = _mm256_set1_pd(-0.0);
+    __m256d vdiff = _mm256_setzero_pd(), vsum = _mm256_setzero_pd(), vdangling = _mm256_setzero_pd();
+    int i = 0;
+    for(;i + 4 <= n;i += 4) {
+        __m256d cur = _mm256_fmadd_pd(valpha, _mm256_loadu_pd(h + i), vbase);
+        __m256d old = _mm256_mul_pd(_mm256_loadu_pd(pr + i), vinv);
+        vdiff = _mm256_add_pd(vdiff, _mm256_andnot_pd(vsign, _mm256_sub_pd(cur, old)));
+        vsum = _mm256_add_pd(vsum, cur);
+        vdangling = _mm256_fmadd_pd(cur, _mm256_loadu_pd(dangling_mask + i), vdangling);
+        _mm256_storeu_pd(pr + i, cur);
+    }
+    reduction r = finalize_scalar(pr + i, h + i, dangling_mask + i, n - i, alpha, base, inv_sum);
+    r.diff += hsum_avx2(vdiff);
+    r.sum += hsum_avx2(vsum);
+    r.dangling += hsum_avx2(vdangling);
+    return r;
+}
+
+__attribute__((target("avx512f"))) inline void
+contrib_avx512(double *c, const double *pr, const double *inv_outdeg, int n, double scale) {
+    __m512d vscale = _mm512_set1_pd(scale);
+    int v = 0;
+    for(;v + 8 <= n;v += 8)
+        _mm512_storeu_pd(c + v, _mm512_mul_pd(_mm512_mul_pd(_mm512_loadu_pd(pr + v), vscale),
+                                              _mm512_loadu_pd(inv_outdeg + v)));
+    contrib_scalar(c + v, pr + v, inv_outdeg + v, n - v, scale);
+}
+
+__attribute__((target("avx512f"))) inline void
+gather_avx512(double *h, const std::int32_t *src, const std::uint64_t *row_start, const double *c, int n) {
+    for(int i = 0;i < n;i++) {
+        std::uint64_t k = row_start[i], end = row_start[i + 1];
+        __m512d acc = _mm512_setzero_pd();
+        for(;k + 8 <= end;k += 8) {
+            __m256i idx = _mm256_loadu_si256((const __m256i *) (src + k));
+            acc = _mm512_add_pd(acc, _mm512_i32gather_pd(idx, c, 8));
+        }
+        double tail = 0.0;
+        for(;k < end;k++)
+            tail += c[src[k]];
+        h[i] = _mm512_reduce_add_pd(acc) + tail;
+    }
+}
+
+__attribute__((target("avx512f"))) inline reduction
+finalize_avx512(double *pr, const double *h, const double *dangling_mask, int n,
+        double alpha, double base, double inv_sum) {
+    __m512d valpha = _mm512_set1_pd(alpha), vbase = _mm512_set1_pd(base), vinv = _mm512_set1_pd(inv_sum);
+    __m512d vdiff = _mm512_setzero_pd(), vsum = _mm512_setzero_pd(), vdangling = _mm512_setzero_pd();
+    int i = 0;
+    for(;i + 8 <= n;i += 8) {
+        __m512d cur = _mm512_fmadd_pd(valpha, _mm512_loadu_pd(h + i), vbase);
+        __m512d old = _mm512_mul_pd(_mm512_loadu_pd(pr + i), vinv);
+        vdiff = _mm512_add_pd(vdiff, _mm512_abs_pd(_mm512_sub_pd(cur, old)));
+        vsum = _mm512_add_pd(vsum, cur);
+        vdangling = _mm512_fmadd_pd(cur, _mm512_loadu_pd(dangling_mask + i), vdangling);
+        _mm512_storeu_pd(pr + i, cur);
+    }
+    reduction r = finalize_scalar(pr + i, h + i, dangling_mask + i, n - i, alpha, base, inv_sum);
+    r.diff += _mm512_reduce_add_pd(vdiff);
+    r.sum += _mm512_reduce_add_pd(vsum);
+    r.dangling += _mm512_reduce_add_pd(vdangling);
+    return r;
+}
+
+#endif
+
+// widest implementation supported by the running cpu
+inline ops
+select_ops() {
+#ifdef PGRANK_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        ops o = {"avx512", contrib_avx512, gather_avx512, finalize_avx512};
+        return o;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        ops o = {"avx2", contrib_avx2, gather_avx2, finalize_avx2};
+        return o;
+    }
+#endif
+    ops o = {"scalar", contrib_scalar, gather_scalar, finalize_scalar};
+    return o;
+}
+
+};   // namespace simd
+};   // namespace pgrank